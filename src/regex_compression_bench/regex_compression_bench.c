@@ -0,0 +1,700 @@
+#include <unistd.h>
+#include <gnunet/platform.h>
+#include <gnunet/gnunet_util_lib.h>
+#include <gnunet/gnunet_testbed_service.h>
+#include <gnunet/gnunet_dht_service.h>
+#include <gnunet/gnunet_regex_service.h>
+#include "compression.h"
+
+
+/**
+ * LOG using this modules name
+ *
+ * @param kind One of GNUNET_ERROR_TYPE
+ * @param ... The format sting and optional arguments
+ */
+#define LOG(kind, ...) GNUNET_log_from (kind, "regex-compression-bench", __VA_ARGS__)
+/**
+ * Log error messages for this module
+ *
+ * @param ... The format sting and optional arguments
+ */
+#define LOG_ERROR(...) LOG (GNUNET_ERROR_TYPE_ERROR, __VA_ARGS__)
+/**
+ * Number of peers we want to start. The announcement and the search run on
+ * the two ends of the overlay so searches need more than one hop, the peers
+ * in between relay.
+ */
+#define NUM_PEERS 5
+/**
+ * Dunno, this value was taken from the testbed_test example
+ */
+#define HT_LENGTH_DEFAULT 10
+/**
+ * How long to count announcement PUTs before searching
+ */
+#define ANNOUNCE_SETTLE_DELAY \
+  GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_SECONDS, 10)
+/**
+ * How long to wait for the first search result
+ */
+#define SEARCH_TIMEOUT \
+  GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_SECONDS, 30)
+/**
+ * Refresh interval of the announcements. Long enough that only the initial
+ * PUTs are counted.
+ */
+#define ANNOUNCE_REFRESH_DELAY \
+  GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_MINUTES, 30)
+
+
+/**
+ * A regex shape to benchmark
+ */
+struct Bench_Shape {
+  /**
+   * Name in the report
+   */
+  const char *name;
+  /**
+   * The subscription regex
+   */
+  const char *regex;
+  /**
+   * A topic matching the regex that is searched for
+   */
+  const char *topic;
+};
+
+
+/**
+ * Measurements of one shape at one compression level
+ */
+struct Bench_Result {
+  /**
+   * REGEX blocks the announcement put into the DHT
+   */
+  unsigned int puts;
+  /**
+   * Total size of those blocks. This is the payload the announcement stores
+   * in the DHT per replica, not memory used by the announcing peer.
+   */
+  unsigned long long put_bytes;
+  /**
+   * REGEX lookups the search issued
+   */
+  unsigned int gets;
+  /**
+   * Highest hop count a REGEX lookup of the search reached on any peer
+   */
+  unsigned int hops;
+  /**
+   * Time from starting the search to the first result
+   */
+  struct GNUNET_TIME_Relative latency;
+  /**
+   * #GNUNET_YES if the search found the announcement
+   */
+  int found;
+};
+
+
+/**
+ * A peer we are connected to
+ */
+struct Bench_Peer {
+  /**
+   * The testbed operation of the service connection
+   */
+  struct GNUNET_TESTBED_Operation *op;
+  /**
+   * The configuration of the peer
+   */
+  const struct GNUNET_CONFIGURATION_Handle *cfg;
+  /**
+   * DHT connection used for monitoring
+   */
+  struct GNUNET_DHT_Handle *dht_handle;
+  /**
+   * Monitor counting the REGEX traffic of the peer
+   */
+  struct GNUNET_DHT_MonitorHandle *monitor;
+};
+
+
+/**
+ * The shapes we sweep: deep MQTT-style paths, wide alternations and
+ * wildcards, plus the subscription used by regex_testbed
+ */
+static const struct Bench_Shape shapes[] = {
+  { "deep", "sensors/building1/floor2/room3/temp",
+    "sensors/building1/floor2/room3/temp" },
+  { "wide", "news/(gnunet|wikileaks|tor|i2p|freenet|tahoe|bitcoin|ethereum)",
+    "news/freenet" },
+  { "wildcard", "sensors/(0|1|2|3|4|5|6|7|8|9)+/temp",
+    "sensors/42/temp" },
+  { "testbed", "news/(gnunet|wikileaks)",
+    "news/wikileaks" }
+};
+/**
+ * The compression levels we sweep
+ */
+static const uint16_t compressions[] = { 1, 2, 4, 8 };
+/**
+ * Number of shapes
+ */
+#define NUM_SHAPES (sizeof (shapes) / sizeof (shapes[0]))
+/**
+ * Number of compression levels
+ */
+#define NUM_COMPRESSIONS (sizeof (compressions) / sizeof (compressions[0]))
+
+/**
+ * The result of the tesbed simulation.
+ *
+ * Either GNUNET_OK or GNUNET_SYSERR
+ */
+static int result = GNUNET_SYSERR;
+/**
+ * The peer announcing the regexes
+ */
+static struct Bench_Peer announcer;
+/**
+ * The peer searching for the topics
+ */
+static struct Bench_Peer searcher;
+/**
+ * The peers in between, only watched for the hops of the search
+ */
+static struct Bench_Peer relays[NUM_PEERS - 2];
+/**
+ * Number of peers whose services are connected
+ */
+static unsigned int peers_connected;
+/**
+ * Results of all cases, indexed by shape and compression
+ */
+static struct Bench_Result results[NUM_SHAPES][NUM_COMPRESSIONS];
+/**
+ * Index of the running case
+ */
+static unsigned int current_case;
+/**
+ * Announcement of the running case
+ */
+static struct GNUNET_REGEX_Announcement *announcement;
+/**
+ * Search of the running case
+ */
+static struct GNUNET_REGEX_Search *search;
+/**
+ * When the search of the running case started
+ */
+static struct GNUNET_TIME_Absolute search_start;
+/**
+ * Task moving the running case on: search after settling, or give up
+ */
+static GNUNET_SCHEDULER_TaskIdentifier case_task = GNUNET_SCHEDULER_NO_TASK;
+/**
+ * Set while announcement PUTs are counted
+ */
+static int counting_puts;
+/**
+ * Set while search GETs are counted
+ */
+static int counting_gets;
+
+
+static void
+run_case (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc);
+
+
+/**
+ * Get the result slot of the running case
+ *
+ * @return The result
+ */
+static struct Bench_Result *
+current_result (void)
+{
+  return &results[current_case / NUM_COMPRESSIONS][current_case % NUM_COMPRESSIONS];
+}
+
+
+/**
+ * Check whether a block belongs to the REGEX subsystem
+ *
+ * @param type The block type
+ * @return #GNUNET_YES if it does
+ */
+static int
+is_regex_block (enum GNUNET_BLOCK_Type type)
+{
+  return ((GNUNET_BLOCK_TYPE_REGEX == type)
+          || (GNUNET_BLOCK_TYPE_REGEX_ACCEPT == type)) ? GNUNET_YES : GNUNET_NO;
+}
+
+
+/**
+ * Print the results of all cases
+ */
+static void
+print_report (void)
+{
+  unsigned int s;
+  unsigned int c;
+  uint16_t chosen;
+  struct Bench_Result *r;
+
+  printf ("%-10s %4s %4s %6s %10s %6s %6s %12s\n",
+          "shape", "comp", "auto", "puts", "put_bytes", "gets", "hops",
+          "latency_ms");
+  for (s = 0; s < NUM_SHAPES; s++)
+  {
+    chosen = compression_for_regex (shapes[s].regex);
+    for (c = 0; c < NUM_COMPRESSIONS; c++)
+    {
+      r = &results[s][c];
+      printf ("%-10s %4u %4s %6u %10llu %6u %6u ",
+              shapes[s].name,
+              compressions[c],
+              (chosen == compressions[c]) ? "*" : "",
+              r->puts,
+              r->put_bytes,
+              r->gets,
+              r->hops);
+      if (GNUNET_YES == r->found)
+      {
+        printf ("%12llu\n", (unsigned long long) (r->latency.rel_value_us / 1000));
+      }
+      else
+      {
+        printf ("%12s\n", "timeout");
+      }
+    }
+  }
+}
+
+
+/**
+ * Stop the announcement and search of the running case and start the next
+ */
+static void
+finish_case (void)
+{
+  counting_gets = GNUNET_NO;
+  if (GNUNET_SCHEDULER_NO_TASK != case_task)
+  {
+    GNUNET_SCHEDULER_cancel (case_task);
+    case_task = GNUNET_SCHEDULER_NO_TASK;
+  }
+  if (NULL != search)
+  {
+    GNUNET_REGEX_search_cancel (search);
+    search = NULL;
+  }
+  if (NULL != announcement)
+  {
+    GNUNET_REGEX_announce_cancel (announcement);
+    announcement = NULL;
+  }
+  current_case++;
+  case_task = GNUNET_SCHEDULER_add_now (&run_case, NULL);
+}
+
+
+/**
+ * Function run on CTRL-C or shutdown (i.e. success/timeout/etc.).
+ * Cleans up.
+ */
+static void
+shutdown_task (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  unsigned int i;
+
+  if (GNUNET_SCHEDULER_NO_TASK != case_task)
+  {
+    GNUNET_SCHEDULER_cancel (case_task);
+    case_task = GNUNET_SCHEDULER_NO_TASK;
+  }
+  if (NULL != search)
+  {
+    GNUNET_REGEX_search_cancel (search);
+    search = NULL;
+  }
+  if (NULL != announcement)
+  {
+    GNUNET_REGEX_announce_cancel (announcement);
+    announcement = NULL;
+  }
+  if (NULL != announcer.op)
+  {
+    GNUNET_TESTBED_operation_done (announcer.op);
+    announcer.op = NULL;
+  }
+  if (NULL != searcher.op)
+  {
+    GNUNET_TESTBED_operation_done (searcher.op);
+    searcher.op = NULL;
+  }
+  for (i = 0; i < NUM_PEERS - 2; i++)
+  {
+    if (NULL != relays[i].op)
+    {
+      GNUNET_TESTBED_operation_done (relays[i].op);
+      relays[i].op = NULL;
+    }
+  }
+
+  /* Also kills the testbed */
+  GNUNET_SCHEDULER_shutdown ();
+}
+
+
+/**
+ * Called on each PUT request going through the DHT of the announcer.
+ *
+ * @param cls Closure.
+ * @param options Options, for instance RecordRoute, DemultiplexEverywhere.
+ * @param type The type of data in the request.
+ * @param hop_count Hop count so far.
+ * @param path_length number of entries in @a path (or 0 if not recorded).
+ * @param path peers on the PUT path (or NULL if not recorded).
+ * @param desired_replication_level Desired replication level.
+ * @param exp Expiration time of the data.
+ * @param key Key under which data is to be stored.
+ * @param data Pointer to the data carried.
+ * @param size Number of bytes in data.
+ */
+static void
+announcer_put_cb (void *cls,
+    enum GNUNET_DHT_RouteOption options,
+    enum GNUNET_BLOCK_Type type,
+    uint32_t hop_count,
+    uint32_t desired_replication_level,
+    unsigned int path_length,
+    const struct GNUNET_PeerIdentity *path,
+    struct GNUNET_TIME_Absolute exp,
+    const struct GNUNET_HashCode *key,
+    const void *data,
+    size_t size)
+{
+  if ((GNUNET_YES != counting_puts) || (GNUNET_YES != is_regex_block (type)))
+  {
+    return;
+  }
+  current_result ()->puts++;
+  current_result ()->put_bytes += size;
+}
+
+
+/**
+ * Called on each GET request going through the DHT of any peer.
+ *
+ * @param cls The Bench_Peer
+ * @param options Options, for instance RecordRoute, DemultiplexEverywhere.
+ * @param type The type of data in the request.
+ * @param hop_count Hop count so far.
+ * @param desired_replication_level Desired replication level.
+ * @param path_length number of entries in @a path (or 0 if not recorded).
+ * @param path peers on the GET path (or NULL if not recorded).
+ * @param key Key of the requested data.
+ */
+static void
+search_get_cb (void *cls,
+    enum GNUNET_DHT_RouteOption options,
+    enum GNUNET_BLOCK_Type type,
+    uint32_t hop_count,
+    uint32_t desired_replication_level,
+    unsigned int path_length,
+    const struct GNUNET_PeerIdentity *path,
+    const struct GNUNET_HashCode * key)
+{
+  struct Bench_Peer *peer = (struct Bench_Peer *) cls;
+  struct Bench_Result *r = current_result ();
+
+  if ((GNUNET_YES != counting_gets) || (GNUNET_YES != is_regex_block (type)))
+  {
+    return;
+  }
+  // Only count the lookups our own search starts, but follow them anywhere
+  if ((&searcher == peer) && (0 == hop_count))
+  {
+    r->gets++;
+  }
+  r->hops = GNUNET_MAX (r->hops, hop_count);
+}
+
+
+/**
+ * The search found the announcement
+ *
+ * @param cls Closure provided in #GNUNET_REGEX_search.
+ * @param id Peer providing a regex that matches the string.
+ * @param get_path Path of the get request.
+ * @param get_path_length Lenght of @a get_path.
+ * @param put_path Path of the put request.
+ * @param put_path_length Length of the @a put_path.
+ * @param key The key of the accepting state
+ */
+static void
+search_found (void *cls,
+              const struct GNUNET_PeerIdentity *id,
+              const struct GNUNET_PeerIdentity *get_path,
+              unsigned int get_path_length,
+              const struct GNUNET_PeerIdentity *put_path,
+              unsigned int put_path_length,
+              const struct GNUNET_HashCode *key)
+{
+  struct Bench_Result *r = current_result ();
+
+  if (GNUNET_YES == r->found)
+  {
+    return;
+  }
+  r->found = GNUNET_YES;
+  r->latency = GNUNET_TIME_absolute_get_duration (search_start);
+  finish_case ();
+}
+
+
+/**
+ * The search did not find the announcement in time
+ *
+ * @param cls NULL
+ * @param tc Task context
+ */
+static void
+search_timeout (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  case_task = GNUNET_SCHEDULER_NO_TASK;
+  LOG_ERROR ("Search in case %u timed out\n", current_case);
+  finish_case ();
+}
+
+
+/**
+ * The announcement settled, search for it
+ *
+ * @param cls NULL
+ * @param tc Task context
+ */
+static void
+start_search (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  const struct Bench_Shape *shape = &shapes[current_case / NUM_COMPRESSIONS];
+  char *topic;
+
+  case_task = GNUNET_SCHEDULER_NO_TASK;
+  counting_puts = GNUNET_NO;
+  counting_gets = GNUNET_YES;
+
+  // The case prefix keeps the announcements of the cases apart
+  GNUNET_asprintf (&topic, "b%u/%s", current_case, shape->topic);
+  search_start = GNUNET_TIME_absolute_get ();
+  search = GNUNET_REGEX_search (searcher.cfg, topic, &search_found, NULL);
+  GNUNET_free (topic);
+  if (NULL == search)
+  {
+    LOG_ERROR ("Can not search in case %u\n", current_case);
+    finish_case ();
+    return;
+  }
+  case_task = GNUNET_SCHEDULER_add_delayed (SEARCH_TIMEOUT, &search_timeout, NULL);
+}
+
+
+/**
+ * Announce the regex of the next case, or report if all cases are done
+ *
+ * @param cls NULL
+ * @param tc Task context
+ */
+static void
+run_case (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  const struct Bench_Shape *shape;
+  uint16_t compression;
+  char *regex;
+
+  case_task = GNUNET_SCHEDULER_NO_TASK;
+  if (NUM_SHAPES * NUM_COMPRESSIONS == current_case)
+  {
+    print_report ();
+    result = GNUNET_OK;
+    GNUNET_SCHEDULER_add_now (&shutdown_task, NULL);
+    return;
+  }
+  shape = &shapes[current_case / NUM_COMPRESSIONS];
+  compression = compressions[current_case % NUM_COMPRESSIONS];
+
+  GNUNET_asprintf (&regex, "b%u/%s", current_case, shape->regex);
+  counting_puts = GNUNET_YES;
+  announcement = GNUNET_REGEX_announce (announcer.cfg,
+                                        regex,
+                                        ANNOUNCE_REFRESH_DELAY,
+                                        compression);
+  GNUNET_free (regex);
+  if (NULL == announcement)
+  {
+    LOG_ERROR ("Can not announce in case %u\n", current_case);
+    finish_case ();
+    return;
+  }
+  case_task = GNUNET_SCHEDULER_add_delayed (ANNOUNCE_SETTLE_DELAY,
+                                            &start_search,
+                                            NULL);
+}
+
+
+/**
+ * Called when the connection to a peer is established, starts the sweep once
+ * all peers are connected
+ *
+ * @param cls The Bench_Peer
+ * @param op The operation
+ * @param ca_result The DHT handle
+ * @param emsg error message, if testbed somehow failed to connect to the DHT.
+ */
+static void
+peer_connected (void *cls,
+  struct GNUNET_TESTBED_Operation *op,
+  void *ca_result,
+  const char *emsg)
+{
+  struct Bench_Peer *peer = (struct Bench_Peer *) cls;
+
+  if ((NULL != emsg) || (NULL == peer->dht_handle))
+  {
+    LOG_ERROR ("Can not connect to peer: %s\n", (NULL != emsg) ? emsg : "DHT");
+    GNUNET_SCHEDULER_add_now (&shutdown_task, NULL);
+    return;
+  }
+  peer->monitor = GNUNET_DHT_monitor_start (peer->dht_handle,
+                                            GNUNET_BLOCK_TYPE_ANY,
+                                            NULL,
+                                            &search_get_cb,
+                                            NULL,
+                                            (peer == &announcer) ? &announcer_put_cb : NULL,
+                                            peer);
+  if (NUM_PEERS == ++peers_connected)
+  {
+    case_task = GNUNET_SCHEDULER_add_now (&run_case, NULL);
+  }
+}
+
+
+/**
+ * Store the configuration of a peer and connect to its DHT
+ *
+ * @param cls The Bench_Peer
+ * @param cfg peer configuration
+ * @return The DHT handle
+ */
+static void *
+peer_ca (void *cls, const struct GNUNET_CONFIGURATION_Handle *cfg)
+{
+  struct Bench_Peer *peer = (struct Bench_Peer *) cls;
+
+  peer->cfg = cfg;
+  peer->dht_handle = GNUNET_DHT_connect (cfg, HT_LENGTH_DEFAULT);
+  return peer->dht_handle;
+}
+
+
+/**
+ * Stop monitoring and disconnect from the DHT of a peer
+ *
+ * @param cls The Bench_Peer
+ * @param op_result The DHT handle
+ */
+static void
+peer_da (void *cls, void *op_result)
+{
+  struct Bench_Peer *peer = (struct Bench_Peer *) cls;
+
+  if (NULL != peer->monitor)
+  {
+    GNUNET_DHT_monitor_stop (peer->monitor);
+    peer->monitor = NULL;
+  }
+  if (NULL != peer->dht_handle)
+  {
+    GNUNET_DHT_disconnect (peer->dht_handle);
+    peer->dht_handle = NULL;
+  }
+}
+
+
+/**
+ * Main function inovked from TESTBED once all of the peers are up and running.
+ *
+ * @param cls closure
+ * @param h the run handle
+ * @param num_peers size of the 'peers' array
+ * @param peers started peers for the test
+ * @param links_succeeded number of links between peers that were created
+ * @param links_failed number of links testbed was unable to establish
+ */
+static void
+run_bench (void *cls,
+    struct GNUNET_TESTBED_RunHandle *h,
+    unsigned int num_peers,
+    struct GNUNET_TESTBED_Peer **peers,
+    unsigned int links_succeeded,
+    unsigned int links_failed)
+{
+  unsigned int i;
+
+  GNUNET_assert (NUM_PEERS == num_peers);
+
+  announcer.op = GNUNET_TESTBED_service_connect (NULL,
+      peers[NUM_PEERS - 1],
+      "dht",
+      &peer_connected,
+      &announcer,
+      &peer_ca,
+      &peer_da,
+      &announcer);
+  searcher.op = GNUNET_TESTBED_service_connect (NULL,
+      peers[0],
+      "dht",
+      &peer_connected,
+      &searcher,
+      &peer_ca,
+      &peer_da,
+      &searcher);
+  for (i = 0; i < NUM_PEERS - 2; i++)
+  {
+    relays[i].op = GNUNET_TESTBED_service_connect (NULL,
+        peers[i + 1],
+        "dht",
+        &peer_connected,
+        &relays[i],
+        &peer_ca,
+        &peer_da,
+        &relays[i]);
+  }
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int ret;
+  ret = GNUNET_TESTBED_test_run ("regex-compression-bench", /* test case name */
+      "../regex_testbed/regex_testbed.conf", /* template configuration */
+      NUM_PEERS, /* number of peers to start */
+      0LL, /* Event mask -set to 0 for no event notifications */
+      NULL, /* Controller event callback */
+      NULL, /* Closure for controller event callback */
+      &run_bench, /* continuation callback to be called when testbed setup is complete */
+      NULL); /* Closure for the run_bench callback */
+
+  if ((GNUNET_OK != ret) || (GNUNET_OK != result))
+  {
+    LOG_ERROR ("Benchmark did not complete\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,295 @@
+#include "arena.h"
+
+
+/**
+ * Alignment every record is rounded up to
+ */
+#define ARENA_ALIGNMENT 16
+/**
+ * Target size of a slab if the caller does not specify one
+ */
+#define ARENA_DEFAULT_SLAB_SIZE 4096
+/**
+ * Round @a n up to the next multiple of #ARENA_ALIGNMENT
+ */
+#define ARENA_ALIGN(n) (((n) + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1))
+
+
+/**
+ * Header of every slab. The records follow directly after it.
+ */
+struct Arena_Slab {
+  /**
+   * Next slab of the arena
+   */
+  struct Arena_Slab *next;
+};
+
+
+/**
+ * A record that is currently on the free list
+ */
+struct Arena_Free_Element {
+  /**
+   * Next free record
+   */
+  struct Arena_Free_Element *next;
+};
+
+
+struct Arena_Pool {
+  /**
+   * One arena per size class, smallest first
+   */
+  struct Arena *classes[ARENA_POOL_MAX_CLASSES];
+  /**
+   * Record size of the smallest class
+   */
+  size_t min_size;
+  /**
+   * Number of @e classes
+   */
+  unsigned int num_classes;
+};
+
+
+struct Arena {
+  /**
+   * Size of every record, already aligned
+   */
+  size_t element_size;
+  /**
+   * Number of records per slab
+   */
+  unsigned int elements_per_slab;
+  /**
+   * All slabs owned by this arena
+   */
+  struct Arena_Slab *slabs;
+  /**
+   * Records ready to be handed out
+   */
+  struct Arena_Free_Element *free_list;
+  /**
+   * Allocator counters
+   */
+  struct Arena_Stats stats;
+};
+
+
+/**
+ * Allocate one more slab and put all of its records on the free list
+ *
+ * @param arena The arena to grow
+ */
+static void
+arena_grow (struct Arena *arena)
+{
+  struct Arena_Slab *slab;
+  size_t size;
+  char *element;
+  unsigned int i;
+
+  size = ARENA_ALIGN (sizeof (struct Arena_Slab))
+      + arena->element_size * arena->elements_per_slab;
+  slab = GNUNET_malloc (size);
+  slab->next = arena->slabs;
+  arena->slabs = slab;
+  arena->stats.slabs++;
+  arena->stats.slab_bytes += size;
+  arena->stats.system_allocs++;
+
+  element = ((char *) slab) + ARENA_ALIGN (sizeof (struct Arena_Slab));
+  for (i = 0; i < arena->elements_per_slab; i++)
+  {
+    struct Arena_Free_Element *fe = (struct Arena_Free_Element *) element;
+    fe->next = arena->free_list;
+    arena->free_list = fe;
+    element += arena->element_size;
+  }
+}
+
+
+struct Arena *
+arena_create (size_t element_size, unsigned int elements_per_slab)
+{
+  struct Arena *arena;
+
+  GNUNET_assert (0 < element_size);
+  arena = GNUNET_new (struct Arena);
+  arena->element_size = ARENA_ALIGN (GNUNET_MAX (element_size,
+                                                 sizeof (struct Arena_Free_Element)));
+  if (0 == elements_per_slab)
+  {
+    elements_per_slab = ARENA_DEFAULT_SLAB_SIZE / arena->element_size;
+  }
+  arena->elements_per_slab = GNUNET_MAX (1, elements_per_slab);
+  arena->stats.system_allocs = 1;
+  return arena;
+}
+
+
+void *
+arena_alloc (struct Arena *arena)
+{
+  struct Arena_Free_Element *fe;
+
+  if (NULL == arena->free_list)
+  {
+    arena_grow (arena);
+  }
+  fe = arena->free_list;
+  arena->free_list = fe->next;
+  arena->stats.in_use++;
+  arena->stats.peak_in_use = GNUNET_MAX (arena->stats.peak_in_use,
+                                         arena->stats.in_use);
+  arena->stats.allocs++;
+
+  memset (fe, 0, arena->element_size);
+  return fe;
+}
+
+
+void
+arena_free (struct Arena *arena, void *element)
+{
+  struct Arena_Free_Element *fe = (struct Arena_Free_Element *) element;
+
+  if (NULL == element)
+  {
+    return;
+  }
+  GNUNET_assert (0 < arena->stats.in_use);
+  fe->next = arena->free_list;
+  arena->free_list = fe;
+  arena->stats.in_use--;
+}
+
+
+void
+arena_destroy (struct Arena *arena)
+{
+  struct Arena_Slab *slab;
+
+  if (NULL == arena)
+  {
+    return;
+  }
+  while (NULL != (slab = arena->slabs))
+  {
+    arena->slabs = slab->next;
+    GNUNET_free (slab);
+  }
+  GNUNET_free (arena);
+}
+
+
+void
+arena_get_stats (const struct Arena *arena, struct Arena_Stats *stats)
+{
+  *stats = arena->stats;
+}
+
+
+struct Arena_Pool *
+arena_pool_create (size_t min_size, size_t max_size)
+{
+  struct Arena_Pool *pool;
+  size_t size;
+
+  GNUNET_assert (0 < min_size);
+  pool = GNUNET_new (struct Arena_Pool);
+  pool->min_size = min_size;
+  for (size = min_size; ; size *= 2)
+  {
+    GNUNET_assert (ARENA_POOL_MAX_CLASSES > pool->num_classes);
+    pool->classes[pool->num_classes++] = arena_create (size, 0);
+    if (size >= max_size)
+    {
+      break;
+    }
+  }
+  return pool;
+}
+
+
+/**
+ * Find the smallest size class a record fits
+ *
+ * @param pool The pool
+ * @param size Size of the record
+ * @return Index of the class, @e num_classes if none fits
+ */
+static unsigned int
+arena_pool_class (const struct Arena_Pool *pool, size_t size)
+{
+  unsigned int i = 0;
+  size_t class_size = pool->min_size;
+
+  while ((i < pool->num_classes) && (size > class_size))
+  {
+    i++;
+    class_size *= 2;
+  }
+  return i;
+}
+
+
+void *
+arena_pool_alloc (struct Arena_Pool *pool, size_t size)
+{
+  unsigned int i = arena_pool_class (pool, size);
+
+  if (i == pool->num_classes)
+  {
+    return NULL;
+  }
+  return arena_alloc (pool->classes[i]);
+}
+
+
+void
+arena_pool_free (struct Arena_Pool *pool, void *element, size_t size)
+{
+  unsigned int i = arena_pool_class (pool, size);
+
+  GNUNET_assert (i < pool->num_classes);
+  arena_free (pool->classes[i], element);
+}
+
+
+void
+arena_pool_destroy (struct Arena_Pool *pool)
+{
+  unsigned int i;
+
+  if (NULL == pool)
+  {
+    return;
+  }
+  for (i = 0; i < pool->num_classes; i++)
+  {
+    arena_destroy (pool->classes[i]);
+  }
+  GNUNET_free (pool);
+}
+
+
+void
+arena_pool_get_stats (const struct Arena_Pool *pool, struct Arena_Stats *stats)
+{
+  struct Arena_Stats class_stats;
+  unsigned int i;
+
+  memset (stats, 0, sizeof (struct Arena_Stats));
+  for (i = 0; i < pool->num_classes; i++)
+  {
+    arena_get_stats (pool->classes[i], &class_stats);
+    stats->slabs += class_stats.slabs;
+    stats->in_use += class_stats.in_use;
+    stats->peak_in_use += class_stats.peak_in_use;
+    stats->slab_bytes += class_stats.slab_bytes;
+    stats->allocs += class_stats.allocs;
+    stats->system_allocs += class_stats.system_allocs;
+  }
+}
@@ -0,0 +1,176 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <gnunet/platform.h>
+#include <gnunet/gnunet_util_lib.h>
+
+
+/**
+ * Slab allocator for fixed-size bookkeeping records.
+ *
+ * Records are carved out of larger slabs and recycled through a free list, so
+ * the per-event cost is a pointer swap instead of a malloc/free pair. All
+ * records of an arena are released at once by #arena_destroy, which is what we
+ * do when a subscription is cancelled.
+ *
+ * An arena is not thread safe, it is meant to be used from scheduler tasks
+ * only.
+ */
+struct Arena;
+
+
+/**
+ * Largest number of size classes of an #Arena_Pool
+ */
+#define ARENA_POOL_MAX_CLASSES 8
+
+
+/**
+ * Arenas for records of different sizes, e.g. records carrying a payload.
+ *
+ * Every size class is an arena whose records are twice as large as those of
+ * the class before. A record comes from the smallest class it fits, so at
+ * most half of it is wasted. Records larger than the largest class are not
+ * served.
+ */
+struct Arena_Pool;
+
+
+/**
+ * Counters describing the allocator activity of one arena
+ */
+struct Arena_Stats {
+  /**
+   * Number of slabs currently owned by the arena
+   */
+  unsigned int slabs;
+  /**
+   * Number of records currently handed out
+   */
+  unsigned int in_use;
+  /**
+   * Largest number of records handed out at the same time
+   */
+  unsigned int peak_in_use;
+  /**
+   * Bytes currently held in slabs. Slabs are only released by
+   * #arena_destroy, so this follows @e peak_in_use, not @e in_use.
+   */
+  unsigned long long slab_bytes;
+  /**
+   * Total number of records handed out since the arena was created
+   */
+  unsigned long long allocs;
+  /**
+   * Number of calls into the system allocator since the arena was created.
+   * Allocating every record with malloc would take @e allocs calls.
+   */
+  unsigned long long system_allocs;
+};
+
+
+/**
+ * Create a new arena
+ *
+ * @param element_size Size of every record handed out by the arena
+ * @param elements_per_slab How many records to carve out of one slab. Use 0 to
+ *        let the arena pick a slab of roughly one page.
+ * @return The new arena
+ */
+struct Arena *
+arena_create (size_t element_size, unsigned int elements_per_slab);
+
+
+/**
+ * Get a zeroed record from the arena
+ *
+ * @param arena The arena to allocate from
+ * @return A record of the arenas element size, never NULL
+ */
+void *
+arena_alloc (struct Arena *arena);
+
+
+/**
+ * Return a record to the arena so it can be handed out again
+ *
+ * @param arena The arena the record was allocated from
+ * @param element The record to release
+ */
+void
+arena_free (struct Arena *arena, void *element);
+
+
+/**
+ * Release all records and slabs of the arena and the arena itself
+ *
+ * @param arena The arena to destroy, may be NULL
+ */
+void
+arena_destroy (struct Arena *arena);
+
+
+/**
+ * Read the allocator counters of an arena
+ *
+ * @param arena The arena to inspect
+ * @param stats Will be filled with the counters
+ */
+void
+arena_get_stats (const struct Arena *arena, struct Arena_Stats *stats);
+
+
+/**
+ * Create a new pool
+ *
+ * @param min_size Size of the records of the smallest class
+ * @param max_size Size of the largest record the pool serves, at most
+ *        2^(#ARENA_POOL_MAX_CLASSES - 1) times @a min_size
+ * @return The new pool
+ */
+struct Arena_Pool *
+arena_pool_create (size_t min_size, size_t max_size);
+
+
+/**
+ * Get a zeroed record of at least @a size bytes from the pool
+ *
+ * @param pool The pool to allocate from
+ * @param size Size of the record
+ * @return The record, NULL if @a size is larger than the pool serves
+ */
+void *
+arena_pool_alloc (struct Arena_Pool *pool, size_t size);
+
+
+/**
+ * Return a record to the pool so it can be handed out again
+ *
+ * @param pool The pool the record was allocated from
+ * @param element The record to release, may be NULL
+ * @param size The size the record was allocated with
+ */
+void
+arena_pool_free (struct Arena_Pool *pool, void *element, size_t size);
+
+
+/**
+ * Release all records of the pool and the pool itself
+ *
+ * @param pool The pool to destroy, may be NULL
+ */
+void
+arena_pool_destroy (struct Arena_Pool *pool);
+
+
+/**
+ * Read the allocator counters of all classes of a pool added up. The peak
+ * is the sum of the peaks of the classes.
+ *
+ * @param pool The pool to inspect
+ * @param stats Will be filled with the counters
+ */
+void
+arena_pool_get_stats (const struct Arena_Pool *pool, struct Arena_Stats *stats);
+
+#endif
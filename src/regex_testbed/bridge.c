@@ -0,0 +1,484 @@
+#include <fcntl.h>
+#include <stdatomic.h>
+#include "ring.h"
+#include "bridge.h"
+
+
+/**
+ * Number of messages every lane can buffer in each direction
+ */
+#define BRIDGE_RING_SLOTS 256
+/**
+ * Maximum number of messages taken from one lane before moving on to the
+ * next, so a busy thread can not starve the others
+ */
+#define BRIDGE_DRAIN_BATCH 32
+
+
+/**
+ * Header of every message in a ring, followed by the 0-terminated topic and
+ * the payload
+ */
+struct Bridge_Record_Header {
+  /**
+   * Length of the topic including the terminating 0
+   */
+  uint32_t topic_size;
+  /**
+   * Size of the payload
+   */
+  uint32_t data_size;
+};
+
+
+/**
+ * The rings and wakeup state of one application thread
+ */
+struct Bridge_Lane {
+  /**
+   * Messages from the thread to the scheduler
+   */
+  struct Ring *publish;
+  /**
+   * Messages from the scheduler to the thread
+   */
+  struct Ring *deliver;
+  /**
+   * Pipe the thread polls for deliveries, [0] is the read end
+   */
+  int deliver_pipe[2];
+  /**
+   * Set while a delivery wakeup is signalled but not consumed yet
+   */
+  atomic_int deliver_pending;
+};
+
+
+struct Bridge {
+  /**
+   * All lanes
+   */
+  struct Bridge_Lane *lanes;
+  /**
+   * Number of lanes
+   */
+  unsigned int num_lanes;
+  /**
+   * Pipe the scheduler waits on for publishes
+   */
+  struct GNUNET_DISK_PipeHandle *publish_pipe;
+  /**
+   * Set while a publish wakeup is signalled but not consumed yet
+   */
+  atomic_int publish_pending;
+  /**
+   * Called for every published message
+   */
+  Bridge_Publish_Handler handler;
+  /**
+   * Closure for handler
+   */
+  void *handler_cls;
+  /**
+   * Task draining the publish rings
+   */
+  GNUNET_SCHEDULER_TaskIdentifier drain_task;
+};
+
+
+/**
+ * Encode and queue a message
+ *
+ * @param ring The ring to push to
+ * @param topic The topic
+ * @param data The payload
+ * @param size Size of @a data
+ * @return see #ring_push
+ */
+static int
+bridge_ring_push (struct Ring *ring,
+                  const char *topic,
+                  const void *data,
+                  size_t size)
+{
+  char buf[sizeof (struct Bridge_Record_Header) + BRIDGE_MAX_RECORD_SIZE];
+  struct Bridge_Record_Header *hdr = (struct Bridge_Record_Header *) buf;
+  size_t topic_size = strlen (topic) + 1;
+
+  if (topic_size + size > BRIDGE_MAX_RECORD_SIZE)
+  {
+    return GNUNET_SYSERR;
+  }
+  hdr->topic_size = topic_size;
+  hdr->data_size = size;
+  memcpy (&hdr[1], topic, topic_size);
+  if (0 != size)
+  {
+    memcpy (((char *) &hdr[1]) + topic_size, data, size);
+  }
+  return ring_push (ring, buf, sizeof (struct Bridge_Record_Header) + topic_size + size);
+}
+
+
+/**
+ * Check that a record taken from a ring is a well-formed message
+ *
+ * @param hdr The record
+ * @param size Size of the record
+ * @return #GNUNET_YES if it is
+ */
+static int
+bridge_record_valid (const struct Bridge_Record_Header *hdr, size_t size)
+{
+  return ((size >= sizeof (struct Bridge_Record_Header))
+          && (size == sizeof (struct Bridge_Record_Header) + hdr->topic_size + hdr->data_size)
+          && (0 != hdr->topic_size)
+          && ('\0' == ((const char *) &hdr[1])[hdr->topic_size - 1]))
+      ? GNUNET_YES : GNUNET_NO;
+}
+
+
+/**
+ * Take a message from a ring and validate it
+ *
+ * @param ring The ring to pop from
+ * @param buf Buffer of at least the slot size of the ring
+ * @param buf_size Size of @a buf
+ * @return The header of the message inside @a buf, NULL if the ring is empty
+ */
+static const struct Bridge_Record_Header *
+bridge_ring_pop (struct Ring *ring, char *buf, size_t buf_size)
+{
+  const struct Bridge_Record_Header *hdr = (const struct Bridge_Record_Header *) buf;
+  size_t size;
+
+  while (0 != (size = ring_pop (ring, buf, buf_size)))
+  {
+    if (GNUNET_YES == bridge_record_valid (hdr, size))
+    {
+      return hdr;
+    }
+    GNUNET_break (0);
+  }
+  return NULL;
+}
+
+
+/**
+ * Look at the next message of a ring without taking it, dropping malformed
+ * records on the way
+ *
+ * @param ring The ring
+ * @return The header of the message inside the ring, valid until the next
+ *         #ring_drop; NULL if the ring is empty
+ */
+static const struct Bridge_Record_Header *
+bridge_ring_peek (struct Ring *ring)
+{
+  const struct Bridge_Record_Header *hdr;
+  size_t size;
+
+  while (NULL != (hdr = ring_peek (ring, &size)))
+  {
+    if (GNUNET_YES == bridge_record_valid (hdr, size))
+    {
+      return hdr;
+    }
+    GNUNET_break (0);
+    ring_drop (ring);
+  }
+  return NULL;
+}
+
+
+/**
+ * Take a batch of publishes from every lane and hand them to the handler
+ *
+ * @param cls The Bridge
+ * @param tc Task context
+ */
+static void
+bridge_drain (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  struct Bridge *bridge = (struct Bridge *) cls;
+  char buf[sizeof (struct Bridge_Record_Header) + BRIDGE_MAX_RECORD_SIZE];
+  const struct Bridge_Record_Header *hdr;
+  char wakeups[64];
+  int backlog;
+  unsigned int i;
+  unsigned int j;
+
+  bridge->drain_task = GNUNET_SCHEDULER_NO_TASK;
+  if (0 != (tc->reason & GNUNET_SCHEDULER_REASON_SHUTDOWN))
+  {
+    return;
+  }
+
+  /*
+   * Consume the wakeup before draining. A thread publishing after we looked at
+   * its ring will see the flag cleared and signal again.
+   */
+  if (0 != (tc->reason & GNUNET_SCHEDULER_REASON_READ_READY))
+  {
+    GNUNET_DISK_file_read (GNUNET_DISK_pipe_handle (bridge->publish_pipe,
+                                                    GNUNET_DISK_PIPE_END_READ),
+                           wakeups,
+                           sizeof (wakeups));
+  }
+  atomic_store (&bridge->publish_pending, 0);
+
+  backlog = GNUNET_NO;
+  for (i = 0; i < bridge->num_lanes; i++)
+  {
+    for (j = 0; j < BRIDGE_DRAIN_BATCH; j++)
+    {
+      hdr = bridge_ring_pop (bridge->lanes[i].publish, buf, sizeof (buf));
+      if (NULL == hdr)
+      {
+        break;
+      }
+      bridge->handler (bridge->handler_cls,
+                       i,
+                       (const char *) &hdr[1],
+                       ((const char *) &hdr[1]) + hdr->topic_size,
+                       hdr->data_size);
+    }
+    if (BRIDGE_DRAIN_BATCH == j)
+    {
+      backlog = GNUNET_YES;
+    }
+  }
+
+  if (GNUNET_YES == backlog)
+  {
+    /* Give other tasks a chance before taking the next batch */
+    bridge->drain_task = GNUNET_SCHEDULER_add_now (&bridge_drain, bridge);
+    return;
+  }
+  bridge->drain_task =
+      GNUNET_SCHEDULER_add_read_file (GNUNET_TIME_UNIT_FOREVER_REL,
+                                      GNUNET_DISK_pipe_handle (bridge->publish_pipe,
+                                                               GNUNET_DISK_PIPE_END_READ),
+                                      &bridge_drain,
+                                      bridge);
+}
+
+
+struct Bridge *
+bridge_create (unsigned int num_lanes,
+               Bridge_Publish_Handler handler,
+               void *handler_cls)
+{
+  struct Bridge *bridge;
+  unsigned int i;
+
+  GNUNET_assert (0 < num_lanes);
+  bridge = GNUNET_new (struct Bridge);
+  bridge->num_lanes = num_lanes;
+  bridge->handler = handler;
+  bridge->handler_cls = handler_cls;
+  atomic_init (&bridge->publish_pending, 0);
+  bridge->lanes = GNUNET_new_array (num_lanes, struct Bridge_Lane);
+  for (i = 0; i < num_lanes; i++)
+  {
+    bridge->lanes[i].deliver_pipe[0] = -1;
+    bridge->lanes[i].deliver_pipe[1] = -1;
+  }
+
+  bridge->publish_pipe = GNUNET_DISK_pipe (GNUNET_NO, GNUNET_NO, GNUNET_NO, GNUNET_NO);
+  if (NULL == bridge->publish_pipe)
+  {
+    bridge_destroy (bridge);
+    return NULL;
+  }
+  for (i = 0; i < num_lanes; i++)
+  {
+    struct Bridge_Lane *lane = &bridge->lanes[i];
+
+    lane->publish = ring_create (BRIDGE_RING_SLOTS,
+                                 sizeof (struct Bridge_Record_Header) + BRIDGE_MAX_RECORD_SIZE);
+    lane->deliver = ring_create (BRIDGE_RING_SLOTS,
+                                 sizeof (struct Bridge_Record_Header) + BRIDGE_MAX_RECORD_SIZE);
+    atomic_init (&lane->deliver_pending, 0);
+    if (0 != pipe (lane->deliver_pipe))
+    {
+      lane->deliver_pipe[0] = -1;
+      lane->deliver_pipe[1] = -1;
+      bridge_destroy (bridge);
+      return NULL;
+    }
+    fcntl (lane->deliver_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl (lane->deliver_pipe[1], F_SETFL, O_NONBLOCK);
+  }
+
+  bridge->drain_task =
+      GNUNET_SCHEDULER_add_read_file (GNUNET_TIME_UNIT_FOREVER_REL,
+                                      GNUNET_DISK_pipe_handle (bridge->publish_pipe,
+                                                               GNUNET_DISK_PIPE_END_READ),
+                                      &bridge_drain,
+                                      bridge);
+  return bridge;
+}
+
+
+int
+bridge_publish (struct Bridge *bridge,
+                unsigned int lane,
+                const char *topic,
+                const void *data,
+                size_t size)
+{
+  static const char wakeup = 1;
+  int ret;
+
+  GNUNET_assert (lane < bridge->num_lanes);
+  if (NULL == bridge->handler)
+  {
+    return GNUNET_SYSERR;
+  }
+  ret = bridge_ring_push (bridge->lanes[lane].publish, topic, data, size);
+  if (GNUNET_OK != ret)
+  {
+    return ret;
+  }
+  /* Only the first publish after the scheduler went idle wakes it up */
+  if (0 == atomic_exchange (&bridge->publish_pending, 1))
+  {
+    GNUNET_DISK_file_write (GNUNET_DISK_pipe_handle (bridge->publish_pipe,
+                                                     GNUNET_DISK_PIPE_END_WRITE),
+                            &wakeup,
+                            sizeof (wakeup));
+  }
+  return GNUNET_OK;
+}
+
+
+int
+bridge_deliver (struct Bridge *bridge,
+                unsigned int lane,
+                const char *topic,
+                const void *data,
+                size_t size)
+{
+  static const char wakeup = 1;
+  struct Bridge_Lane *l;
+  int ret;
+
+  GNUNET_assert (lane < bridge->num_lanes);
+  l = &bridge->lanes[lane];
+  ret = bridge_ring_push (l->deliver, topic, data, size);
+  if (GNUNET_OK != ret)
+  {
+    return ret;
+  }
+  if (0 == atomic_exchange (&l->deliver_pending, 1))
+  {
+    if (-1 == write (l->deliver_pipe[1], &wakeup, sizeof (wakeup)))
+    {
+      /* The pipe is only full if the thread has a wakeup pending anyway */
+      GNUNET_break (EAGAIN == errno);
+    }
+  }
+  return GNUNET_OK;
+}
+
+
+ssize_t
+bridge_receive (struct Bridge *bridge,
+                unsigned int lane,
+                char *topic,
+                size_t topic_size,
+                void *data,
+                size_t data_size)
+{
+  const struct Bridge_Record_Header *hdr;
+  struct Bridge_Lane *l;
+  char wakeups[64];
+  ssize_t ret;
+
+  GNUNET_assert (lane < bridge->num_lanes);
+  l = &bridge->lanes[lane];
+  hdr = bridge_ring_peek (l->deliver);
+  if (NULL == hdr)
+  {
+    /*
+     * Going idle: consume the wakeup and look once more, the scheduler may
+     * have delivered right before we cleared the flag.
+     */
+    while (0 < read (l->deliver_pipe[0], wakeups, sizeof (wakeups)))
+      ;
+    atomic_store (&l->deliver_pending, 0);
+    hdr = bridge_ring_peek (l->deliver);
+    if (NULL == hdr)
+    {
+      return BRIDGE_RECEIVE_EMPTY;
+    }
+  }
+  if ((hdr->topic_size > topic_size) || (hdr->data_size > data_size))
+  {
+    // Stays queued, the caller can learn the size from bridge_peek
+    return BRIDGE_RECEIVE_TOO_SMALL;
+  }
+  memcpy (topic, &hdr[1], hdr->topic_size);
+  memcpy (data, ((const char *) &hdr[1]) + hdr->topic_size, hdr->data_size);
+  ret = hdr->data_size;
+  ring_drop (l->deliver);
+  return ret;
+}
+
+
+int
+bridge_peek (struct Bridge *bridge,
+             unsigned int lane,
+             size_t *topic_size,
+             size_t *data_size)
+{
+  const struct Bridge_Record_Header *hdr;
+
+  GNUNET_assert (lane < bridge->num_lanes);
+  hdr = bridge_ring_peek (bridge->lanes[lane].deliver);
+  if (NULL == hdr)
+  {
+    return GNUNET_NO;
+  }
+  *topic_size = hdr->topic_size;
+  *data_size = hdr->data_size;
+  return GNUNET_YES;
+}
+
+
+int
+bridge_receive_fd (const struct Bridge *bridge, unsigned int lane)
+{
+  GNUNET_assert (lane < bridge->num_lanes);
+  return bridge->lanes[lane].deliver_pipe[0];
+}
+
+
+void
+bridge_destroy (struct Bridge *bridge)
+{
+  unsigned int i;
+
+  if (GNUNET_SCHEDULER_NO_TASK != bridge->drain_task)
+  {
+    GNUNET_SCHEDULER_cancel (bridge->drain_task);
+    bridge->drain_task = GNUNET_SCHEDULER_NO_TASK;
+  }
+  for (i = 0; i < bridge->num_lanes; i++)
+  {
+    ring_destroy (bridge->lanes[i].publish);
+    ring_destroy (bridge->lanes[i].deliver);
+    if (-1 != bridge->lanes[i].deliver_pipe[0])
+    {
+      close (bridge->lanes[i].deliver_pipe[0]);
+      close (bridge->lanes[i].deliver_pipe[1]);
+    }
+  }
+  GNUNET_free (bridge->lanes);
+  if (NULL != bridge->publish_pipe)
+  {
+    GNUNET_DISK_pipe_close (bridge->publish_pipe);
+  }
+  GNUNET_free (bridge);
+}
@@ -0,0 +1,173 @@
+#ifndef BRIDGE_H
+#define BRIDGE_H
+
+#include <gnunet/platform.h>
+#include <gnunet/gnunet_util_lib.h>
+
+
+/**
+ * Maximum size of topic and payload of one message passing the bridge
+ */
+#define BRIDGE_MAX_RECORD_SIZE 2048
+/**
+ * Returned by #bridge_receive if no message is waiting
+ */
+#define BRIDGE_RECEIVE_EMPTY -1
+/**
+ * Returned by #bridge_receive if the next message does not fit into the
+ * buffers. It stays queued, #bridge_peek tells its size.
+ */
+#define BRIDGE_RECEIVE_TOO_SMALL -2
+
+
+/**
+ * Bridge between application threads and the GNUnet scheduler.
+ *
+ * Every application thread owns one lane. A lane consists of two lock-free
+ * SPSC rings, one for publishes from the thread and one for deliveries to it,
+ * so neither side ever blocks on the other. Wakeups go through pipes and are
+ * only signalled when the other side is idle, so a burst of messages costs a
+ * single wakeup.
+ *
+ * #bridge_create and #bridge_destroy must be called from the scheduler,
+ * #bridge_publish and #bridge_receive only from the thread owning the lane.
+ */
+struct Bridge;
+
+
+/**
+ * Called from the scheduler for every message published by a thread
+ *
+ * @param cls Closure
+ * @param lane The lane the message was published on
+ * @param topic The topic to publish to, 0-terminated
+ * @param data The payload
+ * @param size Size of @a data
+ */
+typedef void
+(*Bridge_Publish_Handler) (void *cls,
+                           unsigned int lane,
+                           const char *topic,
+                           const void *data,
+                           size_t size);
+
+
+/**
+ * Create a bridge and start draining it from the scheduler
+ *
+ * @param num_lanes Number of application threads that may use the bridge
+ * @param handler Called for every published message, NULL for a bridge that
+ *        only delivers to the threads
+ * @param handler_cls Closure for @a handler
+ * @return The bridge, NULL if the wakeup pipes could not be created
+ */
+struct Bridge *
+bridge_create (unsigned int num_lanes,
+               Bridge_Publish_Handler handler,
+               void *handler_cls);
+
+
+/**
+ * Publish a message from an application thread. Never blocks.
+ *
+ * @param bridge The bridge
+ * @param lane The lane of the calling thread
+ * @param topic The topic to publish to
+ * @param data The payload
+ * @param size Size of @a data
+ * @return #GNUNET_OK if queued, #GNUNET_NO if the lane is full,
+ *         #GNUNET_SYSERR if the message is too large or the bridge does not
+ *         accept publishes
+ */
+int
+bridge_publish (struct Bridge *bridge,
+                unsigned int lane,
+                const char *topic,
+                const void *data,
+                size_t size);
+
+
+/**
+ * Hand a delivered message to the application thread of a lane. Must be
+ * called from the scheduler.
+ *
+ * @param bridge The bridge
+ * @param lane The lane to deliver to
+ * @param topic The topic the message was published to, not the
+ *        subscription it matched
+ * @param data The payload
+ * @param size Size of @a data
+ * @return #GNUNET_OK if queued, #GNUNET_NO if the thread is not keeping up and
+ *         the message was dropped, #GNUNET_SYSERR if the message is too large
+ */
+int
+bridge_deliver (struct Bridge *bridge,
+                unsigned int lane,
+                const char *topic,
+                const void *data,
+                size_t size);
+
+
+/**
+ * Take the next delivered message from a lane. Never blocks; threads that
+ * want to sleep should poll #bridge_receive_fd once this returns
+ * #BRIDGE_RECEIVE_EMPTY.
+ *
+ * @param bridge The bridge
+ * @param lane The lane of the calling thread
+ * @param topic Buffer for the topic
+ * @param topic_size Size of @a topic
+ * @param data Buffer for the payload
+ * @param data_size Size of @a data
+ * @return Size of the payload, #BRIDGE_RECEIVE_EMPTY if no message is
+ *         waiting, #BRIDGE_RECEIVE_TOO_SMALL if the message does not fit
+ */
+ssize_t
+bridge_receive (struct Bridge *bridge,
+                unsigned int lane,
+                char *topic,
+                size_t topic_size,
+                void *data,
+                size_t data_size);
+
+
+/**
+ * Get the size of the next delivered message of a lane without taking it.
+ * Must only be called from the thread owning the lane.
+ *
+ * @param bridge The bridge
+ * @param lane The lane of the calling thread
+ * @param topic_size Set to the length of the topic including the
+ *        terminating 0
+ * @param data_size Set to the size of the payload
+ * @return #GNUNET_YES if a message is waiting, #GNUNET_NO if not
+ */
+int
+bridge_peek (struct Bridge *bridge,
+             unsigned int lane,
+             size_t *topic_size,
+             size_t *data_size);
+
+
+/**
+ * Get a file descriptor that becomes readable when messages are waiting for
+ * the thread of a lane
+ *
+ * @param bridge The bridge
+ * @param lane The lane
+ * @return The file descriptor
+ */
+int
+bridge_receive_fd (const struct Bridge *bridge, unsigned int lane);
+
+
+/**
+ * Stop draining and free the bridge. All application threads must have
+ * stopped using it.
+ *
+ * @param bridge The bridge
+ */
+void
+bridge_destroy (struct Bridge *bridge);
+
+#endif
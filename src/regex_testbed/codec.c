@@ -0,0 +1,469 @@
+#include <zstd.h>
+#include <zdict.h>
+#include "codec.h"
+
+
+/**
+ * zstd compression level, messages are small so higher levels gain little
+ */
+#define CODEC_LEVEL 3
+/**
+ * Prefix hashed with the publisher and dictionary id to get the DHT key of a
+ * dictionary, keeps them apart from REGEX state keys
+ */
+#define CODEC_KEY_PREFIX "regex-testbed-dictionary:"
+
+
+struct Codec_Encoder {
+  /**
+   * Compression context, references @e cdict once activated
+   */
+  ZSTD_CCtx *cctx;
+  /**
+   * The trained dictionary, NULL before
+   */
+  ZSTD_CDict *cdict;
+  /**
+   * Id of @e cdict, 0 before training
+   */
+  uint32_t trained;
+  /**
+   * Id of @e cdict once activated, 0 before
+   */
+  uint32_t dictionary;
+  /**
+   * Sampled messages back to back, NULL once sampling is over
+   */
+  char *samples;
+  /**
+   * Size of each sampled message
+   */
+  size_t *sample_sizes;
+  /**
+   * Total size of @e samples
+   */
+  size_t samples_size;
+  /**
+   * Number of messages sampled so far
+   */
+  unsigned int sample_count;
+  /**
+   * Number of messages to sample
+   */
+  unsigned int sample_target;
+  /**
+   * Called once the dictionary is trained
+   */
+  Codec_Dictionary_Callback cb;
+  /**
+   * Closure for @e cb
+   */
+  void *cb_cls;
+  /**
+   * Counters
+   */
+  struct Codec_Stats stats;
+};
+
+
+struct Codec_Decoder {
+  /**
+   * Decompression context
+   */
+  ZSTD_DCtx *dctx;
+  /**
+   * Dictionaries by their DHT key, which identifies publisher and id
+   */
+  struct GNUNET_CONTAINER_MultiHashMap *dictionaries;
+  /**
+   * Counters
+   */
+  struct Codec_Stats stats;
+};
+
+
+void
+codec_dictionary_key (const struct GNUNET_PeerIdentity *publisher,
+                      uint32_t id,
+                      struct GNUNET_HashCode *key)
+{
+  char name[sizeof (CODEC_KEY_PREFIX) - 1
+            + sizeof (struct GNUNET_PeerIdentity)
+            + sizeof (uint32_t)];
+  uint32_t id_nbo = htonl (id);
+  char *pos = name;
+
+  memcpy (pos, CODEC_KEY_PREFIX, sizeof (CODEC_KEY_PREFIX) - 1);
+  pos += sizeof (CODEC_KEY_PREFIX) - 1;
+  memcpy (pos, publisher, sizeof (struct GNUNET_PeerIdentity));
+  pos += sizeof (struct GNUNET_PeerIdentity);
+  memcpy (pos, &id_nbo, sizeof (uint32_t));
+  GNUNET_CRYPTO_hash (name, sizeof (name), key);
+}
+
+
+struct Codec_Encoder *
+codec_encoder_create (unsigned int samples,
+                      Codec_Dictionary_Callback cb,
+                      void *cb_cls)
+{
+  struct Codec_Encoder *encoder;
+
+  encoder = GNUNET_new (struct Codec_Encoder);
+  encoder->cctx = ZSTD_createCCtx ();
+  if (NULL == encoder->cctx)
+  {
+    GNUNET_free (encoder);
+    return NULL;
+  }
+  ZSTD_CCtx_setParameter (encoder->cctx, ZSTD_c_compressionLevel, CODEC_LEVEL);
+  /* The id is in our header already */
+  ZSTD_CCtx_setParameter (encoder->cctx, ZSTD_c_dictIDFlag, 0);
+  encoder->sample_target = GNUNET_MAX (1, samples);
+  encoder->sample_sizes = GNUNET_malloc (encoder->sample_target * sizeof (size_t));
+  encoder->samples = GNUNET_malloc (1);
+  encoder->cb = cb;
+  encoder->cb_cls = cb_cls;
+  return encoder;
+}
+
+
+/**
+ * Stop sampling and free the samples
+ *
+ * @param encoder The encoder
+ */
+static void
+codec_encoder_stop_sampling (struct Codec_Encoder *encoder)
+{
+  GNUNET_free (encoder->samples);
+  encoder->samples = NULL;
+  GNUNET_free (encoder->sample_sizes);
+  encoder->sample_sizes = NULL;
+}
+
+
+/**
+ * Train the dictionary from the samples. If training fails the encoder goes
+ * on compressing without a dictionary.
+ *
+ * @param encoder The encoder
+ */
+static void
+codec_encoder_train (struct Codec_Encoder *encoder)
+{
+  char dictionary[CODEC_DICTIONARY_SIZE];
+  size_t size;
+
+  size = ZDICT_trainFromBuffer (dictionary,
+                                sizeof (dictionary),
+                                encoder->samples,
+                                encoder->sample_sizes,
+                                encoder->sample_count);
+  codec_encoder_stop_sampling (encoder);
+  if ((ZDICT_isError (size))
+      || (0 == ZDICT_getDictID (dictionary, size)))
+  {
+    return;
+  }
+  encoder->cdict = ZSTD_createCDict (dictionary, size, CODEC_LEVEL);
+  if (NULL == encoder->cdict)
+  {
+    return;
+  }
+  encoder->trained = ZDICT_getDictID (dictionary, size);
+  if (NULL != encoder->cb)
+  {
+    encoder->cb (encoder->cb_cls, encoder->trained, dictionary, size);
+  }
+}
+
+
+int
+codec_encoder_activate (struct Codec_Encoder *encoder)
+{
+  if ((NULL == encoder->cdict)
+      || (ZSTD_isError (ZSTD_CCtx_refCDict (encoder->cctx, encoder->cdict))))
+  {
+    return GNUNET_SYSERR;
+  }
+  encoder->dictionary = encoder->trained;
+  return GNUNET_OK;
+}
+
+
+/**
+ * Keep a copy of a message to train the dictionary from, training it once
+ * enough messages are sampled
+ *
+ * @param encoder The encoder, still sampling
+ * @param data The message
+ * @param size Size of @a data
+ */
+static void
+codec_encoder_sample (struct Codec_Encoder *encoder,
+                      const void *data,
+                      size_t size)
+{
+  if (0 == size)
+  {
+    return;
+  }
+  encoder->samples = GNUNET_realloc (encoder->samples,
+                                     encoder->samples_size + size);
+  memcpy (&encoder->samples[encoder->samples_size], data, size);
+  encoder->samples_size += size;
+  encoder->sample_sizes[encoder->sample_count++] = size;
+  if (encoder->sample_count == encoder->sample_target)
+  {
+    codec_encoder_train (encoder);
+  }
+}
+
+
+size_t
+codec_encode (struct Codec_Encoder *encoder,
+              const void *data,
+              size_t size,
+              void *buf,
+              size_t buf_size)
+{
+  struct Codec_Header *header = (struct Codec_Header *) buf;
+  size_t compressed = 0;
+
+  if (size + sizeof (struct Codec_Header) > buf_size)
+  {
+    return 0;
+  }
+  if (NULL != encoder->samples)
+  {
+    codec_encoder_sample (encoder, data, size);
+  }
+  // Only a result smaller than the message fits, so this also decides
+  // whether compressing was worth it
+  if (1 < size)
+  {
+    compressed = ZSTD_compress2 (encoder->cctx, &header[1], size - 1, data, size);
+    if (ZSTD_isError (compressed))
+    {
+      /* A failed frame leaves the context mid-frame */
+      ZSTD_CCtx_reset (encoder->cctx, ZSTD_reset_session_only);
+      compressed = 0;
+    }
+  }
+  if (0 == compressed)
+  {
+    header->dictionary = htonl (0);
+    header->format = CODEC_FORMAT_PLAIN;
+    if (0 != size)
+    {
+      memcpy (&header[1], data, size);
+    }
+    compressed = size;
+  }
+  else
+  {
+    header->dictionary = htonl (encoder->dictionary);
+    header->format = CODEC_FORMAT_ZSTD;
+    if (0 != encoder->dictionary)
+    {
+      encoder->stats.with_dictionary++;
+    }
+  }
+  encoder->stats.messages++;
+  encoder->stats.plain_bytes += size;
+  encoder->stats.encoded_bytes += sizeof (struct Codec_Header) + compressed;
+  return sizeof (struct Codec_Header) + compressed;
+}
+
+
+void
+codec_encoder_get_stats (const struct Codec_Encoder *encoder,
+                         struct Codec_Stats *stats)
+{
+  *stats = encoder->stats;
+}
+
+
+void
+codec_encoder_destroy (struct Codec_Encoder *encoder)
+{
+  if (NULL == encoder)
+  {
+    return;
+  }
+  if (NULL != encoder->samples)
+  {
+    codec_encoder_stop_sampling (encoder);
+  }
+  ZSTD_freeCCtx (encoder->cctx);
+  ZSTD_freeCDict (encoder->cdict);
+  GNUNET_free (encoder);
+}
+
+
+struct Codec_Decoder *
+codec_decoder_create (void)
+{
+  struct Codec_Decoder *decoder;
+
+  decoder = GNUNET_new (struct Codec_Decoder);
+  decoder->dctx = ZSTD_createDCtx ();
+  if (NULL == decoder->dctx)
+  {
+    GNUNET_free (decoder);
+    return NULL;
+  }
+  decoder->dictionaries = GNUNET_CONTAINER_multihashmap_create (8, GNUNET_NO);
+  return decoder;
+}
+
+
+int
+codec_decoder_add_dictionary (struct Codec_Decoder *decoder,
+                              const struct GNUNET_PeerIdentity *publisher,
+                              uint32_t id,
+                              const void *dictionary,
+                              size_t size)
+{
+  struct GNUNET_HashCode key;
+  ZSTD_DDict *ddict;
+
+  if ((0 == id) || (id != ZDICT_getDictID (dictionary, size)))
+  {
+    return GNUNET_SYSERR;
+  }
+  codec_dictionary_key (publisher, id, &key);
+  if (GNUNET_YES == GNUNET_CONTAINER_multihashmap_contains (decoder->dictionaries,
+                                                            &key))
+  {
+    return GNUNET_OK;
+  }
+  ddict = ZSTD_createDDict (dictionary, size);
+  if (NULL == ddict)
+  {
+    return GNUNET_SYSERR;
+  }
+  GNUNET_assert (GNUNET_OK ==
+                 GNUNET_CONTAINER_multihashmap_put (decoder->dictionaries,
+                                                    &key,
+                                                    ddict,
+                                                    GNUNET_CONTAINER_MULTIHASHMAPOPTION_UNIQUE_ONLY));
+  return GNUNET_OK;
+}
+
+
+int
+codec_decode (struct Codec_Decoder *decoder,
+              const struct GNUNET_PeerIdentity *publisher,
+              const void *data,
+              size_t size,
+              void *buf,
+              size_t buf_size,
+              size_t *message_size,
+              uint32_t *missing)
+{
+  const struct Codec_Header *header = (const struct Codec_Header *) data;
+  uint32_t id;
+  struct GNUNET_HashCode key;
+  ZSTD_DDict *ddict;
+  size_t payload_size;
+  size_t result;
+
+  if (sizeof (struct Codec_Header) > size)
+  {
+    return GNUNET_SYSERR;
+  }
+  id = ntohl (header->dictionary);
+  payload_size = size - sizeof (struct Codec_Header);
+  switch (header->format)
+  {
+  case CODEC_FORMAT_PLAIN:
+    if (payload_size > buf_size)
+    {
+      return GNUNET_SYSERR;
+    }
+    if (0 != payload_size)
+    {
+      memcpy (buf, &header[1], payload_size);
+    }
+    result = payload_size;
+    break;
+  case CODEC_FORMAT_ZSTD:
+    if (0 == id)
+    {
+      result = ZSTD_decompressDCtx (decoder->dctx, buf, buf_size,
+                                    &header[1], payload_size);
+    }
+    else
+    {
+      codec_dictionary_key (publisher, id, &key);
+      ddict = GNUNET_CONTAINER_multihashmap_get (decoder->dictionaries, &key);
+      if (NULL == ddict)
+      {
+        *missing = id;
+        return GNUNET_NO;
+      }
+      result = ZSTD_decompress_usingDDict (decoder->dctx, buf, buf_size,
+                                           &header[1], payload_size, ddict);
+    }
+    if (ZSTD_isError (result))
+    {
+      return GNUNET_SYSERR;
+    }
+    break;
+  default:
+    return GNUNET_SYSERR;
+  }
+  *message_size = result;
+  decoder->stats.messages++;
+  decoder->stats.plain_bytes += result;
+  decoder->stats.encoded_bytes += size;
+  if (0 != id)
+  {
+    decoder->stats.with_dictionary++;
+  }
+  return GNUNET_OK;
+}
+
+
+void
+codec_decoder_get_stats (const struct Codec_Decoder *decoder,
+                         struct Codec_Stats *stats)
+{
+  *stats = decoder->stats;
+}
+
+
+/**
+ * Free a dictionary of a decoder
+ *
+ * @param cls NULL
+ * @param key The DHT key of the dictionary
+ * @param value The ZSTD_DDict
+ * @return #GNUNET_YES to continue
+ */
+static int
+codec_free_dictionary (void *cls,
+                       const struct GNUNET_HashCode *key,
+                       void *value)
+{
+  ZSTD_freeDDict ((ZSTD_DDict *) value);
+  return GNUNET_YES;
+}
+
+
+void
+codec_decoder_destroy (struct Codec_Decoder *decoder)
+{
+  if (NULL == decoder)
+  {
+    return;
+  }
+  GNUNET_CONTAINER_multihashmap_iterate (decoder->dictionaries,
+                                         &codec_free_dictionary,
+                                         NULL);
+  GNUNET_CONTAINER_multihashmap_destroy (decoder->dictionaries);
+  ZSTD_freeDCtx (decoder->dctx);
+  GNUNET_free (decoder);
+}
@@ -0,0 +1,268 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <gnunet/platform.h>
+#include <gnunet/gnunet_util_lib.h>
+
+
+/**
+ * Default number of messages a topic samples to train its dictionary
+ */
+#define CODEC_SAMPLES 128
+/**
+ * Maximum size of a dictionary, small enough to be put into the DHT as one
+ * block
+ */
+#define CODEC_DICTIONARY_SIZE 2048
+
+
+/**
+ * How the payload following a #Codec_Header is encoded
+ */
+enum Codec_Format {
+  /**
+   * Not compressed
+   */
+  CODEC_FORMAT_PLAIN = 0,
+  /**
+   * A zstd frame, compressed with the dictionary in the header if not 0
+   */
+  CODEC_FORMAT_ZSTD = 1
+};
+
+
+GNUNET_NETWORK_STRUCT_BEGIN
+
+/**
+ * Prepended to every encoded message
+ */
+struct Codec_Header {
+  /**
+   * Id of the dictionary of the publisher the message was compressed with,
+   * 0 for none
+   */
+  uint32_t dictionary GNUNET_PACKED;
+  /**
+   * A #Codec_Format
+   */
+  uint8_t format;
+} GNUNET_PACKED;
+
+GNUNET_NETWORK_STRUCT_END
+
+
+/**
+ * Largest overhead #codec_encode adds to a message, messages that do not
+ * compress are sent plain
+ */
+#define CODEC_MAX_OVERHEAD sizeof (struct Codec_Header)
+
+
+/**
+ * Compresses the messages of one topic.
+ *
+ * The first messages are sampled and a zstd dictionary is trained from them.
+ * Once the owner made the dictionary available to decoders and activated it,
+ * all later messages are compressed with it. Small messages of one topic
+ * share most of their structure, so they compress well against the
+ * dictionary while they barely compress on their own.
+ */
+struct Codec_Encoder;
+
+
+/**
+ * Decompresses the messages of all publishers a subscriber receives from,
+ * with the dictionaries of the publishers added as they become known.
+ */
+struct Codec_Decoder;
+
+
+/**
+ * Counters of an encoder or decoder
+ */
+struct Codec_Stats {
+  /**
+   * Messages encoded or decoded
+   */
+  unsigned long long messages;
+  /**
+   * Bytes of the plain messages
+   */
+  unsigned long long plain_bytes;
+  /**
+   * Bytes of the encoded messages including their headers
+   */
+  unsigned long long encoded_bytes;
+  /**
+   * Messages compressed with a dictionary
+   */
+  unsigned long long with_dictionary;
+};
+
+
+/**
+ * Called when an encoder has trained a dictionary. The encoder goes on
+ * compressing without it until #codec_encoder_activate is called, so no
+ * decoder needs it before it can be found.
+ *
+ * @param cls Closure
+ * @param id Id of the dictionary
+ * @param dictionary The dictionary
+ * @param size Size of @a dictionary
+ */
+typedef void
+(*Codec_Dictionary_Callback) (void *cls,
+                              uint32_t id,
+                              const void *dictionary,
+                              size_t size);
+
+
+/**
+ * Get the DHT key a publisher puts a dictionary under
+ *
+ * @param publisher The publisher
+ * @param id Id of the dictionary
+ * @param key Set to the key
+ */
+void
+codec_dictionary_key (const struct GNUNET_PeerIdentity *publisher,
+                      uint32_t id,
+                      struct GNUNET_HashCode *key);
+
+
+/**
+ * Create an encoder
+ *
+ * @param samples Number of messages to train the dictionary from
+ * @param cb Called once the dictionary is trained
+ * @param cb_cls Closure for @a cb
+ * @return The new encoder, NULL if zstd can not be initialized
+ */
+struct Codec_Encoder *
+codec_encoder_create (unsigned int samples,
+                      Codec_Dictionary_Callback cb,
+                      void *cb_cls);
+
+
+/**
+ * Encode a message, compressed if that makes it smaller
+ *
+ * @param encoder The encoder
+ * @param data The message
+ * @param size Size of @a data
+ * @param buf Where to write the encoded message
+ * @param buf_size Size of @a buf, at least @a size + #CODEC_MAX_OVERHEAD
+ * @return Bytes written, 0 if @a buf is too small
+ */
+size_t
+codec_encode (struct Codec_Encoder *encoder,
+              const void *data,
+              size_t size,
+              void *buf,
+              size_t buf_size);
+
+
+/**
+ * Compress all following messages with the trained dictionary
+ *
+ * @param encoder The encoder
+ * @return #GNUNET_OK if activated, #GNUNET_SYSERR if there is no trained
+ *         dictionary or zstd can not use it
+ */
+int
+codec_encoder_activate (struct Codec_Encoder *encoder);
+
+
+/**
+ * Get the counters of an encoder
+ *
+ * @param encoder The encoder
+ * @param stats Set to the counters
+ */
+void
+codec_encoder_get_stats (const struct Codec_Encoder *encoder,
+                         struct Codec_Stats *stats);
+
+
+/**
+ * Free an encoder
+ *
+ * @param encoder The encoder, may be NULL
+ */
+void
+codec_encoder_destroy (struct Codec_Encoder *encoder);
+
+
+/**
+ * Create a decoder
+ *
+ * @return The new decoder, NULL if zstd can not be initialized
+ */
+struct Codec_Decoder *
+codec_decoder_create (void);
+
+
+/**
+ * Add the dictionary of a publisher to a decoder
+ *
+ * @param decoder The decoder
+ * @param publisher The publisher
+ * @param id Id the dictionary was announced with
+ * @param dictionary The dictionary
+ * @param size Size of @a dictionary
+ * @return #GNUNET_OK if added, #GNUNET_SYSERR if it is not a dictionary with
+ *         id @a id
+ */
+int
+codec_decoder_add_dictionary (struct Codec_Decoder *decoder,
+                              const struct GNUNET_PeerIdentity *publisher,
+                              uint32_t id,
+                              const void *dictionary,
+                              size_t size);
+
+
+/**
+ * Decode a message
+ *
+ * @param decoder The decoder
+ * @param publisher The publisher of the message
+ * @param data The encoded message
+ * @param size Size of @a data
+ * @param buf Where to write the message
+ * @param buf_size Size of @a buf, larger messages are rejected
+ * @param message_size Set to the size of the message
+ * @param missing Set to the id of the dictionary if it is not known yet
+ * @return #GNUNET_OK if decoded, #GNUNET_NO if the dictionary in @a missing
+ *         has to be added first, #GNUNET_SYSERR if @a data is malformed
+ */
+int
+codec_decode (struct Codec_Decoder *decoder,
+              const struct GNUNET_PeerIdentity *publisher,
+              const void *data,
+              size_t size,
+              void *buf,
+              size_t buf_size,
+              size_t *message_size,
+              uint32_t *missing);
+
+
+/**
+ * Get the counters of a decoder
+ *
+ * @param decoder The decoder
+ * @param stats Set to the counters
+ */
+void
+codec_decoder_get_stats (const struct Codec_Decoder *decoder,
+                         struct Codec_Stats *stats);
+
+
+/**
+ * Free a decoder and its dictionaries
+ *
+ * @param decoder The decoder, may be NULL
+ */
+void
+codec_decoder_destroy (struct Codec_Decoder *decoder);
+
+#endif
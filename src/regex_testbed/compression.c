@@ -0,0 +1,118 @@
+#include "compression.h"
+
+
+/**
+ * Maximum nesting of groups tracked by the profiler
+ */
+#define COMPRESSION_MAX_DEPTH 32
+
+
+/**
+ * End a run of plain characters and account for it in the profile
+ *
+ * @param profile The profile
+ * @param run Length of the run, reset to 0
+ */
+static void
+compression_end_run (struct Compression_Profile *profile, unsigned int *run)
+{
+  if (0 == *run)
+  {
+    return;
+  }
+  if ((0 == profile->shortest_literal_run)
+      || (*run < profile->shortest_literal_run))
+  {
+    profile->shortest_literal_run = *run;
+  }
+  if (*run > profile->longest_literal_run)
+  {
+    profile->longest_literal_run = *run;
+  }
+  *run = 0;
+}
+
+
+void
+compression_profile (const char *regex, struct Compression_Profile *profile)
+{
+  unsigned int alternatives[COMPRESSION_MAX_DEPTH];
+  unsigned int depth = 0;
+  unsigned int run = 0;
+  const char *c;
+
+  memset (profile, 0, sizeof (struct Compression_Profile));
+  alternatives[0] = 1;
+  for (c = regex; '\0' != *c; c++)
+  {
+    switch (*c)
+    {
+    case '(':
+      compression_end_run (profile, &run);
+      if (depth + 1 < COMPRESSION_MAX_DEPTH)
+      {
+        alternatives[++depth] = 1;
+      }
+      break;
+    case ')':
+      compression_end_run (profile, &run);
+      profile->max_alternatives = GNUNET_MAX (profile->max_alternatives,
+                                              alternatives[depth]);
+      if (0 < depth)
+      {
+        depth--;
+      }
+      break;
+    case '|':
+      compression_end_run (profile, &run);
+      alternatives[depth]++;
+      break;
+    case '*':
+    case '+':
+    case '?':
+      /* The repeated character does not belong to a fixed run */
+      if (0 < run)
+      {
+        run--;
+      }
+      compression_end_run (profile, &run);
+      profile->repetitions++;
+      break;
+    case '\\':
+      if ('\0' != c[1])
+      {
+        c++;
+      }
+      run++;
+      break;
+    default:
+      run++;
+      break;
+    }
+  }
+  compression_end_run (profile, &run);
+  profile->max_alternatives = GNUNET_MAX (profile->max_alternatives,
+                                          alternatives[0]);
+}
+
+
+uint16_t
+compression_for_regex (const char *regex)
+{
+  struct Compression_Profile profile;
+  unsigned int compression;
+
+  compression_profile (regex, &profile);
+
+  /*
+   * Every merged character multiplies the edges of a repeated state, and
+   * merging across an alternation creates one edge per combination of
+   * alternatives, so both keep the default.
+   */
+  if ((0 < profile.repetitions) || (1 < profile.max_alternatives))
+  {
+    return 1;
+  }
+  compression = profile.longest_literal_run;
+  return (uint16_t) GNUNET_MAX (1, GNUNET_MIN (COMPRESSION_MAX, compression));
+}
@@ -0,0 +1,63 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <gnunet/platform.h>
+#include <gnunet/gnunet_util_lib.h>
+
+
+/**
+ * Highest compression #compression_for_regex will pick
+ */
+#define COMPRESSION_MAX 4
+
+
+/**
+ * Structural properties of a subscription regex that decide how well it
+ * compresses into DHT states
+ */
+struct Compression_Profile {
+  /**
+   * Length of the shortest run of plain characters between two operators
+   * (alternation, grouping, repetition)
+   */
+  unsigned int shortest_literal_run;
+  /**
+   * Length of the longest run of plain characters
+   */
+  unsigned int longest_literal_run;
+  /**
+   * Largest number of alternatives in one group
+   */
+  unsigned int max_alternatives;
+  /**
+   * Number of `*`, `+` and `?` operators
+   */
+  unsigned int repetitions;
+};
+
+
+/**
+ * Analyse the structure of a regex
+ *
+ * @param regex The regex
+ * @param profile Set to the properties of @a regex
+ */
+void
+compression_profile (const char *regex, struct Compression_Profile *profile);
+
+
+/**
+ * Pick the path compression for announcing a regex.
+ *
+ * Compression merges up to that many characters into one DHT state. Long
+ * literal topic paths get fewer states and shorter searches from high values.
+ * Alternations and repetitions multiply the number of merged edges per state
+ * with every additional character, so they keep the default of 1.
+ *
+ * @param regex The regex to announce
+ * @return The compression to pass to GNUNET_REGEX_announce
+ */
+uint16_t
+compression_for_regex (const char *regex);
+
+#endif
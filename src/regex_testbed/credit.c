@@ -0,0 +1,503 @@
+#include "credit.h"
+
+
+/**
+ * A queued piece of work
+ */
+struct Credit_Item {
+  /**
+   * Kept in a DLL, oldest first
+   */
+  struct Credit_Item *prev;
+  /**
+   * Kept in a DLL, oldest first
+   */
+  struct Credit_Item *next;
+  /**
+   * Size of the work following this struct
+   */
+  size_t size;
+};
+
+
+struct Credit_Lane {
+  /**
+   * Kept in the DLL of lanes of the class waiting for credit
+   */
+  struct Credit_Lane *prev;
+  /**
+   * Kept in the DLL of lanes of the class waiting for credit
+   */
+  struct Credit_Lane *next;
+  /**
+   * The priority class of the lane
+   */
+  struct Credit_Class *klass;
+  /**
+   * The pool of the node
+   */
+  struct Credit_Pool *pool;
+  /**
+   * Oldest queued work
+   */
+  struct Credit_Item *head;
+  /**
+   * Newest queued work
+   */
+  struct Credit_Item *tail;
+  /**
+   * Starts the operation for a piece of work
+   */
+  Credit_Send_Callback send;
+  /**
+   * Closure for @e send
+   */
+  void *send_cls;
+  /**
+   * Maximum number of operations in flight
+   */
+  unsigned int credits;
+  /**
+   * Maximum number of queued pieces of work
+   */
+  unsigned int queue_length;
+  /**
+   * What to do with work submitted while out of credit
+   */
+  enum Credit_Policy policy;
+  /**
+   * #GNUNET_YES while in the waiting DLL of the class
+   */
+  int waiting;
+  /**
+   * Counters
+   */
+  struct Credit_Stats stats;
+};
+
+
+struct Credit_Class {
+  /**
+   * Kept in the DLL of classes of the pool
+   */
+  struct Credit_Class *prev;
+  /**
+   * Kept in the DLL of classes of the pool
+   */
+  struct Credit_Class *next;
+  /**
+   * The pool of the node
+   */
+  struct Credit_Pool *pool;
+  /**
+   * First lane waiting for credit, served next
+   */
+  struct Credit_Lane *waiting_head;
+  /**
+   * Last lane waiting for credit
+   */
+  struct Credit_Lane *waiting_tail;
+  /**
+   * Maximum number of operations in flight
+   */
+  unsigned int credits;
+  /**
+   * Operations currently in flight
+   */
+  unsigned int in_flight;
+  /**
+   * Pieces of work queued in the lanes of the class
+   */
+  unsigned int queued;
+  /**
+   * Queued pieces of work sent per round while draining
+   */
+  unsigned int weight;
+};
+
+
+struct Credit_Pool {
+  /**
+   * First class, served first in every round
+   */
+  struct Credit_Class *class_head;
+  /**
+   * Last class
+   */
+  struct Credit_Class *class_tail;
+  /**
+   * Maximum number of operations in flight
+   */
+  unsigned int credits;
+  /**
+   * Operations currently in flight
+   */
+  unsigned int in_flight;
+  /**
+   * #GNUNET_YES while queued work is being sent
+   */
+  int draining;
+};
+
+
+int
+credit_policy_from_string (const char *name, enum Credit_Policy *policy)
+{
+  if (0 == strcasecmp (name, "TRY"))
+  {
+    *policy = CREDIT_POLICY_TRY;
+  }
+  else if (0 == strcasecmp (name, "QUEUE"))
+  {
+    *policy = CREDIT_POLICY_QUEUE;
+  }
+  else if (0 == strcasecmp (name, "DROP_OLDEST"))
+  {
+    *policy = CREDIT_POLICY_DROP_OLDEST;
+  }
+  else
+  {
+    return GNUNET_SYSERR;
+  }
+  return GNUNET_OK;
+}
+
+
+struct Credit_Pool *
+credit_pool_create (unsigned int credits)
+{
+  struct Credit_Pool *pool;
+
+  pool = GNUNET_new (struct Credit_Pool);
+  pool->credits = GNUNET_MAX (1, credits);
+  return pool;
+}
+
+
+void
+credit_pool_destroy (struct Credit_Pool *pool)
+{
+  struct Credit_Class *klass;
+
+  if (NULL == pool)
+  {
+    return;
+  }
+  while (NULL != (klass = pool->class_head))
+  {
+    GNUNET_assert (NULL == klass->waiting_head);
+    GNUNET_CONTAINER_DLL_remove (pool->class_head, pool->class_tail, klass);
+    GNUNET_free (klass);
+  }
+  GNUNET_free (pool);
+}
+
+
+struct Credit_Class *
+credit_class_create (struct Credit_Pool *pool,
+                     unsigned int credits,
+                     unsigned int weight)
+{
+  struct Credit_Class *klass;
+
+  klass = GNUNET_new (struct Credit_Class);
+  klass->pool = pool;
+  klass->credits = GNUNET_MAX (1, credits);
+  klass->weight = GNUNET_MAX (1, weight);
+  GNUNET_CONTAINER_DLL_insert_tail (pool->class_head, pool->class_tail, klass);
+  return klass;
+}
+
+
+struct Credit_Lane *
+credit_lane_create (struct Credit_Class *klass,
+                    unsigned int credits,
+                    enum Credit_Policy policy,
+                    unsigned int queue_length,
+                    Credit_Send_Callback send,
+                    void *send_cls)
+{
+  struct Credit_Lane *lane;
+
+  lane = GNUNET_new (struct Credit_Lane);
+  lane->klass = klass;
+  lane->pool = klass->pool;
+  lane->credits = GNUNET_MAX (1, credits);
+  lane->policy = policy;
+  lane->queue_length = queue_length;
+  lane->send = send;
+  lane->send_cls = send_cls;
+  return lane;
+}
+
+
+/**
+ * Remove the oldest queued work of a lane
+ *
+ * @param lane The lane
+ */
+static void
+credit_lane_drop_head (struct Credit_Lane *lane)
+{
+  struct Credit_Item *item = lane->head;
+
+  GNUNET_CONTAINER_DLL_remove (lane->head, lane->tail, item);
+  lane->stats.queued--;
+  lane->klass->queued--;
+  GNUNET_free (item);
+  if ((NULL == lane->head) && (GNUNET_YES == lane->waiting))
+  {
+    GNUNET_CONTAINER_DLL_remove (lane->klass->waiting_head,
+                                 lane->klass->waiting_tail,
+                                 lane);
+    lane->waiting = GNUNET_NO;
+  }
+}
+
+
+void
+credit_lane_destroy (struct Credit_Lane *lane)
+{
+  if (NULL == lane)
+  {
+    return;
+  }
+  while (NULL != lane->head)
+  {
+    credit_lane_drop_head (lane);
+  }
+  lane->klass->in_flight -= lane->stats.in_flight;
+  lane->pool->in_flight -= lane->stats.in_flight;
+  GNUNET_free (lane);
+}
+
+
+/**
+ * Check whether both a class and its pool have credit left
+ *
+ * @param klass The class
+ * @return #GNUNET_YES if an operation can be started
+ */
+static int
+credit_class_has_credit (const struct Credit_Class *klass)
+{
+  return ((klass->in_flight < klass->credits)
+          && (klass->pool->in_flight < klass->pool->credits)) ? GNUNET_YES : GNUNET_NO;
+}
+
+
+/**
+ * Check whether the lane, its class and its pool have credit left
+ *
+ * @param lane The lane
+ * @return #GNUNET_YES if an operation can be started
+ */
+static int
+credit_lane_has_credit (const struct Credit_Lane *lane)
+{
+  return ((lane->stats.in_flight < lane->credits)
+          && (GNUNET_YES == credit_class_has_credit (lane->klass))) ? GNUNET_YES : GNUNET_NO;
+}
+
+
+/**
+ * Take a credit and start an operation, returning the credit if it fails
+ *
+ * @param lane The lane
+ * @param data The work
+ * @param size Size of @a data
+ * @return #GNUNET_OK if the operation was started
+ */
+static int
+credit_lane_send (struct Credit_Lane *lane, const void *data, size_t size)
+{
+  lane->stats.in_flight++;
+  lane->klass->in_flight++;
+  lane->pool->in_flight++;
+  if (GNUNET_OK != lane->send (lane->send_cls, data, size))
+  {
+    lane->stats.in_flight--;
+    lane->klass->in_flight--;
+    lane->pool->in_flight--;
+    return GNUNET_SYSERR;
+  }
+  lane->stats.sent++;
+  return GNUNET_OK;
+}
+
+
+unsigned int
+credit_lane_available (const struct Credit_Lane *lane)
+{
+  unsigned int available;
+
+  if (NULL != lane->head)
+  {
+    return 0;
+  }
+  available = lane->credits - GNUNET_MIN (lane->credits, lane->stats.in_flight);
+  available = GNUNET_MIN (available,
+                          lane->klass->credits - GNUNET_MIN (lane->klass->credits,
+                                                             lane->klass->in_flight));
+  return GNUNET_MIN (available,
+                     lane->pool->credits - GNUNET_MIN (lane->pool->credits,
+                                                       lane->pool->in_flight));
+}
+
+
+enum Credit_Result
+credit_lane_submit (struct Credit_Lane *lane, const void *data, size_t size)
+{
+  struct Credit_Item *item;
+
+  // Queued work goes first, so only send directly if nothing is waiting
+  if ((NULL == lane->head) && (GNUNET_YES == credit_lane_has_credit (lane)))
+  {
+    return (GNUNET_OK == credit_lane_send (lane, data, size))
+        ? CREDIT_SENT : CREDIT_FAILED;
+  }
+  if ((CREDIT_POLICY_TRY == lane->policy) || (0 == lane->queue_length))
+  {
+    lane->stats.rejected++;
+    return CREDIT_REJECTED;
+  }
+  if (lane->stats.queued >= lane->queue_length)
+  {
+    if (CREDIT_POLICY_QUEUE == lane->policy)
+    {
+      lane->stats.rejected++;
+      return CREDIT_REJECTED;
+    }
+    credit_lane_drop_head (lane);
+    lane->stats.dropped++;
+  }
+
+  item = GNUNET_malloc (sizeof (struct Credit_Item) + size);
+  item->size = size;
+  memcpy (&item[1], data, size);
+  GNUNET_CONTAINER_DLL_insert_tail (lane->head, lane->tail, item);
+  lane->stats.queued++;
+  lane->klass->queued++;
+  if (GNUNET_NO == lane->waiting)
+  {
+    GNUNET_CONTAINER_DLL_insert_tail (lane->klass->waiting_head,
+                                      lane->klass->waiting_tail,
+                                      lane);
+    lane->waiting = GNUNET_YES;
+  }
+  return CREDIT_QUEUED;
+}
+
+
+/**
+ * Send queued work of the waiting lanes of a class, one piece per lane in
+ * turn so a busy topic does not starve the others of its class. A lane that
+ * sent goes to the back, so the next round starts with the lane after it.
+ *
+ * @param klass The class
+ * @param quota Maximum number of pieces to send
+ * @return Number of pieces sent
+ */
+static unsigned int
+credit_class_drain (struct Credit_Class *klass, unsigned int quota)
+{
+  struct Credit_Lane *lane;
+  struct Credit_Lane *next;
+  struct Credit_Item *item;
+  unsigned int sent = 0;
+
+  for (lane = klass->waiting_head; NULL != lane; lane = next)
+  {
+    next = lane->next;
+    if ((sent == quota) || (GNUNET_YES != credit_class_has_credit (klass)))
+    {
+      break;
+    }
+    if (GNUNET_YES != credit_lane_has_credit (lane))
+    {
+      continue;
+    }
+    item = lane->head;
+    GNUNET_CONTAINER_DLL_remove (lane->head, lane->tail, item);
+    lane->stats.queued--;
+    klass->queued--;
+    GNUNET_CONTAINER_DLL_remove (klass->waiting_head, klass->waiting_tail, lane);
+    if (NULL == lane->head)
+    {
+      lane->waiting = GNUNET_NO;
+    }
+    else
+    {
+      GNUNET_CONTAINER_DLL_insert_tail (klass->waiting_head,
+                                        klass->waiting_tail,
+                                        lane);
+      if (NULL == next)
+      {
+        next = lane;
+      }
+    }
+    credit_lane_send (lane, &item[1], item->size);
+    GNUNET_free (item);
+    sent++;
+  }
+  return sent;
+}
+
+
+/**
+ * Send queued work of the waiting lanes of a pool while there is credit.
+ * Every round each class sends up to its weight, so a class of small urgent
+ * messages gets its share even while bulk classes have long queues.
+ *
+ * @param pool The pool
+ */
+static void
+credit_pool_drain (struct Credit_Pool *pool)
+{
+  struct Credit_Class *klass;
+  int progress = GNUNET_YES;
+
+  if (GNUNET_YES == pool->draining)
+  {
+    return;
+  }
+  pool->draining = GNUNET_YES;
+  while ((GNUNET_YES == progress) && (pool->in_flight < pool->credits))
+  {
+    progress = GNUNET_NO;
+    for (klass = pool->class_head; NULL != klass; klass = klass->next)
+    {
+      if (0 < credit_class_drain (klass, klass->weight))
+      {
+        progress = GNUNET_YES;
+      }
+    }
+  }
+  pool->draining = GNUNET_NO;
+}
+
+
+void
+credit_lane_release (struct Credit_Lane *lane)
+{
+  GNUNET_assert (0 < lane->stats.in_flight);
+  lane->stats.in_flight--;
+  lane->klass->in_flight--;
+  lane->pool->in_flight--;
+  credit_pool_drain (lane->pool);
+}
+
+
+unsigned int
+credit_class_queued (const struct Credit_Class *klass)
+{
+  return klass->queued;
+}
+
+
+void
+credit_lane_get_stats (const struct Credit_Lane *lane,
+                       struct Credit_Stats *stats)
+{
+  *stats = lane->stats;
+}
@@ -0,0 +1,248 @@
+#ifndef CREDIT_H
+#define CREDIT_H
+
+#include <gnunet/platform.h>
+#include <gnunet/gnunet_util_lib.h>
+
+
+/**
+ * Credit based flow control for DHT operations.
+ *
+ * A pool holds the in-flight budget of a node, a lane the budget of one topic
+ * within the pool. Starting an operation takes one credit from both, its
+ * completion returns them with #credit_lane_release. Work submitted without
+ * credit is handled according to the policy of the lane, so overload shows up
+ * as rejected or dropped work instead of piling up operations that time out.
+ *
+ * Lanes belong to a priority class, which has an in-flight budget of its own
+ * within the pool and a weight. Queued work is sent as soon as credit is
+ * returned: every round each class sends up to its weight in queued work,
+ * lanes within a class are served round robin.
+ */
+struct Credit_Pool;
+
+
+/**
+ * A priority class of lanes
+ */
+struct Credit_Class;
+
+
+/**
+ * The budget and queue of one topic
+ */
+struct Credit_Lane;
+
+
+/**
+ * What to do with work submitted while out of credit
+ */
+enum Credit_Policy {
+  /**
+   * Reject it, the caller decides what to do
+   */
+  CREDIT_POLICY_TRY,
+  /**
+   * Queue it, reject it if the queue is full
+   */
+  CREDIT_POLICY_QUEUE,
+  /**
+   * Queue it, drop the oldest queued work if the queue is full
+   */
+  CREDIT_POLICY_DROP_OLDEST
+};
+
+
+/**
+ * Outcome of #credit_lane_submit
+ */
+enum Credit_Result {
+  /**
+   * The work was sent
+   */
+  CREDIT_SENT,
+  /**
+   * The work was queued until credit is available
+   */
+  CREDIT_QUEUED,
+  /**
+   * The work was rejected for lack of credit or queue space
+   */
+  CREDIT_REJECTED,
+  /**
+   * Sending the work failed
+   */
+  CREDIT_FAILED
+};
+
+
+/**
+ * Counters of one lane
+ */
+struct Credit_Stats {
+  /**
+   * Operations currently in flight
+   */
+  unsigned int in_flight;
+  /**
+   * Work currently queued
+   */
+  unsigned int queued;
+  /**
+   * Total work sent
+   */
+  unsigned long long sent;
+  /**
+   * Total work rejected
+   */
+  unsigned long long rejected;
+  /**
+   * Total queued work dropped to make room for newer work
+   */
+  unsigned long long dropped;
+};
+
+
+/**
+ * Start the operation for a piece of work
+ *
+ * @param cls Closure
+ * @param data The work as submitted
+ * @param size Size of @a data
+ * @return #GNUNET_OK if the operation was started and will be released with
+ *         #credit_lane_release, #GNUNET_SYSERR otherwise
+ */
+typedef int
+(*Credit_Send_Callback) (void *cls, const void *data, size_t size);
+
+
+/**
+ * Parse the name of a policy
+ *
+ * @param name One of `TRY`, `QUEUE` or `DROP_OLDEST`
+ * @param policy Set to the policy
+ * @return #GNUNET_OK if @a name is known
+ */
+int
+credit_policy_from_string (const char *name, enum Credit_Policy *policy);
+
+
+/**
+ * Create the budget of a node
+ *
+ * @param credits Maximum number of operations in flight on the node
+ * @return The new pool
+ */
+struct Credit_Pool *
+credit_pool_create (unsigned int credits);
+
+
+/**
+ * Free a pool and its classes. All lanes have to be destroyed before.
+ *
+ * @param pool The pool, may be NULL
+ */
+void
+credit_pool_destroy (struct Credit_Pool *pool);
+
+
+/**
+ * Add a priority class to a pool. Classes are freed with the pool.
+ *
+ * @param pool The pool
+ * @param credits Maximum number of operations the lanes of the class may have
+ *        in flight together
+ * @param weight Queued pieces of work the class sends per round while
+ *        draining, relative to the weights of the other classes
+ * @return The new class
+ */
+struct Credit_Class *
+credit_class_create (struct Credit_Pool *pool,
+                     unsigned int credits,
+                     unsigned int weight);
+
+
+/**
+ * Get the number of pieces of work queued in the lanes of a class
+ *
+ * @param klass The class
+ * @return Queued pieces of work
+ */
+unsigned int
+credit_class_queued (const struct Credit_Class *klass);
+
+
+/**
+ * Create the budget of a topic
+ *
+ * @param klass The priority class of the topic
+ * @param credits Maximum number of operations in flight for the topic
+ * @param policy What to do with work submitted while out of credit
+ * @param queue_length Maximum number of queued pieces of work
+ * @param send Starts the operation for a piece of work
+ * @param send_cls Closure for @a send
+ * @return The new lane
+ */
+struct Credit_Lane *
+credit_lane_create (struct Credit_Class *klass,
+                    unsigned int credits,
+                    enum Credit_Policy policy,
+                    unsigned int queue_length,
+                    Credit_Send_Callback send,
+                    void *send_cls);
+
+
+/**
+ * Free a lane and its queue. Credit of operations still in flight is
+ * returned to the class and pool, their completion must not be released
+ * anymore.
+ *
+ * @param lane The lane, may be NULL
+ */
+void
+credit_lane_destroy (struct Credit_Lane *lane);
+
+
+/**
+ * Get the number of operations that can be sent right away
+ *
+ * @param lane The lane
+ * @return The credit available to the lane within its class and pool, 0 while
+ *         work is queued
+ */
+unsigned int
+credit_lane_available (const struct Credit_Lane *lane);
+
+
+/**
+ * Send a piece of work if there is credit, otherwise apply the policy
+ *
+ * @param lane The lane
+ * @param data The work, copied if queued
+ * @param size Size of @a data
+ * @return What happened to the work
+ */
+enum Credit_Result
+credit_lane_submit (struct Credit_Lane *lane, const void *data, size_t size);
+
+
+/**
+ * Return the credit of a completed operation and send queued work
+ *
+ * @param lane The lane the operation was sent on
+ */
+void
+credit_lane_release (struct Credit_Lane *lane);
+
+
+/**
+ * Get the counters of a lane
+ *
+ * @param lane The lane
+ * @param stats Set to the counters
+ */
+void
+credit_lane_get_stats (const struct Credit_Lane *lane,
+                       struct Credit_Stats *stats);
+
+#endif
@@ -0,0 +1,972 @@
+#include <limits.h>
+#include "matcher.h"
+
+
+/**
+ * Maximum number of cached DFA states before the cache is dropped
+ */
+#define MATCHER_MAX_DFA_STATES 1024
+/**
+ * Marks an unset NFA transition
+ */
+#define MATCHER_NO_STATE UINT_MAX
+
+
+/**
+ * Kinds of NFA states
+ */
+enum Matcher_Nfa_Type {
+  /**
+   * Consumes one character out of a set
+   */
+  MATCHER_NFA_CHARSET,
+  /**
+   * Moves on to up to two states without consuming anything
+   */
+  MATCHER_NFA_EPSILON,
+  /**
+   * The topic matches a subscription
+   */
+  MATCHER_NFA_MATCH
+};
+
+
+/**
+ * A state of the combined NFA
+ */
+struct Matcher_Nfa_State {
+  /**
+   * Kind of the state
+   */
+  enum Matcher_Nfa_Type type;
+  /**
+   * First successor
+   */
+  unsigned int out1;
+  /**
+   * Second successor, epsilon states only
+   */
+  unsigned int out2;
+  /**
+   * Index of the subscription, match states only
+   */
+  unsigned int subscription;
+  /**
+   * Bitmap of accepted characters, charset states only
+   */
+  uint32_t charset[256 / 32];
+};
+
+
+/**
+ * A state of the lazily built DFA: a set of NFA states
+ */
+struct Matcher_Dfa_State {
+  /**
+   * All DFA states, for freeing
+   */
+  struct Matcher_Dfa_State *next_state;
+  /**
+   * Sorted charset and match NFA states this DFA state consists of
+   */
+  unsigned int *nfa_states;
+  /**
+   * Length of nfa_states
+   */
+  unsigned int num_nfa_states;
+  /**
+   * Successor for every input character, NULL if not computed yet
+   */
+  struct Matcher_Dfa_State *transitions[256];
+};
+
+
+struct Matcher_Subscription {
+  /**
+   * The regex of the subscription
+   */
+  char *regex;
+  /**
+   * Passed to the match callback
+   */
+  void *cls;
+  /**
+   * Index in the subscription array of the matcher
+   */
+  unsigned int index;
+  /**
+   * First NFA state of the compiled regex
+   */
+  unsigned int nfa_start;
+  /**
+   * Number of NFA states of the compiled regex
+   */
+  unsigned int nfa_size;
+};
+
+
+struct Matcher {
+  /**
+   * The combined NFA
+   */
+  struct Matcher_Nfa_State *nfa;
+  /**
+   * Number of NFA states in use
+   */
+  unsigned int nfa_size;
+  /**
+   * Allocated length of nfa
+   */
+  unsigned int nfa_allocated;
+  /**
+   * NFA states of removed subscriptions that are still in nfa
+   */
+  unsigned int nfa_garbage;
+  /**
+   * All subscriptions, NULL for removed ones
+   */
+  struct Matcher_Subscription **subscriptions;
+  /**
+   * Length of subscriptions
+   */
+  unsigned int num_subscriptions;
+  /**
+   * Number of subscriptions that are not NULL
+   */
+  unsigned int live_subscriptions;
+  /**
+   * The cached DFA states, keyed by the hash of their NFA state set
+   */
+  struct GNUNET_CONTAINER_MultiHashMap *dfa;
+  /**
+   * All cached DFA states
+   */
+  struct Matcher_Dfa_State *dfa_head;
+  /**
+   * DFA state for the empty topic, NULL if not computed yet
+   */
+  struct Matcher_Dfa_State *dfa_start;
+  /**
+   * Number of cached DFA states
+   */
+  unsigned int dfa_size;
+  /**
+   * Work space for closure computation, one mark per NFA state
+   */
+  unsigned int *marks;
+  /**
+   * Work space for state sets and the closure stack, two entries per NFA state
+   */
+  unsigned int *work;
+  /**
+   * Number of NFA states the work space is sized for
+   */
+  unsigned int work_size;
+  /**
+   * Current mark generation
+   */
+  unsigned int generation;
+};
+
+
+/**
+ * A piece of NFA under construction with one dangling end
+ */
+struct Matcher_Fragment {
+  /**
+   * Entry state
+   */
+  unsigned int start;
+  /**
+   * Epsilon state whose out1 is not connected yet
+   */
+  unsigned int end;
+};
+
+
+/**
+ * State of the regex parser
+ */
+struct Matcher_Parser {
+  /**
+   * The matcher the NFA is built in
+   */
+  struct Matcher *matcher;
+  /**
+   * Next character to parse
+   */
+  const char *pos;
+};
+
+
+static int
+matcher_parse_alternation (struct Matcher_Parser *p,
+                           struct Matcher_Fragment *frag);
+
+
+/**
+ * Append a new NFA state
+ *
+ * @param matcher The matcher
+ * @param type Kind of the state
+ * @return Index of the state
+ */
+static unsigned int
+matcher_nfa_add (struct Matcher *matcher, enum Matcher_Nfa_Type type)
+{
+  struct Matcher_Nfa_State *state;
+
+  if (matcher->nfa_size == matcher->nfa_allocated)
+  {
+    GNUNET_array_grow (matcher->nfa,
+                       matcher->nfa_allocated,
+                       GNUNET_MAX (64, 2 * matcher->nfa_allocated));
+  }
+  state = &matcher->nfa[matcher->nfa_size];
+  memset (state, 0, sizeof (struct Matcher_Nfa_State));
+  state->type = type;
+  state->out1 = MATCHER_NO_STATE;
+  state->out2 = MATCHER_NO_STATE;
+  return matcher->nfa_size++;
+}
+
+
+/**
+ * Build a fragment consuming one character out of a set
+ *
+ * @param matcher The matcher
+ * @param charset The accepted characters
+ * @param frag Set to the new fragment
+ */
+static void
+matcher_fragment_charset (struct Matcher *matcher,
+                          const uint32_t charset[256 / 32],
+                          struct Matcher_Fragment *frag)
+{
+  unsigned int cs = matcher_nfa_add (matcher, MATCHER_NFA_CHARSET);
+  unsigned int end = matcher_nfa_add (matcher, MATCHER_NFA_EPSILON);
+
+  memcpy (matcher->nfa[cs].charset, charset, sizeof (matcher->nfa[cs].charset));
+  matcher->nfa[cs].out1 = end;
+  frag->start = cs;
+  frag->end = end;
+}
+
+
+/**
+ * Build a fragment that matches the empty string
+ *
+ * @param matcher The matcher
+ * @param frag Set to the new fragment
+ */
+static void
+matcher_fragment_empty (struct Matcher *matcher, struct Matcher_Fragment *frag)
+{
+  frag->start = matcher_nfa_add (matcher, MATCHER_NFA_EPSILON);
+  frag->end = frag->start;
+}
+
+
+/**
+ * Parse a bracket expression, the opening bracket is already consumed
+ *
+ * @param p The parser
+ * @param charset Set to the characters of the expression
+ * @return #GNUNET_OK on success
+ */
+static int
+matcher_parse_bracket (struct Matcher_Parser *p, uint32_t charset[256 / 32])
+{
+  int negate = GNUNET_NO;
+  int first = GNUNET_YES;
+  unsigned int from;
+  unsigned int to;
+  unsigned int c;
+
+  memset (charset, 0, 256 / 8);
+  if ('^' == *p->pos)
+  {
+    negate = GNUNET_YES;
+    p->pos++;
+  }
+  while ((']' != *p->pos) || (GNUNET_YES == first))
+  {
+    first = GNUNET_NO;
+    if ('\0' == *p->pos)
+    {
+      return GNUNET_SYSERR;
+    }
+    if (('\\' == *p->pos) && ('\0' != p->pos[1]))
+    {
+      p->pos++;
+    }
+    from = (unsigned char) *p->pos++;
+    to = from;
+    if (('-' == p->pos[0]) && ('\0' != p->pos[1]) && (']' != p->pos[1]))
+    {
+      p->pos++;
+      if (('\\' == *p->pos) && ('\0' != p->pos[1]))
+      {
+        p->pos++;
+      }
+      to = (unsigned char) *p->pos++;
+      if (to < from)
+      {
+        return GNUNET_SYSERR;
+      }
+    }
+    for (c = from; c <= to; c++)
+    {
+      charset[c / 32] |= 1U << (c % 32);
+    }
+  }
+  p->pos++;
+
+  if (GNUNET_YES == negate)
+  {
+    for (c = 0; c < 256 / 32; c++)
+    {
+      charset[c] = ~charset[c];
+    }
+    charset[0] &= ~1U;
+  }
+  return GNUNET_OK;
+}
+
+
+/**
+ * Parse a single atom: a character, a bracket expression or a group
+ *
+ * @param p The parser
+ * @param frag Set to the fragment of the atom
+ * @return #GNUNET_OK on success
+ */
+static int
+matcher_parse_atom (struct Matcher_Parser *p, struct Matcher_Fragment *frag)
+{
+  uint32_t charset[256 / 32];
+  unsigned int c;
+
+  memset (charset, 0, sizeof (charset));
+  switch (*p->pos)
+  {
+  case '(':
+    p->pos++;
+    if (GNUNET_OK != matcher_parse_alternation (p, frag))
+    {
+      return GNUNET_SYSERR;
+    }
+    if (')' != *p->pos)
+    {
+      return GNUNET_SYSERR;
+    }
+    p->pos++;
+    return GNUNET_OK;
+  case '[':
+    p->pos++;
+    if (GNUNET_OK != matcher_parse_bracket (p, charset))
+    {
+      return GNUNET_SYSERR;
+    }
+    break;
+  case '.':
+    p->pos++;
+    for (c = 1; c < 256; c++)
+    {
+      charset[c / 32] |= 1U << (c % 32);
+    }
+    break;
+  case '\\':
+    p->pos++;
+    if ('\0' == *p->pos)
+    {
+      return GNUNET_SYSERR;
+    }
+    /* fall through */
+  default:
+    c = (unsigned char) *p->pos++;
+    charset[c / 32] |= 1U << (c % 32);
+    break;
+  }
+  matcher_fragment_charset (p->matcher, charset, frag);
+  return GNUNET_OK;
+}
+
+
+/**
+ * Parse an atom followed by any number of `*`, `+` and `?`
+ *
+ * @param p The parser
+ * @param frag Set to the fragment
+ * @return #GNUNET_OK on success
+ */
+static int
+matcher_parse_repetition (struct Matcher_Parser *p,
+                          struct Matcher_Fragment *frag)
+{
+  struct Matcher *m = p->matcher;
+  unsigned int split;
+  unsigned int end;
+
+  if (GNUNET_OK != matcher_parse_atom (p, frag))
+  {
+    return GNUNET_SYSERR;
+  }
+  while (('*' == *p->pos) || ('+' == *p->pos) || ('?' == *p->pos))
+  {
+    split = matcher_nfa_add (m, MATCHER_NFA_EPSILON);
+    end = matcher_nfa_add (m, MATCHER_NFA_EPSILON);
+    m->nfa[split].out1 = frag->start;
+    m->nfa[split].out2 = end;
+    switch (*p->pos)
+    {
+    case '*':
+      m->nfa[frag->end].out1 = split;
+      frag->start = split;
+      break;
+    case '+':
+      m->nfa[frag->end].out1 = split;
+      break;
+    case '?':
+      m->nfa[frag->end].out1 = end;
+      frag->start = split;
+      break;
+    }
+    frag->end = end;
+    p->pos++;
+  }
+  return GNUNET_OK;
+}
+
+
+/**
+ * Parse a sequence of repetitions, which may be empty
+ *
+ * @param p The parser
+ * @param frag Set to the fragment
+ * @return #GNUNET_OK on success
+ */
+static int
+matcher_parse_concatenation (struct Matcher_Parser *p,
+                             struct Matcher_Fragment *frag)
+{
+  struct Matcher_Fragment next;
+
+  matcher_fragment_empty (p->matcher, frag);
+  while (('\0' != *p->pos) && ('|' != *p->pos) && (')' != *p->pos))
+  {
+    if (('*' == *p->pos) || ('+' == *p->pos) || ('?' == *p->pos))
+    {
+      return GNUNET_SYSERR;
+    }
+    if (GNUNET_OK != matcher_parse_repetition (p, &next))
+    {
+      return GNUNET_SYSERR;
+    }
+    p->matcher->nfa[frag->end].out1 = next.start;
+    frag->end = next.end;
+  }
+  return GNUNET_OK;
+}
+
+
+/**
+ * Parse concatenations separated by `|`
+ *
+ * @param p The parser
+ * @param frag Set to the fragment
+ * @return #GNUNET_OK on success
+ */
+static int
+matcher_parse_alternation (struct Matcher_Parser *p,
+                           struct Matcher_Fragment *frag)
+{
+  struct Matcher *m = p->matcher;
+  struct Matcher_Fragment next;
+  unsigned int split;
+  unsigned int end;
+
+  if (GNUNET_OK != matcher_parse_concatenation (p, frag))
+  {
+    return GNUNET_SYSERR;
+  }
+  while ('|' == *p->pos)
+  {
+    p->pos++;
+    if (GNUNET_OK != matcher_parse_concatenation (p, &next))
+    {
+      return GNUNET_SYSERR;
+    }
+    split = matcher_nfa_add (m, MATCHER_NFA_EPSILON);
+    end = matcher_nfa_add (m, MATCHER_NFA_EPSILON);
+    m->nfa[split].out1 = frag->start;
+    m->nfa[split].out2 = next.start;
+    m->nfa[frag->end].out1 = end;
+    m->nfa[next.end].out1 = end;
+    frag->start = split;
+    frag->end = end;
+  }
+  return GNUNET_OK;
+}
+
+
+/**
+ * Compile the regex of a subscription and append it to the NFA
+ *
+ * @param matcher The matcher
+ * @param sub The subscription
+ * @return #GNUNET_OK on success, the NFA is unchanged on error
+ */
+static int
+matcher_compile (struct Matcher *matcher, struct Matcher_Subscription *sub)
+{
+  struct Matcher_Parser p;
+  struct Matcher_Fragment frag;
+  unsigned int match;
+  unsigned int old_size = matcher->nfa_size;
+
+  p.matcher = matcher;
+  p.pos = sub->regex;
+  if ((GNUNET_OK != matcher_parse_alternation (&p, &frag))
+      || ('\0' != *p.pos))
+  {
+    matcher->nfa_size = old_size;
+    return GNUNET_SYSERR;
+  }
+  match = matcher_nfa_add (matcher, MATCHER_NFA_MATCH);
+  matcher->nfa[match].subscription = sub->index;
+  matcher->nfa[frag.end].out1 = match;
+  sub->nfa_start = frag.start;
+  sub->nfa_size = matcher->nfa_size - old_size;
+  return GNUNET_OK;
+}
+
+
+/**
+ * Drop all cached DFA states
+ *
+ * @param matcher The matcher
+ */
+static void
+matcher_dfa_flush (struct Matcher *matcher)
+{
+  struct Matcher_Dfa_State *state;
+
+  while (NULL != (state = matcher->dfa_head))
+  {
+    matcher->dfa_head = state->next_state;
+    GNUNET_free_non_null (state->nfa_states);
+    GNUNET_free (state);
+  }
+  if (NULL != matcher->dfa)
+  {
+    GNUNET_CONTAINER_multihashmap_destroy (matcher->dfa);
+  }
+  matcher->dfa = GNUNET_CONTAINER_multihashmap_create (64, GNUNET_NO);
+  matcher->dfa_start = NULL;
+  matcher->dfa_size = 0;
+}
+
+
+/**
+ * Recompile the NFA from the live subscriptions only, dropping the states of
+ * removed ones
+ *
+ * @param matcher The matcher
+ */
+static void
+matcher_compact (struct Matcher *matcher)
+{
+  unsigned int i;
+
+  matcher->nfa_size = 0;
+  matcher->nfa_garbage = 0;
+  for (i = 0; i < matcher->num_subscriptions; i++)
+  {
+    if (NULL != matcher->subscriptions[i])
+    {
+      GNUNET_assert (GNUNET_OK == matcher_compile (matcher, matcher->subscriptions[i]));
+    }
+  }
+}
+
+
+/**
+ * Add an NFA state and everything reachable from it without consuming input
+ * to a set
+ *
+ * @param matcher The matcher
+ * @param start The state to start from
+ * @param set Array with room for all NFA states
+ * @param set_size Number of states in @a set, updated
+ * @param stack Work space with room for all NFA states
+ */
+static void
+matcher_closure (struct Matcher *matcher,
+                 unsigned int start,
+                 unsigned int *set,
+                 unsigned int *set_size,
+                 unsigned int *stack)
+{
+  struct Matcher_Nfa_State *state;
+  unsigned int stack_size = 0;
+  unsigned int s;
+
+  if ((MATCHER_NO_STATE == start)
+      || (matcher->generation == matcher->marks[start]))
+  {
+    return;
+  }
+  matcher->marks[start] = matcher->generation;
+  stack[stack_size++] = start;
+  while (0 < stack_size)
+  {
+    s = stack[--stack_size];
+    state = &matcher->nfa[s];
+    if (MATCHER_NFA_EPSILON != state->type)
+    {
+      set[(*set_size)++] = s;
+      continue;
+    }
+    if ((MATCHER_NO_STATE != state->out1)
+        && (matcher->generation != matcher->marks[state->out1]))
+    {
+      matcher->marks[state->out1] = matcher->generation;
+      stack[stack_size++] = state->out1;
+    }
+    if ((MATCHER_NO_STATE != state->out2)
+        && (matcher->generation != matcher->marks[state->out2]))
+    {
+      matcher->marks[state->out2] = matcher->generation;
+      stack[stack_size++] = state->out2;
+    }
+  }
+}
+
+
+/**
+ * Make sure the work space covers all NFA states
+ *
+ * @param matcher The matcher
+ */
+static void
+matcher_workspace_ensure (struct Matcher *matcher)
+{
+  if (matcher->work_size >= matcher->nfa_size)
+  {
+    return;
+  }
+  GNUNET_free_non_null (matcher->work);
+  GNUNET_free_non_null (matcher->marks);
+  matcher->work_size = matcher->nfa_allocated;
+  matcher->work = GNUNET_new_array (2 * matcher->work_size, unsigned int);
+  matcher->marks = GNUNET_new_array (matcher->work_size, unsigned int);
+  matcher->generation = 0;
+}
+
+
+/**
+ * Start a new closure computation
+ *
+ * @param matcher The matcher
+ */
+static void
+matcher_closure_begin (struct Matcher *matcher)
+{
+  if (0 == ++matcher->generation)
+  {
+    memset (matcher->marks, 0, matcher->nfa_size * sizeof (unsigned int));
+    matcher->generation = 1;
+  }
+}
+
+
+/**
+ * Comparison for sorting NFA state sets
+ */
+static int
+matcher_cmp_uint (const void *a, const void *b)
+{
+  unsigned int x = *(const unsigned int *) a;
+  unsigned int y = *(const unsigned int *) b;
+
+  return (x < y) ? -1 : (x > y);
+}
+
+
+/**
+ * Look up the DFA state of an NFA state set, creating it if needed
+ *
+ * @param matcher The matcher
+ * @param set The NFA state set, will be sorted
+ * @param set_size Number of states in @a set
+ * @return The DFA state
+ */
+static struct Matcher_Dfa_State *
+matcher_dfa_state (struct Matcher *matcher,
+                   unsigned int *set,
+                   unsigned int set_size)
+{
+  struct Matcher_Dfa_State *state;
+  struct GNUNET_HashCode key;
+
+  qsort (set, set_size, sizeof (unsigned int), &matcher_cmp_uint);
+  GNUNET_CRYPTO_hash (set, set_size * sizeof (unsigned int), &key);
+  state = GNUNET_CONTAINER_multihashmap_get (matcher->dfa, &key);
+  if (NULL != state)
+  {
+    return state;
+  }
+
+  state = GNUNET_new (struct Matcher_Dfa_State);
+  state->num_nfa_states = set_size;
+  if (0 != set_size)
+  {
+    state->nfa_states = GNUNET_new_array (set_size, unsigned int);
+    memcpy (state->nfa_states, set, set_size * sizeof (unsigned int));
+  }
+  state->next_state = matcher->dfa_head;
+  matcher->dfa_head = state;
+  matcher->dfa_size++;
+  GNUNET_CONTAINER_multihashmap_put (matcher->dfa,
+                                     &key,
+                                     state,
+                                     GNUNET_CONTAINER_MULTIHASHMAPOPTION_UNIQUE_FAST);
+  return state;
+}
+
+
+/**
+ * Compute the DFA state the matcher starts in
+ *
+ * @param matcher The matcher
+ * @param set Work space with room for all NFA states
+ * @param stack Work space with room for all NFA states
+ * @return The start state
+ */
+static struct Matcher_Dfa_State *
+matcher_dfa_start (struct Matcher *matcher,
+                   unsigned int *set,
+                   unsigned int *stack)
+{
+  unsigned int set_size = 0;
+  unsigned int i;
+
+  matcher_closure_begin (matcher);
+  for (i = 0; i < matcher->num_subscriptions; i++)
+  {
+    if (NULL != matcher->subscriptions[i])
+    {
+      matcher_closure (matcher,
+                       matcher->subscriptions[i]->nfa_start,
+                       set,
+                       &set_size,
+                       stack);
+    }
+  }
+  return matcher_dfa_state (matcher, set, set_size);
+}
+
+
+/**
+ * Compute the successor of a DFA state for one character
+ *
+ * @param matcher The matcher
+ * @param state The DFA state
+ * @param c The input character
+ * @param set Work space with room for all NFA states
+ * @param stack Work space with room for all NFA states
+ * @return The successor
+ */
+static struct Matcher_Dfa_State *
+matcher_dfa_step (struct Matcher *matcher,
+                  struct Matcher_Dfa_State *state,
+                  unsigned char c,
+                  unsigned int *set,
+                  unsigned int *stack)
+{
+  struct Matcher_Nfa_State *nfa;
+  unsigned int set_size = 0;
+  unsigned int i;
+
+  matcher_closure_begin (matcher);
+  for (i = 0; i < state->num_nfa_states; i++)
+  {
+    nfa = &matcher->nfa[state->nfa_states[i]];
+    if ((MATCHER_NFA_CHARSET == nfa->type)
+        && (0 != (nfa->charset[c / 32] & (1U << (c % 32)))))
+    {
+      matcher_closure (matcher, nfa->out1, set, &set_size, stack);
+    }
+  }
+  state->transitions[c] = matcher_dfa_state (matcher, set, set_size);
+  return state->transitions[c];
+}
+
+
+struct Matcher *
+matcher_create (void)
+{
+  struct Matcher *matcher = GNUNET_new (struct Matcher);
+
+  matcher_dfa_flush (matcher);
+  return matcher;
+}
+
+
+struct Matcher_Subscription *
+matcher_add (struct Matcher *matcher,
+             const char *regex,
+             void *subscription_cls)
+{
+  struct Matcher_Subscription *sub;
+  unsigned int i;
+
+  sub = GNUNET_new (struct Matcher_Subscription);
+  sub->regex = GNUNET_strdup (regex);
+  sub->cls = subscription_cls;
+  for (i = 0; i < matcher->num_subscriptions; i++)
+  {
+    if (NULL == matcher->subscriptions[i])
+    {
+      break;
+    }
+  }
+  sub->index = i;
+  if (GNUNET_OK != matcher_compile (matcher, sub))
+  {
+    GNUNET_free (sub->regex);
+    GNUNET_free (sub);
+    return NULL;
+  }
+  if (i == matcher->num_subscriptions)
+  {
+    GNUNET_array_append (matcher->subscriptions, matcher->num_subscriptions, sub);
+  }
+  else
+  {
+    matcher->subscriptions[i] = sub;
+  }
+  matcher->live_subscriptions++;
+
+  /* Only the states for the new subscription were compiled, the DFA is rebuilt
+     lazily on the next match */
+  matcher_dfa_flush (matcher);
+  return sub;
+}
+
+
+void
+matcher_remove (struct Matcher *matcher,
+                struct Matcher_Subscription *subscription)
+{
+  GNUNET_assert (matcher->subscriptions[subscription->index] == subscription);
+  matcher->subscriptions[subscription->index] = NULL;
+  matcher->live_subscriptions--;
+  matcher->nfa_garbage += subscription->nfa_size;
+  GNUNET_free (subscription->regex);
+  GNUNET_free (subscription);
+
+  if (matcher->nfa_garbage > matcher->nfa_size / 2)
+  {
+    matcher_compact (matcher);
+  }
+  matcher_dfa_flush (matcher);
+}
+
+
+unsigned int
+matcher_match (struct Matcher *matcher,
+               const char *topic,
+               Matcher_Match_Callback cb,
+               void *cb_cls)
+{
+  struct Matcher_Dfa_State *state;
+  struct Matcher_Nfa_State *nfa;
+  unsigned int *set;
+  unsigned int *stack;
+  unsigned int matches = 0;
+  const unsigned char *c;
+  unsigned int i;
+
+  if (0 == matcher->live_subscriptions)
+  {
+    return 0;
+  }
+  if (MATCHER_MAX_DFA_STATES < matcher->dfa_size)
+  {
+    matcher_dfa_flush (matcher);
+  }
+
+  /* Work space is only used for states that are not cached yet */
+  matcher_workspace_ensure (matcher);
+  set = matcher->work;
+  stack = &matcher->work[matcher->work_size];
+
+  if (NULL == matcher->dfa_start)
+  {
+    matcher->dfa_start = matcher_dfa_start (matcher, set, stack);
+  }
+  state = matcher->dfa_start;
+  for (c = (const unsigned char *) topic; '\0' != *c; c++)
+  {
+    if (0 == state->num_nfa_states)
+    {
+      break;
+    }
+    if (NULL != state->transitions[*c])
+    {
+      state = state->transitions[*c];
+    }
+    else
+    {
+      state = matcher_dfa_step (matcher, state, *c, set, stack);
+    }
+  }
+
+  if ('\0' != *c)
+  {
+    return 0;
+  }
+  for (i = 0; i < state->num_nfa_states; i++)
+  {
+    nfa = &matcher->nfa[state->nfa_states[i]];
+    if (MATCHER_NFA_MATCH != nfa->type)
+    {
+      continue;
+    }
+    matches++;
+    if (NULL != cb)
+    {
+      cb (cb_cls, matcher->subscriptions[nfa->subscription]->cls);
+    }
+  }
+  return matches;
+}
+
+
+void
+matcher_destroy (struct Matcher *matcher)
+{
+  unsigned int i;
+
+  if (NULL == matcher)
+  {
+    return;
+  }
+  matcher_dfa_flush (matcher);
+  GNUNET_CONTAINER_multihashmap_destroy (matcher->dfa);
+  for (i = 0; i < matcher->num_subscriptions; i++)
+  {
+    if (NULL != matcher->subscriptions[i])
+    {
+      GNUNET_free (matcher->subscriptions[i]->regex);
+      GNUNET_free (matcher->subscriptions[i]);
+    }
+  }
+  GNUNET_free_non_null (matcher->subscriptions);
+  GNUNET_free_non_null (matcher->nfa);
+  GNUNET_free_non_null (matcher->marks);
+  GNUNET_free_non_null (matcher->work);
+  GNUNET_free (matcher);
+}
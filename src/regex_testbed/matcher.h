@@ -0,0 +1,100 @@
+#ifndef MATCHER_H
+#define MATCHER_H
+
+#include <gnunet/platform.h>
+#include <gnunet/gnunet_util_lib.h>
+
+
+/**
+ * Index of the subscriptions of a node, used to match publishes locally
+ * without going through REGEX search and the DHT.
+ *
+ * All subscription regexes are compiled into one NFA. A combined DFA over it is
+ * built lazily while matching and cached, so after warm up a topic is matched
+ * against every subscription in a single pass over the string. Adding a
+ * subscription only compiles its own regex; adding or removing one drops the
+ * cached DFA states, which are then rebuilt on demand.
+ *
+ * Supported are the constructs used in subscription regexes: literals,
+ * `\` escapes, `.`, bracket expressions with ranges and negation, grouping,
+ * alternation and the `*`, `+` and `?` operators. Like REGEX announcements a
+ * regex has to match the whole topic.
+ */
+struct Matcher;
+
+
+/**
+ * Handle to one subscription in the index
+ */
+struct Matcher_Subscription;
+
+
+/**
+ * Called for every subscription matching a topic
+ *
+ * @param cls Closure
+ * @param subscription_cls The closure the subscription was added with
+ */
+typedef void
+(*Matcher_Match_Callback) (void *cls, void *subscription_cls);
+
+
+/**
+ * Create an empty index
+ *
+ * @return The new index
+ */
+struct Matcher *
+matcher_create (void);
+
+
+/**
+ * Add a subscription to the index
+ *
+ * @param matcher The index
+ * @param regex The subscription regex
+ * @param subscription_cls Passed to the callback on matches
+ * @return Handle to the subscription, NULL if @a regex is malformed
+ */
+struct Matcher_Subscription *
+matcher_add (struct Matcher *matcher,
+             const char *regex,
+             void *subscription_cls);
+
+
+/**
+ * Remove a subscription from the index
+ *
+ * @param matcher The index
+ * @param subscription The handle returned by #matcher_add
+ */
+void
+matcher_remove (struct Matcher *matcher,
+                struct Matcher_Subscription *subscription);
+
+
+/**
+ * Match a topic against all subscriptions
+ *
+ * @param matcher The index
+ * @param topic The topic of a publish
+ * @param cb Called for every matching subscription, may be NULL
+ * @param cb_cls Closure for @a cb
+ * @return Number of matching subscriptions
+ */
+unsigned int
+matcher_match (struct Matcher *matcher,
+               const char *topic,
+               Matcher_Match_Callback cb,
+               void *cb_cls);
+
+
+/**
+ * Free the index. Subscription handles become invalid.
+ *
+ * @param matcher The index, may be NULL
+ */
+void
+matcher_destroy (struct Matcher *matcher);
+
+#endif
@@ -0,0 +1,485 @@
+#include <gnunet/gnunet_signatures.h>
+#include "merkle.h"
+
+
+/**
+ * Prefix of leaf hashes, keeps leaves and inner nodes apart
+ */
+#define MERKLE_LEAF_PREFIX 0
+/**
+ * Prefix of inner node hashes
+ */
+#define MERKLE_NODE_PREFIX 1
+
+
+/**
+ * A message of a batch
+ */
+struct Merkle_Message {
+  /**
+   * The message
+   */
+  void *data;
+  /**
+   * Size of @e data
+   */
+  size_t size;
+};
+
+
+struct Merkle_Batch {
+  /**
+   * The messages
+   */
+  struct Merkle_Message messages[MERKLE_MAX_BATCH];
+  /**
+   * All nodes of the tree, level by level starting with the leaves
+   */
+  struct GNUNET_HashCode nodes[2 * MERKLE_MAX_BATCH];
+  /**
+   * Number of messages
+   */
+  unsigned int count;
+  /**
+   * #GNUNET_YES once signed
+   */
+  int is_signed;
+  /**
+   * Signature over @e root
+   */
+  struct GNUNET_CRYPTO_EddsaSignature signature;
+  /**
+   * The signed root
+   */
+  struct Merkle_Root_Signature_Data root;
+};
+
+
+/**
+ * A verified root
+ */
+struct Merkle_Root {
+  /**
+   * Kept in a DLL, oldest first
+   */
+  struct Merkle_Root *prev;
+  /**
+   * Kept in a DLL, oldest first
+   */
+  struct Merkle_Root *next;
+  /**
+   * Hash of the signer and the signed root data
+   */
+  struct GNUNET_HashCode key;
+};
+
+
+struct Merkle_Verifier {
+  /**
+   * Maps keys of verified roots to their Merkle_Root
+   */
+  struct GNUNET_CONTAINER_MultiHashMap *roots;
+  /**
+   * Oldest verified root, forgotten first
+   */
+  struct Merkle_Root *head;
+  /**
+   * Newest verified root
+   */
+  struct Merkle_Root *tail;
+  /**
+   * Maximum number of roots remembered
+   */
+  unsigned int cache_size;
+  /**
+   * Counters
+   */
+  struct Merkle_Verifier_Stats stats;
+};
+
+
+/**
+ * Hash a message into a leaf
+ *
+ * @param data The message
+ * @param size Size of @a data
+ * @param leaf Set to the leaf hash
+ */
+static void
+merkle_hash_leaf (const void *data, size_t size, struct GNUNET_HashCode *leaf)
+{
+  char *buf;
+
+  buf = GNUNET_malloc (1 + size);
+  buf[0] = MERKLE_LEAF_PREFIX;
+  memcpy (&buf[1], data, size);
+  GNUNET_CRYPTO_hash (buf, 1 + size, leaf);
+  GNUNET_free (buf);
+}
+
+
+/**
+ * Hash two children into their parent
+ *
+ * @param left The left child
+ * @param right The right child
+ * @param parent Set to the parent hash
+ */
+static void
+merkle_hash_node (const struct GNUNET_HashCode *left,
+                  const struct GNUNET_HashCode *right,
+                  struct GNUNET_HashCode *parent)
+{
+  char buf[1 + 2 * sizeof (struct GNUNET_HashCode)];
+
+  buf[0] = MERKLE_NODE_PREFIX;
+  memcpy (&buf[1], left, sizeof (struct GNUNET_HashCode));
+  memcpy (&buf[1 + sizeof (struct GNUNET_HashCode)], right,
+          sizeof (struct GNUNET_HashCode));
+  GNUNET_CRYPTO_hash (buf, sizeof (buf), parent);
+}
+
+
+/**
+ * Get the number of hashes in the inclusion proof of a leaf. A node without
+ * sibling, the last one of a level with an odd number of nodes, is moved up
+ * unchanged and needs no proof hash.
+ *
+ * @param index Index of the leaf
+ * @param count Number of leaves
+ * @return Number of proof hashes
+ */
+static unsigned int
+merkle_proof_length (unsigned int index, unsigned int count)
+{
+  unsigned int length = 0;
+
+  while (1 < count)
+  {
+    if ((index ^ 1) < count)
+    {
+      length++;
+    }
+    index >>= 1;
+    count = (count + 1) / 2;
+  }
+  return length;
+}
+
+
+struct Merkle_Batch *
+merkle_batch_create (void)
+{
+  return GNUNET_new (struct Merkle_Batch);
+}
+
+
+int
+merkle_batch_add (struct Merkle_Batch *batch, const void *data, size_t size)
+{
+  struct Merkle_Message *message;
+
+  GNUNET_assert (GNUNET_NO == batch->is_signed);
+  if (MERKLE_MAX_BATCH == batch->count)
+  {
+    return GNUNET_SYSERR;
+  }
+  message = &batch->messages[batch->count];
+  message->data = GNUNET_malloc (GNUNET_MAX (1, size));
+  memcpy (message->data, data, size);
+  message->size = size;
+  return (int) batch->count++;
+}
+
+
+unsigned int
+merkle_batch_size (const struct Merkle_Batch *batch)
+{
+  return batch->count;
+}
+
+
+int
+merkle_batch_sign (struct Merkle_Batch *batch,
+                   const struct GNUNET_CRYPTO_EddsaPrivateKey *key)
+{
+  unsigned int level = 0;
+  unsigned int count = batch->count;
+  unsigned int next;
+  unsigned int i;
+
+  GNUNET_assert (0 < batch->count);
+  for (i = 0; i < batch->count; i++)
+  {
+    merkle_hash_leaf (batch->messages[i].data,
+                      batch->messages[i].size,
+                      &batch->nodes[i]);
+  }
+  while (1 < count)
+  {
+    next = level + count;
+    for (i = 0; i < count; i += 2)
+    {
+      if (i + 1 < count)
+      {
+        merkle_hash_node (&batch->nodes[level + i],
+                          &batch->nodes[level + i + 1],
+                          &batch->nodes[next + i / 2]);
+      }
+      else
+      {
+        batch->nodes[next + i / 2] = batch->nodes[level + i];
+      }
+    }
+    level = next;
+    count = (count + 1) / 2;
+  }
+
+  batch->root.purpose.size = htonl (sizeof (struct Merkle_Root_Signature_Data));
+  batch->root.purpose.purpose = htonl (GNUNET_SIGNATURE_PURPOSE_TEST);
+  batch->root.root = batch->nodes[level];
+  batch->root.leaf_count = htonl (batch->count);
+  if (GNUNET_OK != GNUNET_CRYPTO_eddsa_sign (key,
+                                             &batch->root.purpose,
+                                             &batch->signature))
+  {
+    return GNUNET_SYSERR;
+  }
+  batch->is_signed = GNUNET_YES;
+  return GNUNET_OK;
+}
+
+
+size_t
+merkle_batch_seal (const struct Merkle_Batch *batch,
+                   unsigned int index,
+                   void *buf,
+                   size_t buf_size)
+{
+  struct Merkle_Envelope *envelope = (struct Merkle_Envelope *) buf;
+  struct GNUNET_HashCode *proof = (struct GNUNET_HashCode *) &envelope[1];
+  const struct Merkle_Message *message = &batch->messages[index];
+  unsigned int length = merkle_proof_length (index, batch->count);
+  unsigned int level = 0;
+  unsigned int count = batch->count;
+  size_t total;
+
+  GNUNET_assert (GNUNET_YES == batch->is_signed);
+  GNUNET_assert (index < batch->count);
+  total = sizeof (struct Merkle_Envelope)
+      + length * sizeof (struct GNUNET_HashCode)
+      + message->size;
+  if (buf_size < total)
+  {
+    return 0;
+  }
+  envelope->signature = batch->signature;
+  envelope->root = batch->root;
+  envelope->leaf_index = htonl (index);
+  while (1 < count)
+  {
+    if ((index ^ 1) < count)
+    {
+      *proof++ = batch->nodes[level + (index ^ 1)];
+    }
+    level += count;
+    index >>= 1;
+    count = (count + 1) / 2;
+  }
+  memcpy (proof, message->data, message->size);
+  return total;
+}
+
+
+void
+merkle_batch_clear (struct Merkle_Batch *batch)
+{
+  unsigned int i;
+
+  for (i = 0; i < batch->count; i++)
+  {
+    GNUNET_free (batch->messages[i].data);
+  }
+  batch->count = 0;
+  batch->is_signed = GNUNET_NO;
+}
+
+
+void
+merkle_batch_destroy (struct Merkle_Batch *batch)
+{
+  if (NULL == batch)
+  {
+    return;
+  }
+  merkle_batch_clear (batch);
+  GNUNET_free (batch);
+}
+
+
+struct Merkle_Verifier *
+merkle_verifier_create (unsigned int cache_size)
+{
+  struct Merkle_Verifier *verifier;
+
+  verifier = GNUNET_new (struct Merkle_Verifier);
+  verifier->cache_size = GNUNET_MAX (1, cache_size);
+  verifier->roots = GNUNET_CONTAINER_multihashmap_create (verifier->cache_size,
+                                                          GNUNET_NO);
+  return verifier;
+}
+
+
+/**
+ * Check the signature of a root unless it was verified before
+ *
+ * @param verifier The verifier
+ * @param signer The expected signer
+ * @param envelope The envelope carrying the root
+ * @return #GNUNET_OK if the root is signed by @a signer
+ */
+static int
+merkle_verifier_check_root (struct Merkle_Verifier *verifier,
+                            const struct GNUNET_CRYPTO_EddsaPublicKey *signer,
+                            const struct Merkle_Envelope *envelope)
+{
+  char buf[sizeof (struct GNUNET_CRYPTO_EddsaPublicKey)
+           + sizeof (struct Merkle_Root_Signature_Data)];
+  struct Merkle_Root *root;
+  struct GNUNET_HashCode key;
+
+  memcpy (buf, signer, sizeof (struct GNUNET_CRYPTO_EddsaPublicKey));
+  memcpy (&buf[sizeof (struct GNUNET_CRYPTO_EddsaPublicKey)],
+          &envelope->root,
+          sizeof (struct Merkle_Root_Signature_Data));
+  GNUNET_CRYPTO_hash (buf, sizeof (buf), &key);
+  if (GNUNET_YES == GNUNET_CONTAINER_multihashmap_contains (verifier->roots,
+                                                            &key))
+  {
+    return GNUNET_OK;
+  }
+
+  if ((sizeof (struct Merkle_Root_Signature_Data)
+       != ntohl (envelope->root.purpose.size))
+      || (GNUNET_OK != GNUNET_CRYPTO_eddsa_verify (GNUNET_SIGNATURE_PURPOSE_TEST,
+                                                   &envelope->root.purpose,
+                                                   &envelope->signature,
+                                                   signer)))
+  {
+    return GNUNET_SYSERR;
+  }
+  verifier->stats.signatures++;
+
+  if (GNUNET_CONTAINER_multihashmap_size (verifier->roots) >= verifier->cache_size)
+  {
+    root = verifier->head;
+    GNUNET_CONTAINER_DLL_remove (verifier->head, verifier->tail, root);
+    GNUNET_CONTAINER_multihashmap_remove (verifier->roots, &root->key, root);
+    GNUNET_free (root);
+  }
+  root = GNUNET_new (struct Merkle_Root);
+  root->key = key;
+  GNUNET_CONTAINER_multihashmap_put (verifier->roots,
+                                     &key,
+                                     root,
+                                     GNUNET_CONTAINER_MULTIHASHMAPOPTION_UNIQUE_FAST);
+  GNUNET_CONTAINER_DLL_insert_tail (verifier->head, verifier->tail, root);
+  return GNUNET_OK;
+}
+
+
+int
+merkle_verifier_open (struct Merkle_Verifier *verifier,
+                      const struct GNUNET_CRYPTO_EddsaPublicKey *signer,
+                      const void *data,
+                      size_t size,
+                      const void **message,
+                      size_t *message_size)
+{
+  const struct Merkle_Envelope *envelope = (const struct Merkle_Envelope *) data;
+  const struct GNUNET_HashCode *proof;
+  struct GNUNET_HashCode hash;
+  unsigned int index;
+  unsigned int count;
+  unsigned int length;
+  size_t header;
+
+  if (sizeof (struct Merkle_Envelope) > size)
+  {
+    verifier->stats.rejected++;
+    return GNUNET_SYSERR;
+  }
+  index = ntohl (envelope->leaf_index);
+  count = ntohl (envelope->root.leaf_count);
+  if ((MERKLE_MAX_BATCH < count) || (index >= count))
+  {
+    verifier->stats.rejected++;
+    return GNUNET_SYSERR;
+  }
+  length = merkle_proof_length (index, count);
+  header = sizeof (struct Merkle_Envelope) + length * sizeof (struct GNUNET_HashCode);
+  if (header > size)
+  {
+    verifier->stats.rejected++;
+    return GNUNET_SYSERR;
+  }
+
+  // Recompute the root from the message and its proof
+  proof = (const struct GNUNET_HashCode *) &envelope[1];
+  merkle_hash_leaf (((const char *) data) + header, size - header, &hash);
+  while (1 < count)
+  {
+    if ((index ^ 1) < count)
+    {
+      if (0 == (index & 1))
+      {
+        merkle_hash_node (&hash, proof, &hash);
+      }
+      else
+      {
+        merkle_hash_node (proof, &hash, &hash);
+      }
+      proof++;
+    }
+    index >>= 1;
+    count = (count + 1) / 2;
+  }
+  if ((0 != memcmp (&hash, &envelope->root.root, sizeof (struct GNUNET_HashCode)))
+      || (GNUNET_OK != merkle_verifier_check_root (verifier, signer, envelope)))
+  {
+    verifier->stats.rejected++;
+    return GNUNET_SYSERR;
+  }
+
+  verifier->stats.accepted++;
+  *message = ((const char *) data) + header;
+  *message_size = size - header;
+  return GNUNET_OK;
+}
+
+
+void
+merkle_verifier_get_stats (const struct Merkle_Verifier *verifier,
+                           struct Merkle_Verifier_Stats *stats)
+{
+  *stats = verifier->stats;
+}
+
+
+void
+merkle_verifier_destroy (struct Merkle_Verifier *verifier)
+{
+  struct Merkle_Root *root;
+
+  if (NULL == verifier)
+  {
+    return;
+  }
+  while (NULL != (root = verifier->head))
+  {
+    GNUNET_CONTAINER_DLL_remove (verifier->head, verifier->tail, root);
+    GNUNET_free (root);
+  }
+  GNUNET_CONTAINER_multihashmap_destroy (verifier->roots);
+  GNUNET_free (verifier);
+}
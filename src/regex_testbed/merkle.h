@@ -0,0 +1,232 @@
+#ifndef MERKLE_H
+#define MERKLE_H
+
+#include <gnunet/platform.h>
+#include <gnunet/gnunet_util_lib.h>
+
+
+/**
+ * Maximum number of messages signed together
+ */
+#define MERKLE_MAX_BATCH 64
+/**
+ * Maximum number of hashes in an inclusion proof, log2 of #MERKLE_MAX_BATCH
+ */
+#define MERKLE_MAX_DEPTH 6
+
+
+GNUNET_NETWORK_STRUCT_BEGIN
+
+/**
+ * What the publisher signs for a batch
+ */
+struct Merkle_Root_Signature_Data {
+  /**
+   * Purpose of the signature
+   */
+  struct GNUNET_CRYPTO_EccSignaturePurpose purpose;
+  /**
+   * Root of the Merkle tree over the messages of the batch
+   */
+  struct GNUNET_HashCode root;
+  /**
+   * Number of messages in the batch
+   */
+  uint32_t leaf_count GNUNET_PACKED;
+};
+
+
+/**
+ * Prepended to every message of a signed batch, followed by the inclusion
+ * proof of the message and then the message itself
+ */
+struct Merkle_Envelope {
+  /**
+   * Signature over @e root
+   */
+  struct GNUNET_CRYPTO_EddsaSignature signature;
+  /**
+   * The signed root of the batch
+   */
+  struct Merkle_Root_Signature_Data root;
+  /**
+   * Position of the message in the batch
+   */
+  uint32_t leaf_index GNUNET_PACKED;
+};
+
+GNUNET_NETWORK_STRUCT_END
+
+
+/**
+ * Largest overhead #merkle_batch_seal adds to a message
+ */
+#define MERKLE_MAX_ENVELOPE \
+  (sizeof (struct Merkle_Envelope) + MERKLE_MAX_DEPTH * sizeof (struct GNUNET_HashCode))
+
+
+/**
+ * Outgoing messages that are signed together.
+ *
+ * A Merkle tree is built over the messages and only its root is signed, each
+ * message then carries the signed root and the sibling hashes on its path to
+ * the root. Messages are sealed after the batch is signed and the batch is
+ * cleared for the next round.
+ */
+struct Merkle_Batch;
+
+
+/**
+ * Checks sealed messages. Roots whose signature was verified are cached, so
+ * one signature verification covers all messages of a batch.
+ */
+struct Merkle_Verifier;
+
+
+/**
+ * Counters of a verifier
+ */
+struct Merkle_Verifier_Stats {
+  /**
+   * Messages accepted
+   */
+  unsigned long long accepted;
+  /**
+   * Messages rejected
+   */
+  unsigned long long rejected;
+  /**
+   * Signatures verified
+   */
+  unsigned long long signatures;
+};
+
+
+/**
+ * Create an empty batch
+ *
+ * @return The new batch
+ */
+struct Merkle_Batch *
+merkle_batch_create (void);
+
+
+/**
+ * Add a message to a batch
+ *
+ * @param batch The batch, not signed yet
+ * @param data The message, copied
+ * @param size Size of @a data
+ * @return Index of the message in the batch, #GNUNET_SYSERR if the batch is
+ *         full
+ */
+int
+merkle_batch_add (struct Merkle_Batch *batch, const void *data, size_t size);
+
+
+/**
+ * Get the number of messages in a batch
+ *
+ * @param batch The batch
+ * @return Number of messages
+ */
+unsigned int
+merkle_batch_size (const struct Merkle_Batch *batch);
+
+
+/**
+ * Build the Merkle tree of a batch and sign its root
+ *
+ * @param batch The batch, not empty
+ * @param key The key of the publisher
+ * @return #GNUNET_OK on success
+ */
+int
+merkle_batch_sign (struct Merkle_Batch *batch,
+                   const struct GNUNET_CRYPTO_EddsaPrivateKey *key);
+
+
+/**
+ * Write a message of a signed batch with its envelope and inclusion proof
+ *
+ * @param batch The signed batch
+ * @param index Index of the message
+ * @param buf Where to write
+ * @param buf_size Size of @a buf
+ * @return Bytes written, 0 if @a buf is too small
+ */
+size_t
+merkle_batch_seal (const struct Merkle_Batch *batch,
+                   unsigned int index,
+                   void *buf,
+                   size_t buf_size);
+
+
+/**
+ * Remove all messages from a batch so it can be filled again
+ *
+ * @param batch The batch
+ */
+void
+merkle_batch_clear (struct Merkle_Batch *batch);
+
+
+/**
+ * Free a batch
+ *
+ * @param batch The batch, may be NULL
+ */
+void
+merkle_batch_destroy (struct Merkle_Batch *batch);
+
+
+/**
+ * Create a verifier
+ *
+ * @param cache_size Number of verified roots to remember
+ * @return The new verifier
+ */
+struct Merkle_Verifier *
+merkle_verifier_create (unsigned int cache_size);
+
+
+/**
+ * Check a sealed message and find the message in it
+ *
+ * @param verifier The verifier
+ * @param signer Public key the batch has to be signed with
+ * @param data The sealed message
+ * @param size Size of @a data
+ * @param message Set to the message inside @a data
+ * @param message_size Set to the size of @a message
+ * @return #GNUNET_OK if the message is authentic
+ */
+int
+merkle_verifier_open (struct Merkle_Verifier *verifier,
+                      const struct GNUNET_CRYPTO_EddsaPublicKey *signer,
+                      const void *data,
+                      size_t size,
+                      const void **message,
+                      size_t *message_size);
+
+
+/**
+ * Get the counters of a verifier
+ *
+ * @param verifier The verifier
+ * @param stats Set to the counters
+ */
+void
+merkle_verifier_get_stats (const struct Merkle_Verifier *verifier,
+                           struct Merkle_Verifier_Stats *stats);
+
+
+/**
+ * Free a verifier
+ *
+ * @param verifier The verifier, may be NULL
+ */
+void
+merkle_verifier_destroy (struct Merkle_Verifier *verifier);
+
+#endif
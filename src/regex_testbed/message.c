@@ -0,0 +1,50 @@
+#include "message.h"
+
+
+size_t
+message_write_header (const char *topic,
+                      struct GNUNET_TIME_Absolute timestamp,
+                      void *buf,
+                      size_t buf_size)
+{
+  struct Message_Header *header = (struct Message_Header *) buf;
+  size_t topic_size = strlen (topic) + 1;
+
+  if ((UINT16_MAX < topic_size)
+      || (sizeof (struct Message_Header) + topic_size > buf_size))
+  {
+    return 0;
+  }
+  header->timestamp = GNUNET_TIME_absolute_hton (timestamp);
+  header->topic_size = htons ((uint16_t) topic_size);
+  memcpy (&header[1], topic, topic_size);
+  return sizeof (struct Message_Header) + topic_size;
+}
+
+
+size_t
+message_read_header (const void *data,
+                     size_t size,
+                     const char **topic,
+                     struct GNUNET_TIME_Absolute *timestamp)
+{
+  const struct Message_Header *header = (const struct Message_Header *) data;
+  const char *name = (const char *) &header[1];
+  size_t topic_size;
+
+  if (sizeof (struct Message_Header) > size)
+  {
+    return 0;
+  }
+  topic_size = ntohs (header->topic_size);
+  // The topic ends at its first 0, which has to be its last byte
+  if ((0 == topic_size)
+      || (sizeof (struct Message_Header) + topic_size > size)
+      || (&name[topic_size - 1] != memchr (name, '\0', topic_size)))
+  {
+    return 0;
+  }
+  *topic = name;
+  *timestamp = GNUNET_TIME_absolute_ntoh (header->timestamp);
+  return sizeof (struct Message_Header) + topic_size;
+}
@@ -0,0 +1,63 @@
+#ifndef MESSAGE_H
+#define MESSAGE_H
+
+#include <gnunet/platform.h>
+#include <gnunet/gnunet_util_lib.h>
+
+
+GNUNET_NETWORK_STRUCT_BEGIN
+
+/**
+ * Prepended to every message a publisher puts into the DHT, in front of the
+ * codec header. Followed by the 0-terminated topic the message was published
+ * to and then the payload. It is signed with the message, so a signed
+ * message can not be passed off as one of another topic or time.
+ */
+struct Message_Header {
+  /**
+   * When the message was published. Of several values stored under the
+   * retained key of a topic the newest one is the retained message.
+   */
+  struct GNUNET_TIME_AbsoluteNBO timestamp;
+  /**
+   * Length of the topic including the terminating 0
+   */
+  uint16_t topic_size GNUNET_PACKED;
+} GNUNET_PACKED;
+
+GNUNET_NETWORK_STRUCT_END
+
+
+/**
+ * Write the header of a message published to a topic
+ *
+ * @param topic The topic
+ * @param timestamp When the message was published
+ * @param buf Where to write the header, the payload goes after it
+ * @param buf_size Size of @a buf
+ * @return Bytes written, 0 if @a buf is too small
+ */
+size_t
+message_write_header (const char *topic,
+                      struct GNUNET_TIME_Absolute timestamp,
+                      void *buf,
+                      size_t buf_size);
+
+
+/**
+ * Read the header of a received message
+ *
+ * @param data The message
+ * @param size Size of @a data
+ * @param topic Set to the topic inside @a data
+ * @param timestamp Set to when the message was published
+ * @return Size of the header, the payload follows it, 0 if @a data is
+ *         malformed
+ */
+size_t
+message_read_header (const void *data,
+                     size_t size,
+                     const char **topic,
+                     struct GNUNET_TIME_Absolute *timestamp);
+
+#endif
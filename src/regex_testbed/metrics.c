@@ -0,0 +1,319 @@
+#include <gnunet/gnunet_statistics_service.h>
+#include "metrics.h"
+
+
+/**
+ * Statistics values of a histogram: one per bucket, the number of
+ * observations and their sum
+ */
+#define METRICS_HISTOGRAM_VALUES (METRICS_HISTOGRAM_BUCKETS + 2)
+
+
+/**
+ * One statistics value
+ */
+struct Metrics_Value {
+  /**
+   * Name of the statistics value
+   */
+  char *name;
+  /**
+   * Change not flushed yet
+   */
+  int64_t pending;
+};
+
+
+/**
+ * Where a metric keeps its values
+ */
+struct Metrics_Entry {
+  /**
+   * Index of the first value of the metric
+   */
+  unsigned int first;
+  /**
+   * Current level of a gauge
+   */
+  uint64_t level;
+};
+
+
+struct Metrics {
+  /**
+   * Connection to the statistics service
+   */
+  struct GNUNET_STATISTICS_Handle *statistics;
+  /**
+   * The metrics
+   */
+  const struct Metrics_Definition *definitions;
+  /**
+   * Values of every metric
+   */
+  struct Metrics_Entry *entries;
+  /**
+   * Number of @e definitions and @e entries
+   */
+  unsigned int count;
+  /**
+   * All statistics values
+   */
+  struct Metrics_Value *values;
+  /**
+   * Number of @e values
+   */
+  unsigned int value_count;
+  /**
+   * How often changed values are flushed
+   */
+  struct GNUNET_TIME_Relative interval;
+  /**
+   * The next flush
+   */
+  GNUNET_SCHEDULER_TaskIdentifier flush_task;
+  /**
+   * Called before every flush
+   */
+  Metrics_Sample_Callback sample;
+  /**
+   * Closure for @e sample
+   */
+  void *sample_cls;
+};
+
+
+/**
+ * Flush the metrics and schedule the next flush
+ *
+ * @param cls The Metrics
+ * @param tc Task context
+ */
+static void
+metrics_flush_task (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  struct Metrics *metrics = (struct Metrics *) cls;
+
+  metrics->flush_task = GNUNET_SCHEDULER_NO_TASK;
+  if (0 != (tc->reason & GNUNET_SCHEDULER_REASON_SHUTDOWN))
+  {
+    // The owner flushes a last time when destroying the metrics
+    return;
+  }
+  if (NULL != metrics->sample)
+  {
+    metrics->sample (metrics->sample_cls, metrics);
+  }
+  metrics_flush (metrics);
+  metrics->flush_task = GNUNET_SCHEDULER_add_delayed (metrics->interval,
+                                                      &metrics_flush_task,
+                                                      metrics);
+}
+
+
+struct Metrics *
+metrics_create (const struct GNUNET_CONFIGURATION_Handle *cfg,
+                const char *subsystem,
+                const struct Metrics_Definition *definitions,
+                unsigned int count,
+                struct GNUNET_TIME_Relative interval,
+                Metrics_Sample_Callback sample,
+                void *sample_cls)
+{
+  struct Metrics *metrics;
+  struct Metrics_Value *value;
+  unsigned int i;
+  unsigned int j;
+
+  metrics = GNUNET_new (struct Metrics);
+  metrics->statistics = GNUNET_STATISTICS_create (subsystem, cfg);
+  if (NULL == metrics->statistics)
+  {
+    GNUNET_free (metrics);
+    return NULL;
+  }
+  metrics->definitions = definitions;
+  metrics->count = count;
+  metrics->entries = GNUNET_malloc (count * sizeof (struct Metrics_Entry));
+  for (i = 0; i < count; i++)
+  {
+    metrics->entries[i].first = metrics->value_count;
+    metrics->value_count += (METRICS_HISTOGRAM == definitions[i].type)
+        ? METRICS_HISTOGRAM_VALUES : 1;
+  }
+
+  // Names are built once, flushing only looks them up
+  metrics->values = GNUNET_malloc (metrics->value_count * sizeof (struct Metrics_Value));
+  for (i = 0; i < count; i++)
+  {
+    value = &metrics->values[metrics->entries[i].first];
+    if (METRICS_HISTOGRAM != definitions[i].type)
+    {
+      value->name = GNUNET_strdup (definitions[i].name);
+      continue;
+    }
+    for (j = 0; j < METRICS_HISTOGRAM_BUCKETS; j++)
+    {
+      GNUNET_asprintf (&value[j].name, "%s < %llu ms",
+                       definitions[i].name, 1ULL << j);
+    }
+    GNUNET_asprintf (&value[j++].name, "%s count", definitions[i].name);
+    GNUNET_asprintf (&value[j].name, "%s total ms", definitions[i].name);
+  }
+
+  metrics->interval = interval;
+  metrics->sample = sample;
+  metrics->sample_cls = sample_cls;
+  metrics->flush_task = GNUNET_SCHEDULER_add_delayed (interval,
+                                                      &metrics_flush_task,
+                                                      metrics);
+  return metrics;
+}
+
+
+void
+metrics_count (struct Metrics *metrics, unsigned int metric, uint64_t delta)
+{
+  if (NULL == metrics)
+  {
+    return;
+  }
+  GNUNET_assert (METRICS_COUNTER == metrics->definitions[metric].type);
+  metrics->values[metrics->entries[metric].first].pending += delta;
+}
+
+
+void
+metrics_gauge_add (struct Metrics *metrics, unsigned int metric, int64_t delta)
+{
+  if (NULL == metrics)
+  {
+    return;
+  }
+  metrics_gauge_set (metrics, metric, metrics->entries[metric].level + delta);
+}
+
+
+void
+metrics_gauge_set (struct Metrics *metrics, unsigned int metric, uint64_t value)
+{
+  struct Metrics_Entry *entry;
+
+  if (NULL == metrics)
+  {
+    return;
+  }
+  GNUNET_assert (METRICS_GAUGE == metrics->definitions[metric].type);
+  entry = &metrics->entries[metric];
+  metrics->values[entry->first].pending += (int64_t) (value - entry->level);
+  entry->level = value;
+}
+
+
+void
+metrics_observe (struct Metrics *metrics,
+                 unsigned int metric,
+                 struct GNUNET_TIME_Relative latency)
+{
+  struct Metrics_Value *value;
+  uint64_t ms;
+  unsigned int bucket = 0;
+
+  if (NULL == metrics)
+  {
+    return;
+  }
+  GNUNET_assert (METRICS_HISTOGRAM == metrics->definitions[metric].type);
+  value = &metrics->values[metrics->entries[metric].first];
+  ms = latency.rel_value_us / 1000;
+  while ((bucket < METRICS_HISTOGRAM_BUCKETS) && (ms >= (1ULL << bucket)))
+  {
+    bucket++;
+  }
+  // Slower than the last bound only shows up in the count
+  if (METRICS_HISTOGRAM_BUCKETS > bucket)
+  {
+    value[bucket].pending++;
+  }
+  value[METRICS_HISTOGRAM_BUCKETS].pending++;
+  value[METRICS_HISTOGRAM_BUCKETS + 1].pending += ms;
+}
+
+
+void
+metrics_flush (struct Metrics *metrics)
+{
+  struct Metrics_Value *value;
+  int64_t below;
+  unsigned int i;
+  unsigned int j;
+
+  for (i = 0; i < metrics->count; i++)
+  {
+    value = &metrics->values[metrics->entries[i].first];
+    if (METRICS_HISTOGRAM != metrics->definitions[i].type)
+    {
+      if (0 != value->pending)
+      {
+        GNUNET_STATISTICS_update (metrics->statistics,
+                                  value->name,
+                                  value->pending,
+                                  GNUNET_NO);
+        value->pending = 0;
+      }
+      continue;
+    }
+
+    // Buckets are counted individually but published cumulative
+    below = 0;
+    for (j = 0; j < METRICS_HISTOGRAM_VALUES; j++)
+    {
+      if (METRICS_HISTOGRAM_BUCKETS > j)
+      {
+        below += value[j].pending;
+        value[j].pending = below;
+      }
+      if (0 != value[j].pending)
+      {
+        GNUNET_STATISTICS_update (metrics->statistics,
+                                  value[j].name,
+                                  value[j].pending,
+                                  GNUNET_NO);
+        value[j].pending = 0;
+      }
+    }
+  }
+}
+
+
+void
+metrics_destroy (struct Metrics *metrics)
+{
+  unsigned int i;
+
+  if (NULL == metrics)
+  {
+    return;
+  }
+  if (GNUNET_SCHEDULER_NO_TASK != metrics->flush_task)
+  {
+    GNUNET_SCHEDULER_cancel (metrics->flush_task);
+  }
+  // Nothing is in flight anymore once the owner is gone
+  for (i = 0; i < metrics->count; i++)
+  {
+    if (METRICS_GAUGE == metrics->definitions[i].type)
+    {
+      metrics_gauge_set (metrics, i, 0);
+    }
+  }
+  metrics_flush (metrics);
+  GNUNET_STATISTICS_destroy (metrics->statistics, GNUNET_YES);
+  for (i = 0; i < metrics->value_count; i++)
+  {
+    GNUNET_free (metrics->values[i].name);
+  }
+  GNUNET_free (metrics->values);
+  GNUNET_free (metrics->entries);
+  GNUNET_free (metrics);
+}
@@ -0,0 +1,157 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <gnunet/platform.h>
+#include <gnunet/gnunet_util_lib.h>
+
+
+/**
+ * Number of buckets of a histogram, bucket i counts latencies below 2^i ms
+ */
+#define METRICS_HISTOGRAM_BUCKETS 16
+
+
+/**
+ * Runtime metrics published through the statistics service of a peer.
+ *
+ * Updates only change local accumulators, no message is sent per event. A
+ * timer flushes what changed since the last flush with one statistics update
+ * per changed value. Values are sent as differences, so peers sharing one
+ * statistics service add up instead of overwriting each other.
+ */
+struct Metrics;
+
+
+/**
+ * Kinds of metrics
+ */
+enum Metrics_Type {
+  /**
+   * A total that only grows, e.g. messages published
+   */
+  METRICS_COUNTER,
+  /**
+   * A current level, e.g. operations in flight
+   */
+  METRICS_GAUGE,
+  /**
+   * A latency distribution. Published as the number of observations below
+   * each bucket bound, the number of observations and their sum in ms.
+   */
+  METRICS_HISTOGRAM
+};
+
+
+/**
+ * Describes one metric
+ */
+struct Metrics_Definition {
+  /**
+   * Name of the statistics value, by convention starting with "# "
+   */
+  const char *name;
+  /**
+   * Kind of the metric
+   */
+  enum Metrics_Type type;
+};
+
+
+/**
+ * Called before every flush to update gauges that are cheaper to read than
+ * to track per event
+ *
+ * @param cls Closure
+ * @param metrics The metrics about to be flushed
+ */
+typedef void
+(*Metrics_Sample_Callback) (void *cls, struct Metrics *metrics);
+
+
+/**
+ * Connect to the statistics service of a peer and start flushing
+ *
+ * @param cfg Configuration of the peer
+ * @param subsystem Subsystem the values are published under
+ * @param definitions The metrics, which are referred to by their index in
+ *        this array. It has to stay valid until the metrics are destroyed.
+ * @param count Number of @a definitions
+ * @param interval How often changed values are flushed
+ * @param sample Called before every flush, may be NULL
+ * @param sample_cls Closure for @a sample
+ * @return The metrics, NULL if the statistics service can not be used
+ */
+struct Metrics *
+metrics_create (const struct GNUNET_CONFIGURATION_Handle *cfg,
+                const char *subsystem,
+                const struct Metrics_Definition *definitions,
+                unsigned int count,
+                struct GNUNET_TIME_Relative interval,
+                Metrics_Sample_Callback sample,
+                void *sample_cls);
+
+
+/**
+ * Add to a counter
+ *
+ * @param metrics The metrics, may be NULL
+ * @param metric Index of the counter
+ * @param delta Amount to add
+ */
+void
+metrics_count (struct Metrics *metrics, unsigned int metric, uint64_t delta);
+
+
+/**
+ * Raise or lower a gauge
+ *
+ * @param metrics The metrics, may be NULL
+ * @param metric Index of the gauge
+ * @param delta Amount to add, negative to lower it
+ */
+void
+metrics_gauge_add (struct Metrics *metrics, unsigned int metric, int64_t delta);
+
+
+/**
+ * Set a gauge
+ *
+ * @param metrics The metrics, may be NULL
+ * @param metric Index of the gauge
+ * @param value The new level
+ */
+void
+metrics_gauge_set (struct Metrics *metrics, unsigned int metric, uint64_t value);
+
+
+/**
+ * Add an observation to a histogram
+ *
+ * @param metrics The metrics, may be NULL
+ * @param metric Index of the histogram
+ * @param latency The observed latency
+ */
+void
+metrics_observe (struct Metrics *metrics,
+                 unsigned int metric,
+                 struct GNUNET_TIME_Relative latency);
+
+
+/**
+ * Send the values changed since the last flush to the statistics service
+ *
+ * @param metrics The metrics
+ */
+void
+metrics_flush (struct Metrics *metrics);
+
+
+/**
+ * Flush the metrics a last time and disconnect from the statistics service
+ *
+ * @param metrics The metrics, may be NULL
+ */
+void
+metrics_destroy (struct Metrics *metrics);
+
+#endif
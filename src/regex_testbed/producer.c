@@ -0,0 +1,531 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include "producer.h"
+
+
+/**
+ * Marks a message of a producer thread
+ */
+#define PRODUCER_MAGIC 0x50524f44
+/**
+ * Payload bytes of the smallest message
+ */
+#define PRODUCER_MIN_PAYLOAD 32
+/**
+ * Payload sizes vary between #PRODUCER_MIN_PAYLOAD and this plus the minimum
+ */
+#define PRODUCER_PAYLOAD_SPREAD 480
+
+
+/**
+ * Header in front of every message, followed by a pattern derived from the
+ * fields so the receiver can check every byte
+ */
+struct Producer_Message_Header {
+  /**
+   * Always #PRODUCER_MAGIC
+   */
+  uint32_t magic;
+  /**
+   * Index of the thread that published the message
+   */
+  uint32_t thread;
+  /**
+   * Sequence number of the message within its thread
+   */
+  uint32_t seq;
+  /**
+   * Number of pattern bytes following the header
+   */
+  uint32_t length;
+};
+
+
+/**
+ * State of one producer thread
+ */
+struct Producer_Thread {
+  /**
+   * The producer the thread belongs to
+   */
+  struct Producer *producer;
+  /**
+   * The thread
+   */
+  pthread_t thread;
+  /**
+   * Index of the thread, also its lane on both bridges
+   */
+  unsigned int index;
+  /**
+   * #GNUNET_YES once the thread was started
+   */
+  int started;
+  /**
+   * Which of our own messages came back so far from every subscriber
+   */
+  uint8_t seen[PRODUCER_MAX_RECEIVERS][PRODUCER_MAX_MESSAGES];
+  /**
+   * Number of messages published
+   */
+  unsigned int published;
+  /**
+   * Number of distinct own messages that came back from every subscriber
+   */
+  unsigned int returned[PRODUCER_MAX_RECEIVERS];
+  /**
+   * Number of subscribers all requested messages came back from
+   */
+  unsigned int complete;
+  /**
+   * Number of received messages that failed the check
+   */
+  unsigned long long corrupt;
+  /**
+   * #GNUNET_YES if all requested messages came back from every subscriber
+   */
+  int verified;
+};
+
+
+struct Producer {
+  /**
+   * Bridge of the publisher
+   */
+  struct Bridge *publish_bridge;
+  /**
+   * Bridges of the subscribers
+   */
+  struct Bridge *receive_bridges[PRODUCER_MAX_RECEIVERS];
+  /**
+   * Number of @e receive_bridges
+   */
+  unsigned int num_receivers;
+  /**
+   * Topic to publish to
+   */
+  char *topic;
+  /**
+   * Number of own messages every thread has to get back
+   */
+  unsigned int count;
+  /**
+   * Time between two messages of a thread in milliseconds
+   */
+  unsigned long long interval_ms;
+  /**
+   * All threads
+   */
+  struct Producer_Thread *threads;
+  /**
+   * Number of threads
+   */
+  unsigned int num_threads;
+  /**
+   * Number of threads still running
+   */
+  atomic_uint running;
+  /**
+   * Written to once to stop all threads, [0] is the read end
+   */
+  int stop_pipe[2];
+  /**
+   * Written to by the last thread to finish
+   */
+  struct GNUNET_DISK_PipeHandle *done_pipe;
+  /**
+   * Task waiting for the threads to finish
+   */
+  GNUNET_SCHEDULER_TaskIdentifier done_task;
+  /**
+   * Called once all threads finished
+   */
+  Producer_Done_Callback done;
+  /**
+   * Closure for done
+   */
+  void *done_cls;
+};
+
+
+/**
+ * Get the current time of the monotonic clock
+ *
+ * @return The time in milliseconds
+ */
+static unsigned long long
+producer_now_ms (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/**
+ * Get the pattern byte at a position of a message
+ *
+ * @param hdr The header of the message
+ * @param i Position within the pattern
+ * @return The byte
+ */
+static uint8_t
+producer_pattern (const struct Producer_Message_Header *hdr, uint32_t i)
+{
+  return (uint8_t) (hdr->seq * 31 + hdr->thread * 7 + i);
+}
+
+
+/**
+ * Build the next message of a thread
+ *
+ * @param t The thread
+ * @param buf Buffer of #BRIDGE_MAX_RECORD_SIZE bytes
+ * @return Size of the message
+ */
+static size_t
+producer_build (const struct Producer_Thread *t, char *buf)
+{
+  struct Producer_Message_Header *hdr = (struct Producer_Message_Header *) buf;
+  uint8_t *pattern = (uint8_t *) &hdr[1];
+  uint32_t i;
+
+  hdr->magic = PRODUCER_MAGIC;
+  hdr->thread = t->index;
+  hdr->seq = t->published;
+  hdr->length = PRODUCER_MIN_PAYLOAD
+      + (t->published * 37 + t->index * 11) % PRODUCER_PAYLOAD_SPREAD;
+  for (i = 0; i < hdr->length; i++)
+  {
+    pattern[i] = producer_pattern (hdr, i);
+  }
+  return sizeof (struct Producer_Message_Header) + hdr->length;
+}
+
+
+/**
+ * Check a received message and count it if it is one of our own
+ *
+ * @param t The thread
+ * @param receiver Index of the subscriber bridge the message came from
+ * @param data The message
+ * @param size Size of @a data
+ */
+static void
+producer_check (struct Producer_Thread *t,
+                unsigned int receiver,
+                const char *data,
+                size_t size)
+{
+  const struct Producer_Message_Header *hdr = (const struct Producer_Message_Header *) data;
+  const uint8_t *pattern = (const uint8_t *) &hdr[1];
+  uint32_t i;
+
+  if ((sizeof (struct Producer_Message_Header) > size)
+      || (PRODUCER_MAGIC != hdr->magic)
+      || (size != sizeof (struct Producer_Message_Header) + hdr->length))
+  {
+    t->corrupt++;
+    return;
+  }
+  for (i = 0; i < hdr->length; i++)
+  {
+    if (producer_pattern (hdr, i) != pattern[i])
+    {
+      t->corrupt++;
+      return;
+    }
+  }
+  // Retained copies and messages of other threads are not counted
+  if ((hdr->thread != t->index)
+      || (hdr->seq >= PRODUCER_MAX_MESSAGES)
+      || (0 != t->seen[receiver][hdr->seq]))
+  {
+    return;
+  }
+  t->seen[receiver][hdr->seq] = 1;
+  if (++t->returned[receiver] != t->producer->count)
+  {
+    return;
+  }
+  if (++t->complete == t->producer->num_receivers)
+  {
+    t->verified = GNUNET_YES;
+  }
+}
+
+
+/**
+ * Take all messages waiting on the lane of a thread of one subscriber bridge
+ *
+ * @param t The thread
+ * @param receiver Index of the subscriber bridge
+ * @return #GNUNET_OK to go on, #GNUNET_SYSERR if the lane is stuck
+ */
+static int
+producer_receive (struct Producer_Thread *t, unsigned int receiver)
+{
+  struct Producer *producer = t->producer;
+  char topic[BRIDGE_MAX_RECORD_SIZE];
+  char data[BRIDGE_MAX_RECORD_SIZE];
+  ssize_t size;
+
+  while (BRIDGE_RECEIVE_EMPTY != (size = bridge_receive (producer->receive_bridges[receiver],
+                                                         t->index,
+                                                         topic,
+                                                         sizeof (topic),
+                                                         data,
+                                                         sizeof (data))))
+  {
+    if (BRIDGE_RECEIVE_TOO_SMALL == size)
+    {
+      /* Can not happen with buffers of the maximum record size */
+      return GNUNET_SYSERR;
+    }
+    // Subscribers have to tell the topic a message was published to
+    if (0 != strcmp (topic, producer->topic))
+    {
+      t->corrupt++;
+      continue;
+    }
+    producer_check (t, receiver, data, size);
+  }
+  return GNUNET_OK;
+}
+
+
+/**
+ * Main loop of a producer thread
+ *
+ * @param cls The Producer_Thread
+ * @return NULL
+ */
+static void *
+producer_thread (void *cls)
+{
+  static const char finished = 1;
+  struct Producer_Thread *t = (struct Producer_Thread *) cls;
+  struct Producer *producer = t->producer;
+  char buf[BRIDGE_MAX_RECORD_SIZE];
+  struct pollfd fds[PRODUCER_MAX_RECEIVERS + 1];
+  unsigned long long next = producer_now_ms ();
+  unsigned long long now;
+  unsigned int i;
+  size_t size;
+
+  fds[0].fd = producer->stop_pipe[0];
+  fds[0].events = POLLIN;
+  for (i = 0; i < producer->num_receivers; i++)
+  {
+    fds[i + 1].fd = bridge_receive_fd (producer->receive_bridges[i], t->index);
+    fds[i + 1].events = POLLIN;
+  }
+  while (GNUNET_YES != t->verified)
+  {
+    now = producer_now_ms ();
+    if (now >= next)
+    {
+      if (PRODUCER_MAX_MESSAGES == t->published)
+      {
+        break;
+      }
+      size = producer_build (t, buf);
+      switch (bridge_publish (producer->publish_bridge,
+                              t->index,
+                              producer->topic,
+                              buf,
+                              size))
+      {
+      case GNUNET_OK:
+        t->published++;
+        break;
+      case GNUNET_NO:
+        /* Lane full, try again next interval */
+        break;
+      default:
+        t->published = PRODUCER_MAX_MESSAGES;
+        break;
+      }
+      next = now + producer->interval_ms;
+    }
+    if ((-1 == poll (fds,
+                     producer->num_receivers + 1,
+                     (int) (next - GNUNET_MIN (next, producer_now_ms ()))))
+        && (EINTR != errno))
+    {
+      break;
+    }
+    if (0 != (fds[0].revents & POLLIN))
+    {
+      break;
+    }
+    for (i = 0; i < producer->num_receivers; i++)
+    {
+      if (GNUNET_OK != producer_receive (t, i))
+      {
+        break;
+      }
+    }
+    if (i < producer->num_receivers)
+    {
+      break;
+    }
+  }
+
+  if (1 == atomic_fetch_sub (&producer->running, 1))
+  {
+    GNUNET_DISK_file_write (GNUNET_DISK_pipe_handle (producer->done_pipe,
+                                                     GNUNET_DISK_PIPE_END_WRITE),
+                            &finished,
+                            sizeof (finished));
+  }
+  return NULL;
+}
+
+
+/**
+ * Report the result once all threads finished
+ *
+ * @param cls The Producer
+ * @param tc Task context
+ */
+static void
+producer_finished (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  struct Producer *producer = (struct Producer *) cls;
+  unsigned long long corrupt = 0;
+  unsigned int verified = 0;
+  unsigned int i;
+
+  producer->done_task = GNUNET_SCHEDULER_NO_TASK;
+  if (0 != (tc->reason & GNUNET_SCHEDULER_REASON_SHUTDOWN))
+  {
+    return;
+  }
+  for (i = 0; i < producer->num_threads; i++)
+  {
+    pthread_join (producer->threads[i].thread, NULL);
+    producer->threads[i].started = GNUNET_NO;
+    corrupt += producer->threads[i].corrupt;
+    if (GNUNET_YES == producer->threads[i].verified)
+    {
+      verified++;
+    }
+  }
+  producer->done (producer->done_cls, verified, corrupt);
+}
+
+
+struct Producer *
+producer_start (struct Bridge *publish_bridge,
+                struct Bridge *const *receive_bridges,
+                unsigned int num_receivers,
+                unsigned int threads,
+                const char *topic,
+                unsigned int count,
+                struct GNUNET_TIME_Relative interval,
+                Producer_Done_Callback done,
+                void *done_cls)
+{
+  struct Producer *producer;
+  unsigned int i;
+
+  GNUNET_assert ((0 < threads)
+                 && (0 < count) && (count <= PRODUCER_MAX_MESSAGES)
+                 && (0 < num_receivers) && (num_receivers <= PRODUCER_MAX_RECEIVERS));
+  producer = GNUNET_new (struct Producer);
+  producer->publish_bridge = publish_bridge;
+  memcpy (producer->receive_bridges,
+          receive_bridges,
+          num_receivers * sizeof (struct Bridge *));
+  producer->num_receivers = num_receivers;
+  producer->topic = GNUNET_strdup (topic);
+  producer->count = count;
+  producer->interval_ms = interval.rel_value_us / 1000;
+  producer->num_threads = threads;
+  producer->done = done;
+  producer->done_cls = done_cls;
+  producer->threads = GNUNET_malloc (threads * sizeof (struct Producer_Thread));
+  producer->stop_pipe[0] = -1;
+  producer->stop_pipe[1] = -1;
+  atomic_init (&producer->running, threads);
+
+  producer->done_pipe = GNUNET_DISK_pipe (GNUNET_NO, GNUNET_NO, GNUNET_NO, GNUNET_NO);
+  if ((NULL == producer->done_pipe)
+      || (0 != pipe (producer->stop_pipe)))
+  {
+    producer_stop (producer);
+    return NULL;
+  }
+  for (i = 0; i < threads; i++)
+  {
+    producer->threads[i].producer = producer;
+    producer->threads[i].index = i;
+    if (0 != pthread_create (&producer->threads[i].thread,
+                             NULL,
+                             &producer_thread,
+                             &producer->threads[i]))
+    {
+      producer_stop (producer);
+      return NULL;
+    }
+    producer->threads[i].started = GNUNET_YES;
+  }
+  producer->done_task =
+      GNUNET_SCHEDULER_add_read_file (GNUNET_TIME_UNIT_FOREVER_REL,
+                                      GNUNET_DISK_pipe_handle (producer->done_pipe,
+                                                               GNUNET_DISK_PIPE_END_READ),
+                                      &producer_finished,
+                                      producer);
+  return producer;
+}
+
+
+void
+producer_stop (struct Producer *producer)
+{
+  static const char stop = 1;
+  unsigned int i;
+
+  if (NULL == producer)
+  {
+    return;
+  }
+  if (GNUNET_SCHEDULER_NO_TASK != producer->done_task)
+  {
+    GNUNET_SCHEDULER_cancel (producer->done_task);
+    producer->done_task = GNUNET_SCHEDULER_NO_TASK;
+  }
+  if (-1 != producer->stop_pipe[1])
+  {
+    /* Never read, so every thread sees it */
+    if (-1 == write (producer->stop_pipe[1], &stop, sizeof (stop)))
+    {
+      GNUNET_break (0);
+    }
+  }
+  for (i = 0; i < producer->num_threads; i++)
+  {
+    if (GNUNET_YES == producer->threads[i].started)
+    {
+      pthread_join (producer->threads[i].thread, NULL);
+    }
+  }
+  if (-1 != producer->stop_pipe[0])
+  {
+    close (producer->stop_pipe[0]);
+    close (producer->stop_pipe[1]);
+  }
+  if (NULL != producer->done_pipe)
+  {
+    GNUNET_DISK_pipe_close (producer->done_pipe);
+  }
+  GNUNET_free (producer->threads);
+  GNUNET_free (producer->topic);
+  GNUNET_free (producer);
+}
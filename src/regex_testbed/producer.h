@@ -0,0 +1,87 @@
+#ifndef PRODUCER_H
+#define PRODUCER_H
+
+#include <gnunet/platform.h>
+#include <gnunet/gnunet_util_lib.h>
+#include "bridge.h"
+
+
+/**
+ * Largest number of messages one producer thread publishes before it gives
+ * up waiting for its messages to come back
+ */
+#define PRODUCER_MAX_MESSAGES 1024
+
+
+/**
+ * Largest number of subscriber bridges a producer reads
+ */
+#define PRODUCER_MAX_RECEIVERS 4
+
+
+/**
+ * Application threads driving a publisher and its subscribers end to end.
+ *
+ * Every thread owns the lane of its index on all bridges. It publishes a
+ * numbered, self-checking message through the publisher bridge every
+ * interval and reads the subscriber bridges with #bridge_receive in between,
+ * until it got the requested number of its own messages back from every
+ * subscriber. Messages of other threads are checked as well but not counted,
+ * messages delivered with another topic than the published one are corrupt.
+ */
+struct Producer;
+
+
+/**
+ * Called from the scheduler once all threads finished
+ *
+ * @param cls Closure
+ * @param verified Number of threads that got all of their messages back
+ *        from every subscriber
+ * @param corrupt Number of received messages that failed the check
+ */
+typedef void
+(*Producer_Done_Callback) (void *cls,
+                           unsigned int verified,
+                           unsigned long long corrupt);
+
+
+/**
+ * Start the producer threads. Must be called from the scheduler.
+ *
+ * @param publish_bridge Bridge of the publisher, at least @a threads lanes
+ * @param receive_bridges Bridges of the subscribers, each with at least
+ *        @a threads lanes
+ * @param num_receivers Number of @a receive_bridges, at most
+ *        #PRODUCER_MAX_RECEIVERS
+ * @param threads Number of threads to start
+ * @param topic Topic to publish to
+ * @param count Number of its own messages every thread has to get back, at
+ *        most #PRODUCER_MAX_MESSAGES
+ * @param interval Time between two messages of a thread
+ * @param done Called once all threads finished
+ * @param done_cls Closure for @a done
+ * @return The producer, NULL if the threads could not be started
+ */
+struct Producer *
+producer_start (struct Bridge *publish_bridge,
+                struct Bridge *const *receive_bridges,
+                unsigned int num_receivers,
+                unsigned int threads,
+                const char *topic,
+                unsigned int count,
+                struct GNUNET_TIME_Relative interval,
+                Producer_Done_Callback done,
+                void *done_cls);
+
+
+/**
+ * Stop and join the threads. Must be called from the scheduler before the
+ * bridges are destroyed. @a done is not called anymore.
+ *
+ * @param producer The producer, may be NULL
+ */
+void
+producer_stop (struct Producer *producer);
+
+#endif
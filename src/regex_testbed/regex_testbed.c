@@ -1,9 +1,24 @@
+#include <limits.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <gnunet/platform.h>
 #include <gnunet/gnunet_util_lib.h>
 #include <gnunet/gnunet_testbed_service.h>
 #include <gnunet/gnunet_dht_service.h>
 #include <gnunet/gnunet_regex_service.h>
+#include "arena.h"
+#include "bridge.h"
+#include "codec.h"
+#include "compression.h"
+#include "credit.h"
+#include "matcher.h"
+#include "merkle.h"
+#include "message.h"
+#include "metrics.h"
+#include "producer.h"
+#include "retained.h"
+#include "shard.h"
+#include "topic_filter.h"
 
 
 /**
@@ -36,15 +51,270 @@
  */
 #define LOG_WARNING(...) LOG (GNUNET_ERROR_TYPE_WARNING, __VA_ARGS__)
 /**
- * Number of peers we want to start
+ * Number of peers we want to start unless PEERS says otherwise
  *
- * 1 Publisher, 1 Suscriber so far.
+ * 1 Publisher, 1 Suscriber so far, any further peers only run the DHT.
  */
 #define NUM_PEERS 2
+/**
+ * Template configuration used if none is given on the command line
+ */
+#define TEMPLATE_DEFAULT "regex_testbed.conf"
 /**
  * Dunno, this value was taken from the testbed_test example
  */
 #define HT_LENGTH_DEFAULT 10
+/**
+ * Default time between two messages of a producer thread
+ */
+#define PRODUCER_INTERVAL_DEFAULT GNUNET_TIME_UNIT_SECONDS
+/**
+ * Largest message of the bridge once encoded, with its topic in front
+ */
+#define PUBLISHER_MAX_MESSAGE \
+  (sizeof (struct Message_Header) + BRIDGE_MAX_RECORD_SIZE + CODEC_MAX_OVERHEAD)
+/**
+ * Maximum payload a publisher puts next to its identity in one DHT block, an
+ * encoded message and its signature envelope
+ */
+#define PUBLISHER_MAX_PAYLOAD (PUBLISHER_MAX_MESSAGE + MERKLE_MAX_ENVELOPE)
+/**
+ * Largest block a publisher puts into the DHT
+ */
+#define PUBLISHER_MAX_BLOCK \
+  (sizeof (struct GNUNET_PeerIdentity) + PUBLISHER_MAX_PAYLOAD)
+/**
+ * Default number of PUTs a topic may have in flight
+ */
+#define PUBLISHER_TOPIC_CREDITS 16
+/**
+ * Default number of PUTs all publishers of a node may have in flight
+ */
+#define PUBLISHER_NODE_CREDITS 64
+/**
+ * Default number of PUTs all control topics of a node may have in flight
+ */
+#define PUBLISHER_CONTROL_CREDITS 16
+/**
+ * Default number of queued control PUTs sent per bulk PUT while draining
+ */
+#define PUBLISHER_CONTROL_WEIGHT 4
+/**
+ * Default number of PUTs a control topic queues while out of credit
+ */
+#define PUBLISHER_CONTROL_QUEUE_LENGTH 16
+/**
+ * Default timeout of control PUTs, commands arriving later are stale
+ */
+#define PUBLISHER_CONTROL_TIMEOUT \
+  GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_SECONDS, 5)
+/**
+ * Default number of PUTs all bulk topics of a node may have in flight, less
+ * than #PUBLISHER_NODE_CREDITS so control PUTs always find credit
+ */
+#define PUBLISHER_BULK_CREDITS 48
+/**
+ * Default weight of the bulk class while draining
+ */
+#define PUBLISHER_BULK_WEIGHT 1
+/**
+ * Default number of PUTs a bulk topic queues while out of credit
+ */
+#define PUBLISHER_BULK_QUEUE_LENGTH 128
+/**
+ * Default timeout of bulk PUTs
+ */
+#define PUBLISHER_BULK_TIMEOUT \
+  GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_MINUTES, 1)
+/**
+ * How long a signing publisher collects messages before signing them together
+ */
+#define PUBLISHER_BATCH_DELAY \
+  GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_MILLISECONDS, 5)
+/**
+ * How long a publisher waits before putting a dictionary again that the DHT
+ * did not take
+ */
+#define PUBLISHER_DICTIONARY_RETRY_DELAY GNUNET_TIME_UNIT_SECONDS
+/**
+ * Number of verified batch roots a subscriber remembers
+ */
+#define SUBSCRIBER_ROOT_CACHE_SIZE 256
+/**
+ * Number of received messages a subscriber keeps while it looks up the
+ * dictionaries they were compressed with
+ */
+#define SUBSCRIBER_MAX_PENDING 64
+/**
+ * How long a subscriber looks for a dictionary before dropping the messages
+ * waiting for it
+ */
+#define SUBSCRIBER_DICTIONARY_TIMEOUT \
+  GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_SECONDS, 30)
+/**
+ * Number of topics whose retained message is cached per peer
+ */
+#define RETAINED_CACHE_SIZE 64
+/**
+ * How long a cached retained message is served without asking the DHT
+ */
+#define RETAINED_CACHE_TTL \
+  GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_MINUTES, 5)
+/**
+ * How long a subscriber collects retained messages before it delivers the
+ * newest one of every topic
+ */
+#define RETAINED_GET_WINDOW \
+  GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_SECONDS, 5)
+/**
+ * How often metrics are flushed to the statistics service by default
+ */
+#define NODE_METRICS_INTERVAL GNUNET_TIME_UNIT_SECONDS
+/**
+ * How long a subscriber waits before changing its subscription to the
+ * RESUBSCRIBE filter by default
+ */
+#define SUBSCRIBER_RESUBSCRIBE_DELAY \
+  GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_SECONDS, 10)
+
+
+struct Publisher_Config;
+
+
+/**
+ * A DHT PUT of the publisher that is still in flight
+ */
+struct Publisher_Put {
+  /**
+   * Kept in a DLL
+   */
+  struct Publisher_Put *prev;
+  /**
+   * Kept in a DLL
+   */
+  struct Publisher_Put *next;
+  /**
+   * The publisher that issued the PUT
+   */
+  struct Publisher_Config *pconf;
+  /**
+   * The handle for the DHT put operation
+   */
+  struct GNUNET_DHT_PutHandle *handle;
+  /**
+   * When the PUT was issued
+   */
+  struct GNUNET_TIME_Absolute start;
+};
+
+
+/**
+ * A dictionary a publisher puts into the DHT until the DHT took it. It is
+ * followed by the block, signed if the publisher signs.
+ */
+struct Publisher_Dictionary {
+  /**
+   * The publisher that trained the dictionary
+   */
+  struct Publisher_Config *pconf;
+  /**
+   * The DHT key of the dictionary
+   */
+  struct GNUNET_HashCode key;
+  /**
+   * Id of the dictionary
+   */
+  uint32_t id;
+  /**
+   * Size of the block
+   */
+  size_t size;
+  /**
+   * The running PUT, NULL while waiting to retry
+   */
+  struct GNUNET_DHT_PutHandle *handle;
+  /**
+   * Task putting the dictionary again
+   */
+  GNUNET_SCHEDULER_TaskIdentifier retry_task;
+};
+
+
+/**
+ * Priority classes of topics, most urgent first
+ */
+enum Publisher_Priority {
+  /**
+   * Small command messages that must not wait behind bulk traffic
+   */
+  PUBLISHER_PRIORITY_CONTROL,
+  /**
+   * Everything else, e.g. telemetry
+   */
+  PUBLISHER_PRIORITY_BULK,
+  /**
+   * Number of classes
+   */
+  PUBLISHER_PRIORITIES
+};
+
+
+/**
+ * Metrics publishers and subscribers publish through the statistics service
+ * of their peer, see #node_metrics
+ */
+enum Node_Metric {
+  NODE_METRIC_SEARCHES,
+  NODE_METRIC_SEARCH_RESULTS,
+  NODE_METRIC_SEARCH_DUPLICATES,
+  NODE_METRIC_PUBLISHED,
+  NODE_METRIC_PUTS,
+  NODE_METRIC_PUTS_REJECTED,
+  NODE_METRIC_PUT_TIMEOUTS,
+  NODE_METRIC_PUTS_IN_FLIGHT,
+  /**
+   * Queue depth of the first priority class, the others follow in the order
+   * of #Publisher_Priority
+   */
+  NODE_METRIC_CLASS_QUEUED,
+  NODE_METRIC_PUT_LATENCY = NODE_METRIC_CLASS_QUEUED + PUBLISHER_PRIORITIES,
+  NODE_METRIC_MONITORS,
+  NODE_METRIC_MONITOR_HITS,
+  NODE_METRIC_DELIVERED,
+  NODE_METRIC_DELIVERY_DROPPED,
+  NODE_METRIC_REJECTED,
+  NODE_METRIC_RETAINED_DUPLICATES,
+  NODE_METRIC_RETAINED_LATENCY,
+  NODE_METRIC_PENDING,
+  NODE_METRIC_DICTIONARY_LATENCY,
+  NODE_METRIC_RECORDS,
+  NODE_METRIC_RECORD_SYSTEM_ALLOCS,
+  NODE_METRIC_RECORD_BYTES,
+  NODE_METRIC_RESUBSCRIBE_MISCOUNTS,
+  /**
+   * Number of metrics
+   */
+  NODE_METRICS
+};
+
+
+/**
+ * The budget and PUT options shared by the topics of one priority class
+ */
+struct Publisher_Class {
+  /**
+   * In-flight budget and drain weight of the class within the node
+   */
+  struct Credit_Class *credits;
+  /**
+   * Number of PUTs each topic of the class queues while out of credit
+   */
+  unsigned int queue_length;
+  /**
+   * Timeout of the PUTs of the class
+   */
+  struct GNUNET_TIME_Relative timeout;
+};
 
 
 /**
@@ -71,13 +341,227 @@ struct Publisher_Config {
    */
   struct GNUNET_REGEX_Search *regex_search;
   /**
-   * The handle for the DHT put operation
+   * Head of the DLL of PUTs in flight
+   */
+  struct Publisher_Put *put_head;
+  /**
+   * Tail of the DLL of PUTs in flight
+   */
+  struct Publisher_Put *put_tail;
+  /**
+   * Allocator of the Publisher_Put records, created with the first PUT
+   */
+  struct Arena *put_arena;
+  /**
+   * Accepting state keys of all subscribers found by the search. Every
+   * published message is put under each of them.
+   */
+  struct GNUNET_CONTAINER_MultiHashMap *subscriber_keys;
+  /**
+   * Bridge application threads publish through
    */
-  struct GNUNET_DHT_PutHandle *put_handle;
+  struct Bridge *bridge;
   /**
    * The publishers identity as determined from the configuration
    */
   struct GNUNET_PeerIdentity identity;
+  /**
+   * Worker processes the topics are handed to if the node runs sharded
+   */
+  struct Shard_Pool *shard_pool;
+  /**
+   * Connection to the node if this publisher runs inside a shard worker
+   */
+  struct Shard_Worker *shard_worker;
+  /**
+   * #GNUNET_YES if published messages are also stored as the retained message
+   * of the topic
+   */
+  int retain;
+  /**
+   * In-flight budget of the topic, every DHT PUT goes through it
+   */
+  struct Credit_Lane *credits;
+  /**
+   * What happens to publishes while the topic is out of credit
+   */
+  enum Credit_Policy flow_policy;
+  /**
+   * Priority class of the topic
+   */
+  struct Publisher_Class *priority;
+  /**
+   * Key messages are signed with, NULL if the publisher does not sign
+   */
+  struct GNUNET_CRYPTO_EddsaPrivateKey *private_key;
+  /**
+   * Messages waiting to be signed together
+   */
+  struct Merkle_Batch *batch;
+  /**
+   * Task signing and sending @e batch
+   */
+  GNUNET_SCHEDULER_TaskIdentifier batch_task;
+  /**
+   * Compresses the messages of the topic, NULL if they are sent plain
+   */
+  struct Codec_Encoder *encoder;
+  /**
+   * Trained dictionary not taken by the DHT yet, NULL if there is none
+   */
+  struct Publisher_Dictionary *dictionary;
+  /**
+   * Metrics of the publisher, NULL if disabled
+   */
+  struct Metrics *metrics;
+};
+
+
+/**
+ * A running DHT monitor for one accepting state of the subscription
+ */
+struct Subscriber_Monitor {
+  /**
+   * Kept in a DLL
+   */
+  struct Subscriber_Monitor *prev;
+  /**
+   * Kept in a DLL
+   */
+  struct Subscriber_Monitor *next;
+  /**
+   * The accepting state key that is monitored
+   */
+  struct GNUNET_HashCode key;
+  /**
+   * Handle to the DHT monitor
+   */
+  struct GNUNET_DHT_MonitorHandle *handle;
+  /**
+   * Value of the monitor generation of the subscriber when the key was last
+   * found accepting
+   */
+  unsigned int generation;
+};
+
+
+struct Subscriber_Config;
+
+
+/**
+ * A received message waiting for the dictionary it was compressed with
+ */
+struct Subscriber_Pending {
+  /**
+   * Kept in a DLL
+   */
+  struct Subscriber_Pending *prev;
+  /**
+   * Kept in a DLL
+   */
+  struct Subscriber_Pending *next;
+  /**
+   * The DHT key of the dictionary
+   */
+  struct GNUNET_HashCode dictionary;
+  /**
+   * The publisher of the message
+   */
+  struct GNUNET_PeerIdentity publisher;
+  /**
+   * Size of the encoded message following this struct
+   */
+  size_t size;
+};
+
+
+/**
+ * A running DHT GET for a dictionary of a publisher
+ */
+struct Subscriber_Dictionary_Get {
+  /**
+   * Kept in a DLL
+   */
+  struct Subscriber_Dictionary_Get *prev;
+  /**
+   * Kept in a DLL
+   */
+  struct Subscriber_Dictionary_Get *next;
+  /**
+   * The subscriber looking up the dictionary
+   */
+  struct Subscriber_Config *sconf;
+  /**
+   * The DHT key of the dictionary
+   */
+  struct GNUNET_HashCode key;
+  /**
+   * The publisher of the dictionary
+   */
+  struct GNUNET_PeerIdentity publisher;
+  /**
+   * Id of the dictionary
+   */
+  uint32_t id;
+  /**
+   * Handle to the DHT GET
+   */
+  struct GNUNET_DHT_GetHandle *handle;
+  /**
+   * Task giving up on the dictionary
+   */
+  GNUNET_SCHEDULER_TaskIdentifier timeout_task;
+  /**
+   * When the lookup started
+   */
+  struct GNUNET_TIME_Absolute start;
+};
+
+
+/**
+ * A running DHT GET for the retained message of one topic
+ */
+struct Subscriber_Retained_Get {
+  /**
+   * Kept in a DLL
+   */
+  struct Subscriber_Retained_Get *prev;
+  /**
+   * Kept in a DLL
+   */
+  struct Subscriber_Retained_Get *next;
+  /**
+   * The subscriber looking up the message
+   */
+  struct Subscriber_Config *sconf;
+  /**
+   * The retained key of the topic
+   */
+  struct GNUNET_HashCode key;
+  /**
+   * Publish time of the newest message found so far
+   */
+  struct GNUNET_TIME_Absolute newest;
+  /**
+   * Publisher of the newest message
+   */
+  struct GNUNET_PeerIdentity publisher;
+  /**
+   * The newest message as opened by #subscriber_open, NULL if none was found
+   */
+  void *data;
+  /**
+   * Size of @e data
+   */
+  size_t size;
+  /**
+   * When the lookup started
+   */
+  struct GNUNET_TIME_Absolute start;
+  /**
+   * Handle to the DHT GET
+   */
+  struct GNUNET_DHT_GetHandle *handle;
 };
 
 
@@ -90,7 +574,7 @@ struct Subscriber_Config {
    *
    * Note that the subscriber is right now limited to one subscription only!
    */
-  char *topic;
+  const char *topic;
   struct GNUNET_TESTBED_Operation *op;
   /**
    * size of the internal hash table to use for processing multiple GET/FIND
@@ -110,41 +594,423 @@ struct Subscriber_Config {
    * Handle to the subscription announcement
    */
   struct GNUNET_REGEX_Announcement *regex_announcement;
-};
-
-
-/**
- * The result of the tesbed simulation.
- *
- * Either GNUNET_OK or GNUNET_SYSERR
- */
-static int result = GNUNET_SYSERR;
-/**
- * The main cls for the publisher.
- */
-static struct Publisher_Config publisher_conf;
-/**
- * The main cls for the subscriber
- */
-static struct Subscriber_Config subscriber_conf;
-/**
- * Handle to the shutdown task. Used for scheduling
- */
-static GNUNET_SCHEDULER_TaskIdentifier shutdown_tid = GNUNET_SCHEDULER_NO_TASK;
-
-
-/**
- * Function run on CTRL-C or shutdown (i.e. success/timeout/etc.).
- * Cleans up.
+  /**
+   * MQTT filters subscribed to on this node, merged by equivalence
+   */
+  struct Topic_Filter_Set *filters;
+  /**
+   * The entry of the subscription in @e filters if it was given as an MQTT
+   * filter, its regex is then used as @e topic
+   */
+  struct Topic_Filter_Entry *filter_entry;
+  /**
+   * Size-classed allocator for all per-subscription bookkeeping records:
+   * monitors, dictionary and retained lookups and messages waiting for a
+   * dictionary. Destroying it releases all of them at once.
+   */
+  struct Arena_Pool *arena;
+  /**
+   * Counters of @e arena as last published through @e metrics
+   */
+  struct Arena_Stats arena_reported;
+  /**
+   * Bridge received messages are handed to application threads through
+   */
+  struct Bridge *bridge;
+  /**
+   * The subscription in the local matcher index
+   */
+  struct Matcher_Subscription *local_subscription;
+  /**
+   * Head of the DLL of running monitors
+   */
+  struct Subscriber_Monitor *monitor_head;
+  /**
+   * Tail of the DLL of running monitors
+   */
+  struct Subscriber_Monitor *monitor_tail;
+  /**
+   * The running monitors keyed by the accepting state they monitor
+   */
+  struct GNUNET_CONTAINER_MultiHashMap *monitors;
+  /**
+   * Counts the accepting state lookups. Monitors whose key was not found by
+   * the last lookup are stale.
+   */
+  unsigned int monitor_generation;
+  /**
+   * Announcement of the subscription being changed to, its accepting states
+   * are still looked up
+   */
+  struct GNUNET_REGEX_Announcement *update_announcement;
+  /**
+   * The entry in @e filters the subscription is being changed to
+   */
+  struct Topic_Filter_Entry *update_entry;
+  /**
+   * Task changing the subscription to the RESUBSCRIBE filter
+   */
+  GNUNET_SCHEDULER_TaskIdentifier update_task;
+  /**
+   * #GNUNET_YES once the subscription changed to the RESUBSCRIBE filter
+   * with the expected monitors started, stopped and kept
+   */
+  int resubscribed;
+  /**
+   * Head of the DLL of running retained message lookups
+   */
+  struct Subscriber_Retained_Get *retained_head;
+  /**
+   * Tail of the DLL of running retained message lookups
+   */
+  struct Subscriber_Retained_Get *retained_tail;
+  /**
+   * Task closing the window of the retained message lookups
+   */
+  GNUNET_SCHEDULER_TaskIdentifier retained_task;
+  /**
+   * Retained keys of all topics the subscription matches, NULL if it
+   * matches too many
+   */
+  struct GNUNET_HashCode *retained_keys;
+  /**
+   * Number of @e retained_keys
+   */
+  unsigned int retained_key_count;
+  /**
+   * Checks the signatures of received messages, NULL if they are not signed
+   */
+  struct Merkle_Verifier *verifier;
+  /**
+   * Decompresses received messages, NULL if they are not compressed
+   */
+  struct Codec_Decoder *decoder;
+  /**
+   * Head of the DLL of messages waiting for their dictionary
+   */
+  struct Subscriber_Pending *pending_head;
+  /**
+   * Tail of the DLL of messages waiting for their dictionary
+   */
+  struct Subscriber_Pending *pending_tail;
+  /**
+   * Number of messages waiting for their dictionary
+   */
+  unsigned int pending_count;
+  /**
+   * Head of the DLL of running dictionary lookups
+   */
+  struct Subscriber_Dictionary_Get *dictionary_head;
+  /**
+   * Tail of the DLL of running dictionary lookups
+   */
+  struct Subscriber_Dictionary_Get *dictionary_tail;
+  /**
+   * Metrics of the subscriber, NULL if disabled
+   */
+  struct Metrics *metrics;
+};
+
+
+/**
+ * Points in time of the testbed setup, reported once it is complete
+ */
+struct Setup_Timings {
+  /**
+   * When the binary started
+   */
+  struct GNUNET_TIME_Absolute start;
+  /**
+   * When the template was read and the testbed was asked to start
+   */
+  struct GNUNET_TIME_Absolute prepared;
+  /**
+   * When the last peer was started
+   */
+  struct GNUNET_TIME_Absolute peers_started;
+  /**
+   * When the last overlay link was established
+   */
+  struct GNUNET_TIME_Absolute links_ready;
+  /**
+   * When the testbed handed over to #run_test
+   */
+  struct GNUNET_TIME_Absolute testbed_ready;
+  /**
+   * Number of peers started
+   */
+  unsigned int peers;
+  /**
+   * Number of overlay links established
+   */
+  unsigned int links;
+};
+
+
+/**
+ * The result of the tesbed simulation.
+ *
+ * Either GNUNET_OK or GNUNET_SYSERR
+ */
+static int result = GNUNET_SYSERR;
+/**
+ * The main cls for the publisher.
+ */
+static struct Publisher_Config publisher_conf;
+/**
+ * The main cls for the subscriber
+ */
+static struct Subscriber_Config subscriber_conf;
+/**
+ * Subscriber on the publishers peer, served by #local_matcher
+ */
+static struct Subscriber_Config local_subscriber_conf;
+/**
+ * #GNUNET_YES if #local_subscriber_conf runs
+ */
+static int local_subscriber;
+/**
+ * #GNUNET_YES if the subscribers change to the RESUBSCRIBE filter, the run
+ * then only succeeds once they did
+ */
+static int resubscribe;
+/**
+ * Handle to the shutdown task. Used for scheduling
+ */
+static GNUNET_SCHEDULER_TaskIdentifier shutdown_tid = GNUNET_SCHEDULER_NO_TASK;
+/**
+ * Absolute path of our own binary, used to start shard workers
+ */
+static char *binary_name;
+/**
+ * Number of peers of the testbed
+ */
+static unsigned int testbed_peers = NUM_PEERS;
+/**
+ * Number of application threads, each owning one lane of the bridges of the
+ * publisher and the subscriber
+ */
+static unsigned int bridge_lanes = 1;
+/**
+ * Number of its own messages every producer thread has to get back
+ */
+static unsigned int produce_count = 1;
+/**
+ * #GNUNET_YES once every producer thread got its messages back intact
+ */
+static int producer_verified;
+/**
+ * Application threads publishing through the publisher and receiving
+ * through the subscriber
+ */
+static struct Producer *producer;
+/**
+ * Setup phases of the testbed
+ */
+static struct Setup_Timings setup_timings;
+/**
+ * Index of all subscriptions of this process. Publishes are matched against
+ * it first so subscribers on the publishing node get the message directly.
+ */
+static struct Matcher *local_matcher;
+/**
+ * Retained_Cache of every peer, holding the last retained message of topics
+ * recently looked up or published on that peer
+ */
+static struct GNUNET_CONTAINER_MultiPeerMap *retained_caches;
+/**
+ * In-flight budget shared by all publishers of this process
+ */
+static struct Credit_Pool *node_credits;
+/**
+ * Priority classes within #node_credits
+ */
+static struct Publisher_Class node_classes[PUBLISHER_PRIORITIES];
+/**
+ * Names and kinds of the #Node_Metric values
+ */
+static const struct Metrics_Definition node_metrics[NODE_METRICS] = {
+  [NODE_METRIC_SEARCHES] = { "# regex searches issued", METRICS_COUNTER },
+  [NODE_METRIC_SEARCH_RESULTS] = { "# regex results", METRICS_COUNTER },
+  [NODE_METRIC_SEARCH_DUPLICATES] = { "# duplicate regex results dropped", METRICS_COUNTER },
+  [NODE_METRIC_PUBLISHED] = { "# messages published", METRICS_COUNTER },
+  [NODE_METRIC_PUTS] = { "# DHT PUTs issued", METRICS_COUNTER },
+  [NODE_METRIC_PUTS_REJECTED] = { "# DHT PUTs rejected for lack of credit", METRICS_COUNTER },
+  [NODE_METRIC_PUT_TIMEOUTS] = { "# DHT PUTs timed out", METRICS_COUNTER },
+  [NODE_METRIC_PUTS_IN_FLIGHT] = { "# DHT PUTs in flight", METRICS_GAUGE },
+  [NODE_METRIC_CLASS_QUEUED + PUBLISHER_PRIORITY_CONTROL] = { "# control PUTs waiting for credit", METRICS_GAUGE },
+  [NODE_METRIC_CLASS_QUEUED + PUBLISHER_PRIORITY_BULK] = { "# bulk PUTs waiting for credit", METRICS_GAUGE },
+  [NODE_METRIC_PUT_LATENCY] = { "# DHT PUT latency", METRICS_HISTOGRAM },
+  [NODE_METRIC_MONITORS] = { "# DHT monitors running", METRICS_GAUGE },
+  [NODE_METRIC_MONITOR_HITS] = { "# DHT monitor PUTs seen", METRICS_COUNTER },
+  [NODE_METRIC_DELIVERED] = { "# messages delivered", METRICS_COUNTER },
+  [NODE_METRIC_DELIVERY_DROPPED] = { "# messages dropped by the application bridge", METRICS_COUNTER },
+  [NODE_METRIC_REJECTED] = { "# messages rejected", METRICS_COUNTER },
+  [NODE_METRIC_RETAINED_DUPLICATES] = { "# duplicate retained messages dropped", METRICS_COUNTER },
+  [NODE_METRIC_RETAINED_LATENCY] = { "# retained message lookup latency", METRICS_HISTOGRAM },
+  [NODE_METRIC_PENDING] = { "# messages waiting for dictionary", METRICS_GAUGE },
+  [NODE_METRIC_DICTIONARY_LATENCY] = { "# dictionary lookup latency", METRICS_HISTOGRAM },
+  [NODE_METRIC_RECORDS] = { "# subscriber records allocated", METRICS_COUNTER },
+  [NODE_METRIC_RECORD_SYSTEM_ALLOCS] = { "# subscriber record system allocations", METRICS_COUNTER },
+  [NODE_METRIC_RECORD_BYTES] = { "# subscriber record slab bytes", METRICS_GAUGE },
+  [NODE_METRIC_RESUBSCRIBE_MISCOUNTS] = { "# subscription changes with unexpected monitor counts", METRICS_COUNTER },
+};
+
+
+/**
+ * Free the budget of the node and its priority classes
+ */
+static void
+node_credits_destroy (void)
+{
+  unsigned int i;
+
+  /* Also frees the classes */
+  credit_pool_destroy (node_credits);
+  node_credits = NULL;
+  for (i = 0; i < PUBLISHER_PRIORITIES; i++)
+  {
+    node_classes[i].credits = NULL;
+  }
+}
+
+
+/**
+ * Set the queue depths of the priority classes before the metrics of a
+ * publisher are flushed
+ *
+ * @param cls NULL
+ * @param metrics The metrics of the publisher
+ */
+static void
+node_metrics_sample (void *cls, struct Metrics *metrics)
+{
+  unsigned int i;
+
+  for (i = 0; i < PUBLISHER_PRIORITIES; i++)
+  {
+    if (NULL != node_classes[i].credits)
+    {
+      metrics_gauge_set (metrics,
+                         NODE_METRIC_CLASS_QUEUED + i,
+                         credit_class_queued (node_classes[i].credits));
+    }
+  }
+}
+
+
+/**
+ * Connect the metrics of a publisher or subscriber to the statistics service
+ * of its peer, unless they are disabled
+ *
+ * @param cfg Configuration of the peer
+ * @param sample Called before every flush, may be NULL
+ * @param sample_cls Closure for @a sample
+ * @return The metrics, NULL if disabled or unavailable
+ */
+static struct Metrics *
+node_metrics_create (const struct GNUNET_CONFIGURATION_Handle *cfg,
+                     Metrics_Sample_Callback sample,
+                     void *sample_cls)
+{
+  struct GNUNET_TIME_Relative interval;
+  struct Metrics *metrics;
+
+  if (GNUNET_NO == GNUNET_CONFIGURATION_get_value_yesno (cfg,
+                                                         "regex-testbed",
+                                                         "METRICS"))
+  {
+    return NULL;
+  }
+  if (GNUNET_OK != GNUNET_CONFIGURATION_get_value_time (cfg,
+                                                        "regex-testbed",
+                                                        "METRICS_INTERVAL",
+                                                        &interval))
+  {
+    interval = NODE_METRICS_INTERVAL;
+  }
+  metrics = metrics_create (cfg,
+                            "regex-testbed",
+                            node_metrics,
+                            NODE_METRICS,
+                            interval,
+                            sample,
+                            sample_cls);
+  if (NULL == metrics)
+  {
+    LOG_WARNING ("Can not connect to statistics service, metrics disabled\n");
+  }
+  return metrics;
+}
+
+
+/**
+ * Get the retained message cache of a peer, creating it on first use
+ *
+ * @param peer The peer
+ * @return The cache, NULL if this process does not cache
+ */
+static struct Retained_Cache *
+node_retained_cache (const struct GNUNET_PeerIdentity *peer)
+{
+  struct Retained_Cache *cache;
+
+  if (NULL == retained_caches)
+  {
+    return NULL;
+  }
+  cache = GNUNET_CONTAINER_multipeermap_get (retained_caches, peer);
+  if (NULL == cache)
+  {
+    cache = retained_cache_create (RETAINED_CACHE_SIZE, RETAINED_CACHE_TTL);
+    GNUNET_CONTAINER_multipeermap_put (retained_caches,
+                                       peer,
+                                       cache,
+                                       GNUNET_CONTAINER_MULTIHASHMAPOPTION_UNIQUE_FAST);
+  }
+  return cache;
+}
+
+
+/**
+ * Free the retained message cache of a peer
+ *
+ * @param cls NULL
+ * @param key The peer
+ * @param value The Retained_Cache
+ * @return #GNUNET_YES to go on
+ */
+static int
+node_retained_cache_free (void *cls,
+                          const struct GNUNET_PeerIdentity *key,
+                          void *value)
+{
+  retained_cache_destroy ((struct Retained_Cache *) value);
+  return GNUNET_YES;
+}
+
+
+/**
+ * Function run on CTRL-C or shutdown (i.e. success/timeout/etc.).
+ * Cleans up.
  */
 static void
 shutdown_task (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
 {
+  // The threads use the bridges, so they go first
+  producer_stop (producer);
+  producer = NULL;
+
   if (NULL != subscriber_conf.op)
   {
     GNUNET_TESTBED_operation_done(subscriber_conf.op);
     subscriber_conf.op = NULL;
   }
+  if (NULL != local_subscriber_conf.op)
+  {
+    GNUNET_TESTBED_operation_done(local_subscriber_conf.op);
+    local_subscriber_conf.op = NULL;
+  }
 
   // shut down the publisher
   if (NULL != publisher_conf.op)
@@ -153,6 +1019,19 @@ shutdown_task (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
     publisher_conf.op = NULL;
   }
 
+  // all subscriptions are gone now
+  matcher_destroy (local_matcher);
+  local_matcher = NULL;
+  if (NULL != retained_caches)
+  {
+    GNUNET_CONTAINER_multipeermap_iterate (retained_caches,
+                                           &node_retained_cache_free,
+                                           NULL);
+    GNUNET_CONTAINER_multipeermap_destroy (retained_caches);
+    retained_caches = NULL;
+  }
+  node_credits_destroy ();
+
   /* Also kills the testbed */
   shutdown_tid = GNUNET_SCHEDULER_NO_TASK;
   GNUNET_SCHEDULER_shutdown ();
@@ -182,6 +1061,106 @@ schedule_shutdown_test (uint16_t seconds)
 }
 
 
+/**
+ * End the run successfully once everything it checks happened. Messages
+ * count only once they were verified and delivered to the application
+ * threads, seeing a PUT of the publisher is not enough. With RESUBSCRIBE
+ * every subscriber also has to have changed its subscription.
+ */
+static void
+test_check_done (void)
+{
+  if (GNUNET_YES != producer_verified)
+  {
+    return;
+  }
+  if ((GNUNET_YES == resubscribe)
+      && ((GNUNET_YES != subscriber_conf.resubscribed)
+          || ((GNUNET_YES == local_subscriber)
+              && (GNUNET_YES != local_subscriber_conf.resubscribed))))
+  {
+    return;
+  }
+  result = GNUNET_OK;
+  schedule_shutdown_test (0);
+}
+
+
+/**
+ * Called once all producer threads finished
+ *
+ * @param cls NULL
+ * @param verified Number of threads that got all of their messages back
+ * @param corrupt Number of received messages that failed the check
+ */
+static void
+producer_done (void *cls, unsigned int verified, unsigned long long corrupt)
+{
+  if ((verified != bridge_lanes) || (0 != corrupt))
+  {
+    LOG_ERROR ("%u of %u producer threads got their messages back, %llu corrupt messages\n",
+               verified, bridge_lanes, corrupt);
+    schedule_shutdown_test (0);
+    return;
+  }
+  LOG_DEBUG ("All %u producer threads got their %u messages back\n",
+             verified, produce_count);
+  producer_verified = GNUNET_YES;
+  test_check_done ();
+}
+
+
+/**
+ * Start the producer threads once the publisher and all subscribers have
+ * their bridges
+ */
+static void
+producer_try_start (void)
+{
+  struct Bridge *receivers[2];
+  unsigned int num_receivers = 0;
+  struct GNUNET_TIME_Relative interval;
+
+  if ((NULL != producer)
+      || (NULL == publisher_conf.bridge)
+      || (NULL == subscriber_conf.bridge)
+      || ((GNUNET_YES == local_subscriber)
+          && (NULL == local_subscriber_conf.bridge)))
+  {
+    return;
+  }
+  receivers[num_receivers++] = subscriber_conf.bridge;
+  if (GNUNET_YES == local_subscriber)
+  {
+    receivers[num_receivers++] = local_subscriber_conf.bridge;
+  }
+  if (GNUNET_OK != GNUNET_CONFIGURATION_get_value_time (publisher_conf.cfg,
+                                                        "regex-testbed",
+                                                        "PRODUCE_INTERVAL",
+                                                        &interval))
+  {
+    interval = PRODUCER_INTERVAL_DEFAULT;
+  }
+  producer = producer_start (publisher_conf.bridge,
+                             receivers,
+                             num_receivers,
+                             bridge_lanes,
+                             publisher_conf.topic,
+                             produce_count,
+                             interval,
+                             &producer_done,
+                             NULL);
+  if (NULL == producer)
+  {
+    LOG_ERROR ("Can not start %u producer threads\n", bridge_lanes);
+    schedule_shutdown_test (0);
+    return;
+  }
+  LOG_DEBUG ("Started %u producer threads publishing to \"%s\" for %u subscribers\n",
+             bridge_lanes, publisher_conf.topic, num_receivers);
+}
+
+
 /**
  * Callback called on each GET request going through the DHT.
  *
@@ -242,335 +1221,2726 @@ subscriber_monitor_get_response_cb (void *cls,
 
 
 /**
- * Callback called on each PUT request going through the DHT.
+ * Hand a received message to the application threads of a subscriber
+ *
+ * @param sconf The subscriber
+ * @param topic The topic the message was published to
+ * @param data The message payload
+ * @param size Size of @a data
+ */
+static void
+subscriber_deliver (struct Subscriber_Config *sconf,
+                    const char *topic,
+                    const void *data,
+                    size_t size)
+{
+  unsigned int lane;
+
+  if (NULL == sconf->bridge)
+  {
+    return;
+  }
+  // Every application thread gets every message of the subscription
+  for (lane = 0; lane < bridge_lanes; lane++)
+  {
+    if (GNUNET_OK != bridge_deliver (sconf->bridge, lane, topic, data, size))
+    {
+      LOG_WARNING ("Subscriber dropped message for thread %u, application is not keeping up\n",
+                   lane);
+      metrics_count (sconf->metrics, NODE_METRIC_DELIVERY_DROPPED, 1);
+      continue;
+    }
+    metrics_count (sconf->metrics, NODE_METRIC_DELIVERED, 1);
+  }
+}
+
+
+/**
+ * Check the signature of a received message if the subscriber verifies them
+ *
+ * @param sconf The subscriber
+ * @param publisher The publisher the message claims to come from
+ * @param data The received payload
+ * @param size Size of @a data
+ * @param message Set to the message inside @a data
+ * @param message_size Set to the size of @a message
+ * @return #GNUNET_OK if the message can be delivered
+ */
+static int
+subscriber_open (struct Subscriber_Config *sconf,
+                 const struct GNUNET_PeerIdentity *publisher,
+                 const void *data,
+                 size_t size,
+                 const void **message,
+                 size_t *message_size)
+{
+  if (NULL == sconf->verifier)
+  {
+    *message = data;
+    *message_size = size;
+    return GNUNET_OK;
+  }
+  if (GNUNET_OK != merkle_verifier_open (sconf->verifier,
+                                         &publisher->public_key,
+                                         data,
+                                         size,
+                                         message,
+                                         message_size))
+  {
+    LOG_WARNING ("Subscriber rejected message with bad signature from %s\n",
+                 GNUNET_i2s (publisher));
+    metrics_count (sconf->metrics, NODE_METRIC_REJECTED, 1);
+    return GNUNET_SYSERR;
+  }
+  return GNUNET_OK;
+}
+
+
+/**
+ * Connect a subscriber to the DHT unless it already is
+ *
+ * @param sconf The subscriber
+ * @return #GNUNET_OK if connected
+ */
+static int
+subscriber_connect_dht (struct Subscriber_Config *sconf)
+{
+  if (NULL != sconf->dht_handle)
+  {
+    return GNUNET_OK;
+  }
+  /* Use the provided configuration to connect to the dht */
+  sconf->dht_handle = GNUNET_DHT_connect (sconf->cfg, sconf->ht_length);
+  if (NULL == sconf->dht_handle)
+  {
+    LOG_ERROR ("Subscriber can not connect to DHT\n");
+    return GNUNET_SYSERR;
+  }
+  return GNUNET_OK;
+}
+
+
+/**
+ * Stop looking up a dictionary
+ *
+ * @param get The lookup
+ */
+static void
+subscriber_stop_dictionary_get (struct Subscriber_Dictionary_Get *get)
+{
+  struct Subscriber_Config *sconf = get->sconf;
+
+  GNUNET_CONTAINER_DLL_remove (sconf->dictionary_head,
+                               sconf->dictionary_tail,
+                               get);
+  if (GNUNET_SCHEDULER_NO_TASK != get->timeout_task)
+  {
+    GNUNET_SCHEDULER_cancel (get->timeout_task);
+  }
+  GNUNET_DHT_get_stop (get->handle);
+  arena_pool_free (sconf->arena, get, sizeof (struct Subscriber_Dictionary_Get));
+}
+
+
+/**
+ * Deliver or drop the messages waiting for a dictionary
+ *
+ * @param sconf The subscriber
+ * @param dictionary The DHT key of the dictionary
+ * @param deliver #GNUNET_YES if the dictionary was added to the decoder,
+ *        #GNUNET_NO to drop the messages
+ */
+static void
+subscriber_flush_pending (struct Subscriber_Config *sconf,
+                          const struct GNUNET_HashCode *dictionary,
+                          int deliver)
+{
+  struct Subscriber_Pending *pending;
+  struct Subscriber_Pending *next;
+  char message[BRIDGE_MAX_RECORD_SIZE];
+  size_t message_size;
+  size_t header_size;
+  const char *topic;
+  struct GNUNET_TIME_Absolute timestamp;
+  uint32_t missing;
+
+  for (pending = sconf->pending_head; NULL != pending; pending = next)
+  {
+    next = pending->next;
+    if (0 != memcmp (&pending->dictionary,
+                     dictionary,
+                     sizeof (struct GNUNET_HashCode)))
+    {
+      continue;
+    }
+    GNUNET_CONTAINER_DLL_remove (sconf->pending_head,
+                                 sconf->pending_tail,
+                                 pending);
+    sconf->pending_count--;
+    metrics_gauge_add (sconf->metrics, NODE_METRIC_PENDING, -1);
+    // The header was checked before the message was kept
+    header_size = message_read_header (&pending[1],
+                                       pending->size,
+                                       &topic,
+                                       &timestamp);
+    if ((GNUNET_YES == deliver)
+        && (GNUNET_OK == codec_decode (sconf->decoder,
+                                       &pending->publisher,
+                                       ((const char *) &pending[1]) + header_size,
+                                       pending->size - header_size,
+                                       message,
+                                       sizeof (message),
+                                       &message_size,
+                                       &missing)))
+    {
+      subscriber_deliver (sconf, topic, message, message_size);
+    }
+    arena_pool_free (sconf->arena,
+                     pending,
+                     sizeof (struct Subscriber_Pending) + pending->size);
+  }
+}
+
+
+/**
+ * Iterator called with the dictionary a subscriber looks up
+ *
+ * @param cls The Subscriber_Dictionary_Get
+ * @param exp when will this value expire
+ * @param key key of the result
+ * @param get_path peers on reply path (or NULL if not recorded)
+ * @param get_path_length number of entries in @a get_path
+ * @param put_path peers on the PUT path (or NULL if not recorded)
+ * @param put_path_length number of entries in @a put_path
+ * @param type type of the result
+ * @param size number of bytes in @a data
+ * @param data pointer to the result data
+ */
+static void
+subscriber_dictionary_result (void *cls,
+                              struct GNUNET_TIME_Absolute exp,
+                              const struct GNUNET_HashCode *key,
+                              const struct GNUNET_PeerIdentity *get_path,
+                              unsigned int get_path_length,
+                              const struct GNUNET_PeerIdentity *put_path,
+                              unsigned int put_path_length,
+                              enum GNUNET_BLOCK_Type type,
+                              size_t size,
+                              const void *data)
+{
+  struct Subscriber_Dictionary_Get *get = (struct Subscriber_Dictionary_Get *) cls;
+  struct Subscriber_Config *sconf = get->sconf;
+  struct GNUNET_HashCode dictionary = get->key;
+  const void *block;
+  size_t block_size;
+
+  // Anyone can put under the key, only a dictionary the publisher signed
+  // is used if messages are signed
+  if (GNUNET_OK != subscriber_open (sconf,
+                                    &get->publisher,
+                                    data,
+                                    size,
+                                    &block,
+                                    &block_size))
+  {
+    return;
+  }
+  if (GNUNET_OK != codec_decoder_add_dictionary (sconf->decoder,
+                                                 &get->publisher,
+                                                 get->id,
+                                                 block,
+                                                 block_size))
+  {
+    LOG_WARNING ("Subscriber got invalid dictionary %u from %s\n",
+                 get->id, GNUNET_i2s (&get->publisher));
+    return;
+  }
+  LOG_DEBUG ("Subscriber loaded dictionary %u of %s\n",
+             get->id, GNUNET_i2s (&get->publisher));
+  metrics_observe (sconf->metrics,
+                   NODE_METRIC_DICTIONARY_LATENCY,
+                   GNUNET_TIME_absolute_get_duration (get->start));
+  subscriber_stop_dictionary_get (get);
+  subscriber_flush_pending (sconf, &dictionary, GNUNET_YES);
+}
+
+
+/**
+ * Give up on a dictionary, dropping the messages waiting for it
+ *
+ * @param cls The Subscriber_Dictionary_Get
+ * @param tc Task context
+ */
+static void
+subscriber_dictionary_timeout (void *cls,
+                               const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  struct Subscriber_Dictionary_Get *get = (struct Subscriber_Dictionary_Get *) cls;
+  struct Subscriber_Config *sconf = get->sconf;
+  struct GNUNET_HashCode dictionary = get->key;
+
+  LOG_WARNING ("Subscriber did not find dictionary %u of %s\n",
+               get->id, GNUNET_i2s (&get->publisher));
+  get->timeout_task = GNUNET_SCHEDULER_NO_TASK;
+  subscriber_stop_dictionary_get (get);
+  subscriber_flush_pending (sconf, &dictionary, GNUNET_NO);
+}
+
+
+/**
+ * Keep a message until the dictionary it was compressed with is loaded,
+ * looking the dictionary up unless that already happens
+ *
+ * @param sconf The subscriber
+ * @param publisher The publisher of the message
+ * @param id Id of the dictionary
+ * @param data The encoded message
+ * @param size Size of @a data
+ */
+static void
+subscriber_wait_dictionary (struct Subscriber_Config *sconf,
+                            const struct GNUNET_PeerIdentity *publisher,
+                            uint32_t id,
+                            const void *data,
+                            size_t size)
+{
+  struct Subscriber_Dictionary_Get *get;
+  struct Subscriber_Pending *pending;
+  struct GNUNET_HashCode key;
+
+  if (SUBSCRIBER_MAX_PENDING == sconf->pending_count)
+  {
+    LOG_WARNING ("Subscriber dropped message waiting for dictionary %u\n", id);
+    return;
+  }
+  pending = arena_pool_alloc (sconf->arena,
+                              sizeof (struct Subscriber_Pending) + size);
+  if (NULL == pending)
+  {
+    LOG_WARNING ("Subscriber dropped oversized message waiting for dictionary %u\n",
+                 id);
+    return;
+  }
+  codec_dictionary_key (publisher, id, &key);
+  pending->dictionary = key;
+  pending->publisher = *publisher;
+  pending->size = size;
+  memcpy (&pending[1], data, size);
+  GNUNET_CONTAINER_DLL_insert_tail (sconf->pending_head,
+                                    sconf->pending_tail,
+                                    pending);
+  sconf->pending_count++;
+  metrics_gauge_add (sconf->metrics, NODE_METRIC_PENDING, 1);
+
+  for (get = sconf->dictionary_head; NULL != get; get = get->next)
+  {
+    if (0 == memcmp (&get->key, &key, sizeof (struct GNUNET_HashCode)))
+    {
+      return;
+    }
+  }
+  if (GNUNET_OK != subscriber_connect_dht (sconf))
+  {
+    subscriber_flush_pending (sconf, &key, GNUNET_NO);
+    return;
+  }
+  get = arena_pool_alloc (sconf->arena,
+                          sizeof (struct Subscriber_Dictionary_Get));
+  get->sconf = sconf;
+  get->key = key;
+  get->publisher = *publisher;
+  get->id = id;
+  get->start = GNUNET_TIME_absolute_get ();
+  get->handle = GNUNET_DHT_get_start (sconf->dht_handle,
+                                      GNUNET_BLOCK_TYPE_TEST,
+                                      &key,
+                                      2,
+                                      GNUNET_DHT_RO_NONE,
+                                      NULL,
+                                      0,
+                                      &subscriber_dictionary_result,
+                                      get);
+  if (NULL == get->handle)
+  {
+    LOG_WARNING ("Subscriber can not look up dictionary %u\n", id);
+    arena_pool_free (sconf->arena,
+                     get,
+                     sizeof (struct Subscriber_Dictionary_Get));
+    subscriber_flush_pending (sconf, &key, GNUNET_NO);
+    return;
+  }
+  get->timeout_task = GNUNET_SCHEDULER_add_delayed (SUBSCRIBER_DICTIONARY_TIMEOUT,
+                                                    &subscriber_dictionary_timeout,
+                                                    get);
+  GNUNET_CONTAINER_DLL_insert (sconf->dictionary_head,
+                               sconf->dictionary_tail,
+                               get);
+}
+
+
+/**
+ * Read the topic of a received message and decompress it if the
+ * subscriber's publishers compress
+ *
+ * @param sconf The subscriber
+ * @param publisher The publisher of the message
+ * @param data The payload as opened by #subscriber_open
+ * @param size Size of @a data
+ * @param buf Buffer of #BRIDGE_MAX_RECORD_SIZE bytes for the message
+ * @param topic Set to the topic the message was published to
+ * @param timestamp Set to when the message was published
+ * @param message Set to the message
+ * @param message_size Set to the size of @a message
+ * @return #GNUNET_OK if the message can be delivered, #GNUNET_NO if it waits
+ *         for its dictionary, #GNUNET_SYSERR if it is malformed
+ */
+static int
+subscriber_decode (struct Subscriber_Config *sconf,
+                   const struct GNUNET_PeerIdentity *publisher,
+                   const void *data,
+                   size_t size,
+                   char *buf,
+                   const char **topic,
+                   struct GNUNET_TIME_Absolute *timestamp,
+                   const void **message,
+                   size_t *message_size)
+{
+  size_t header_size;
+  uint32_t missing;
+
+  header_size = message_read_header (data, size, topic, timestamp);
+  if (0 == header_size)
+  {
+    LOG_WARNING ("Subscriber got malformed message from %s\n",
+                 GNUNET_i2s (publisher));
+    metrics_count (sconf->metrics, NODE_METRIC_REJECTED, 1);
+    return GNUNET_SYSERR;
+  }
+  if (NULL == sconf->decoder)
+  {
+    *message = ((const char *) data) + header_size;
+    *message_size = size - header_size;
+    return GNUNET_OK;
+  }
+  switch (codec_decode (sconf->decoder,
+                        publisher,
+                        ((const char *) data) + header_size,
+                        size - header_size,
+                        buf,
+                        BRIDGE_MAX_RECORD_SIZE,
+                        message_size,
+                        &missing))
+  {
+  case GNUNET_OK:
+    *message = buf;
+    return GNUNET_OK;
+  case GNUNET_NO:
+    subscriber_wait_dictionary (sconf, publisher, missing, data, size);
+    return GNUNET_NO;
+  default:
+    LOG_WARNING ("Subscriber got malformed compressed message from %s\n",
+                 GNUNET_i2s (publisher));
+    metrics_count (sconf->metrics, NODE_METRIC_REJECTED, 1);
+    return GNUNET_SYSERR;
+  }
+}
+
+
+/**
+ * Keep the retained message cache of a subscriber's peer fresh with a
+ * message received live, if the subscription uses retained messages
+ *
+ * @param sconf The subscriber
+ * @param topic The topic the message was published to
+ * @param timestamp When the message was published
+ * @param message The delivered message
+ * @param size Size of @a message
+ */
+static void
+subscriber_retain_live (struct Subscriber_Config *sconf,
+                        const char *topic,
+                        struct GNUNET_TIME_Absolute timestamp,
+                        const void *message,
+                        size_t size)
+{
+  struct Retained_Cache *cache = node_retained_cache (&sconf->identity);
+  struct GNUNET_HashCode key;
+
+  if ((NULL == cache) || (0 == sconf->retained_key_count))
+  {
+    return;
+  }
+  retained_key (topic, &key);
+  retained_cache_put (cache, &key, timestamp, message, size);
+}
+
+
+/**
+ * Callback called on each PUT request going through the DHT.
+ *
+ * @param cls Closure.
+ * @param options Options, for instance RecordRoute, DemultiplexEverywhere.
+ * @param type The type of data in the request.
+ * @param hop_count Hop count so far.
+ * @param path_length number of entries in @a path (or 0 if not recorded).
+ * @param path peers on the PUT path (or NULL if not recorded).
+ * @param desired_replication_level Desired replication level.
+ * @param exp Expiration time of the data.
+ * @param key Key under which data is to be stored.
+ * @param data Pointer to the data carried.
+ * @param size Number of bytes in data.
+ */
+void subscriber_monitor_put_cb (void *cls,
+    enum GNUNET_DHT_RouteOption options,
+    enum GNUNET_BLOCK_Type type,
+    uint32_t hop_count,
+    uint32_t desired_replication_level,
+    unsigned int path_length,
+    const struct GNUNET_PeerIdentity *path,
+    struct GNUNET_TIME_Absolute exp,
+    const struct GNUNET_HashCode *key,
+    const void *data,
+    size_t size)
+{
+  struct Subscriber_Config *sconf = (struct Subscriber_Config *) cls;
+  const struct GNUNET_PeerIdentity *publisher = (const struct GNUNET_PeerIdentity *) data;
+  char buf[BRIDGE_MAX_RECORD_SIZE];
+  const void *opened;
+  size_t opened_size;
+  const char *topic;
+  struct GNUNET_TIME_Absolute timestamp;
+  const void *message;
+  size_t message_size;
+
+  LOG_DEBUG("Subscriber monitor put callback called %s\n", GNUNET_h2s(key));
+  metrics_count (sconf->metrics, NODE_METRIC_MONITOR_HITS, 1);
+  if (sizeof (struct GNUNET_PeerIdentity) > size)
+  {
+    return;
+  }
+  LOG_DEBUG("Subscriber monitor put data %s\n",
+            GNUNET_i2s((struct GNUNET_PeerIdentity *) data));
+
+  // Accepting state keys are shared by all subscribers of a regex, so
+  // publishers put for remote ones anyway. Messages of our own peer were
+  // already delivered by #local_matcher.
+  if ((NULL != sconf->local_subscription)
+      && (0 == memcmp (&sconf->identity,
+                       publisher,
+                       sizeof (struct GNUNET_PeerIdentity))))
+  {
+    return;
+  }
+
+  // Everything after the publishers identity is the message payload
+  if ((sizeof (struct GNUNET_PeerIdentity) < size)
+      && (GNUNET_OK == subscriber_open (sconf,
+                                        publisher,
+                                        &publisher[1],
+                                        size - sizeof (struct GNUNET_PeerIdentity),
+                                        &opened,
+                                        &opened_size))
+      && (GNUNET_OK == subscriber_decode (sconf,
+                                          publisher,
+                                          opened,
+                                          opened_size,
+                                          buf,
+                                          &topic,
+                                          &timestamp,
+                                          &message,
+                                          &message_size)))
+  {
+    subscriber_deliver (sconf, topic, message, message_size);
+    subscriber_retain_live (sconf, topic, timestamp, message, message_size);
+  }
+}
+
+
+/**
+ * Start monitoring an accepting state of a subscription unless it already is
+ *
+ * @param sconf The subscriber
+ * @param key The accepting state key
+ * @return #GNUNET_OK if a monitor was started, #GNUNET_NO if @a key is already
+ *         monitored, #GNUNET_SYSERR if the subscriber can not reach the DHT
+ */
+static int
+subscriber_start_monitor (struct Subscriber_Config *sconf,
+                          const struct GNUNET_HashCode *key)
+{
+  struct Subscriber_Monitor *monitor;
+
+  monitor = GNUNET_CONTAINER_multihashmap_get (sconf->monitors, key);
+  if (NULL != monitor)
+  {
+    monitor->generation = sconf->monitor_generation;
+    return GNUNET_NO;
+  }
+  if (GNUNET_OK != subscriber_connect_dht (sconf))
+  {
+    return GNUNET_SYSERR;
+  }
+
+  monitor = arena_pool_alloc (sconf->arena, sizeof (struct Subscriber_Monitor));
+  monitor->key = *key;
+  monitor->generation = sconf->monitor_generation;
+  monitor->handle = GNUNET_DHT_monitor_start (sconf->dht_handle,
+                                              GNUNET_BLOCK_TYPE_TEST,
+                                              key,
+                                              &subscriber_monitor_get_cb,
+                                              &subscriber_monitor_get_response_cb,
+                                              &subscriber_monitor_put_cb,
+                                              sconf);
+  if (NULL != monitor->handle)
+  {
+    metrics_gauge_add (sconf->metrics, NODE_METRIC_MONITORS, 1);
+  }
+  GNUNET_CONTAINER_DLL_insert (sconf->monitor_head,
+                               sconf->monitor_tail,
+                               monitor);
+  GNUNET_CONTAINER_multihashmap_put (sconf->monitors,
+                                     key,
+                                     monitor,
+                                     GNUNET_CONTAINER_MULTIHASHMAPOPTION_UNIQUE_FAST);
+  return GNUNET_OK;
+}
+
+
+/**
+ * Stop monitoring an accepting state and free the monitor
+ *
+ * @param sconf The subscriber
+ * @param monitor The monitor
+ */
+static void
+subscriber_stop_monitor (struct Subscriber_Config *sconf,
+                         struct Subscriber_Monitor *monitor)
+{
+  GNUNET_CONTAINER_DLL_remove (sconf->monitor_head,
+                               sconf->monitor_tail,
+                               monitor);
+  GNUNET_CONTAINER_multihashmap_remove (sconf->monitors,
+                                        &monitor->key,
+                                        monitor);
+  if (NULL != monitor->handle)
+  {
+    GNUNET_DHT_monitor_stop (monitor->handle);
+    metrics_gauge_add (sconf->metrics, NODE_METRIC_MONITORS, -1);
+  }
+  arena_pool_free (sconf->arena, monitor, sizeof (struct Subscriber_Monitor));
+}
+
+
+/**
+ * Issue DHT-Monitor for each state and free memory when done
+ *
+ * @param cls Subscriber_Conf
+ * @param key current key code. Will be monitored
+ * @param value value in the hash map, expected to bet the proof
+ * @return #GNUNET_YES if we should continue to
+ *         iterate,
+ *         #GNUNET_NO if not.
+ */
+static int
+subscriber_monitor_state_and_free (void *cls,
+    const struct GNUNET_HashCode *key,
+    void *value)
+{
+  LOG_DEBUG ("Subscriber monitoring state %s %s\n", value, GNUNET_h2s(key));
+
+  struct Subscriber_Config *sconf = (struct Subscriber_Config *) cls;
+  int ret = subscriber_start_monitor (sconf, key);
+
+  GNUNET_free (value);
+  if (GNUNET_SYSERR == ret)
+  {
+    schedule_shutdown_test (0);
+    return GNUNET_NO;
+  }
+  return GNUNET_YES;
+}
+
+
+/**
+ * Stop all retained message lookups of a subscriber
+ *
+ * @param sconf The subscriber
+ */
+static void
+subscriber_stop_retained (struct Subscriber_Config *sconf)
+{
+  struct Subscriber_Retained_Get *get;
+
+  if (GNUNET_SCHEDULER_NO_TASK != sconf->retained_task)
+  {
+    GNUNET_SCHEDULER_cancel (sconf->retained_task);
+    sconf->retained_task = GNUNET_SCHEDULER_NO_TASK;
+  }
+  while (NULL != (get = sconf->retained_head))
+  {
+    GNUNET_CONTAINER_DLL_remove (sconf->retained_head,
+                                 sconf->retained_tail,
+                                 get);
+    GNUNET_DHT_get_stop (get->handle);
+    arena_pool_free (sconf->arena, get->data, get->size);
+    arena_pool_free (sconf->arena,
+                     get,
+                     sizeof (struct Subscriber_Retained_Get));
+  }
+  GNUNET_free_non_null (sconf->retained_keys);
+  sconf->retained_keys = NULL;
+  sconf->retained_key_count = 0;
+}
+
+
+/**
+ * Stop looking for retained messages and deliver the newest one found for
+ * every topic
+ *
+ * @param cls The Subscriber_Config
+ * @param tc Task context
+ */
+static void
+subscriber_retained_window_closed (void *cls,
+                                   const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  struct Subscriber_Config *sconf = (struct Subscriber_Config *) cls;
+  struct Subscriber_Retained_Get *get;
+  struct Retained_Cache *cache = node_retained_cache (&sconf->identity);
+  char buf[BRIDGE_MAX_RECORD_SIZE];
+  const char *topic;
+  struct GNUNET_TIME_Absolute timestamp;
+  const void *message;
+  size_t message_size;
+
+  sconf->retained_task = GNUNET_SCHEDULER_NO_TASK;
+  for (get = sconf->retained_head; NULL != get; get = get->next)
+  {
+    GNUNET_DHT_get_stop (get->handle);
+    get->handle = NULL;
+    // A message waiting for its dictionary is delivered later but not cached
+    if ((NULL == get->data)
+        || (GNUNET_OK != subscriber_decode (sconf,
+                                            &get->publisher,
+                                            get->data,
+                                            get->size,
+                                            buf,
+                                            &topic,
+                                            &timestamp,
+                                            &message,
+                                            &message_size)))
+    {
+      continue;
+    }
+    LOG_DEBUG ("Subscriber got retained message for %s from %s\n",
+               GNUNET_h2s (&get->key), GNUNET_i2s (&get->publisher));
+    if (NULL != cache)
+    {
+      retained_cache_put (cache, &get->key, get->newest, message, message_size);
+    }
+    subscriber_deliver (sconf, topic, message, message_size);
+  }
+  while (NULL != (get = sconf->retained_head))
+  {
+    GNUNET_CONTAINER_DLL_remove (sconf->retained_head,
+                                 sconf->retained_tail,
+                                 get);
+    arena_pool_free (sconf->arena, get->data, get->size);
+    arena_pool_free (sconf->arena,
+                     get,
+                     sizeof (struct Subscriber_Retained_Get));
+  }
+}
+
+
+/**
+ * Called for every value found under the retained key of a topic. The newest
+ * value that verifies and was published to the topic is kept until the
+ * window closes. Topic and time are taken from the signed message header,
+ * so a signed message put again under another key or claiming a later time
+ * is rejected.
+ *
+ * @param cls The Subscriber_Retained_Get
+ * @param exp when will this value expire
+ * @param key key of the result
+ * @param get_path peers on reply path (or NULL if not recorded)
+ * @param get_path_length number of entries in @a get_path
+ * @param put_path peers on the PUT path (or NULL if not recorded)
+ * @param put_path_length number of entries in @a put_path
+ * @param type type of the result
+ * @param size number of bytes in @a data
+ * @param data pointer to the result data
+ */
+static void
+subscriber_retained_result (void *cls,
+                            struct GNUNET_TIME_Absolute exp,
+                            const struct GNUNET_HashCode *key,
+                            const struct GNUNET_PeerIdentity *get_path,
+                            unsigned int get_path_length,
+                            const struct GNUNET_PeerIdentity *put_path,
+                            unsigned int put_path_length,
+                            enum GNUNET_BLOCK_Type type,
+                            size_t size,
+                            const void *data)
+{
+  struct Subscriber_Retained_Get *get = (struct Subscriber_Retained_Get *) cls;
+  const struct GNUNET_PeerIdentity *publisher = (const struct GNUNET_PeerIdentity *) data;
+  struct GNUNET_TIME_Absolute timestamp;
+  struct GNUNET_HashCode topic_key;
+  const char *topic;
+  const void *opened;
+  size_t opened_size;
+  void *copy;
+
+  if (sizeof (struct GNUNET_PeerIdentity) > size)
+  {
+    LOG_WARNING ("Subscriber got malformed retained message for %s\n",
+                 GNUNET_h2s (key));
+    return;
+  }
+  if (GNUNET_OK != subscriber_open (get->sconf,
+                                    publisher,
+                                    &publisher[1],
+                                    size - sizeof (struct GNUNET_PeerIdentity),
+                                    &opened,
+                                    &opened_size))
+  {
+    return;
+  }
+  if (0 == message_read_header (opened, opened_size, &topic, &timestamp))
+  {
+    LOG_WARNING ("Subscriber got malformed retained message for %s\n",
+                 GNUNET_h2s (key));
+    return;
+  }
+  retained_key (topic, &topic_key);
+  if (0 != memcmp (&topic_key, &get->key, sizeof (struct GNUNET_HashCode)))
+  {
+    LOG_WARNING ("Subscriber rejected retained message of \"%s\" under %s\n",
+                 topic, GNUNET_h2s (key));
+    metrics_count (get->sconf->metrics, NODE_METRIC_REJECTED, 1);
+    return;
+  }
+  if (timestamp.abs_value_us <= get->newest.abs_value_us)
+  {
+    metrics_count (get->sconf->metrics, NODE_METRIC_RETAINED_DUPLICATES, 1);
+    return;
+  }
+  copy = arena_pool_alloc (get->sconf->arena, opened_size);
+  if (NULL == copy)
+  {
+    LOG_WARNING ("Subscriber dropped oversized retained message of \"%s\"\n",
+                 topic);
+    metrics_count (get->sconf->metrics, NODE_METRIC_REJECTED, 1);
+    return;
+  }
+  if (NULL == get->data)
+  {
+    metrics_observe (get->sconf->metrics,
+                     NODE_METRIC_RETAINED_LATENCY,
+                     GNUNET_TIME_absolute_get_duration (get->start));
+  }
+  else
+  {
+    // Replaced by a newer one, so the older one never reaches the application
+    metrics_count (get->sconf->metrics, NODE_METRIC_RETAINED_DUPLICATES, 1);
+    arena_pool_free (get->sconf->arena, get->data, get->size);
+  }
+  get->newest = timestamp;
+  get->publisher = *publisher;
+  get->data = copy;
+  get->size = opened_size;
+  memcpy (get->data, opened, opened_size);
+}
+
+
+/**
+ * Deliver the retained message of one topic the subscription matches, from
+ * the cache if possible or else from the DHT
+ *
+ * @param cls The Subscriber_Config
+ * @param topic The topic
+ */
+static void
+subscriber_fetch_retained_topic (void *cls, const char *topic)
+{
+  struct Subscriber_Config *sconf = (struct Subscriber_Config *) cls;
+  struct Retained_Cache *cache = node_retained_cache (&sconf->identity);
+  struct Subscriber_Retained_Get *get;
+  struct GNUNET_HashCode key;
+  struct GNUNET_TIME_Absolute timestamp;
+  const void *data;
+  size_t size;
+
+  retained_key (topic, &key);
+  GNUNET_array_append (sconf->retained_keys, sconf->retained_key_count, key);
+  if ((NULL != cache)
+      && (NULL != (data = retained_cache_get (cache,
+                                              &key,
+                                              &timestamp,
+                                              &size))))
+  {
+    LOG_DEBUG ("Subscriber serves retained \"%s\" from cache\n", topic);
+    subscriber_deliver (sconf, topic, data, size);
+    return;
+  }
+
+  get = arena_pool_alloc (sconf->arena,
+                          sizeof (struct Subscriber_Retained_Get));
+  get->sconf = sconf;
+  get->key = key;
+  get->start = GNUNET_TIME_absolute_get ();
+  get->handle = GNUNET_DHT_get_start (sconf->dht_handle,
+                                      GNUNET_BLOCK_TYPE_TEST,
+                                      &key,
+                                      2,
+                                      GNUNET_DHT_RO_NONE,
+                                      NULL,
+                                      0,
+                                      &subscriber_retained_result,
+                                      get);
+  if (NULL == get->handle)
+  {
+    LOG_WARNING ("Subscriber can not look up retained \"%s\"\n", topic);
+    arena_pool_free (sconf->arena,
+                     get,
+                     sizeof (struct Subscriber_Retained_Get));
+    return;
+  }
+  GNUNET_CONTAINER_DLL_insert (sconf->retained_head, sconf->retained_tail, get);
+}
+
+
+/**
+ * Look up the retained messages of all topics the subscription matches. The
+ * GETs run in parallel and the newest message of every topic is delivered
+ * when #RETAINED_GET_WINDOW closes, so a new subscriber does not have to wait
+ * for the next publish. Topics cached on the subscriber's peer are delivered
+ * right away.
+ *
+ * @param sconf The subscriber
+ */
+static void
+subscriber_fetch_retained (struct Subscriber_Config *sconf)
+{
+  int topics;
+
+  if (GNUNET_OK != subscriber_connect_dht (sconf))
+  {
+    return;
+  }
+  topics = retained_expand (sconf->topic, &subscriber_fetch_retained_topic, sconf);
+  if (GNUNET_SYSERR == topics)
+  {
+    GNUNET_free_non_null (sconf->retained_keys);
+    sconf->retained_keys = NULL;
+    sconf->retained_key_count = 0;
+    LOG_DEBUG ("Subscription \"%s\" matches too many topics for retained messages\n",
+               sconf->topic);
+    return;
+  }
+  LOG_DEBUG ("Subscriber looks up retained messages of %d topics\n", topics);
+  if (NULL != sconf->retained_head)
+  {
+    sconf->retained_task = GNUNET_SCHEDULER_add_delayed (RETAINED_GET_WINDOW,
+                                                         &subscriber_retained_window_closed,
+                                                         sconf);
+  }
+}
+
+
+/**
+ * Callback for #GNUNET_REGEX_announce_get_accepting_dht_entries
+ *
+ * @param cls The closure for the callback
+ * @param a The original announcement
+ * @param accepting_states A map containing all accepting states, or NULL if
+ *        something went terribly wrong
+ */
+static void
+subscriber_monitor_accepting_states (void *cls,
+    struct GNUNET_REGEX_Announcement *a,
+    struct GNUNET_CONTAINER_MultiHashMap *accepting_states)
+{
+  LOG_DEBUG ("Subscriber start monitoring states\n");
+  struct Subscriber_Config *sconf = (struct Subscriber_Config *) cls;
+  sconf->monitor_generation++;
+  GNUNET_CONTAINER_multihashmap_iterate (accepting_states,
+                                        &subscriber_monitor_state_and_free,
+                                        sconf);
+  GNUNET_CONTAINER_multihashmap_destroy (accepting_states);
+
+  // Monitors are armed, now catch up on what was published before
+  subscriber_fetch_retained (sconf);
+}
+
+
+/**
+ * Forget the subscription change in progress
+ *
+ * @param sconf The subscriber
+ */
+static void
+subscriber_cancel_update (struct Subscriber_Config *sconf)
+{
+  if (NULL != sconf->update_announcement)
+  {
+    GNUNET_REGEX_announce_cancel (sconf->update_announcement);
+    sconf->update_announcement = NULL;
+  }
+  if (NULL != sconf->update_entry)
+  {
+    topic_filter_set_remove (sconf->filters, sconf->update_entry);
+    sconf->update_entry = NULL;
+  }
+}
+
+
+/**
+ * Closure for #subscriber_count_kept
+ */
+struct Subscriber_Update_Context {
+  /**
+   * The subscriber
+   */
+  struct Subscriber_Config *sconf;
+  /**
+   * Accepting states of the new subscription that are monitored already
+   */
+  unsigned int kept;
+};
+
+
+/**
+ * Count an accepting state of a new subscription if it is monitored already
+ *
+ * @param cls The Subscriber_Update_Context
+ * @param key The accepting state key
+ * @param value ignored
+ * @return #GNUNET_YES to continue with the next state
+ */
+static int
+subscriber_count_kept (void *cls,
+                       const struct GNUNET_HashCode *key,
+                       void *value)
+{
+  struct Subscriber_Update_Context *ctx = (struct Subscriber_Update_Context *) cls;
+
+  if (GNUNET_YES == GNUNET_CONTAINER_multihashmap_contains (ctx->sconf->monitors,
+                                                            key))
+  {
+    ctx->kept++;
+  }
+  return GNUNET_YES;
+}
+
+
+/**
+ * Callback for #GNUNET_REGEX_announce_get_accepting_dht_entries of a
+ * subscription change. Monitors are started for the keys the new
+ * subscription adds and stopped for the keys it drops, the others keep
+ * running. Then the new announcement replaces the old one. If the monitors
+ * changed differently than the key sets differ, this is logged and counted.
+ *
+ * @param cls The Subscriber_Config
+ * @param a The announcement of the new subscription
+ * @param accepting_states A map containing all accepting states, or NULL if
+ *        something went terribly wrong
+ */
+static void
+subscriber_update_accepting_states (void *cls,
+                                    struct GNUNET_REGEX_Announcement *a,
+                                    struct GNUNET_CONTAINER_MultiHashMap *accepting_states)
+{
+  struct Subscriber_Config *sconf = (struct Subscriber_Config *) cls;
+  struct Subscriber_Update_Context ctx;
+  struct Subscriber_Monitor *monitor;
+  struct Subscriber_Monitor *next;
+  unsigned int before = GNUNET_CONTAINER_multihashmap_size (sconf->monitors);
+  unsigned int after;
+  unsigned int started;
+  unsigned int stopped = 0;
+
+  if (NULL == accepting_states)
+  {
+    LOG_WARNING ("Subscriber can not look up the states of \"%s\", keeping \"%s\"\n",
+                 topic_filter_entry_regex (sconf->update_entry), sconf->topic);
+    subscriber_cancel_update (sconf);
+    // The run waits for the change, it can not succeed anymore
+    schedule_shutdown_test (0);
+    return;
+  }
+  // Expected changes, from the key sets before any monitor is touched
+  ctx.sconf = sconf;
+  ctx.kept = 0;
+  GNUNET_CONTAINER_multihashmap_iterate (accepting_states,
+                                         &subscriber_count_kept,
+                                         &ctx);
+  after = GNUNET_CONTAINER_multihashmap_size (accepting_states);
+
+  sconf->monitor_generation++;
+  GNUNET_CONTAINER_multihashmap_iterate (accepting_states,
+                                         &subscriber_monitor_state_and_free,
+                                         sconf);
+  GNUNET_CONTAINER_multihashmap_destroy (accepting_states);
+  started = GNUNET_CONTAINER_multihashmap_size (sconf->monitors) - before;
+  for (monitor = sconf->monitor_head; NULL != monitor; monitor = next)
+  {
+    next = monitor->next;
+    if (sconf->monitor_generation != monitor->generation)
+    {
+      subscriber_stop_monitor (sconf, monitor);
+      stopped++;
+    }
+  }
+
+  // The old announcement stays until the new monitors are armed, so
+  // publishers always find one of them
+  GNUNET_REGEX_announce_cancel (sconf->regex_announcement);
+  sconf->regex_announcement = a;
+  sconf->update_announcement = NULL;
+  if (NULL != sconf->local_subscription)
+  {
+    matcher_remove (local_matcher, sconf->local_subscription);
+    sconf->local_subscription = NULL;
+  }
+  if (NULL != sconf->filter_entry)
+  {
+    topic_filter_set_remove (sconf->filters, sconf->filter_entry);
+  }
+  sconf->filter_entry = sconf->update_entry;
+  sconf->update_entry = NULL;
+  sconf->topic = topic_filter_entry_regex (sconf->filter_entry);
+  if (NULL != local_matcher)
+  {
+    sconf->local_subscription = matcher_add (local_matcher, sconf->topic, sconf);
+  }
+  LOG_DEBUG ("Subscriber changed to \"%s\": started %u, stopped %u, kept %u monitors\n",
+             sconf->topic, started, stopped, before - stopped);
+
+  subscriber_stop_retained (sconf);
+  subscriber_fetch_retained (sconf);
+  if ((started != after - ctx.kept)
+      || (stopped != before - ctx.kept)
+      || (after != GNUNET_CONTAINER_multihashmap_size (sconf->monitors)))
+  {
+    LOG_WARNING ("Subscriber expected to start %u, stop %u and keep %u monitors, has %u\n",
+                 after - ctx.kept, before - ctx.kept, ctx.kept,
+                 GNUNET_CONTAINER_multihashmap_size (sconf->monitors));
+    metrics_count (sconf->metrics, NODE_METRIC_RESUBSCRIBE_MISCOUNTS, 1);
+  }
+  sconf->resubscribed = GNUNET_YES;
+  test_check_done ();
+}
+
+
+/**
+ * Change the MQTT filter of a subscription. The new filter is announced and
+ * its accepting states looked up, then only the monitors of states that
+ * differ from the current subscription are started or stopped.
+ *
+ * @param sconf The subscriber
+ * @param filter The new MQTT filter
+ * @return #GNUNET_OK if the change was started, #GNUNET_NO if the subscriber
+ *         is still arming its first monitors, #GNUNET_SYSERR on failure
+ */
+static int
+subscriber_update (struct Subscriber_Config *sconf, const char *filter)
+{
+  const char *regex;
+  int created;
+
+  if (0 == sconf->monitor_generation)
+  {
+    return GNUNET_NO;
+  }
+  // A newer change replaces one still in progress
+  subscriber_cancel_update (sconf);
+
+  if (NULL == sconf->filters)
+  {
+    sconf->filters = topic_filter_set_create ();
+  }
+  sconf->update_entry = topic_filter_set_add (sconf->filters, filter, &created);
+  if (NULL == sconf->update_entry)
+  {
+    LOG_WARNING ("Subscriber rejects MQTT filter \"%s\"\n", filter);
+    return GNUNET_SYSERR;
+  }
+  if (sconf->update_entry == sconf->filter_entry)
+  {
+    LOG_DEBUG ("Subscriber already subscribes to \"%s\"\n", filter);
+    subscriber_cancel_update (sconf);
+    return GNUNET_OK;
+  }
+
+  regex = topic_filter_entry_regex (sconf->update_entry);
+  sconf->update_announcement = GNUNET_REGEX_announce_with_key (sconf->cfg,
+                                                               regex,
+                                                               GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_SECONDS, 5),
+                                                               compression_for_regex (regex),
+                                                               GNUNET_CRYPTO_eddsa_key_get_anonymous ());
+  if ((NULL == sconf->update_announcement)
+      || (GNUNET_YES != GNUNET_REGEX_announce_get_accepting_dht_entries (sconf->update_announcement,
+                                                                          &subscriber_update_accepting_states,
+                                                                          sconf)))
+  {
+    LOG_WARNING ("Subscriber failed announcing interest \"%s\"\n", regex);
+    subscriber_cancel_update (sconf);
+    return GNUNET_SYSERR;
+  }
+  LOG_DEBUG ("Subscriber changes to \"%s\"\n", regex);
+  return GNUNET_OK;
+}
+
+
+/**
+ * Change the subscription to the RESUBSCRIBE filter, retrying later while
+ * the first monitors are not armed yet
+ *
+ * @param cls The Subscriber_Config
+ * @param tc Task context
+ */
+static void
+subscriber_resubscribe_task (void *cls,
+                             const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  struct Subscriber_Config *sconf = (struct Subscriber_Config *) cls;
+  char *filter;
+
+  sconf->update_task = GNUNET_SCHEDULER_NO_TASK;
+  if (GNUNET_OK != GNUNET_CONFIGURATION_get_value_string (sconf->cfg,
+                                                          "regex-testbed",
+                                                          "RESUBSCRIBE",
+                                                          &filter))
+  {
+    return;
+  }
+  switch (subscriber_update (sconf, filter))
+  {
+  case GNUNET_OK:
+    if (NULL == sconf->update_announcement)
+    {
+      // Already subscribed to it, nothing to change
+      sconf->resubscribed = GNUNET_YES;
+      test_check_done ();
+    }
+    break;
+  case GNUNET_NO:
+    sconf->update_task = GNUNET_SCHEDULER_add_delayed (GNUNET_TIME_UNIT_SECONDS,
+                                                       &subscriber_resubscribe_task,
+                                                       sconf);
+    break;
+  default:
+    LOG_ERROR ("Subscriber can not change to \"%s\"\n", filter);
+    schedule_shutdown_test (0);
+    break;
+  }
+  GNUNET_free (filter);
+}
+
+
+/**
+ * This is where the test logic should be, at least that part of it that uses
+ * the DHT of peer "0".
+ *
+ * @param cls closure, for the example: NULL
+ * @param op should be equal to "dht_op"
+ * @param ca_result result of the connect operation, the connection to the DHT
+ *    service
+ * @param emsg error message, if testbed somehow failed to connect to the DHT.
+ */
+static void
+subscriber_run (void *cls,
+  struct GNUNET_TESTBED_Operation *op,
+  void *ca_result,
+  const char *emsg)
+{
+  LOG_DEBUG ("Running subscriber\n");
+
+  struct Subscriber_Config *sconf = (struct Subscriber_Config *) cls;
+  char *filter;
+  int created;
+
+  if (GNUNET_OK == GNUNET_CONFIGURATION_get_value_string (sconf->cfg,
+                                                          "regex-testbed",
+                                                          "FILTER",
+                                                          &filter))
+  {
+    // Clients subscribe with MQTT filters, equivalent ones share a regex
+    sconf->filters = topic_filter_set_create ();
+    sconf->filter_entry = topic_filter_set_add (sconf->filters, filter, &created);
+    if (NULL == sconf->filter_entry)
+    {
+      LOG_ERROR ("Subscriber rejects MQTT filter \"%s\"\n", filter);
+      GNUNET_free (filter);
+      schedule_shutdown_test (0);
+      return;
+    }
+    LOG_DEBUG ("Subscriber %s MQTT filter \"%s\"\n",
+               (GNUNET_YES == created) ? "announces" : "shares announcement of",
+               filter);
+    GNUNET_free (filter);
+    sconf->topic = topic_filter_entry_regex (sconf->filter_entry);
+  }
+
+  sconf->arena = arena_pool_create (sizeof (struct Subscriber_Monitor),
+                                    sizeof (struct Subscriber_Pending)
+                                    + PUBLISHER_MAX_MESSAGE);
+  sconf->monitors = GNUNET_CONTAINER_multihashmap_create (sconf->ht_length,
+                                                          GNUNET_NO);
+  sconf->bridge = bridge_create (bridge_lanes, NULL, NULL);
+  if (GNUNET_YES == GNUNET_CONFIGURATION_get_value_yesno (sconf->cfg,
+                                                          "regex-testbed",
+                                                          "SIGN"))
+  {
+    sconf->verifier = merkle_verifier_create (SUBSCRIBER_ROOT_CACHE_SIZE);
+  }
+  if (GNUNET_YES == GNUNET_CONFIGURATION_get_value_yesno (sconf->cfg,
+                                                          "regex-testbed",
+                                                          "COMPRESS"))
+  {
+    sconf->decoder = codec_decoder_create ();
+    if (NULL == sconf->decoder)
+    {
+      LOG_ERROR ("Subscriber can not set up decompression\n");
+      schedule_shutdown_test (0);
+      return;
+    }
+  }
+
+  // Announce the subscriber anonymously
+  uint16_t compression = compression_for_regex (sconf->topic);
+  sconf->regex_announcement = GNUNET_REGEX_announce_with_key (sconf->cfg,
+                                                              sconf->topic,
+                                                              GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_SECONDS, 5),
+                                                              compression,
+                                                              GNUNET_CRYPTO_eddsa_key_get_anonymous ());
+  if (NULL == sconf->regex_announcement)
+  {
+    LOG_ERROR ("Subscriber failed announcing interest \"%s\"\n", sconf->topic);
+    schedule_shutdown_test (0);
+    return;
+  }
+  LOG_DEBUG ("Subscriber announced interest \"%s\" with compression %u\n",
+             sconf->topic, compression);
+
+  if (NULL != local_matcher)
+  {
+    sconf->local_subscription = matcher_add (local_matcher, sconf->topic, sconf);
+    if (NULL == sconf->local_subscription)
+    {
+      LOG_WARNING ("Subscription \"%s\" can not be matched locally\n",
+                   sconf->topic);
+    }
+  }
+
+  int get_result = GNUNET_REGEX_announce_get_accepting_dht_entries (sconf->regex_announcement,
+                                                                    &subscriber_monitor_accepting_states,
+                                                                    sconf);
+  if (GNUNET_YES != get_result)
+  {
+    LOG_ERROR ("Subscriber failed initiating accepting state lookup\n");
+    schedule_shutdown_test (0);
+    return;
+  }
+
+  if (GNUNET_YES == GNUNET_CONFIGURATION_have_value (sconf->cfg,
+                                                     "regex-testbed",
+                                                     "RESUBSCRIBE"))
+  {
+    struct GNUNET_TIME_Relative delay;
+
+    if (GNUNET_OK != GNUNET_CONFIGURATION_get_value_time (sconf->cfg,
+                                                          "regex-testbed",
+                                                          "RESUBSCRIBE_DELAY",
+                                                          &delay))
+    {
+      delay = SUBSCRIBER_RESUBSCRIBE_DELAY;
+    }
+    sconf->update_task = GNUNET_SCHEDULER_add_delayed (delay,
+                                                       &subscriber_resubscribe_task,
+                                                       sconf);
+  }
+  producer_try_start ();
+}
+
+
+/**
+ * Publish the allocator counters of the subscription arena before the
+ * metrics of a subscriber are flushed. Next to "# subscriber records
+ * allocated", which is the number of malloc calls allocating every record
+ * on its own would take, they show how many system allocations the arena
+ * made and how much memory it holds.
+ *
+ * @param cls The Subscriber_Config
+ * @param metrics The metrics of the subscriber
+ */
+static void
+subscriber_metrics_sample (void *cls, struct Metrics *metrics)
+{
+  struct Subscriber_Config *sconf = (struct Subscriber_Config *) cls;
+  struct Arena_Stats stats;
+
+  if (NULL == sconf->arena)
+  {
+    return;
+  }
+  arena_pool_get_stats (sconf->arena, &stats);
+  metrics_count (metrics,
+                 NODE_METRIC_RECORDS,
+                 stats.allocs - sconf->arena_reported.allocs);
+  metrics_count (metrics,
+                 NODE_METRIC_RECORD_SYSTEM_ALLOCS,
+                 stats.system_allocs - sconf->arena_reported.system_allocs);
+  metrics_gauge_set (metrics, NODE_METRIC_RECORD_BYTES, stats.slab_bytes);
+  sconf->arena_reported = stats;
+}
+
+
+/**
+ * shuts down the subscriber
+ *
+ * @param cls The Subscriber_Config
+ * @param op_result ignored
+ *
+ * This gets called when the shutdown task runs
+ */
+static void
+subscriber_da (void *cls, void *op_result)
+{
+  struct Subscriber_Config *sconf = (struct Subscriber_Config *) cls;
+  struct Subscriber_Pending *pending;
+
+  if (GNUNET_SCHEDULER_NO_TASK != sconf->update_task)
+  {
+    GNUNET_SCHEDULER_cancel (sconf->update_task);
+    sconf->update_task = GNUNET_SCHEDULER_NO_TASK;
+  }
+  subscriber_cancel_update (sconf);
+  if (NULL != sconf->regex_announcement)
+  {
+    GNUNET_REGEX_announce_cancel(sconf->regex_announcement);
+    sconf->regex_announcement = NULL;
+  }
+
+  if (NULL != sconf->local_subscription)
+  {
+    matcher_remove (local_matcher, sconf->local_subscription);
+    sconf->local_subscription = NULL;
+  }
+
+  subscriber_stop_retained (sconf);
+  while (NULL != sconf->dictionary_head)
+  {
+    subscriber_stop_dictionary_get (sconf->dictionary_head);
+  }
+  while (NULL != (pending = sconf->pending_head))
+  {
+    GNUNET_CONTAINER_DLL_remove (sconf->pending_head,
+                                 sconf->pending_tail,
+                                 pending);
+    arena_pool_free (sconf->arena,
+                     pending,
+                     sizeof (struct Subscriber_Pending) + pending->size);
+  }
+  sconf->pending_count = 0;
+
+  while (NULL != sconf->monitor_head)
+  {
+    subscriber_stop_monitor (sconf, sconf->monitor_head);
+  }
+  if (NULL != sconf->monitors)
+  {
+    GNUNET_CONTAINER_multihashmap_destroy (sconf->monitors);
+    sconf->monitors = NULL;
+  }
+  if (NULL != sconf->arena)
+  {
+    struct Arena_Stats stats;
+    subscriber_metrics_sample (sconf, sconf->metrics);
+    arena_pool_get_stats (sconf->arena, &stats);
+    LOG_DEBUG ("Subscriber arena served %llu records with %llu system allocations instead of %llu, peak %u records in %llu bytes\n",
+               stats.allocs, stats.system_allocs, stats.allocs,
+               stats.peak_in_use, stats.slab_bytes);
+
+    /* Releases all records of the subscription at once */
+    arena_pool_destroy (sconf->arena);
+    sconf->arena = NULL;
+  }
+  if (NULL != sconf->bridge)
+  {
+    bridge_destroy (sconf->bridge);
+    sconf->bridge = NULL;
+  }
+  if (NULL != sconf->verifier)
+  {
+    struct Merkle_Verifier_Stats stats;
+    merkle_verifier_get_stats (sconf->verifier, &stats);
+    LOG_DEBUG ("Subscriber accepted %llu and rejected %llu signed messages with %llu signature checks\n",
+               stats.accepted, stats.rejected, stats.signatures);
+    merkle_verifier_destroy (sconf->verifier);
+    sconf->verifier = NULL;
+  }
+  if (NULL != sconf->decoder)
+  {
+    struct Codec_Stats stats;
+    codec_decoder_get_stats (sconf->decoder, &stats);
+    LOG_DEBUG ("Subscriber decoded %llu messages, %llu DHT bytes for %llu payload bytes\n",
+               stats.messages, stats.encoded_bytes, stats.plain_bytes);
+    codec_decoder_destroy (sconf->decoder);
+    sconf->decoder = NULL;
+  }
+  if (NULL != sconf->filters)
+  {
+    /* Also frees the regex used as topic */
+    topic_filter_set_destroy (sconf->filters);
+    sconf->filters = NULL;
+    sconf->filter_entry = NULL;
+    sconf->topic = NULL;
+  }
+
+  if (NULL != sconf->dht_handle)
+  {
+    GNUNET_DHT_disconnect (sconf->dht_handle);
+    sconf->dht_handle = NULL;
+  }
+  metrics_destroy (sconf->metrics);
+  sconf->metrics = NULL;
+}
+
+
+/**
+ * Stores the given configuration in the master Subscriber_Conf struct
+ *
+ * @param cls closure
+ * @param cfg peer configuration
+ *
+ * @return The Subscriber_Conf struct
+ */
+static void *
+subscriber_ca (void *cls, const struct GNUNET_CONFIGURATION_Handle *cfg)
+{
+  struct Subscriber_Config *sconf = (struct Subscriber_Config *) cls;
+  sconf->cfg = cfg;
+  GNUNET_CRYPTO_get_peer_identity(cfg, &sconf->identity);
+  sconf->metrics = node_metrics_create (cfg, &subscriber_metrics_sample, sconf);
+
+  LOG_DEBUG("Subscriber peer ID is %s\n", GNUNET_i2s(&sconf->identity));
+
+  return cls;
+}
+
+
+/**
+ * Initialize given peer as a subscriber
+ *
+ * @param peer The peer to initialize
+ * @param conf The config structure for the peer
+ */
+static void
+start_subscriber (struct GNUNET_TESTBED_Peer *subscriber,
+    struct Subscriber_Config *conf)
+{
+  LOG_DEBUG ("Starting Subscriber\n");
+
+  conf->ht_length = HT_LENGTH_DEFAULT;
+  conf->topic = "news/(gnunet|wikileaks)";
+
+  /* connect to a peers service */
+  conf->op = GNUNET_TESTBED_service_connect (NULL, /* Closure for operation */
+      subscriber, /* The peer whose service to connect to */
+      NULL, /* The name of the service */
+      &subscriber_run, /* callback to call after a handle to service is opened */
+      conf, /* closure for the above callback */
+      &subscriber_ca, /* callback to call with peer's configuration; this should open the needed service connection */
+      &subscriber_da, /* callback to be called when closing the opened service connection */
+      conf); /* closure for the above two callbacks */
+}
+
+
+/**
+ * DHT put continuation, called after the put has successfully sent out.
+ *
+ * @param cls The Publisher_Put
+ * @param success GNUNET_OK if the PUT was transmitted, GNUNET_NO on timeout,
+ *        GNUNET_SYSERR on disconnect from service after the PUT message was
+ *        transmitted (so we don't know if it was received or not)
+ */
+static void
+publisher_put_dht_signal_done (void *cls,
+                               int success)
+{
+  struct Publisher_Put *put = (struct Publisher_Put *) cls;
+  struct Publisher_Config *pconf = put->pconf;
+
+  GNUNET_CONTAINER_DLL_remove (pconf->put_head, pconf->put_tail, put);
+  metrics_gauge_add (pconf->metrics, NODE_METRIC_PUTS_IN_FLIGHT, -1);
+  metrics_observe (pconf->metrics,
+                   NODE_METRIC_PUT_LATENCY,
+                   GNUNET_TIME_absolute_get_duration (put->start));
+  arena_free (pconf->put_arena, put);
+  if (NULL != pconf->credits)
+  {
+    // May start PUTs that were waiting for credit
+    credit_lane_release (pconf->credits);
+  }
+
+  if (GNUNET_NO == success)
+  {
+    // Not worth delivering anymore, the next message is fresher
+    metrics_count (pconf->metrics, NODE_METRIC_PUT_TIMEOUTS, 1);
+    LOG_WARNING ("Publisher PUT for \"%s\" timed out after %s\n",
+                 pconf->topic,
+                 GNUNET_STRINGS_relative_time_to_string (pconf->priority->timeout,
+                                                         GNUNET_YES));
+    return;
+  }
+  if (GNUNET_OK != success)
+  {
+    LOG_ERROR("Publisher failed putting DHT Signal\n");
+    schedule_shutdown_test(0);
+    return;
+  }
+
+  if (NULL != pconf->shard_worker)
+  {
+    if (GNUNET_OK != shard_worker_send (pconf->shard_worker,
+                                        SHARD_RECORD_PUBLISHED,
+                                        pconf->topic,
+                                        NULL,
+                                        0))
+    {
+      LOG_WARNING ("Shard can not report publish of \"%s\"\n", pconf->topic);
+    }
+  }
+}
+
+
+/**
+ * Connect a publisher to the DHT unless it already is
+ *
+ * @param pconf The publisher
+ * @return #GNUNET_OK if connected
+ */
+static int
+publisher_connect_dht (struct Publisher_Config *pconf)
+{
+  if (NULL != pconf->dht_handle)
+  {
+    return GNUNET_OK;
+  }
+  /* Use the provided configuration to connect to the dht */
+  pconf->dht_handle = GNUNET_DHT_connect (pconf->cfg, pconf->ht_length);
+  if (NULL == pconf->dht_handle)
+  {
+    LOG_ERROR ("Publisher can not connect to DHT\n");
+    return GNUNET_SYSERR;
+  }
+  return GNUNET_OK;
+}
+
+
+/**
+ * Put a block into the DHT and track the PUT until it completes. Called by
+ * the credit lane of the publisher once the PUT has credit.
+ *
+ * @param cls The Publisher_Config
+ * @param data The key to put under followed by the block
+ * @param data_size Size of @a data
+ * @return #GNUNET_OK if the PUT was issued
+ */
+static int
+publisher_put_block_send (void *cls, const void *data, size_t data_size)
+{
+  struct Publisher_Config *pconf = (struct Publisher_Config *) cls;
+  const struct GNUNET_HashCode *key = (const struct GNUNET_HashCode *) data;
+  const void *block = &key[1];
+  size_t size = data_size - sizeof (struct GNUNET_HashCode);
+  struct Publisher_Put *put;
+
+  if (GNUNET_OK != publisher_connect_dht (pconf))
+  {
+    return GNUNET_SYSERR;
+  }
+
+  if (NULL == pconf->put_arena)
+  {
+    pconf->put_arena = arena_create (sizeof (struct Publisher_Put), 0);
+  }
+  put = arena_alloc (pconf->put_arena);
+  put->pconf = pconf;
+  put->start = GNUNET_TIME_absolute_get ();
+  put->handle = GNUNET_DHT_put (pconf->dht_handle,
+            key, // key
+            2, // repl_lvl
+            GNUNET_DHT_RO_NONE, // options
+            GNUNET_BLOCK_TYPE_TEST , // type
+            size, // size
+            block, // data
+            GNUNET_TIME_UNIT_FOREVER_ABS, // expiry
+            pconf->priority->timeout, //timeout
+            publisher_put_dht_signal_done, // continuation
+            put); // closure
+  if (NULL == put->handle)
+  {
+    LOG_ERROR ("Publisher can not put Info into DHT\n");
+    arena_free (pconf->put_arena, put);
+    return GNUNET_SYSERR;
+  }
+  GNUNET_CONTAINER_DLL_insert (pconf->put_head, pconf->put_tail, put);
+  metrics_count (pconf->metrics, NODE_METRIC_PUTS, 1);
+  metrics_gauge_add (pconf->metrics, NODE_METRIC_PUTS_IN_FLIGHT, 1);
+  return GNUNET_OK;
+}
+
+
+/**
+ * Put a block into the DHT as soon as the topic and node have credit
+ *
+ * @param pconf The publisher
+ * @param key The key to put under
+ * @param block The block
+ * @param size Size of @a block, at most #PUBLISHER_MAX_BLOCK
+ * @return #GNUNET_OK if the PUT was issued or queued, #GNUNET_NO if the flow
+ *         policy rejected it, #GNUNET_SYSERR on failure
+ */
+static int
+publisher_put_block (struct Publisher_Config *pconf,
+                     const struct GNUNET_HashCode *key,
+                     const void *block,
+                     size_t size)
+{
+  char data[sizeof (struct GNUNET_HashCode) + PUBLISHER_MAX_BLOCK];
+
+  GNUNET_assert (PUBLISHER_MAX_BLOCK >= size);
+  memcpy (data, key, sizeof (struct GNUNET_HashCode));
+  memcpy (&data[sizeof (struct GNUNET_HashCode)], block, size);
+  if (NULL == pconf->credits)
+  {
+    return publisher_put_block_send (pconf,
+                                     data,
+                                     sizeof (struct GNUNET_HashCode) + size);
+  }
+  switch (credit_lane_submit (pconf->credits,
+                              data,
+                              sizeof (struct GNUNET_HashCode) + size))
+  {
+  case CREDIT_SENT:
+  case CREDIT_QUEUED:
+    return GNUNET_OK;
+  case CREDIT_REJECTED:
+    metrics_count (pconf->metrics, NODE_METRIC_PUTS_REJECTED, 1);
+    return GNUNET_NO;
+  default:
+    return GNUNET_SYSERR;
+  }
+}
+
+
+/**
+ * Put the publishers identity followed by a payload into the DHT
+ *
+ * @param pconf The publisher
+ * @param key The accepting state key of a subscriber
+ * @param data The payload, may be NULL if @a size is 0
+ * @param size Size of @a data
+ * @return #GNUNET_OK if the PUT was issued
+ */
+static int
+publisher_put (struct Publisher_Config *pconf,
+               const struct GNUNET_HashCode *key,
+               const void *data,
+               size_t size)
+{
+  char block[sizeof (struct GNUNET_PeerIdentity) + PUBLISHER_MAX_PAYLOAD];
+
+  if (PUBLISHER_MAX_PAYLOAD < size)
+  {
+    LOG_ERROR ("Publisher payload of %u bytes is too large\n",
+               (unsigned int) size);
+    return GNUNET_SYSERR;
+  }
+
+  memcpy (block, &pconf->identity, sizeof (struct GNUNET_PeerIdentity));
+  if (0 != size)
+  {
+    memcpy (&block[sizeof (struct GNUNET_PeerIdentity)], data, size);
+  }
+  return publisher_put_block (pconf,
+                              key,
+                              block,
+                              sizeof (struct GNUNET_PeerIdentity) + size);
+}
+
+
+/**
+ * Store a message as the retained message of the publishers topic under the
+ * retained key of the topic. Topic and time of the message are in its
+ * header, which a signing publisher signed with it.
+ *
+ * @param pconf The publisher
+ * @param data The payload, may be NULL if @a size is 0
+ * @param size Size of @a data
+ * @return #GNUNET_OK if the PUT was issued
+ */
+static int
+publisher_retain (struct Publisher_Config *pconf,
+                  const void *data,
+                  size_t size)
+{
+  struct GNUNET_HashCode key;
+
+  retained_key (pconf->topic, &key);
+  return publisher_put (pconf, &key, data, size);
+}
+
+
+/**
+ * Stop putting the trained dictionary of a publisher
+ *
+ * @param pconf The publisher
+ */
+static void
+publisher_dictionary_cancel (struct Publisher_Config *pconf)
+{
+  struct Publisher_Dictionary *dictionary = pconf->dictionary;
+
+  if (NULL == dictionary)
+  {
+    return;
+  }
+  if (NULL != dictionary->handle)
+  {
+    GNUNET_DHT_put_cancel (dictionary->handle);
+  }
+  if (GNUNET_SCHEDULER_NO_TASK != dictionary->retry_task)
+  {
+    GNUNET_SCHEDULER_cancel (dictionary->retry_task);
+  }
+  GNUNET_free (dictionary);
+  pconf->dictionary = NULL;
+}
+
+
+static void
+publisher_dictionary_send (struct Publisher_Dictionary *dictionary);
+
+
+/**
+ * Task putting a dictionary again
+ *
+ * @param cls The Publisher_Dictionary
+ * @param tc Task context
+ */
+static void
+publisher_dictionary_retry (void *cls,
+                            const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  struct Publisher_Dictionary *dictionary = (struct Publisher_Dictionary *) cls;
+
+  dictionary->retry_task = GNUNET_SCHEDULER_NO_TASK;
+  publisher_dictionary_send (dictionary);
+}
+
+
+/**
+ * DHT put continuation of a dictionary. Once the DHT took it subscribers can
+ * find it, so the encoder starts compressing with it. Otherwise the PUT is
+ * retried and messages stay compressed without it.
+ *
+ * @param cls The Publisher_Dictionary
+ * @param success #GNUNET_OK if the PUT was transmitted
+ */
+static void
+publisher_dictionary_put_done (void *cls, int success)
+{
+  struct Publisher_Dictionary *dictionary = (struct Publisher_Dictionary *) cls;
+  struct Publisher_Config *pconf = dictionary->pconf;
+
+  dictionary->handle = NULL;
+  if (GNUNET_OK != success)
+  {
+    LOG_WARNING ("Publisher PUT of dictionary %u failed, retrying\n",
+                 dictionary->id);
+    dictionary->retry_task = GNUNET_SCHEDULER_add_delayed (PUBLISHER_DICTIONARY_RETRY_DELAY,
+                                                           &publisher_dictionary_retry,
+                                                           dictionary);
+    return;
+  }
+  if (GNUNET_OK != codec_encoder_activate (pconf->encoder))
+  {
+    LOG_WARNING ("Publisher can not compress with dictionary %u\n",
+                 dictionary->id);
+  }
+  else
+  {
+    LOG_DEBUG ("Publisher of \"%s\" compresses with dictionary %u\n",
+               pconf->topic, dictionary->id);
+  }
+  publisher_dictionary_cancel (pconf);
+}
+
+
+/**
+ * Put a dictionary into the DHT. It does not go through the credit lane of
+ * the topic, which may reject or drop it, but is retried until the DHT took
+ * it.
+ *
+ * @param dictionary The dictionary
+ */
+static void
+publisher_dictionary_send (struct Publisher_Dictionary *dictionary)
+{
+  struct Publisher_Config *pconf = dictionary->pconf;
+
+  if (GNUNET_OK == publisher_connect_dht (pconf))
+  {
+    dictionary->handle = GNUNET_DHT_put (pconf->dht_handle,
+                                         &dictionary->key,
+                                         2,
+                                         GNUNET_DHT_RO_NONE,
+                                         GNUNET_BLOCK_TYPE_TEST,
+                                         dictionary->size,
+                                         &dictionary[1],
+                                         GNUNET_TIME_UNIT_FOREVER_ABS,
+                                         pconf->priority->timeout,
+                                         &publisher_dictionary_put_done,
+                                         dictionary);
+  }
+  if (NULL == dictionary->handle)
+  {
+    LOG_WARNING ("Publisher can not put dictionary %u, retrying\n",
+                 dictionary->id);
+    dictionary->retry_task = GNUNET_SCHEDULER_add_delayed (PUBLISHER_DICTIONARY_RETRY_DELAY,
+                                                           &publisher_dictionary_retry,
+                                                           dictionary);
+    return;
+  }
+  metrics_count (pconf->metrics, NODE_METRIC_PUTS, 1);
+}
+
+
+/**
+ * Put a dictionary the publisher trained into the DHT, where subscribers look
+ * it up when they receive the first message compressed with it. A signing
+ * publisher signs it like a message, so subscribers only use dictionaries
+ * of the publisher.
+ *
+ * @param cls The Publisher_Config
+ * @param id Id of the dictionary
+ * @param dictionary The dictionary
+ * @param size Size of @a dictionary
+ */
+static void
+publisher_put_dictionary (void *cls,
+                          uint32_t id,
+                          const void *dictionary,
+                          size_t size)
+{
+  struct Publisher_Config *pconf = (struct Publisher_Config *) cls;
+  struct Publisher_Dictionary *put;
+  struct Merkle_Batch *batch;
+
+  LOG_DEBUG ("Publisher of \"%s\" trained dictionary %u of %u bytes\n",
+             pconf->topic, id, (unsigned int) size);
+  publisher_dictionary_cancel (pconf);
+  put = GNUNET_malloc (sizeof (struct Publisher_Dictionary)
+                       + size + MERKLE_MAX_ENVELOPE);
+  put->pconf = pconf;
+  put->id = id;
+  codec_dictionary_key (&pconf->identity, id, &put->key);
+  if (NULL == pconf->private_key)
+  {
+    memcpy (&put[1], dictionary, size);
+    put->size = size;
+  }
+  else
+  {
+    batch = merkle_batch_create ();
+    GNUNET_assert (0 == merkle_batch_add (batch, dictionary, size));
+    if (GNUNET_OK == merkle_batch_sign (batch, pconf->private_key))
+    {
+      put->size = merkle_batch_seal (batch, 0, &put[1], size + MERKLE_MAX_ENVELOPE);
+    }
+    merkle_batch_destroy (batch);
+    if (0 == put->size)
+    {
+      // Messages stay compressed without it
+      LOG_ERROR ("Publisher failed signing dictionary %u\n", id);
+      GNUNET_free (put);
+      return;
+    }
+  }
+  pconf->dictionary = put;
+  publisher_dictionary_send (put);
+}
+
+
+/**
+ * Closure for #publisher_publish_to_key
+ */
+struct Publisher_Publish_Context {
+  /**
+   * The publisher
+   */
+  struct Publisher_Config *pconf;
+  /**
+   * The topic of the message
+   */
+  const char *topic;
+  /**
+   * The payload
+   */
+  const void *data;
+  /**
+   * Size of data
+   */
+  size_t size;
+  /**
+   * Number of PUTs issued
+   */
+  unsigned int puts;
+};
+
+
+/**
+ * Put a message under the key of one subscriber
+ *
+ * @param cls The Publisher_Publish_Context
+ * @param key The accepting state key of the subscriber
+ * @param value ignored
+ * @return #GNUNET_YES to continue with the next subscriber
+ */
+static int
+publisher_publish_to_key (void *cls,
+                          const struct GNUNET_HashCode *key,
+                          void *value)
+{
+  struct Publisher_Publish_Context *ctx = (struct Publisher_Publish_Context *) cls;
+
+  if (GNUNET_OK == publisher_put (ctx->pconf, key, ctx->data, ctx->size))
+  {
+    ctx->puts++;
+  }
+  return GNUNET_YES;
+}
+
+
+/**
+ * Deliver a message in-process to a local subscription matching its topic
+ *
+ * @param cls The Publisher_Publish_Context
+ * @param subscription_cls The Subscriber_Config of the subscription
+ */
+static void
+publisher_publish_local (void *cls, void *subscription_cls)
+{
+  struct Publisher_Publish_Context *ctx = (struct Publisher_Publish_Context *) cls;
+  struct Subscriber_Config *sconf = (struct Subscriber_Config *) subscription_cls;
+
+  // Only subscriptions of the same peer are served without the DHT
+  if (0 != memcmp (&sconf->identity,
+                   &ctx->pconf->identity,
+                   sizeof (struct GNUNET_PeerIdentity)))
+  {
+    return;
+  }
+  subscriber_deliver (sconf, ctx->topic, ctx->data, ctx->size);
+}
+
+
+/**
+ * Put a message into the DHT for every subscriber found so far, and as the
+ * retained message of the topic if the publisher retains.
+ *
+ * With the TRY policy the message is only put if all of its PUTs can be
+ * issued right away. The check is made here, when the PUTs are issued, so
+ * it sees the credit taken by earlier messages of a signing batch.
+ *
+ * @param pconf The publisher
+ * @param data The payload, sealed if the publisher signs
+ * @param size Size of @a data
+ * @return The number of PUTs issued
+ */
+static unsigned int
+publisher_publish_remote (struct Publisher_Config *pconf,
+                          const void *data,
+                          size_t size)
+{
+  struct Publisher_Publish_Context ctx;
+  unsigned int needed = (GNUNET_YES == pconf->retain) ? 1 : 0;
+
+  if (NULL != pconf->subscriber_keys)
+  {
+    needed += GNUNET_CONTAINER_multihashmap_size (pconf->subscriber_keys);
+  }
+  if ((CREDIT_POLICY_TRY == pconf->flow_policy)
+      && (NULL != pconf->credits)
+      && (credit_lane_available (pconf->credits) < needed))
+  {
+    LOG_WARNING ("Publisher of \"%s\" is out of credit, message rejected\n",
+                 pconf->topic);
+    metrics_count (pconf->metrics, NODE_METRIC_PUTS_REJECTED, needed);
+    return 0;
+  }
+
+  ctx.pconf = pconf;
+  ctx.topic = pconf->topic;
+  ctx.data = data;
+  ctx.size = size;
+  ctx.puts = 0;
+  if ((GNUNET_YES == pconf->retain)
+      && (GNUNET_OK == publisher_retain (pconf, data, size)))
+  {
+    ctx.puts++;
+  }
+  if (NULL != pconf->subscriber_keys)
+  {
+    GNUNET_CONTAINER_multihashmap_iterate (pconf->subscriber_keys,
+                                           &publisher_publish_to_key,
+                                           &ctx);
+  }
+  return ctx.puts;
+}
+
+
+/**
+ * Sign the collected messages of a publisher together and put them into the
+ * DHT, each with the signed root and its inclusion proof
+ *
+ * @param pconf The publisher
+ * @return The number of PUTs issued
+ */
+static unsigned int
+publisher_flush_batch (struct Publisher_Config *pconf)
+{
+  char sealed[PUBLISHER_MAX_PAYLOAD];
+  unsigned int count = merkle_batch_size (pconf->batch);
+  unsigned int puts = 0;
+  unsigned int i;
+  size_t size;
+
+  if (0 == count)
+  {
+    return 0;
+  }
+  if (GNUNET_OK != merkle_batch_sign (pconf->batch, pconf->private_key))
+  {
+    LOG_ERROR ("Publisher failed signing %u messages\n", count);
+    merkle_batch_clear (pconf->batch);
+    return 0;
+  }
+  for (i = 0; i < count; i++)
+  {
+    size = merkle_batch_seal (pconf->batch, i, sealed, sizeof (sealed));
+    if (0 == size)
+    {
+      LOG_ERROR ("Publisher failed sealing message %u of the batch\n", i);
+      continue;
+    }
+    puts += publisher_publish_remote (pconf, sealed, size);
+  }
+  LOG_DEBUG ("Publisher signed %u messages with one signature, %u PUTs\n",
+             count, puts);
+  merkle_batch_clear (pconf->batch);
+  return puts;
+}
+
+
+/**
+ * Task signing the messages collected since the first one of the batch
+ *
+ * @param cls The Publisher_Config
+ * @param tc Task context
+ */
+static void
+publisher_flush_batch_task (void *cls,
+                            const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  struct Publisher_Config *pconf = (struct Publisher_Config *) cls;
+
+  pconf->batch_task = GNUNET_SCHEDULER_NO_TASK;
+  publisher_flush_batch (pconf);
+}
+
+
+/**
+ * Add a message to the signing batch of a publisher. A full batch is signed
+ * right away, otherwise once #PUBLISHER_BATCH_DELAY has passed.
  *
- * @param cls Closure.
- * @param options Options, for instance RecordRoute, DemultiplexEverywhere.
- * @param type The type of data in the request.
- * @param hop_count Hop count so far.
- * @param path_length number of entries in @a path (or 0 if not recorded).
- * @param path peers on the PUT path (or NULL if not recorded).
- * @param desired_replication_level Desired replication level.
- * @param exp Expiration time of the data.
- * @param key Key under which data is to be stored.
- * @param data Pointer to the data carried.
- * @param size Number of bytes in data.
+ * @param pconf The publisher
+ * @param data The payload
+ * @param size Size of @a data
+ * @return The number of PUTs issued
  */
-void subscriber_monitor_put_cb (void *cls,
-    enum GNUNET_DHT_RouteOption options,
-    enum GNUNET_BLOCK_Type type,
-    uint32_t hop_count,
-    uint32_t desired_replication_level,
-    unsigned int path_length,
-    const struct GNUNET_PeerIdentity *path,
-    struct GNUNET_TIME_Absolute exp,
-    const struct GNUNET_HashCode *key,
-    const void *data,
-    size_t size)
+static unsigned int
+publisher_batch (struct Publisher_Config *pconf,
+                 const void *data,
+                 size_t size)
 {
-  LOG_DEBUG("Subscriber monitor put callback called %s\n", GNUNET_h2s(key));
-  LOG_DEBUG("Subscriber monitor put data %s\n",
-            GNUNET_i2s((struct GNUNET_PeerIdentity *) data));
+  unsigned int puts = 0;
 
-  if (sizeof (struct GNUNET_PeerIdentity) == size)
+  if (PUBLISHER_MAX_MESSAGE < size)
+  {
+    LOG_ERROR ("Publisher payload of %u bytes is too large to sign\n",
+               (unsigned int) size);
+    return 0;
+  }
+  if (GNUNET_SYSERR == merkle_batch_add (pconf->batch, data, size))
   {
-    if (0 == memcmp (&publisher_conf.identity, data, size))
+    puts += publisher_flush_batch (pconf);
+    GNUNET_assert (GNUNET_SYSERR != merkle_batch_add (pconf->batch, data, size));
+  }
+  if (MERKLE_MAX_BATCH == merkle_batch_size (pconf->batch))
+  {
+    if (GNUNET_SCHEDULER_NO_TASK != pconf->batch_task)
     {
-      result = GNUNET_OK;
-      schedule_shutdown_test (0);
+      GNUNET_SCHEDULER_cancel (pconf->batch_task);
+      pconf->batch_task = GNUNET_SCHEDULER_NO_TASK;
     }
+    return puts + publisher_flush_batch (pconf);
+  }
+  if (GNUNET_SCHEDULER_NO_TASK == pconf->batch_task)
+  {
+    pconf->batch_task = GNUNET_SCHEDULER_add_delayed (PUBLISHER_BATCH_DELAY,
+                                                      &publisher_flush_batch_task,
+                                                      pconf);
   }
+  return puts;
 }
 
 
 /**
- * Issue DHT-Monitor for each state and free memory when done
+ * Serve the subscribers of the publishers own peer: deliver a message
+ * in-process to the local subscriptions matching its topic, and store it in
+ * the retained message cache of the peer if the publisher retains
  *
- * @param cls Subscriber_Conf
- * @param key current key code. Will be monitored
- * @param value value in the hash map, expected to bet the proof
- * @return #GNUNET_YES if we should continue to
- *         iterate,
- *         #GNUNET_NO if not.
+ * @param pconf The publisher
+ * @param topic The topic of the message
+ * @param timestamp When the message was published
+ * @param data The payload
+ * @param size Size of @a data
  */
-static int
-subscriber_monitor_state_and_free (void *cls,
-    const struct GNUNET_HashCode *key,
-    void *value)
+static void
+publisher_publish_node (struct Publisher_Config *pconf,
+                        const char *topic,
+                        struct GNUNET_TIME_Absolute timestamp,
+                        const void *data,
+                        size_t size)
 {
-  LOG_DEBUG ("Subscriber monitoring state %s %s\n", value, GNUNET_h2s(key));
+  struct Publisher_Publish_Context ctx;
+  struct Retained_Cache *cache;
+  struct GNUNET_HashCode key;
 
-  struct Subscriber_Config *sconf = (struct Subscriber_Config *) cls;
-  if (NULL == sconf->dht_handle)
+  ctx.pconf = pconf;
+  ctx.topic = topic;
+  ctx.data = data;
+  ctx.size = size;
+  ctx.puts = 0;
+  if (NULL != local_matcher)
   {
-    /* Use the provided configuration to connect to the dht */
-    sconf->dht_handle = GNUNET_DHT_connect (sconf->cfg, sconf->ht_length);
-    if (NULL == sconf->dht_handle)
-    {
-      LOG_ERROR ("Subscriber can not connect to DHT\n");
-      schedule_shutdown_test (0);
-      return GNUNET_NO;
-    }
+    matcher_match (local_matcher, topic, &publisher_publish_local, &ctx);
+  }
+  if ((GNUNET_YES == pconf->retain)
+      && (NULL != (cache = node_retained_cache (&pconf->identity))))
+  {
+    // Subscribers on our own peer are served from it, others ask the DHT
+    retained_key (topic, &key);
+    retained_cache_put (cache, &key, timestamp, data, size);
   }
+}
 
-  // todo add handle to some dll
-  GNUNET_DHT_monitor_start (sconf->dht_handle,
-                                    GNUNET_BLOCK_TYPE_TEST,
-                                    key,
-                                    &subscriber_monitor_get_cb,
-                                    &subscriber_monitor_get_response_cb,
-                                    &subscriber_monitor_put_cb,
-                                    sconf);
 
-  GNUNET_free (value);
-  return GNUNET_YES;
+/**
+ * Publish a message to every subscriber found so far. Subscribers on this
+ * node are matched and served locally, all others through the DHT. A
+ * retaining publisher also stores the message for later subscribers. A
+ * compressing publisher compresses the message for the DHT. A signing
+ * publisher collects messages and signs them together, so their PUTs are
+ * issued later.
+ *
+ * @param pconf The publisher
+ * @param data The payload
+ * @param size Size of @a data
+ * @return The number of PUTs issued
+ */
+static unsigned int
+publisher_publish (struct Publisher_Config *pconf,
+                   const void *data,
+                   size_t size)
+{
+  char encoded[PUBLISHER_MAX_MESSAGE];
+  struct GNUNET_TIME_Absolute now = GNUNET_TIME_absolute_get ();
+  size_t header_size;
+
+  metrics_count (pconf->metrics, NODE_METRIC_PUBLISHED, 1);
+  publisher_publish_node (pconf, pconf->topic, now, data, size);
+  // Subscribers of a filter learn the topic of a message from its header
+  header_size = message_write_header (pconf->topic,
+                                      now,
+                                      encoded,
+                                      sizeof (encoded));
+  if ((0 == header_size)
+      || (size + CODEC_MAX_OVERHEAD > sizeof (encoded) - header_size))
+  {
+    LOG_ERROR ("Publisher message to \"%s\" is too large\n", pconf->topic);
+    return 0;
+  }
+  if (NULL != pconf->encoder)
+  {
+    // Signed and put compressed, local subscribers got it plain already
+    size = codec_encode (pconf->encoder,
+                         data,
+                         size,
+                         &encoded[header_size],
+                         sizeof (encoded) - header_size);
+  }
+  else if (0 != size)
+  {
+    memcpy (&encoded[header_size], data, size);
+  }
+  data = encoded;
+  size += header_size;
+  if (NULL != pconf->batch)
+  {
+    return publisher_batch (pconf, data, size);
+  }
+  return publisher_publish_remote (pconf, data, size);
 }
 
 
 /**
- * Callback for #GNUNET_REGEX_announce_get_accepting_dht_entries
+ * Publish a message an application handed to the publisher. The flow policy
+ * of the topic applies when its PUTs are issued.
  *
- * @param cls The closure for the callback
- * @param a The original announcement
- * @param accepting_states A map containing all accepting states, or NULL if
- *        something went terribly wrong
+ * @param pconf The publisher
+ * @param data The payload
+ * @param size Size of @a data
  */
 static void
-subscriber_monitor_accepting_states (void *cls,
-    struct GNUNET_REGEX_Announcement *a,
-    struct GNUNET_CONTAINER_MultiHashMap *accepting_states)
+publisher_submit (struct Publisher_Config *pconf,
+                  const void *data,
+                  size_t size)
 {
-  LOG_DEBUG ("Subscriber start monitoring states\n");
-  struct Subscriber_Config *sconf = (struct Subscriber_Config *) cls;
-  GNUNET_CONTAINER_multihashmap_iterate (accepting_states,
-                                        &subscriber_monitor_state_and_free,
-                                        sconf);
-  GNUNET_CONTAINER_multihashmap_destroy (accepting_states);
+  LOG_DEBUG ("Publisher sent message of %u bytes to %u subscribers\n",
+             (unsigned int) size, publisher_publish (pconf, data, size));
 }
 
 
 /**
- * This is where the test logic should be, at least that part of it that uses
- * the DHT of peer "0".
+ * Called from the scheduler for every message an application thread
+ * published through the bridge
  *
- * @param cls closure, for the example: NULL
- * @param op should be equal to "dht_op"
- * @param ca_result result of the connect operation, the connection to the DHT
- *    service
- * @param emsg error message, if testbed somehow failed to connect to the DHT.
+ * @param cls The Publisher_Config
+ * @param lane The lane of the application thread
+ * @param topic The topic to publish to
+ * @param data The payload
+ * @param size Size of @a data
  */
 static void
-subscriber_run (void *cls,
-  struct GNUNET_TESTBED_Operation *op,
-  void *ca_result,
-  const char *emsg)
+publisher_bridge_publish (void *cls,
+                          unsigned int lane,
+                          const char *topic,
+                          const void *data,
+                          size_t size)
 {
-  LOG_DEBUG ("Running subscriber\n");
-
-  struct Subscriber_Config *sconf = (struct Subscriber_Config *) cls;
+  struct Publisher_Config *pconf = (struct Publisher_Config *) cls;
 
-  // Announce the subscriber anonymously
-  sconf->regex_announcement = GNUNET_REGEX_announce_with_key (sconf->cfg,
-                                                              sconf->topic,
-                                                              GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_SECONDS, 5),
-                                                              1,
-                                                              GNUNET_CRYPTO_eddsa_key_get_anonymous ());
-  if (NULL == sconf->regex_announcement)
+  if (0 != strcmp (topic, pconf->topic))
   {
-    LOG_ERROR ("Subscriber failed announcing interest \"%s\"\n", sconf->topic);
-    schedule_shutdown_test (0);
+    LOG_WARNING ("Publisher of \"%s\" can not publish to \"%s\"\n",
+                 pconf->topic, topic);
     return;
   }
-  LOG_DEBUG ("Subscriber announced interest \"%s\"\n", sconf->topic);
+  publisher_submit (pconf, data, size);
+}
 
-  int get_result = GNUNET_REGEX_announce_get_accepting_dht_entries (sconf->regex_announcement,
-                                                                    &subscriber_monitor_accepting_states,
-                                                                    sconf);
-  if (GNUNET_YES != get_result)
+
+/**
+ * Called from the scheduler for every message an application thread
+ * published through the bridge of a sharded node. Subscribers of the node's
+ * own peer are served here, as the workers have no local matcher and their
+ * PUTs carry the identity of the peer, which local subscribers ignore. Then
+ * the message is handed to the worker owning its topic, which starts
+ * publishing the topic on its first message.
+ *
+ * @param cls The Publisher_Config of the node
+ * @param lane The lane of the application thread
+ * @param topic The topic to publish to
+ * @param data The payload
+ * @param size Size of @a data
+ */
+static void
+publisher_shard_forward (void *cls,
+                         unsigned int lane,
+                         const char *topic,
+                         const void *data,
+                         size_t size)
+{
+  struct Publisher_Config *pconf = (struct Publisher_Config *) cls;
+
+  publisher_publish_node (pconf, topic, GNUNET_TIME_absolute_get (), data, size);
+  switch (shard_pool_publish (pconf->shard_pool, topic, data, size))
   {
-    LOG_ERROR ("Subscriber failed initiating accepting state lookup\n");
-    schedule_shutdown_test (0);
-    return;
+  case GNUNET_OK:
+    break;
+  case GNUNET_NO:
+    LOG_WARNING ("Shard of \"%s\" is not keeping up, message dropped\n", topic);
+    break;
+  default:
+    LOG_WARNING ("Message of %u bytes for \"%s\" is too large for a shard\n",
+                 (unsigned int) size, topic);
+    break;
   }
 }
 
 
 /**
- * shuts down the subscriber
+ * Cancel all operations of a publisher and release what it allocated, except
+ * for its DHT connection
  *
- * @param cls The Subscriber_Config
- * @param op_result ignored
- *
- * This gets called when the shutdown task runs
+ * @param pconf The publisher
  */
 static void
-subscriber_da (void *cls, void *op_result)
+publisher_cleanup (struct Publisher_Config *pconf)
 {
-  struct Subscriber_Config *sconf = (struct Subscriber_Config *) cls;
+  struct Publisher_Put *put;
 
-  if (NULL != sconf->regex_announcement)
+  if (GNUNET_SCHEDULER_NO_TASK != pconf->batch_task)
   {
-    GNUNET_REGEX_announce_cancel(sconf->regex_announcement);
-    sconf->regex_announcement = NULL;
+    GNUNET_SCHEDULER_cancel (pconf->batch_task);
+    pconf->batch_task = GNUNET_SCHEDULER_NO_TASK;
+  }
+  if (NULL != pconf->batch)
+  {
+    merkle_batch_destroy (pconf->batch);
+    pconf->batch = NULL;
+  }
+  if (NULL != pconf->private_key)
+  {
+    GNUNET_free (pconf->private_key);
+    pconf->private_key = NULL;
+  }
+  publisher_dictionary_cancel (pconf);
+  if (NULL != pconf->encoder)
+  {
+    struct Codec_Stats stats;
+    codec_encoder_get_stats (pconf->encoder, &stats);
+    LOG_DEBUG ("Publisher of \"%s\" compressed %llu messages of %llu bytes into %llu bytes, %llu with dictionary\n",
+               pconf->topic, stats.messages, stats.plain_bytes,
+               stats.encoded_bytes, stats.with_dictionary);
+    if (0 < stats.encoded_bytes)
+    {
+      LOG_DEBUG ("Publisher of \"%s\" fits %llu messages into %u bytes of DHT blocks instead of %llu\n",
+                 pconf->topic,
+                 PUBLISHER_MAX_BLOCK * stats.messages / stats.encoded_bytes,
+                 (unsigned int) PUBLISHER_MAX_BLOCK,
+                 PUBLISHER_MAX_BLOCK * stats.messages / GNUNET_MAX (1, stats.plain_bytes));
+    }
+    codec_encoder_destroy (pconf->encoder);
+    pconf->encoder = NULL;
+  }
+  while (NULL != (put = pconf->put_head))
+  {
+    GNUNET_CONTAINER_DLL_remove (pconf->put_head, pconf->put_tail, put);
+    GNUNET_DHT_put_cancel (put->handle);
+    metrics_gauge_add (pconf->metrics, NODE_METRIC_PUTS_IN_FLIGHT, -1);
+    arena_free (pconf->put_arena, put);
+  }
+  if (NULL != pconf->put_arena)
+  {
+    arena_destroy (pconf->put_arena);
+    pconf->put_arena = NULL;
   }
+  if (NULL != pconf->credits)
+  {
+    struct Credit_Stats stats;
+    credit_lane_get_stats (pconf->credits, &stats);
+    LOG_DEBUG ("Publisher of \"%s\" sent %llu PUTs, rejected %llu, dropped %llu\n",
+               pconf->topic, stats.sent, stats.rejected, stats.dropped);
 
-  if (NULL != sconf->dht_handle)
+    /* Returns the credit of the cancelled PUTs to the node */
+    credit_lane_destroy (pconf->credits);
+    pconf->credits = NULL;
+  }
+  if (NULL != pconf->regex_search)
   {
-    GNUNET_DHT_disconnect (sconf->dht_handle);
-    sconf->dht_handle = NULL;
+    GNUNET_REGEX_search_cancel(pconf->regex_search);
+    pconf->regex_search = NULL;
+  }
+  if (NULL != pconf->subscriber_keys)
+  {
+    GNUNET_CONTAINER_multihashmap_destroy (pconf->subscriber_keys);
+    pconf->subscriber_keys = NULL;
+  }
+  if (NULL != pconf->bridge)
+  {
+    bridge_destroy (pconf->bridge);
+    pconf->bridge = NULL;
   }
 }
 
 
 /**
- * Stores the given configuration in the master Subscriber_Conf struct
+ * Put a signal in the DHT for every matching regex
  *
- * @param cls closure
- * @param cfg peer configuration
+ * @param cls Closure provided in #GNUNET_REGEX_search.
+ * @param id Peer providing a regex that matches the string.
+ * @param get_path Path of the get request.
+ * @param get_path_length Lenght of @a get_path.
+ * @param put_path Path of the put request.
+ * @param put_path_length Length of the @a put_path.
  *
- * @return The Subscriber_Conf struct
+ * Search callback function, invoked for every result that was found. The key
+ * is remembered so later messages are published to this subscriber as well.
  */
-static void *
-subscriber_ca (void *cls, const struct GNUNET_CONFIGURATION_Handle *cfg)
+static void
+publisher_put_dht_signal(void *cls,
+                         const struct GNUNET_PeerIdentity *id,
+                         const struct GNUNET_PeerIdentity *get_path,
+                         unsigned int get_path_length,
+                         const struct GNUNET_PeerIdentity *put_path,
+                         unsigned int put_path_length,
+                         const struct GNUNET_HashCode *key)
 {
-  struct Subscriber_Config *sconf = (struct Subscriber_Config *) cls;
-  sconf->cfg = cfg;
-  GNUNET_CRYPTO_get_peer_identity(cfg, &sconf->identity);
+  struct Publisher_Config *pconf = (struct Publisher_Config *) cls;
 
-  LOG_DEBUG("Subscriber peer ID is %s\n", GNUNET_i2s(&sconf->identity));
+  // check if this was the anonymous peer!
+  struct GNUNET_CRYPTO_EddsaPublicKey anon_pkey;
+  GNUNET_CRYPTO_eddsa_key_get_public (GNUNET_CRYPTO_eddsa_key_get_anonymous (),
+                                      &anon_pkey);
+  if (0 != memcmp (&id->public_key, &anon_pkey, sizeof (struct GNUNET_CRYPTO_EddsaPublicKey)))
+  {
+#if 0
+    LOG_ERROR ("Publisher found announcement from %s\n", GNUNET_i2s(id));
+#endif
+    // schedule_shutdown_test (0);
+    return;
+  }
+  LOG_DEBUG("Publisher finds anonymous annonucement\n");
+  metrics_count (pconf->metrics, NODE_METRIC_SEARCH_RESULTS, 1);
 
-  return cls;
+  if (NULL == pconf->subscriber_keys)
+  {
+    pconf->subscriber_keys = GNUNET_CONTAINER_multihashmap_create (pconf->ht_length,
+                                                                   GNUNET_NO);
+  }
+  if (GNUNET_OK != GNUNET_CONTAINER_multihashmap_put (pconf->subscriber_keys,
+                                                      key,
+                                                      pconf,
+                                                      GNUNET_CONTAINER_MULTIHASHMAPOPTION_UNIQUE_ONLY))
+  {
+    /* We already signalled this subscriber */
+    metrics_count (pconf->metrics, NODE_METRIC_SEARCH_DUPLICATES, 1);
+    return;
+  }
+  LOG_DEBUG("Publisher puts signal for key %s\n", GNUNET_h2s(key));
+
+  switch (publisher_put (pconf, key, NULL, 0))
+  {
+  case GNUNET_OK:
+    break;
+  case GNUNET_NO:
+    LOG_WARNING ("Publisher is out of credit to signal %s\n", GNUNET_h2s (key));
+    break;
+  default:
+    schedule_shutdown_test (0);
+    return;
+  }
 }
 
 
 /**
- * Initialize given peer as a subscriber
+ * Called for every record a shard worker sends to the publishing node. The
+ * workers only acknowledge their PUTs, subscriptions are not sharded.
  *
- * @param peer The peer to initialize
- * @param conf The config structure for the peer
+ * @param cls The Publisher_Config
+ * @param shard Index of the shard
+ * @param type Type of the record
+ * @param topic The topic of the record
+ * @param data The payload
+ * @param size Size of @a data
  */
 static void
-start_subscriber (struct GNUNET_TESTBED_Peer *subscriber,
-    struct Subscriber_Config *conf)
+publisher_shard_record (void *cls,
+                        unsigned int shard,
+                        enum Shard_Record_Type type,
+                        const char *topic,
+                        const void *data,
+                        size_t size)
 {
-  LOG_DEBUG ("Starting Subscriber\n");
-
-  conf->ht_length = HT_LENGTH_DEFAULT;
-  conf->topic = "news/(gnunet|wikileaks)";
-
-  /* connect to a peers service */
-  conf->op = GNUNET_TESTBED_service_connect (NULL, /* Closure for operation */
-      subscriber, /* The peer whose service to connect to */
-      NULL, /* The name of the service */
-      &subscriber_run, /* callback to call after a handle to service is opened */
-      conf, /* closure for the above callback */
-      &subscriber_ca, /* callback to call with peer's configuration; this should open the needed service connection */
-      &subscriber_da, /* callback to be called when closing the opened service connection */
-      conf); /* closure for the above two callbacks */
+  switch (type)
+  {
+  case SHARD_RECORD_PUBLISHED:
+    LOG_DEBUG ("Shard %u published \"%s\"\n", shard, topic);
+    break;
+  default:
+    LOG_WARNING ("Shard %u sent unexpected record %d\n", shard, type);
+    break;
+  }
 }
 
 
 /**
- * DHT put continuation, called after the put has successfully sent out.
+ * Read a number from the regex-testbed section of the configuration
  *
- * @param cls ignored
- * @param success GNUNET_OK if the PUT was transmitted, GNUNET_NO on timeout,
- *        GNUNET_SYSERR on disconnect from service after the PUT message was
- *        transmitted (so we don't know if it was received or not)
+ * @param cfg The configuration
+ * @param option The option
+ * @param def Returned if the option is not set
+ * @return The value
  */
-static void
-publisher_put_dht_signal_done (void *cls,
-                               int success)
+static unsigned int
+get_testbed_number (const struct GNUNET_CONFIGURATION_Handle *cfg,
+                    const char *option,
+                    unsigned int def)
 {
-  struct Publisher_Config *pconf = (struct Publisher_Config *) cls;
-  pconf->put_handle = NULL;
+  unsigned long long value;
 
-  if (GNUNET_OK != success)
+  if (GNUNET_OK != GNUNET_CONFIGURATION_get_value_number (cfg,
+                                                          "regex-testbed",
+                                                          option,
+                                                          &value))
   {
-    LOG_ERROR("Publisher failed putting DHT Signal\n");
-    schedule_shutdown_test(0);
+    return def;
   }
+  return (unsigned int) value;
 }
 
 
 /**
- * Put a signal in the DHT for every matching regex
+ * Create a priority class within the budget of the node
  *
- * @param cls Closure provided in #GNUNET_REGEX_search.
- * @param id Peer providing a regex that matches the string.
- * @param get_path Path of the get request.
- * @param get_path_length Lenght of @a get_path.
- * @param put_path Path of the put request.
- * @param put_path_length Length of the @a put_path.
+ * @param cfg The configuration
+ * @param priority The class
+ * @param name Prefix of the options of the class
+ * @param credits Default in-flight budget
+ * @param weight Default drain weight
+ * @param queue_length Default queue length per topic
+ * @param timeout Default PUT timeout
+ */
+static void
+node_class_setup (const struct GNUNET_CONFIGURATION_Handle *cfg,
+                  enum Publisher_Priority priority,
+                  const char *name,
+                  unsigned int credits,
+                  unsigned int weight,
+                  unsigned int queue_length,
+                  struct GNUNET_TIME_Relative timeout)
+{
+  struct Publisher_Class *klass = &node_classes[priority];
+  char *option;
+
+  GNUNET_asprintf (&option, "%s_CREDITS", name);
+  credits = get_testbed_number (cfg, option, credits);
+  GNUNET_free (option);
+  GNUNET_asprintf (&option, "%s_WEIGHT", name);
+  weight = get_testbed_number (cfg, option, weight);
+  GNUNET_free (option);
+  klass->credits = credit_class_create (node_credits, credits, weight);
+  GNUNET_asprintf (&option, "%s_QUEUE_LENGTH", name);
+  klass->queue_length = get_testbed_number (cfg, option, queue_length);
+  GNUNET_free (option);
+  GNUNET_asprintf (&option, "%s_TIMEOUT", name);
+  if (GNUNET_OK != GNUNET_CONFIGURATION_get_value_time (cfg,
+                                                        "regex-testbed",
+                                                        option,
+                                                        &klass->timeout))
+  {
+    klass->timeout = timeout;
+  }
+  GNUNET_free (option);
+}
+
+
+/**
+ * Find the priority class of a topic, control if it matches one of the MQTT
+ * filters in CONTROL_TOPICS
  *
- * Search callback function, invoked for every result that was found. But if we
- * already have a DHT put handle every consequent call will be ignored.
+ * @param cfg The configuration
+ * @param topic The topic
+ * @return The class
  */
-static void
-publisher_put_dht_signal(void *cls,
-                         const struct GNUNET_PeerIdentity *id,
-                         const struct GNUNET_PeerIdentity *get_path,
-                         unsigned int get_path_length,
-                         const struct GNUNET_PeerIdentity *put_path,
-                         unsigned int put_path_length,
-                         const struct GNUNET_HashCode *key)
+static enum Publisher_Priority
+publisher_priority (const struct GNUNET_CONFIGURATION_Handle *cfg,
+                    const char *topic)
 {
-  struct Publisher_Config *pconf = (struct Publisher_Config *) cls;
+  enum Publisher_Priority priority = PUBLISHER_PRIORITY_BULK;
+  char *filters;
+  char *filter;
 
-  if (NULL != pconf->put_handle)
+  if (GNUNET_OK != GNUNET_CONFIGURATION_get_value_string (cfg,
+                                                          "regex-testbed",
+                                                          "CONTROL_TOPICS",
+                                                          &filters))
   {
-    /*
-     * Only add a new signal if we are currently not putting in the DHT.
-     * Because unfortunately this code is not capable of handling simultaneous
-     * PUTs.
-     */
-    return;
+    return priority;
   }
-
-  // check if this was the anonymous peer!
-  struct GNUNET_CRYPTO_EddsaPublicKey anon_pkey;
-  GNUNET_CRYPTO_eddsa_key_get_public (GNUNET_CRYPTO_eddsa_key_get_anonymous (),
-                                      &anon_pkey);
-  if (0 != memcmp (&id->public_key, &anon_pkey, sizeof (struct GNUNET_CRYPTO_EddsaPublicKey)))
+  for (filter = strtok (filters, " "); NULL != filter; filter = strtok (NULL, " "))
   {
-#if 0
-    LOG_ERROR ("Publisher found announcement from %s\n", GNUNET_i2s(id));
-#endif
-    // schedule_shutdown_test (0);
-    return;
+    if (GNUNET_YES == topic_filter_match (filter, topic))
+    {
+      priority = PUBLISHER_PRIORITY_CONTROL;
+      break;
+    }
   }
-  LOG_DEBUG("Publisher finds anonymous annonucement\n");
-  LOG_DEBUG("Publisher puts signal for key %s\n", GNUNET_h2s(key));
+  GNUNET_free (filters);
+  return priority;
+}
 
-  if (NULL == pconf->dht_handle)
+
+/**
+ * Give a publisher its in-flight budget in the priority class of its topic,
+ * creating the budget of the node and its classes with the first publisher
+ *
+ * @param pconf The publisher
+ * @return #GNUNET_OK on success, #GNUNET_SYSERR if the policy is unknown
+ */
+static int
+publisher_setup_flow_control (struct Publisher_Config *pconf)
+{
+  char *policy;
+
+  pconf->flow_policy = CREDIT_POLICY_QUEUE;
+  if (GNUNET_OK == GNUNET_CONFIGURATION_get_value_string (pconf->cfg,
+                                                          "regex-testbed",
+                                                          "FLOW_POLICY",
+                                                          &policy))
   {
-    /* Use the provided configuration to connect to the dht */
-    pconf->dht_handle = GNUNET_DHT_connect (pconf->cfg, pconf->ht_length);
-    if (NULL == pconf->dht_handle)
+    if (GNUNET_OK != credit_policy_from_string (policy, &pconf->flow_policy))
     {
-      LOG_ERROR ("Publisher can not connect to DHT\n");
-      schedule_shutdown_test (0);
-      return;
+      LOG_ERROR ("Unknown FLOW_POLICY \"%s\"\n", policy);
+      GNUNET_free (policy);
+      return GNUNET_SYSERR;
     }
+    GNUNET_free (policy);
   }
-
-  pconf->put_handle = GNUNET_DHT_put (pconf->dht_handle,
-            key, // key
-            2, // repl_lvl
-            GNUNET_DHT_RO_NONE, // options
-            GNUNET_BLOCK_TYPE_TEST , // type
-            sizeof (struct GNUNET_PeerIdentity), // size
-            &pconf->identity, // data
-            GNUNET_TIME_UNIT_FOREVER_ABS, // expiry
-            GNUNET_TIME_relative_multiply (GNUNET_TIME_UNIT_MINUTES, 1), //timeout
-            publisher_put_dht_signal_done, // continuation
-            pconf); // closure
-  if (NULL == pconf->put_handle)
+  if (NULL == node_credits)
   {
-    LOG_ERROR ("Publisher can not put Info into DHT\n");
-    schedule_shutdown_test (0);
-    return;
+    node_credits = credit_pool_create (get_testbed_number (pconf->cfg,
+                                                           "NODE_CREDITS",
+                                                           PUBLISHER_NODE_CREDITS));
+    // Created in order of urgency, which is the order they are drained in
+    node_class_setup (pconf->cfg, PUBLISHER_PRIORITY_CONTROL, "CONTROL",
+                      PUBLISHER_CONTROL_CREDITS, PUBLISHER_CONTROL_WEIGHT,
+                      PUBLISHER_CONTROL_QUEUE_LENGTH, PUBLISHER_CONTROL_TIMEOUT);
+    node_class_setup (pconf->cfg, PUBLISHER_PRIORITY_BULK, "BULK",
+                      PUBLISHER_BULK_CREDITS, PUBLISHER_BULK_WEIGHT,
+                      PUBLISHER_BULK_QUEUE_LENGTH, PUBLISHER_BULK_TIMEOUT);
   }
+  pconf->priority = &node_classes[publisher_priority (pconf->cfg, pconf->topic)];
+  LOG_DEBUG ("Publisher of \"%s\" is in the %s class\n", pconf->topic,
+             (&node_classes[PUBLISHER_PRIORITY_CONTROL] == pconf->priority)
+             ? "control" : "bulk");
+  pconf->credits = credit_lane_create (pconf->priority->credits,
+                                       get_testbed_number (pconf->cfg,
+                                                           "TOPIC_CREDITS",
+                                                           PUBLISHER_TOPIC_CREDITS),
+                                       pconf->flow_policy,
+                                       pconf->priority->queue_length,
+                                       &publisher_put_block_send,
+                                       pconf);
+  return GNUNET_OK;
 }
 
 
@@ -593,6 +3963,84 @@ publisher_run(void *cls,
   LOG_DEBUG ("Running publisher\n");
 
   struct Publisher_Config *pconf = (struct Publisher_Config *) cls;
+  unsigned long long num_shards;
+
+  pconf->retain = GNUNET_CONFIGURATION_get_value_yesno (pconf->cfg,
+                                                        "regex-testbed",
+                                                        "RETAIN");
+  if ((NULL == pconf->shard_worker)
+      && (GNUNET_OK == GNUNET_CONFIGURATION_get_value_number (pconf->cfg,
+                                                              "regex-testbed",
+                                                              "SHARDS",
+                                                              &num_shards))
+      && (0 < num_shards))
+  {
+    // The workers publish into the DHT, the node serves its own peer and
+    // hands the topics to them
+    pconf->shard_pool = shard_pool_start (binary_name,
+                                          pconf->cfg,
+                                          num_shards,
+                                          &publisher_shard_record,
+                                          pconf);
+    if (NULL == pconf->shard_pool)
+    {
+      LOG_ERROR ("Publisher can not start %llu shards\n", num_shards);
+      schedule_shutdown_test (0);
+      return;
+    }
+    if (GNUNET_OK != shard_pool_publish (pconf->shard_pool, pconf->topic, NULL, 0))
+    {
+      LOG_ERROR ("Publisher can not hand \"%s\" to its shard\n", pconf->topic);
+      schedule_shutdown_test (0);
+      return;
+    }
+    LOG_DEBUG ("Publisher handed \"%s\" to shard %u\n",
+               pconf->topic, shard_for_topic (pconf->topic, num_shards));
+    pconf->bridge = bridge_create (bridge_lanes, &publisher_shard_forward, pconf);
+    if (NULL == pconf->bridge)
+    {
+      LOG_WARNING ("Publisher can not create application bridge\n");
+    }
+    producer_try_start ();
+    return;
+  }
+
+  if (GNUNET_OK != publisher_setup_flow_control (pconf))
+  {
+    schedule_shutdown_test (0);
+    return;
+  }
+  if (GNUNET_YES == GNUNET_CONFIGURATION_get_value_yesno (pconf->cfg,
+                                                          "regex-testbed",
+                                                          "SIGN"))
+  {
+    // Messages are signed with the peers key, subscribers know it from the
+    // identity in front of every message
+    pconf->private_key = GNUNET_CRYPTO_eddsa_key_create_from_configuration (pconf->cfg);
+    if (NULL == pconf->private_key)
+    {
+      LOG_ERROR ("Publisher can not load its private key\n");
+      schedule_shutdown_test (0);
+      return;
+    }
+    pconf->batch = merkle_batch_create ();
+  }
+  if (GNUNET_YES == GNUNET_CONFIGURATION_get_value_yesno (pconf->cfg,
+                                                          "regex-testbed",
+                                                          "COMPRESS"))
+  {
+    pconf->encoder = codec_encoder_create (get_testbed_number (pconf->cfg,
+                                                               "COMPRESS_SAMPLES",
+                                                               CODEC_SAMPLES),
+                                           &publisher_put_dictionary,
+                                           pconf);
+    if (NULL == pconf->encoder)
+    {
+      LOG_ERROR ("Publisher can not set up compression\n");
+      schedule_shutdown_test (0);
+      return;
+    }
+  }
 
   // Search for the Subscribers
   pconf->regex_search = GNUNET_REGEX_search(pconf->cfg,
@@ -606,6 +4054,18 @@ publisher_run(void *cls,
     return;
   }
   LOG_DEBUG("Publisher does REGEX search \"%s\"\n", pconf->topic);
+  metrics_count (pconf->metrics, NODE_METRIC_SEARCHES, 1);
+
+  if (NULL == pconf->shard_worker)
+  {
+    // Let application threads publish through the bridge
+    pconf->bridge = bridge_create (bridge_lanes, &publisher_bridge_publish, pconf);
+    if (NULL == pconf->bridge)
+    {
+      LOG_WARNING ("Publisher can not create application bridge\n");
+    }
+    producer_try_start ();
+  }
 }
 
 
@@ -623,6 +4083,7 @@ publisher_ca (void *cls, const struct GNUNET_CONFIGURATION_Handle *cfg)
   struct Publisher_Config *pconf = (struct Publisher_Config *) cls;
   pconf->cfg = cfg;
   GNUNET_CRYPTO_get_peer_identity(cfg, &pconf->identity);
+  pconf->metrics = node_metrics_create (cfg, &node_metrics_sample, NULL);
 
   LOG_DEBUG("Publisher peer ID is %s\n", GNUNET_i2s(&pconf->identity));
   return cls;
@@ -642,20 +4103,19 @@ publisher_da (void *cls, void *op_result)
 {
   struct Publisher_Config *pconf = (struct Publisher_Config *) cls;
 
+  publisher_cleanup (pconf);
   if (NULL != pconf->dht_handle)
   {
-    if (NULL != pconf->put_handle)
-    {
-      GNUNET_DHT_put_cancel(pconf->put_handle);
-    }
     GNUNET_DHT_disconnect (pconf->dht_handle);
     pconf->dht_handle = NULL;
   }
-  if (NULL != pconf->regex_search)
+  if (NULL != pconf->shard_pool)
   {
-    GNUNET_REGEX_search_cancel(pconf->regex_search);
-    pconf->regex_search = NULL;
+    shard_pool_stop (pconf->shard_pool);
+    pconf->shard_pool = NULL;
   }
+  metrics_destroy (pconf->metrics);
+  pconf->metrics = NULL;
 
   pconf->op = NULL;
 }
@@ -688,6 +4148,77 @@ start_publisher (struct GNUNET_TESTBED_Peer *publisher,
 }
 
 
+/**
+ * Log the duration of one setup phase
+ *
+ * @param phase Name of the phase
+ * @param start When the phase started
+ * @param end When the phase ended
+ */
+static void
+setup_log_phase (const char *phase,
+                 struct GNUNET_TIME_Absolute start,
+                 struct GNUNET_TIME_Absolute end)
+{
+  LOG_DEBUG ("Setup phase %-9s %s\n",
+             phase,
+             GNUNET_STRINGS_relative_time_to_string (GNUNET_TIME_absolute_get_difference (start, end),
+                                                     GNUNET_NO));
+}
+
+
+/**
+ * Report how long each phase of the testbed setup took
+ */
+static void
+setup_report (void)
+{
+  struct Setup_Timings *t = &setup_timings;
+  struct GNUNET_TIME_Absolute last = t->prepared;
+
+  LOG_DEBUG ("Testbed with %u peers and %u links ready\n",
+             t->peers, t->links);
+  setup_log_phase ("prepare", t->start, t->prepared);
+  if (0 < t->peers)
+  {
+    setup_log_phase ("peers", last, t->peers_started);
+    last = t->peers_started;
+  }
+  if (0 < t->links)
+  {
+    setup_log_phase ("links", last, t->links_ready);
+    last = t->links_ready;
+  }
+  setup_log_phase ("handover", last, t->testbed_ready);
+  setup_log_phase ("total", t->start, t->testbed_ready);
+}
+
+
+/**
+ * Called by the testbed for peer starts and overlay links during setup
+ *
+ * @param cls NULL
+ * @param event The event
+ */
+static void
+setup_event_cb (void *cls, const struct GNUNET_TESTBED_EventInformation *event)
+{
+  switch (event->type)
+  {
+  case GNUNET_TESTBED_ET_PEER_START:
+    setup_timings.peers++;
+    setup_timings.peers_started = GNUNET_TIME_absolute_get ();
+    break;
+  case GNUNET_TESTBED_ET_CONNECT:
+    setup_timings.links++;
+    setup_timings.links_ready = GNUNET_TIME_absolute_get ();
+    break;
+  default:
+    break;
+  }
+}
+
+
 /**
  * Main function inovked from TESTBED once all of the peers are up and running.
  * This one then connects just to the DHT service of peer 0.
@@ -707,8 +4238,14 @@ run_test (void *cls,
     unsigned int links_succeeded,
     unsigned int links_failed)
 {
-  GNUNET_assert (NUM_PEERS == num_peers);
-  GNUNET_assert (1 < NUM_PEERS);
+  GNUNET_assert (testbed_peers == num_peers);
+  GNUNET_assert (1 < num_peers);
+
+  setup_timings.testbed_ready = GNUNET_TIME_absolute_get ();
+  setup_report ();
+
+  local_matcher = matcher_create ();
+  retained_caches = GNUNET_CONTAINER_multipeermap_create (testbed_peers, GNUNET_NO);
 
   // First set a time limit for the simulation
   schedule_shutdown_test (600);
@@ -723,21 +4260,342 @@ run_test (void *cls,
   // monitor the DHT to addition by the publisher!
   struct GNUNET_TESTBED_Peer *subscriber = peers[1];
   start_subscriber (subscriber, &subscriber_conf);
+
+  // A subscriber next to the publisher gets its messages without the DHT
+  if (GNUNET_YES == local_subscriber)
+  {
+    start_subscriber (publisher, &local_subscriber_conf);
+  }
+}
+
+
+/**
+ * State of this process if it runs as a shard worker
+ */
+struct Shard_Worker_Context {
+  /**
+   * File name of the shared memory segment
+   */
+  const char *segment;
+  /**
+   * Index of the shard
+   */
+  unsigned int index;
+  /**
+   * File name of the peer configuration
+   */
+  const char *cfg_filename;
+  /**
+   * The peer configuration
+   */
+  struct GNUNET_CONFIGURATION_Handle *cfg;
+  /**
+   * Connection to the node
+   */
+  struct Shard_Worker *worker;
+  /**
+   * DHT connection shared by all publishers of this shard
+   */
+  struct GNUNET_DHT_Handle *dht_handle;
+  /**
+   * Metrics shared by all publishers of this shard
+   */
+  struct Metrics *metrics;
+  /**
+   * Publisher_Config of every topic owned by this shard, keyed by the hash of
+   * the topic
+   */
+  struct GNUNET_CONTAINER_MultiHashMap *publishers;
+};
+
+
+/**
+ * Cancel all operations of a shard publisher and free it
+ *
+ * @param cls ignored
+ * @param key hash of the topic
+ * @param value The Publisher_Config
+ * @return #GNUNET_YES to continue iterating
+ */
+static int
+shard_worker_free_publisher (void *cls,
+                             const struct GNUNET_HashCode *key,
+                             void *value)
+{
+  struct Publisher_Config *pconf = (struct Publisher_Config *) value;
+
+  publisher_cleanup (pconf);
+  GNUNET_free (pconf->topic);
+  GNUNET_free (pconf);
+  return GNUNET_YES;
+}
+
+
+/**
+ * Clean up the shard worker, runs on shutdown
+ *
+ * @param cls The Shard_Worker_Context
+ * @param tc Task context
+ */
+static void
+shard_worker_shutdown (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  struct Shard_Worker_Context *ctx = (struct Shard_Worker_Context *) cls;
+
+  if (NULL != ctx->worker)
+  {
+    shard_worker_detach (ctx->worker);
+    ctx->worker = NULL;
+  }
+  if (NULL != ctx->publishers)
+  {
+    GNUNET_CONTAINER_multihashmap_iterate (ctx->publishers,
+                                           &shard_worker_free_publisher,
+                                           NULL);
+    GNUNET_CONTAINER_multihashmap_destroy (ctx->publishers);
+    ctx->publishers = NULL;
+  }
+  metrics_destroy (ctx->metrics);
+  ctx->metrics = NULL;
+  node_credits_destroy ();
+  if (NULL != ctx->dht_handle)
+  {
+    GNUNET_DHT_disconnect (ctx->dht_handle);
+    ctx->dht_handle = NULL;
+  }
+  if (NULL != ctx->cfg)
+  {
+    GNUNET_CONFIGURATION_destroy (ctx->cfg);
+    ctx->cfg = NULL;
+  }
+}
+
+
+/**
+ * Called for every record the node sends to this shard. The first record of
+ * a topic starts a publisher for it, every record with a payload is
+ * published.
+ *
+ * @param cls The Shard_Worker_Context
+ * @param shard Index of this shard
+ * @param type Type of the record
+ * @param topic The topic to publish to
+ * @param data The payload
+ * @param size Size of @a data
+ */
+static void
+shard_worker_record (void *cls,
+                     unsigned int shard,
+                     enum Shard_Record_Type type,
+                     const char *topic,
+                     const void *data,
+                     size_t size)
+{
+  struct Shard_Worker_Context *ctx = (struct Shard_Worker_Context *) cls;
+  struct Publisher_Config *pconf;
+  struct GNUNET_HashCode topic_hash;
+
+  if (SHARD_RECORD_PUBLISH != type)
+  {
+    LOG_WARNING ("Shard %u received unexpected record %d\n", shard, type);
+    return;
+  }
+
+  GNUNET_CRYPTO_hash (topic, strlen (topic), &topic_hash);
+  pconf = GNUNET_CONTAINER_multihashmap_get (ctx->publishers, &topic_hash);
+  if (NULL == pconf)
+  {
+    pconf = GNUNET_new (struct Publisher_Config);
+    pconf->topic = GNUNET_strdup (topic);
+    pconf->ht_length = HT_LENGTH_DEFAULT;
+    pconf->cfg = ctx->cfg;
+    pconf->dht_handle = ctx->dht_handle;
+    pconf->metrics = ctx->metrics;
+    pconf->shard_worker = ctx->worker;
+    GNUNET_CRYPTO_get_peer_identity (ctx->cfg, &pconf->identity);
+    GNUNET_CONTAINER_multihashmap_put (ctx->publishers,
+                                       &topic_hash,
+                                       pconf,
+                                       GNUNET_CONTAINER_MULTIHASHMAPOPTION_UNIQUE_FAST);
+
+    LOG_DEBUG ("Shard %u publishes \"%s\"\n", shard, topic);
+    publisher_run (pconf, NULL, NULL, NULL);
+  }
+
+  // A record without payload only hands the topic over
+  if (0 != size)
+  {
+    publisher_submit (pconf, data, size);
+  }
+}
+
+
+/**
+ * Connect the shard worker to its peer and to the node
+ *
+ * @param cls The Shard_Worker_Context
+ * @param tc Task context
+ */
+static void
+shard_worker_run (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  struct Shard_Worker_Context *ctx = (struct Shard_Worker_Context *) cls;
+
+  GNUNET_SCHEDULER_add_delayed (GNUNET_TIME_UNIT_FOREVER_REL,
+                                &shard_worker_shutdown,
+                                ctx);
+
+  ctx->cfg = GNUNET_CONFIGURATION_create ();
+  if (GNUNET_OK != GNUNET_CONFIGURATION_load (ctx->cfg, ctx->cfg_filename))
+  {
+    LOG_ERROR ("Shard %u can not load configuration %s\n",
+               ctx->index, ctx->cfg_filename);
+    GNUNET_SCHEDULER_shutdown ();
+    return;
+  }
+  ctx->dht_handle = GNUNET_DHT_connect (ctx->cfg, HT_LENGTH_DEFAULT);
+  if (NULL == ctx->dht_handle)
+  {
+    LOG_ERROR ("Shard %u can not connect to DHT\n", ctx->index);
+    GNUNET_SCHEDULER_shutdown ();
+    return;
+  }
+  ctx->metrics = node_metrics_create (ctx->cfg, &node_metrics_sample, NULL);
+  ctx->publishers = GNUNET_CONTAINER_multihashmap_create (HT_LENGTH_DEFAULT,
+                                                          GNUNET_NO);
+  ctx->worker = shard_worker_attach (ctx->segment,
+                                     ctx->index,
+                                     &shard_worker_record,
+                                     ctx);
+  if (NULL == ctx->worker)
+  {
+    GNUNET_SCHEDULER_shutdown ();
+    return;
+  }
+  LOG_DEBUG ("Shard %u running\n", ctx->index);
+}
+
+
+/**
+ * Run this process as one shard of a publishing node
+ *
+ * @param argc number of arguments
+ * @param argv `<binary> --shard-worker <segment> <index> <config>`
+ * @return 0 on success
+ */
+static int
+shard_worker_main (int argc, char **argv)
+{
+  struct Shard_Worker_Context ctx;
+
+  memset (&ctx, 0, sizeof (ctx));
+  ctx.segment = argv[2];
+  ctx.index = (unsigned int) strtoul (argv[3], NULL, 10);
+  ctx.cfg_filename = argv[4];
+  GNUNET_SCHEDULER_run (&shard_worker_run, &ctx);
+  return 0;
+}
+
+
+/**
+ * Read the options of the run from the template
+ *
+ * @param template The template configuration
+ * @return #GNUNET_OK on success
+ */
+static int
+prepare_testbed (const char *template)
+{
+  struct GNUNET_CONFIGURATION_Handle *cfg;
+
+  cfg = GNUNET_CONFIGURATION_create ();
+  if (GNUNET_OK != GNUNET_CONFIGURATION_load (cfg, template))
+  {
+    LOG_ERROR ("Can not load template configuration %s\n", template);
+    GNUNET_CONFIGURATION_destroy (cfg);
+    return GNUNET_SYSERR;
+  }
+  testbed_peers = GNUNET_MAX (NUM_PEERS, get_testbed_number (cfg, "PEERS", NUM_PEERS));
+  bridge_lanes = GNUNET_MAX (1, get_testbed_number (cfg, "THREADS", 1));
+  local_subscriber = GNUNET_CONFIGURATION_get_value_yesno (cfg,
+                                                           "regex-testbed",
+                                                           "LOCAL_SUBSCRIBER");
+  produce_count = GNUNET_MAX (1, GNUNET_MIN (PRODUCER_MAX_MESSAGES,
+                                             get_testbed_number (cfg, "PRODUCE", 1)));
+  resubscribe = GNUNET_CONFIGURATION_have_value (cfg,
+                                                 "regex-testbed",
+                                                 "RESUBSCRIBE");
+  GNUNET_CONFIGURATION_destroy (cfg);
+  return GNUNET_OK;
+}
+
+
+/**
+ * Find the absolute path of our own binary. argv[0] is not enough, it is a
+ * bare name if we were started through PATH and relative to a working
+ * directory the testbed may change.
+ *
+ * @param argv0 The name we were started with
+ * @return The path, free with #GNUNET_free
+ */
+static char *
+resolve_binary_name (const char *argv0)
+{
+  char path[PATH_MAX];
+  ssize_t len;
+
+  len = readlink ("/proc/self/exe", path, sizeof (path) - 1);
+  if (0 < len)
+  {
+    path[len] = '\0';
+    return GNUNET_strdup (path);
+  }
+  if ((NULL != strchr (argv0, '/'))
+      && (NULL != realpath (argv0, path)))
+  {
+    return GNUNET_strdup (path);
+  }
+  LOG_WARNING ("Can not resolve the path of %s, shard workers may not start\n",
+               argv0);
+  return GNUNET_strdup (argv0);
 }
 
 
 int
 main (int argc, char **argv)
 {
+  const char *template = TEMPLATE_DEFAULT;
   int ret;
+
+  if ((5 == argc) && (0 == strcmp (SHARD_WORKER_ARGUMENT, argv[1])))
+  {
+    return shard_worker_main (argc, argv);
+  }
+  binary_name = resolve_binary_name (argv[0]);
+  if (2 == argc)
+  {
+    // e.g. regex_testbed-fast.conf
+    template = argv[1];
+  }
+
+  setup_timings.start = GNUNET_TIME_absolute_get ();
+  if (GNUNET_OK != prepare_testbed (template))
+  {
+    GNUNET_free (binary_name);
+    return 1;
+  }
+  setup_timings.prepared = GNUNET_TIME_absolute_get ();
+
   ret = GNUNET_TESTBED_test_run ("regex-announce-anonymous-test", /* test case name */
-      "regex_testbed.conf", /* template configuration */
-      NUM_PEERS, /* number of peers to start */
-      0LL, /* Event mask -set to 0 for no event notifications */
-      NULL, /* Controller event callback */
+      template, /* template configuration */
+      testbed_peers, /* number of peers to start */
+      (1LL << GNUNET_TESTBED_ET_PEER_START)
+      | (1LL << GNUNET_TESTBED_ET_CONNECT), /* Events needed for the setup timings */
+      &setup_event_cb, /* Controller event callback */
       NULL, /* Closure for controller event callback */
       &run_test, /* continuation callback to be called when testbed setup is complete */
       NULL); /* Closure for the run_test callback */
+  GNUNET_free (binary_name);
 
   if ((GNUNET_OK != ret) || (GNUNET_OK != result)) {
     LOG_ERROR("FAIL: (╯°□°）╯︵ ┻━┻\n");
@@ -0,0 +1,430 @@
+#include "retained.h"
+
+
+/**
+ * Prefix hashed with the topic to get the retained key, keeps retained keys
+ * apart from REGEX state keys
+ */
+#define RETAINED_KEY_PREFIX "regex-testbed-retained:"
+
+
+/**
+ * A set of topics produced while expanding a regex
+ */
+struct Retained_Set {
+  /**
+   * The topics
+   */
+  char **topics;
+  /**
+   * Number of topics
+   */
+  unsigned int count;
+};
+
+
+/**
+ * A cached retained message
+ */
+struct Retained_Entry {
+  /**
+   * Kept in a DLL ordered by last use, most recent first
+   */
+  struct Retained_Entry *prev;
+  /**
+   * Kept in a DLL ordered by last use, most recent first
+   */
+  struct Retained_Entry *next;
+  /**
+   * The retained key of the topic
+   */
+  struct GNUNET_HashCode key;
+  /**
+   * When the message was published
+   */
+  struct GNUNET_TIME_Absolute timestamp;
+  /**
+   * When the entry stops being served
+   */
+  struct GNUNET_TIME_Absolute expiration;
+  /**
+   * Size of the payload following this struct
+   */
+  size_t size;
+};
+
+
+struct Retained_Cache {
+  /**
+   * Maps retained keys to their Retained_Entry
+   */
+  struct GNUNET_CONTAINER_MultiHashMap *entries;
+  /**
+   * Most recently used entry
+   */
+  struct Retained_Entry *head;
+  /**
+   * Least recently used entry, evicted first
+   */
+  struct Retained_Entry *tail;
+  /**
+   * Maximum number of entries
+   */
+  unsigned int capacity;
+  /**
+   * How long an entry is served after it was stored
+   */
+  struct GNUNET_TIME_Relative ttl;
+};
+
+
+void
+retained_key (const char *topic, struct GNUNET_HashCode *key)
+{
+  char *name;
+
+  GNUNET_asprintf (&name, "%s%s", RETAINED_KEY_PREFIX, topic);
+  GNUNET_CRYPTO_hash (name, strlen (name), key);
+  GNUNET_free (name);
+}
+
+
+/**
+ * Free all topics of a set and empty it
+ *
+ * @param set The set
+ */
+static void
+retained_set_clear (struct Retained_Set *set)
+{
+  unsigned int i;
+
+  for (i = 0; i < set->count; i++)
+  {
+    GNUNET_free (set->topics[i]);
+  }
+  GNUNET_free_non_null (set->topics);
+  set->topics = NULL;
+  set->count = 0;
+}
+
+
+/**
+ * Add a topic to a set
+ *
+ * @param set The set
+ * @param topic The topic, owned by the set afterwards
+ */
+static void
+retained_set_add (struct Retained_Set *set, char *topic)
+{
+  GNUNET_array_append (set->topics, set->count, topic);
+}
+
+
+/**
+ * Replace a set by the concatenation of each of its topics with each topic
+ * of another set
+ *
+ * @param set The prefixes, replaced by the result
+ * @param suffixes The suffixes
+ * @return #GNUNET_OK, #GNUNET_SYSERR if the result would be too large
+ */
+static int
+retained_set_product (struct Retained_Set *set,
+                      const struct Retained_Set *suffixes)
+{
+  struct Retained_Set product;
+  unsigned int i;
+  unsigned int j;
+  char *topic;
+
+  if (RETAINED_MAX_TOPICS < set->count * suffixes->count)
+  {
+    return GNUNET_SYSERR;
+  }
+  memset (&product, 0, sizeof (product));
+  for (i = 0; i < set->count; i++)
+  {
+    for (j = 0; j < suffixes->count; j++)
+    {
+      GNUNET_asprintf (&topic, "%s%s", set->topics[i], suffixes->topics[j]);
+      retained_set_add (&product, topic);
+    }
+  }
+  retained_set_clear (set);
+  *set = product;
+  return GNUNET_OK;
+}
+
+
+static int
+retained_expand_alternation (const char **pos, struct Retained_Set *set);
+
+
+/**
+ * Expand a sequence of atoms up to the next `|`, `)` or the end
+ *
+ * @param pos Position in the regex, advanced past the sequence
+ * @param set Set to the topics of the sequence
+ * @return #GNUNET_OK, #GNUNET_SYSERR if the sequence can not be enumerated
+ */
+static int
+retained_expand_concatenation (const char **pos, struct Retained_Set *set)
+{
+  struct Retained_Set atom;
+  char literal[2];
+  int ret;
+
+  memset (set, 0, sizeof (struct Retained_Set));
+  retained_set_add (set, GNUNET_strdup (""));
+  while (('\0' != **pos) && ('|' != **pos) && (')' != **pos))
+  {
+    memset (&atom, 0, sizeof (atom));
+    ret = GNUNET_OK;
+    switch (**pos)
+    {
+    case '(':
+      (*pos)++;
+      ret = retained_expand_alternation (pos, &atom);
+      if ((GNUNET_OK != ret) || (')' != **pos))
+      {
+        ret = GNUNET_SYSERR;
+        break;
+      }
+      (*pos)++;
+      break;
+    case '*':
+    case '+':
+    case '.':
+    case '[':
+    case ']':
+    case '{':
+    case '}':
+    case '?':
+      /* Infinite or too large languages, or a dangling operator */
+      ret = GNUNET_SYSERR;
+      break;
+    case '\\':
+      (*pos)++;
+      if ('\0' == **pos)
+      {
+        ret = GNUNET_SYSERR;
+        break;
+      }
+      /* fall through */
+    default:
+      literal[0] = **pos;
+      literal[1] = '\0';
+      retained_set_add (&atom, GNUNET_strdup (literal));
+      (*pos)++;
+      break;
+    }
+    if ((GNUNET_OK == ret) && ('?' == **pos))
+    {
+      retained_set_add (&atom, GNUNET_strdup (""));
+      (*pos)++;
+    }
+    if (GNUNET_OK == ret)
+    {
+      ret = retained_set_product (set, &atom);
+    }
+    retained_set_clear (&atom);
+    if (GNUNET_OK != ret)
+    {
+      retained_set_clear (set);
+      return GNUNET_SYSERR;
+    }
+  }
+  return GNUNET_OK;
+}
+
+
+/**
+ * Expand alternatives separated by `|` up to the next `)` or the end
+ *
+ * @param pos Position in the regex, advanced past the alternatives
+ * @param set Set to the topics of all alternatives
+ * @return #GNUNET_OK, #GNUNET_SYSERR if the alternatives can not be enumerated
+ */
+static int
+retained_expand_alternation (const char **pos, struct Retained_Set *set)
+{
+  struct Retained_Set alternative;
+  unsigned int i;
+
+  if (GNUNET_OK != retained_expand_concatenation (pos, set))
+  {
+    return GNUNET_SYSERR;
+  }
+  while ('|' == **pos)
+  {
+    (*pos)++;
+    if ((GNUNET_OK != retained_expand_concatenation (pos, &alternative))
+        || (RETAINED_MAX_TOPICS < set->count + alternative.count))
+    {
+      retained_set_clear (&alternative);
+      retained_set_clear (set);
+      return GNUNET_SYSERR;
+    }
+    for (i = 0; i < alternative.count; i++)
+    {
+      retained_set_add (set, alternative.topics[i]);
+    }
+    GNUNET_free_non_null (alternative.topics);
+  }
+  return GNUNET_OK;
+}
+
+
+int
+retained_expand (const char *regex,
+                 Retained_Topic_Callback cb,
+                 void *cb_cls)
+{
+  struct Retained_Set set;
+  const char *pos = regex;
+  unsigned int count = 0;
+  unsigned int i;
+  unsigned int j;
+
+  if ((GNUNET_OK != retained_expand_alternation (&pos, &set))
+      || ('\0' != *pos))
+  {
+    retained_set_clear (&set);
+    return GNUNET_SYSERR;
+  }
+  for (i = 0; i < set.count; i++)
+  {
+    // Alternatives may overlap, report every topic once
+    for (j = 0; j < i; j++)
+    {
+      if (0 == strcmp (set.topics[i], set.topics[j]))
+      {
+        break;
+      }
+    }
+    if (j < i)
+    {
+      continue;
+    }
+    count++;
+    if (NULL != cb)
+    {
+      cb (cb_cls, set.topics[i]);
+    }
+  }
+  retained_set_clear (&set);
+  return (int) count;
+}
+
+
+struct Retained_Cache *
+retained_cache_create (unsigned int capacity, struct GNUNET_TIME_Relative ttl)
+{
+  struct Retained_Cache *cache;
+
+  cache = GNUNET_new (struct Retained_Cache);
+  cache->capacity = GNUNET_MAX (1, capacity);
+  cache->ttl = ttl;
+  cache->entries = GNUNET_CONTAINER_multihashmap_create (cache->capacity,
+                                                         GNUNET_NO);
+  return cache;
+}
+
+
+/**
+ * Remove an entry from the cache and free it
+ *
+ * @param cache The cache
+ * @param entry The entry
+ */
+static void
+retained_cache_remove (struct Retained_Cache *cache,
+                       struct Retained_Entry *entry)
+{
+  GNUNET_CONTAINER_DLL_remove (cache->head, cache->tail, entry);
+  GNUNET_CONTAINER_multihashmap_remove (cache->entries, &entry->key, entry);
+  GNUNET_free (entry);
+}
+
+
+int
+retained_cache_put (struct Retained_Cache *cache,
+                    const struct GNUNET_HashCode *key,
+                    struct GNUNET_TIME_Absolute timestamp,
+                    const void *data,
+                    size_t size)
+{
+  struct Retained_Entry *entry;
+
+  entry = GNUNET_CONTAINER_multihashmap_get (cache->entries, key);
+  if (NULL != entry)
+  {
+    if ((entry->timestamp.abs_value_us > timestamp.abs_value_us)
+        && (0 != GNUNET_TIME_absolute_get_remaining (entry->expiration).rel_value_us))
+    {
+      return GNUNET_NO;
+    }
+    retained_cache_remove (cache, entry);
+  }
+  else if (GNUNET_CONTAINER_multihashmap_size (cache->entries) >= cache->capacity)
+  {
+    retained_cache_remove (cache, cache->tail);
+  }
+
+  entry = GNUNET_malloc (sizeof (struct Retained_Entry) + size);
+  entry->key = *key;
+  entry->timestamp = timestamp;
+  entry->expiration = GNUNET_TIME_relative_to_absolute (cache->ttl);
+  entry->size = size;
+  memcpy (&entry[1], data, size);
+  GNUNET_CONTAINER_multihashmap_put (cache->entries,
+                                     key,
+                                     entry,
+                                     GNUNET_CONTAINER_MULTIHASHMAPOPTION_UNIQUE_FAST);
+  GNUNET_CONTAINER_DLL_insert (cache->head, cache->tail, entry);
+  return GNUNET_YES;
+}
+
+
+const void *
+retained_cache_get (struct Retained_Cache *cache,
+                    const struct GNUNET_HashCode *key,
+                    struct GNUNET_TIME_Absolute *timestamp,
+                    size_t *size)
+{
+  struct Retained_Entry *entry;
+
+  entry = GNUNET_CONTAINER_multihashmap_get (cache->entries, key);
+  if (NULL == entry)
+  {
+    return NULL;
+  }
+  if (0 == GNUNET_TIME_absolute_get_remaining (entry->expiration).rel_value_us)
+  {
+    retained_cache_remove (cache, entry);
+    return NULL;
+  }
+  GNUNET_CONTAINER_DLL_remove (cache->head, cache->tail, entry);
+  GNUNET_CONTAINER_DLL_insert (cache->head, cache->tail, entry);
+  *timestamp = entry->timestamp;
+  *size = entry->size;
+  return &entry[1];
+}
+
+
+void
+retained_cache_destroy (struct Retained_Cache *cache)
+{
+  if (NULL == cache)
+  {
+    return;
+  }
+  while (NULL != cache->head)
+  {
+    retained_cache_remove (cache, cache->head);
+  }
+  GNUNET_CONTAINER_multihashmap_destroy (cache->entries);
+  GNUNET_free (cache);
+}
@@ -0,0 +1,117 @@
+#ifndef RETAINED_H
+#define RETAINED_H
+
+#include <gnunet/platform.h>
+#include <gnunet/gnunet_util_lib.h>
+
+
+/**
+ * Maximum number of topics #retained_expand produces for one regex
+ */
+#define RETAINED_MAX_TOPICS 64
+
+
+/**
+ * In-memory cache of the last retained message of recently looked up topics,
+ * so repeated lookups on a node do not go to the DHT.
+ *
+ * The cache holds a fixed number of topics and evicts the least recently
+ * used one when full. Entries older than the time to live of the cache are
+ * treated as missing, so a lookup goes to the DHT again.
+ */
+struct Retained_Cache;
+
+
+/**
+ * Called for every topic a regex expands to
+ *
+ * @param cls Closure
+ * @param topic The topic
+ */
+typedef void
+(*Retained_Topic_Callback) (void *cls, const char *topic);
+
+
+/**
+ * Derive the DHT key the retained message of a topic is stored under
+ *
+ * @param topic The topic
+ * @param key Set to the key
+ */
+void
+retained_key (const char *topic, struct GNUNET_HashCode *key);
+
+
+/**
+ * Enumerate the topics a subscription regex matches.
+ *
+ * Only finite languages can be enumerated: literals, `\` escapes, grouping,
+ * alternation and `?`. Regexes using `*`, `+`, `.` or bracket expressions, or
+ * matching more than #RETAINED_MAX_TOPICS topics, are rejected.
+ *
+ * @param regex The subscription regex
+ * @param cb Called for every topic
+ * @param cb_cls Closure for @a cb
+ * @return Number of topics, #GNUNET_SYSERR if @a regex can not be enumerated
+ */
+int
+retained_expand (const char *regex,
+                 Retained_Topic_Callback cb,
+                 void *cb_cls);
+
+
+/**
+ * Create an empty cache
+ *
+ * @param capacity Maximum number of topics held
+ * @param ttl How long an entry is served after it was stored
+ * @return The new cache
+ */
+struct Retained_Cache *
+retained_cache_create (unsigned int capacity, struct GNUNET_TIME_Relative ttl);
+
+
+/**
+ * Store a retained message unless the cache holds a newer one for its key
+ *
+ * @param cache The cache
+ * @param key The retained key of the topic
+ * @param timestamp When the message was published
+ * @param data The payload
+ * @param size Size of @a data
+ * @return #GNUNET_YES if stored, #GNUNET_NO if the cached message is newer
+ */
+int
+retained_cache_put (struct Retained_Cache *cache,
+                    const struct GNUNET_HashCode *key,
+                    struct GNUNET_TIME_Absolute timestamp,
+                    const void *data,
+                    size_t size);
+
+
+/**
+ * Look up the retained message of a topic
+ *
+ * @param cache The cache
+ * @param key The retained key of the topic
+ * @param timestamp Set to when the message was published
+ * @param size Set to the size of the payload
+ * @return The payload, valid until the next call on @a cache; NULL on a miss
+ *         or if the entry expired
+ */
+const void *
+retained_cache_get (struct Retained_Cache *cache,
+                    const struct GNUNET_HashCode *key,
+                    struct GNUNET_TIME_Absolute *timestamp,
+                    size_t *size);
+
+
+/**
+ * Free the cache
+ *
+ * @param cache The cache, may be NULL
+ */
+void
+retained_cache_destroy (struct Retained_Cache *cache);
+
+#endif
@@ -0,0 +1,214 @@
+#include <stdatomic.h>
+#include "ring.h"
+
+
+/**
+ * Size of a cache line. Producer and consumer indices are kept on different
+ * lines so the two sides do not invalidate each others cache.
+ */
+#define RING_CACHE_LINE 64
+
+
+/**
+ * Header in front of every slot
+ */
+struct Ring_Slot_Header {
+  /**
+   * Number of payload bytes in the slot
+   */
+  uint32_t size;
+};
+
+
+struct Ring {
+  /**
+   * Next slot the producer writes to, only written by the producer
+   */
+  _Atomic uint32_t head;
+  char head_pad[RING_CACHE_LINE - sizeof (uint32_t)];
+  /**
+   * Next slot the consumer reads from, only written by the consumer
+   */
+  _Atomic uint32_t tail;
+  char tail_pad[RING_CACHE_LINE - sizeof (uint32_t)];
+  /**
+   * Number of slots, a power of two
+   */
+  uint32_t slot_count;
+  /**
+   * Maximum payload of a slot
+   */
+  uint32_t slot_size;
+  /**
+   * Distance between two slots, header included
+   */
+  uint32_t slot_stride;
+  /* followed by slot_count slots of slot_stride bytes */
+};
+
+
+/**
+ * Get the slot belonging to a position
+ *
+ * @param ring The ring
+ * @param pos A head or tail value
+ * @return The slot header of that position
+ */
+static struct Ring_Slot_Header *
+ring_slot (const struct Ring *ring, uint32_t pos)
+{
+  return (struct Ring_Slot_Header *)
+      (((char *) &ring[1]) + (size_t) (pos & (ring->slot_count - 1)) * ring->slot_stride);
+}
+
+
+/**
+ * Compute the distance between two slots
+ *
+ * @param slot_size Maximum payload of one slot
+ * @return The stride, aligned to 8 bytes
+ */
+static uint32_t
+ring_stride (uint32_t slot_size)
+{
+  return (sizeof (struct Ring_Slot_Header) + slot_size + 7) & ~7U;
+}
+
+
+size_t
+ring_memory_size (uint32_t slot_count, uint32_t slot_size)
+{
+  return sizeof (struct Ring) + (size_t) slot_count * ring_stride (slot_size);
+}
+
+
+struct Ring *
+ring_init (void *memory, uint32_t slot_count, uint32_t slot_size)
+{
+  struct Ring *ring = (struct Ring *) memory;
+
+  GNUNET_assert ((0 < slot_count) && (0 == (slot_count & (slot_count - 1))));
+  memset (ring, 0, sizeof (struct Ring));
+  atomic_init (&ring->head, 0);
+  atomic_init (&ring->tail, 0);
+  ring->slot_count = slot_count;
+  ring->slot_size = slot_size;
+  ring->slot_stride = ring_stride (slot_size);
+  return ring;
+}
+
+
+struct Ring *
+ring_create (uint32_t slot_count, uint32_t slot_size)
+{
+  return ring_init (GNUNET_malloc_large (ring_memory_size (slot_count, slot_size)),
+                    slot_count,
+                    slot_size);
+}
+
+
+void
+ring_destroy (struct Ring *ring)
+{
+  GNUNET_free_non_null (ring);
+}
+
+
+int
+ring_push (struct Ring *ring, const void *data, size_t size)
+{
+  uint32_t head;
+  uint32_t tail;
+  struct Ring_Slot_Header *slot;
+
+  if ((0 == size) || (size > ring->slot_size))
+  {
+    return GNUNET_SYSERR;
+  }
+  head = atomic_load_explicit (&ring->head, memory_order_relaxed);
+  tail = atomic_load_explicit (&ring->tail, memory_order_acquire);
+  if (head - tail >= ring->slot_count)
+  {
+    return GNUNET_NO;
+  }
+
+  slot = ring_slot (ring, head);
+  slot->size = (uint32_t) size;
+  memcpy (&slot[1], data, size);
+  /* Publish the slot only after its content is written */
+  atomic_store_explicit (&ring->head, head + 1, memory_order_release);
+  return GNUNET_OK;
+}
+
+
+size_t
+ring_pop (struct Ring *ring, void *buf, size_t buf_size)
+{
+  uint32_t head;
+  uint32_t tail;
+  struct Ring_Slot_Header *slot;
+  size_t size;
+
+  tail = atomic_load_explicit (&ring->tail, memory_order_relaxed);
+  head = atomic_load_explicit (&ring->head, memory_order_acquire);
+  if (head == tail)
+  {
+    return 0;
+  }
+
+  slot = ring_slot (ring, tail);
+  size = slot->size;
+  GNUNET_assert (size <= buf_size);
+  memcpy (buf, &slot[1], size);
+  /* Hand the slot back to the producer only after it was copied out */
+  atomic_store_explicit (&ring->tail, tail + 1, memory_order_release);
+  return size;
+}
+
+
+const void *
+ring_peek (struct Ring *ring, size_t *size)
+{
+  uint32_t head;
+  uint32_t tail;
+  struct Ring_Slot_Header *slot;
+
+  tail = atomic_load_explicit (&ring->tail, memory_order_relaxed);
+  head = atomic_load_explicit (&ring->head, memory_order_acquire);
+  if (head == tail)
+  {
+    return NULL;
+  }
+  slot = ring_slot (ring, tail);
+  *size = slot->size;
+  return &slot[1];
+}
+
+
+void
+ring_drop (struct Ring *ring)
+{
+  uint32_t tail;
+
+  tail = atomic_load_explicit (&ring->tail, memory_order_relaxed);
+  GNUNET_assert (tail != atomic_load_explicit (&ring->head, memory_order_acquire));
+  /* The producer may reuse the slot from now on */
+  atomic_store_explicit (&ring->tail, tail + 1, memory_order_release);
+}
+
+
+uint32_t
+ring_count (const struct Ring *ring)
+{
+  struct Ring *r = (struct Ring *) ring;
+
+  return atomic_load_explicit (&r->head, memory_order_acquire)
+      - atomic_load_explicit (&r->tail, memory_order_acquire);
+}
+
+
+uint32_t
+ring_slot_size (const struct Ring *ring)
+{
+  return ring->slot_size;
+}
@@ -0,0 +1,129 @@
+#ifndef RING_H
+#define RING_H
+
+#include <gnunet/platform.h>
+#include <gnunet/gnunet_util_lib.h>
+
+
+/**
+ * Lock-free single-producer/single-consumer ring of fixed-size slots.
+ *
+ * The ring is self contained (no pointers inside), so it can live in memory
+ * shared between processes as well as in the heap of a single process. Exactly
+ * one thread or process may push and exactly one may pop at any time.
+ */
+struct Ring;
+
+
+/**
+ * Compute how many bytes a ring with the given geometry needs
+ *
+ * @param slot_count Number of slots, must be a power of two
+ * @param slot_size Maximum payload of one slot in bytes
+ * @return The number of bytes to pass to #ring_init
+ */
+size_t
+ring_memory_size (uint32_t slot_count, uint32_t slot_size);
+
+
+/**
+ * Initialize a ring inside caller provided memory
+ *
+ * @param memory At least #ring_memory_size bytes, suitably aligned
+ * @param slot_count Number of slots, must be a power of two
+ * @param slot_size Maximum payload of one slot in bytes
+ * @return The ring, located at @a memory
+ */
+struct Ring *
+ring_init (void *memory, uint32_t slot_count, uint32_t slot_size);
+
+
+/**
+ * Allocate and initialize a ring on the heap
+ *
+ * @param slot_count Number of slots, must be a power of two
+ * @param slot_size Maximum payload of one slot in bytes
+ * @return The new ring, free it with #ring_destroy
+ */
+struct Ring *
+ring_create (uint32_t slot_count, uint32_t slot_size);
+
+
+/**
+ * Free a ring created with #ring_create
+ *
+ * @param ring The ring to free, may be NULL
+ */
+void
+ring_destroy (struct Ring *ring);
+
+
+/**
+ * Append a record to the ring. Must only be called by the producer.
+ *
+ * @param ring The ring
+ * @param data The record
+ * @param size Size of @a data
+ * @return #GNUNET_OK if the record was queued, #GNUNET_NO if the ring is full,
+ *         #GNUNET_SYSERR if the record is empty or does not fit into a slot
+ */
+int
+ring_push (struct Ring *ring, const void *data, size_t size);
+
+
+/**
+ * Take the oldest record from the ring. Must only be called by the consumer.
+ *
+ * @param ring The ring
+ * @param buf Where to copy the record to, at least the slot size of the ring
+ * @param buf_size Size of @a buf
+ * @return Size of the record, 0 if the ring is empty
+ */
+size_t
+ring_pop (struct Ring *ring, void *buf, size_t buf_size);
+
+
+/**
+ * Look at the oldest record without taking it from the ring. Must only be
+ * called by the consumer.
+ *
+ * @param ring The ring
+ * @param size Set to the size of the record
+ * @return The record inside the ring, valid until #ring_drop; NULL if the
+ *         ring is empty
+ */
+const void *
+ring_peek (struct Ring *ring, size_t *size);
+
+
+/**
+ * Take the record returned by #ring_peek from the ring. Must only be called
+ * by the consumer, after #ring_peek returned a record.
+ *
+ * @param ring The ring
+ */
+void
+ring_drop (struct Ring *ring);
+
+
+/**
+ * Get the number of records currently queued. The result is only a snapshot
+ * if the other side is active concurrently.
+ *
+ * @param ring The ring
+ * @return Number of queued records
+ */
+uint32_t
+ring_count (const struct Ring *ring);
+
+
+/**
+ * Get the maximum payload of one slot
+ *
+ * @param ring The ring
+ * @return The slot size in bytes
+ */
+uint32_t
+ring_slot_size (const struct Ring *ring);
+
+#endif
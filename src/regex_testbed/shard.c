@@ -0,0 +1,935 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ring.h"
+#include "shard.h"
+
+
+/**
+ * LOG using this modules name
+ *
+ * @param kind One of GNUNET_ERROR_TYPE
+ * @param ... The format sting and optional arguments
+ */
+#define LOG(kind, ...) GNUNET_log_from (kind, "regex-testbed-shard", __VA_ARGS__)
+/**
+ * Log error messages for this module
+ *
+ * @param ... The format sting and optional arguments
+ */
+#define LOG_ERROR(...) LOG (GNUNET_ERROR_TYPE_ERROR, __VA_ARGS__)
+/**
+ * Number of slots in every ring between the node and a shard
+ */
+#define SHARD_RING_SLOTS 1024
+/**
+ * Maximum number of records drained in one run of the poll task
+ */
+#define SHARD_POLL_BATCH 64
+/**
+ * Marks a valid segment
+ */
+#define SHARD_SEGMENT_MAGIC 0x53485244
+
+
+/**
+ * Header at the start of the shared memory segment
+ */
+struct Shard_Segment_Header {
+  /**
+   * Always #SHARD_SEGMENT_MAGIC
+   */
+  uint32_t magic;
+  /**
+   * Number of shards in the segment
+   */
+  uint32_t num_shards;
+  /**
+   * Size of every ring in the segment
+   */
+  uint64_t ring_size;
+  /*
+   * followed by a Shard_Wakeup for every shard, then an inbound and an
+   * outbound ring for every shard
+   */
+};
+
+
+/**
+ * Wakeup state of the two rings of a shard, inside the segment. A side only
+ * writes to the FIFO of a ring if the flag shows the reader is not signalled
+ * yet, so a burst of records costs a single wakeup.
+ */
+struct Shard_Wakeup {
+  /**
+   * Set while a wakeup for the inbound ring is signalled but not consumed
+   */
+  atomic_uint inbound_pending;
+  /**
+   * Set while a wakeup for the outbound ring is signalled but not consumed
+   */
+  atomic_uint outbound_pending;
+};
+
+
+/**
+ * Header of every record in a ring, followed by the 0-terminated topic and
+ * the payload
+ */
+struct Shard_Record_Header {
+  /**
+   * One of #Shard_Record_Type
+   */
+  uint16_t type;
+  /**
+   * Length of the topic including the terminating 0
+   */
+  uint16_t topic_size;
+  /**
+   * Size of the payload
+   */
+  uint32_t data_size;
+};
+
+
+/**
+ * Mapping of the shared memory segment
+ */
+struct Shard_Segment {
+  /**
+   * File backing the segment
+   */
+  char *filename;
+  /**
+   * Start of the mapping
+   */
+  struct Shard_Segment_Header *header;
+  /**
+   * Size of the mapping
+   */
+  size_t size;
+};
+
+
+/**
+ * Rings and wakeup FIFOs between the node and one shard, as seen from either
+ * side
+ */
+struct Shard_Channel {
+  /**
+   * Records from the node to the worker
+   */
+  struct Ring *inbound;
+  /**
+   * Records from the worker to the node
+   */
+  struct Ring *outbound;
+  /**
+   * Wakeup flags of the rings
+   */
+  struct Shard_Wakeup *wakeup;
+  /**
+   * FIFO the worker waits on for inbound records
+   */
+  struct GNUNET_DISK_FileHandle *inbound_fifo;
+  /**
+   * FIFO the node waits on for outbound records
+   */
+  struct GNUNET_DISK_FileHandle *outbound_fifo;
+};
+
+
+struct Shard_Pool;
+
+
+/**
+ * State of one worker as seen by the node
+ */
+struct Shard {
+  /**
+   * The pool the shard belongs to
+   */
+  struct Shard_Pool *pool;
+  /**
+   * Index of the shard
+   */
+  unsigned int index;
+  /**
+   * Rings and FIFOs to the worker
+   */
+  struct Shard_Channel channel;
+  /**
+   * Task draining the outbound ring
+   */
+  GNUNET_SCHEDULER_TaskIdentifier poll_task;
+  /**
+   * The worker process
+   */
+  struct GNUNET_OS_Process *process;
+};
+
+
+struct Shard_Pool {
+  /**
+   * The shared memory segment
+   */
+  struct Shard_Segment segment;
+  /**
+   * File the peer configuration was written to for the workers
+   */
+  char *cfg_filename;
+  /**
+   * All shards
+   */
+  struct Shard *shards;
+  /**
+   * Number of shards
+   */
+  unsigned int num_shards;
+  /**
+   * Called for records from the workers
+   */
+  Shard_Record_Handler handler;
+  /**
+   * Closure for handler
+   */
+  void *handler_cls;
+};
+
+
+struct Shard_Worker {
+  /**
+   * The shared memory segment
+   */
+  struct Shard_Segment segment;
+  /**
+   * Index of this shard
+   */
+  unsigned int index;
+  /**
+   * Rings and FIFOs to the node, we consume the inbound ring and produce the
+   * outbound one
+   */
+  struct Shard_Channel channel;
+  /**
+   * Called for records from the node
+   */
+  Shard_Record_Handler handler;
+  /**
+   * Closure for handler
+   */
+  void *handler_cls;
+  /**
+   * Task draining the inbound ring
+   */
+  GNUNET_SCHEDULER_TaskIdentifier poll_task;
+};
+
+
+/**
+ * Round @a n up to a multiple of the cache line size
+ */
+static size_t
+shard_align (size_t n)
+{
+  return (n + 63) & ~((size_t) 63);
+}
+
+
+/**
+ * Get the offset of the first ring in the segment
+ *
+ * @param num_shards Number of shards in the segment
+ * @return The offset in bytes
+ */
+static size_t
+shard_segment_rings_offset (unsigned int num_shards)
+{
+  return shard_align (sizeof (struct Shard_Segment_Header))
+      + shard_align (num_shards * sizeof (struct Shard_Wakeup));
+}
+
+
+/**
+ * Map the segment file into memory
+ *
+ * @param segment The segment, the filename must be set
+ * @param size Size of the segment, 0 to take it from the file
+ * @return #GNUNET_OK on success
+ */
+static int
+shard_segment_map (struct Shard_Segment *segment, size_t size)
+{
+  int fd;
+  void *mem;
+
+  fd = open (segment->filename, O_RDWR);
+  if (-1 == fd)
+  {
+    LOG_ERROR ("Can not open shard segment %s: %s\n",
+               segment->filename, strerror (errno));
+    return GNUNET_SYSERR;
+  }
+  if ((0 != size) && (0 != ftruncate (fd, size)))
+  {
+    LOG_ERROR ("Can not size shard segment: %s\n", strerror (errno));
+    close (fd);
+    return GNUNET_SYSERR;
+  }
+  if (0 == size)
+  {
+    struct stat st;
+    if (0 != fstat (fd, &st))
+    {
+      close (fd);
+      return GNUNET_SYSERR;
+    }
+    size = st.st_size;
+  }
+  mem = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  if (MAP_FAILED == mem)
+  {
+    LOG_ERROR ("Can not map shard segment: %s\n", strerror (errno));
+    return GNUNET_SYSERR;
+  }
+  segment->header = mem;
+  segment->size = size;
+  return GNUNET_OK;
+}
+
+
+/**
+ * Get one of the rings of a shard inside the segment
+ *
+ * @param segment The mapped segment
+ * @param index Index of the shard
+ * @param outbound #GNUNET_YES for the worker to node ring
+ * @return The ring
+ */
+static struct Ring *
+shard_segment_ring (const struct Shard_Segment *segment,
+                    unsigned int index,
+                    int outbound)
+{
+  size_t offset = shard_segment_rings_offset (segment->header->num_shards)
+      + (2 * index + ((GNUNET_YES == outbound) ? 1 : 0)) * segment->header->ring_size;
+
+  return (struct Ring *) (((char *) segment->header) + offset);
+}
+
+
+/**
+ * Get the wakeup flags of a shard inside the segment
+ *
+ * @param segment The mapped segment
+ * @param index Index of the shard
+ * @return The wakeup flags
+ */
+static struct Shard_Wakeup *
+shard_segment_wakeup (const struct Shard_Segment *segment, unsigned int index)
+{
+  struct Shard_Wakeup *wakeups = (struct Shard_Wakeup *)
+      (((char *) segment->header) + shard_align (sizeof (struct Shard_Segment_Header)));
+
+  return &wakeups[index];
+}
+
+
+/**
+ * Get the name of the wakeup FIFO of a ring
+ *
+ * @param segment File name of the segment
+ * @param index Index of the shard
+ * @param outbound #GNUNET_YES for the FIFO of the worker to node ring
+ * @return The file name, free with #GNUNET_free
+ */
+static char *
+shard_fifo_name (const char *segment, unsigned int index, int outbound)
+{
+  char *name;
+
+  GNUNET_asprintf (&name,
+                   "%s-%u-%s",
+                   segment,
+                   index,
+                   (GNUNET_YES == outbound) ? "out" : "in");
+  return name;
+}
+
+
+/**
+ * Open the wakeup FIFOs of a shard. Both sides open them for reading and
+ * writing, so opening never blocks and a wakeup written before the other
+ * side opened is kept.
+ *
+ * @param channel The channel, the rings must be set
+ * @param segment File name of the segment
+ * @param index Index of the shard
+ * @param create #GNUNET_YES to create the FIFOs first
+ * @return #GNUNET_OK on success
+ */
+static int
+shard_channel_open (struct Shard_Channel *channel,
+                    const char *segment,
+                    unsigned int index,
+                    int create)
+{
+  struct GNUNET_DISK_FileHandle **fifo;
+  char *name;
+  int outbound;
+
+  for (outbound = GNUNET_NO; outbound <= GNUNET_YES; outbound++)
+  {
+    fifo = (GNUNET_YES == outbound) ? &channel->outbound_fifo : &channel->inbound_fifo;
+    name = shard_fifo_name (segment, index, outbound);
+    if ((GNUNET_YES == create)
+        && (0 != mkfifo (name, S_IRUSR | S_IWUSR)))
+    {
+      LOG_ERROR ("Can not create shard FIFO %s: %s\n", name, strerror (errno));
+      GNUNET_free (name);
+      return GNUNET_SYSERR;
+    }
+    *fifo = GNUNET_DISK_file_open (name,
+                                   GNUNET_DISK_OPEN_READWRITE,
+                                   GNUNET_DISK_PERM_NONE);
+    if (NULL == *fifo)
+    {
+      LOG_ERROR ("Can not open shard FIFO %s\n", name);
+      GNUNET_free (name);
+      return GNUNET_SYSERR;
+    }
+    GNUNET_free (name);
+  }
+  return GNUNET_OK;
+}
+
+
+/**
+ * Close the wakeup FIFOs of a shard
+ *
+ * @param channel The channel
+ * @param segment File name of the segment
+ * @param index Index of the shard
+ * @param remove #GNUNET_YES to also remove the FIFOs
+ */
+static void
+shard_channel_close (struct Shard_Channel *channel,
+                     const char *segment,
+                     unsigned int index,
+                     int remove)
+{
+  char *name;
+  int outbound;
+
+  if (NULL != channel->inbound_fifo)
+  {
+    GNUNET_DISK_file_close (channel->inbound_fifo);
+    channel->inbound_fifo = NULL;
+  }
+  if (NULL != channel->outbound_fifo)
+  {
+    GNUNET_DISK_file_close (channel->outbound_fifo);
+    channel->outbound_fifo = NULL;
+  }
+  for (outbound = GNUNET_NO; (GNUNET_YES == remove) && (outbound <= GNUNET_YES); outbound++)
+  {
+    name = shard_fifo_name (segment, index, outbound);
+    unlink (name);
+    GNUNET_free (name);
+  }
+}
+
+
+/**
+ * Encode and queue a record
+ *
+ * @param ring The ring to push to
+ * @param type Type of the record
+ * @param topic The topic
+ * @param data The payload
+ * @param size Size of @a data
+ * @return see #ring_push
+ */
+static int
+shard_ring_send (struct Ring *ring,
+                 enum Shard_Record_Type type,
+                 const char *topic,
+                 const void *data,
+                 size_t size)
+{
+  char buf[SHARD_MAX_RECORD_SIZE + sizeof (struct Shard_Record_Header)];
+  struct Shard_Record_Header *hdr = (struct Shard_Record_Header *) buf;
+  size_t topic_size = strlen (topic) + 1;
+
+  if (topic_size + size > SHARD_MAX_RECORD_SIZE)
+  {
+    return GNUNET_SYSERR;
+  }
+  hdr->type = (uint16_t) type;
+  hdr->topic_size = (uint16_t) topic_size;
+  hdr->data_size = (uint32_t) size;
+  memcpy (&hdr[1], topic, topic_size);
+  if (0 != size)
+  {
+    memcpy (((char *) &hdr[1]) + topic_size, data, size);
+  }
+  return ring_push (ring, buf, sizeof (struct Shard_Record_Header) + topic_size + size);
+}
+
+
+/**
+ * Queue a record and wake the reader of the ring up unless it already is
+ *
+ * @param ring The ring to push to
+ * @param pending The wakeup flag of @a ring
+ * @param fifo The wakeup FIFO of @a ring
+ * @param type Type of the record
+ * @param topic The topic
+ * @param data The payload
+ * @param size Size of @a data
+ * @return see #ring_push
+ */
+static int
+shard_send (struct Ring *ring,
+            atomic_uint *pending,
+            const struct GNUNET_DISK_FileHandle *fifo,
+            enum Shard_Record_Type type,
+            const char *topic,
+            const void *data,
+            size_t size)
+{
+  static const char wakeup = 1;
+  int ret;
+
+  ret = shard_ring_send (ring, type, topic, data, size);
+  if (GNUNET_OK != ret)
+  {
+    return ret;
+  }
+  if (0 == atomic_exchange (pending, 1))
+  {
+    GNUNET_DISK_file_write (fifo, &wakeup, sizeof (wakeup));
+  }
+  return GNUNET_OK;
+}
+
+
+/**
+ * Drain up to #SHARD_POLL_BATCH records from a ring
+ *
+ * @param ring The ring to drain
+ * @param shard Index of the shard the ring belongs to
+ * @param handler Called for every record
+ * @param handler_cls Closure for @a handler
+ * @return Number of records drained
+ */
+static unsigned int
+shard_ring_drain (struct Ring *ring,
+                  unsigned int shard,
+                  Shard_Record_Handler handler,
+                  void *handler_cls)
+{
+  char buf[SHARD_MAX_RECORD_SIZE + sizeof (struct Shard_Record_Header)];
+  const struct Shard_Record_Header *hdr = (const struct Shard_Record_Header *) buf;
+  unsigned int drained;
+  size_t size;
+
+  for (drained = 0; drained < SHARD_POLL_BATCH; drained++)
+  {
+    size = ring_pop (ring, buf, sizeof (buf));
+    if (0 == size)
+    {
+      break;
+    }
+    if ((size < sizeof (struct Shard_Record_Header))
+        || (size != sizeof (struct Shard_Record_Header) + hdr->topic_size + hdr->data_size)
+        || (0 == hdr->topic_size)
+        || ('\0' != ((const char *) &hdr[1])[hdr->topic_size - 1]))
+    {
+      GNUNET_break (0);
+      continue;
+    }
+    handler (handler_cls,
+             shard,
+             (enum Shard_Record_Type) hdr->type,
+             (const char *) &hdr[1],
+             ((const char *) &hdr[1]) + hdr->topic_size,
+             hdr->data_size);
+  }
+  return drained;
+}
+
+
+/**
+ * Consume the wakeup of a ring before draining it. A writer pushing after
+ * the ring was drained sees the flag cleared and signals again.
+ *
+ * @param tc Context of the poll task
+ * @param pending The wakeup flag of the ring
+ * @param fifo The wakeup FIFO of the ring
+ */
+static void
+shard_consume_wakeup (const struct GNUNET_SCHEDULER_TaskContext *tc,
+                      atomic_uint *pending,
+                      const struct GNUNET_DISK_FileHandle *fifo)
+{
+  char wakeups[64];
+
+  if (0 != (tc->reason & GNUNET_SCHEDULER_REASON_READ_READY))
+  {
+    GNUNET_DISK_file_read (fifo, wakeups, sizeof (wakeups));
+  }
+  atomic_store (pending, 0);
+}
+
+
+/**
+ * Reschedule a poll task, right away if the last run left a backlog and
+ * otherwise once the writer signals the FIFO of the ring
+ *
+ * @param drained Number of records drained in the last run
+ * @param fifo The wakeup FIFO of the ring
+ * @param task The poll task
+ * @param cls Closure for @a task
+ * @return The new task identifier
+ */
+static GNUNET_SCHEDULER_TaskIdentifier
+shard_schedule_poll (unsigned int drained,
+                     const struct GNUNET_DISK_FileHandle *fifo,
+                     GNUNET_SCHEDULER_Task task,
+                     void *cls)
+{
+  if (SHARD_POLL_BATCH == drained)
+  {
+    /* Give other tasks a chance before taking the next batch */
+    return GNUNET_SCHEDULER_add_now (task, cls);
+  }
+  return GNUNET_SCHEDULER_add_read_file (GNUNET_TIME_UNIT_FOREVER_REL,
+                                         fifo,
+                                         task,
+                                         cls);
+}
+
+
+unsigned int
+shard_for_topic (const char *topic, unsigned int num_shards)
+{
+  struct GNUNET_HashCode hash;
+
+  GNUNET_assert (0 < num_shards);
+  GNUNET_CRYPTO_hash (topic, strlen (topic), &hash);
+  return hash.bits[0] % num_shards;
+}
+
+
+/**
+ * Drain the outbound ring of a shard
+ *
+ * @param cls The Shard
+ * @param tc Task context
+ */
+static void
+shard_pool_poll (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  struct Shard *shard = (struct Shard *) cls;
+  struct Shard_Channel *channel = &shard->channel;
+  unsigned int drained;
+
+  shard->poll_task = GNUNET_SCHEDULER_NO_TASK;
+  if (0 != (tc->reason & GNUNET_SCHEDULER_REASON_SHUTDOWN))
+  {
+    return;
+  }
+  shard_consume_wakeup (tc, &channel->wakeup->outbound_pending, channel->outbound_fifo);
+  drained = shard_ring_drain (channel->outbound,
+                              shard->index,
+                              shard->pool->handler,
+                              shard->pool->handler_cls);
+  shard->poll_task = shard_schedule_poll (drained,
+                                          channel->outbound_fifo,
+                                          &shard_pool_poll,
+                                          shard);
+}
+
+
+struct Shard_Pool *
+shard_pool_start (const char *binary,
+                  const struct GNUNET_CONFIGURATION_Handle *cfg,
+                  unsigned int num_shards,
+                  Shard_Record_Handler handler,
+                  void *handler_cls)
+{
+  struct Shard_Pool *pool;
+  struct GNUNET_CONFIGURATION_Handle *worker_cfg;
+  size_t ring_size;
+  char index[16];
+  unsigned int i;
+
+  GNUNET_assert (0 < num_shards);
+  pool = GNUNET_new (struct Shard_Pool);
+  pool->num_shards = num_shards;
+  pool->handler = handler;
+  pool->handler_cls = handler_cls;
+
+  /* The workers connect to the same peer, so they get its configuration */
+  pool->cfg_filename = GNUNET_DISK_mktemp ("regex-testbed-shard-cfg");
+  worker_cfg = GNUNET_CONFIGURATION_dup (cfg);
+  if ((NULL == pool->cfg_filename)
+      || (GNUNET_OK != GNUNET_CONFIGURATION_write (worker_cfg, pool->cfg_filename)))
+  {
+    LOG_ERROR ("Can not write shard worker configuration\n");
+    GNUNET_CONFIGURATION_destroy (worker_cfg);
+    shard_pool_stop (pool);
+    return NULL;
+  }
+  GNUNET_CONFIGURATION_destroy (worker_cfg);
+
+  ring_size = shard_align (ring_memory_size (SHARD_RING_SLOTS,
+                                             SHARD_MAX_RECORD_SIZE
+                                             + sizeof (struct Shard_Record_Header)));
+  pool->segment.filename = GNUNET_DISK_mktemp ("regex-testbed-shard-segment");
+  if ((NULL == pool->segment.filename)
+      || (GNUNET_OK != shard_segment_map (&pool->segment,
+                                          shard_segment_rings_offset (num_shards)
+                                          + 2 * num_shards * ring_size)))
+  {
+    shard_pool_stop (pool);
+    return NULL;
+  }
+  pool->segment.header->num_shards = num_shards;
+  pool->segment.header->ring_size = ring_size;
+
+  pool->shards = GNUNET_new_array (num_shards, struct Shard);
+  for (i = 0; i < num_shards; i++)
+  {
+    struct Shard_Channel *channel = &pool->shards[i].channel;
+
+    pool->shards[i].pool = pool;
+    pool->shards[i].index = i;
+    channel->inbound = ring_init (shard_segment_ring (&pool->segment, i, GNUNET_NO),
+                                  SHARD_RING_SLOTS,
+                                  SHARD_MAX_RECORD_SIZE
+                                  + sizeof (struct Shard_Record_Header));
+    channel->outbound = ring_init (shard_segment_ring (&pool->segment, i, GNUNET_YES),
+                                   SHARD_RING_SLOTS,
+                                   SHARD_MAX_RECORD_SIZE
+                                   + sizeof (struct Shard_Record_Header));
+    channel->wakeup = shard_segment_wakeup (&pool->segment, i);
+    atomic_init (&channel->wakeup->inbound_pending, 0);
+    atomic_init (&channel->wakeup->outbound_pending, 0);
+    if (GNUNET_OK != shard_channel_open (channel,
+                                         pool->segment.filename,
+                                         i,
+                                         GNUNET_YES))
+    {
+      shard_pool_stop (pool);
+      return NULL;
+    }
+  }
+  /* Only mark the segment valid once all rings are initialized */
+  pool->segment.header->magic = SHARD_SEGMENT_MAGIC;
+
+  for (i = 0; i < num_shards; i++)
+  {
+    GNUNET_snprintf (index, sizeof (index), "%u", i);
+    pool->shards[i].process = GNUNET_OS_start_process (GNUNET_NO,
+                                                       GNUNET_OS_INHERIT_STD_OUT_AND_ERR,
+                                                       NULL,
+                                                       NULL,
+                                                       binary,
+                                                       binary,
+                                                       SHARD_WORKER_ARGUMENT,
+                                                       pool->segment.filename,
+                                                       index,
+                                                       pool->cfg_filename,
+                                                       NULL);
+    if (NULL == pool->shards[i].process)
+    {
+      LOG_ERROR ("Can not start shard worker %s %u\n", binary, i);
+      shard_pool_stop (pool);
+      return NULL;
+    }
+    pool->shards[i].poll_task =
+        GNUNET_SCHEDULER_add_read_file (GNUNET_TIME_UNIT_FOREVER_REL,
+                                        pool->shards[i].channel.outbound_fifo,
+                                        &shard_pool_poll,
+                                        &pool->shards[i]);
+  }
+  return pool;
+}
+
+
+int
+shard_pool_publish (struct Shard_Pool *pool,
+                    const char *topic,
+                    const void *data,
+                    size_t size)
+{
+  struct Shard_Channel *channel =
+      &pool->shards[shard_for_topic (topic, pool->num_shards)].channel;
+
+  return shard_send (channel->inbound,
+                     &channel->wakeup->inbound_pending,
+                     channel->inbound_fifo,
+                     SHARD_RECORD_PUBLISH,
+                     topic,
+                     data,
+                     size);
+}
+
+
+void
+shard_pool_stop (struct Shard_Pool *pool)
+{
+  unsigned int i;
+
+  for (i = 0; (NULL != pool->shards) && (i < pool->num_shards); i++)
+  {
+    if (GNUNET_SCHEDULER_NO_TASK != pool->shards[i].poll_task)
+    {
+      GNUNET_SCHEDULER_cancel (pool->shards[i].poll_task);
+      pool->shards[i].poll_task = GNUNET_SCHEDULER_NO_TASK;
+    }
+    shard_channel_close (&pool->shards[i].channel,
+                         pool->segment.filename,
+                         i,
+                         GNUNET_YES);
+    if (NULL == pool->shards[i].process)
+    {
+      continue;
+    }
+    if (0 != GNUNET_OS_process_kill (pool->shards[i].process, SIGTERM))
+    {
+      LOG_ERROR ("Can not stop shard worker %u\n", i);
+    }
+    GNUNET_OS_process_wait (pool->shards[i].process);
+    GNUNET_OS_process_destroy (pool->shards[i].process);
+  }
+  GNUNET_free_non_null (pool->shards);
+
+  if (NULL != pool->segment.header)
+  {
+    munmap (pool->segment.header, pool->segment.size);
+  }
+  if (NULL != pool->segment.filename)
+  {
+    unlink (pool->segment.filename);
+    GNUNET_free (pool->segment.filename);
+  }
+  if (NULL != pool->cfg_filename)
+  {
+    unlink (pool->cfg_filename);
+    GNUNET_free (pool->cfg_filename);
+  }
+  GNUNET_free (pool);
+}
+
+
+/**
+ * Drain the inbound ring of a worker
+ *
+ * @param cls The Shard_Worker
+ * @param tc Task context
+ */
+static void
+shard_worker_poll (void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+  struct Shard_Worker *worker = (struct Shard_Worker *) cls;
+  struct Shard_Channel *channel = &worker->channel;
+  unsigned int drained;
+
+  worker->poll_task = GNUNET_SCHEDULER_NO_TASK;
+  if (0 != (tc->reason & GNUNET_SCHEDULER_REASON_SHUTDOWN))
+  {
+    return;
+  }
+  shard_consume_wakeup (tc, &channel->wakeup->inbound_pending, channel->inbound_fifo);
+  drained = shard_ring_drain (channel->inbound,
+                              worker->index,
+                              worker->handler,
+                              worker->handler_cls);
+  worker->poll_task = shard_schedule_poll (drained,
+                                           channel->inbound_fifo,
+                                           &shard_worker_poll,
+                                           worker);
+}
+
+
+struct Shard_Worker *
+shard_worker_attach (const char *segment,
+                     unsigned int index,
+                     Shard_Record_Handler handler,
+                     void *handler_cls)
+{
+  struct Shard_Worker *worker;
+
+  worker = GNUNET_new (struct Shard_Worker);
+  worker->segment.filename = GNUNET_strdup (segment);
+  if (GNUNET_OK != shard_segment_map (&worker->segment, 0))
+  {
+    shard_worker_detach (worker);
+    return NULL;
+  }
+  if ((SHARD_SEGMENT_MAGIC != worker->segment.header->magic)
+      || (index >= worker->segment.header->num_shards))
+  {
+    LOG_ERROR ("Invalid shard segment or index %u\n", index);
+    shard_worker_detach (worker);
+    return NULL;
+  }
+  worker->index = index;
+  worker->channel.inbound = shard_segment_ring (&worker->segment, index, GNUNET_NO);
+  worker->channel.outbound = shard_segment_ring (&worker->segment, index, GNUNET_YES);
+  worker->channel.wakeup = shard_segment_wakeup (&worker->segment, index);
+  if (GNUNET_OK != shard_channel_open (&worker->channel, segment, index, GNUNET_NO))
+  {
+    shard_worker_detach (worker);
+    return NULL;
+  }
+  worker->handler = handler;
+  worker->handler_cls = handler_cls;
+  /* The node may have queued records before we attached */
+  worker->poll_task = GNUNET_SCHEDULER_add_now (&shard_worker_poll, worker);
+  return worker;
+}
+
+
+int
+shard_worker_send (struct Shard_Worker *worker,
+                   enum Shard_Record_Type type,
+                   const char *topic,
+                   const void *data,
+                   size_t size)
+{
+  return shard_send (worker->channel.outbound,
+                     &worker->channel.wakeup->outbound_pending,
+                     worker->channel.outbound_fifo,
+                     type,
+                     topic,
+                     data,
+                     size);
+}
+
+
+void
+shard_worker_detach (struct Shard_Worker *worker)
+{
+  if (GNUNET_SCHEDULER_NO_TASK != worker->poll_task)
+  {
+    GNUNET_SCHEDULER_cancel (worker->poll_task);
+    worker->poll_task = GNUNET_SCHEDULER_NO_TASK;
+  }
+  shard_channel_close (&worker->channel,
+                       worker->segment.filename,
+                       worker->index,
+                       GNUNET_NO);
+  if (NULL != worker->segment.header)
+  {
+    munmap (worker->segment.header, worker->segment.size);
+  }
+  GNUNET_free (worker->segment.filename);
+  GNUNET_free (worker);
+}
@@ -0,0 +1,176 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <gnunet/platform.h>
+#include <gnunet/gnunet_util_lib.h>
+
+
+/**
+ * Command line argument that starts the binary as a shard worker.
+ *
+ * The full worker command line is
+ * `<binary> --shard-worker <segment file> <shard index> <config file>`
+ */
+#define SHARD_WORKER_ARGUMENT "--shard-worker"
+/**
+ * Maximum size of topic and payload of one record handed between shards.
+ * Matches the bridge, so every message an application thread publishes on
+ * the node can be handed to a shard.
+ */
+#define SHARD_MAX_RECORD_SIZE 2048
+
+
+/**
+ * Types of records exchanged between the node and its shard workers.
+ *
+ * Only publishers are sharded. Subscriptions stay in the node process, where
+ * their deliveries reach the application threads through the bridge.
+ */
+enum Shard_Record_Type {
+  /**
+   * Node to worker: publish the payload under the topic. The first record of
+   * a topic hands it to the worker, a record without payload only does that.
+   */
+  SHARD_RECORD_PUBLISH = 1,
+  /**
+   * Worker to node: the payload was put into the DHT for the topic
+   */
+  SHARD_RECORD_PUBLISHED = 2
+};
+
+
+/**
+ * Called for every record received from the other side
+ *
+ * @param cls Closure
+ * @param shard Index of the shard the record belongs to
+ * @param type What the record is about
+ * @param topic The topic of the record, 0-terminated
+ * @param data The payload
+ * @param size Size of @a data
+ */
+typedef void
+(*Shard_Record_Handler) (void *cls,
+                         unsigned int shard,
+                         enum Shard_Record_Type type,
+                         const char *topic,
+                         const void *data,
+                         size_t size);
+
+
+/**
+ * Node side of a set of shard worker processes
+ */
+struct Shard_Pool;
+
+
+/**
+ * Worker side of the connection to the node
+ */
+struct Shard_Worker;
+
+
+/**
+ * Get the shard that owns a topic
+ *
+ * @param topic The topic
+ * @param num_shards Total number of shards
+ * @return The index of the owning shard
+ */
+unsigned int
+shard_for_topic (const char *topic, unsigned int num_shards);
+
+
+/**
+ * Start worker processes and the shared memory segment used to talk to them.
+ *
+ * Every worker runs its own scheduler and opens its own DHT and REGEX
+ * connections to the peer described by @a cfg. Both sides sleep in their
+ * scheduler until the other one signals the FIFO next to the segment, which
+ * only happens when the ring was drained before.
+ *
+ * @param binary Absolute path of the binary to start as worker
+ * @param cfg Configuration of the peer the workers should connect to
+ * @param num_shards Number of workers to start
+ * @param handler Called for every record sent by a worker
+ * @param handler_cls Closure for @a handler
+ * @return The pool, NULL on error
+ */
+struct Shard_Pool *
+shard_pool_start (const char *binary,
+                  const struct GNUNET_CONFIGURATION_Handle *cfg,
+                  unsigned int num_shards,
+                  Shard_Record_Handler handler,
+                  void *handler_cls);
+
+
+/**
+ * Hand a publish over to the shard owning the topic
+ *
+ * @param pool The pool
+ * @param topic The topic to publish to
+ * @param data The payload, may be NULL if @a size is 0
+ * @param size Size of @a data
+ * @return #GNUNET_OK on success, #GNUNET_NO if the shard is congested,
+ *         #GNUNET_SYSERR if the record is too large
+ */
+int
+shard_pool_publish (struct Shard_Pool *pool,
+                    const char *topic,
+                    const void *data,
+                    size_t size);
+
+
+/**
+ * Stop all workers and release the shared memory
+ *
+ * @param pool The pool to stop
+ */
+void
+shard_pool_stop (struct Shard_Pool *pool);
+
+
+/**
+ * Attach a worker process to the shared memory segment of its node
+ *
+ * @param segment File name of the segment as given on the command line
+ * @param index Index of this shard
+ * @param handler Called for every record sent by the node
+ * @param handler_cls Closure for @a handler
+ * @return The worker, NULL on error
+ */
+struct Shard_Worker *
+shard_worker_attach (const char *segment,
+                     unsigned int index,
+                     Shard_Record_Handler handler,
+                     void *handler_cls);
+
+
+/**
+ * Send a record from the worker to the node
+ *
+ * @param worker The worker
+ * @param type The type of the record
+ * @param topic The topic of the record
+ * @param data The payload, may be NULL if @a size is 0
+ * @param size Size of @a data
+ * @return #GNUNET_OK on success, #GNUNET_NO if the node is congested,
+ *         #GNUNET_SYSERR if the record is too large
+ */
+int
+shard_worker_send (struct Shard_Worker *worker,
+                   enum Shard_Record_Type type,
+                   const char *topic,
+                   const void *data,
+                   size_t size);
+
+
+/**
+ * Detach the worker from the shared memory segment
+ *
+ * @param worker The worker
+ */
+void
+shard_worker_detach (struct Shard_Worker *worker);
+
+#endif
@@ -0,0 +1,377 @@
+#include "topic_filter.h"
+
+
+/**
+ * Separator of topic levels
+ */
+#define TOPIC_FILTER_SEPARATOR '/'
+/**
+ * Single level wildcard
+ */
+#define TOPIC_FILTER_SINGLE "+"
+/**
+ * Multi level wildcard
+ */
+#define TOPIC_FILTER_MULTI "#"
+
+
+struct Topic_Filter_Entry {
+  /**
+   * The regex all filters of this entry translate to
+   */
+  char *regex;
+  /**
+   * Hash of @e regex, the key of the entry in the set
+   */
+  struct GNUNET_HashCode key;
+  /**
+   * Number of subscriptions to this entry
+   */
+  unsigned int subscriptions;
+};
+
+
+struct Topic_Filter_Set {
+  /**
+   * Maps hashes of regexes to their Topic_Filter_Entry
+   */
+  struct GNUNET_CONTAINER_MultiHashMap *entries;
+};
+
+
+/**
+ * Build a loop over the level alphabet, optionally including the separator
+ *
+ * @param with_separator #GNUNET_YES to also match `/`
+ * @return The regex, free with GNUNET_free
+ */
+static char *
+topic_filter_loop (int with_separator)
+{
+  size_t alphabet = strlen (TOPIC_FILTER_ALPHABET);
+  char *loop;
+  char *c;
+  size_t i;
+
+  /* "(" + "x|" per character + "/|" + ")*" */
+  loop = GNUNET_malloc (2 * alphabet + 2 + 4 + 1);
+  c = loop;
+  *c++ = '(';
+  for (i = 0; i < alphabet; i++)
+  {
+    *c++ = TOPIC_FILTER_ALPHABET[i];
+    *c++ = '|';
+  }
+  if (GNUNET_YES == with_separator)
+  {
+    *c++ = TOPIC_FILTER_SEPARATOR;
+    *c++ = '|';
+  }
+  /* Replace the last '|' */
+  c[-1] = ')';
+  *c++ = '*';
+  *c = '\0';
+  return loop;
+}
+
+
+/**
+ * Check that a level of a filter is a wildcard or a literal over the level
+ * alphabet
+ *
+ * @param level Start of the level
+ * @param length Length of the level
+ * @return #GNUNET_OK if valid
+ */
+static int
+topic_filter_check_level (const char *level, size_t length)
+{
+  size_t i;
+
+  if ((1 == length)
+      && ((TOPIC_FILTER_SINGLE[0] == level[0])
+          || (TOPIC_FILTER_MULTI[0] == level[0])))
+  {
+    return GNUNET_OK;
+  }
+  for (i = 0; i < length; i++)
+  {
+    if (NULL == strchr (TOPIC_FILTER_ALPHABET, level[i]))
+    {
+      return GNUNET_SYSERR;
+    }
+  }
+  return GNUNET_OK;
+}
+
+
+char *
+topic_filter_to_regex (const char *filter)
+{
+  const char *levels[TOPIC_FILTER_MAX_LEVELS];
+  size_t lengths[TOPIC_FILTER_MAX_LEVELS];
+  unsigned int num_levels = 0;
+  unsigned int wildcards = 0;
+  unsigned int prefix_levels;
+  int multi;
+  char *single_loop;
+  char *multi_loop;
+  char *regex;
+  char *tmp;
+  const char *start;
+  const char *end;
+  unsigned int i;
+
+  if ((NULL == filter) || ('\0' == filter[0]))
+  {
+    return NULL;
+  }
+  for (start = filter; ; start = end + 1)
+  {
+    end = strchr (start, TOPIC_FILTER_SEPARATOR);
+    if (NULL == end)
+    {
+      end = start + strlen (start);
+    }
+    if ((TOPIC_FILTER_MAX_LEVELS == num_levels)
+        || (GNUNET_OK != topic_filter_check_level (start, end - start)))
+    {
+      return NULL;
+    }
+    levels[num_levels] = start;
+    lengths[num_levels] = end - start;
+    num_levels++;
+    if ('\0' == *end)
+    {
+      break;
+    }
+  }
+
+  for (i = 0; i < num_levels; i++)
+  {
+    if ((1 != lengths[i])
+        || ((TOPIC_FILTER_SINGLE[0] != levels[i][0])
+            && (TOPIC_FILTER_MULTI[0] != levels[i][0])))
+    {
+      continue;
+    }
+    // '#' has to be the last level
+    if ((TOPIC_FILTER_MULTI[0] == levels[i][0]) && (i + 1 != num_levels))
+    {
+      return NULL;
+    }
+    wildcards++;
+  }
+  if (TOPIC_FILTER_MAX_WILDCARDS < wildcards)
+  {
+    return NULL;
+  }
+
+  multi = ((1 == lengths[num_levels - 1])
+           && (TOPIC_FILTER_MULTI[0] == levels[num_levels - 1][0]))
+      ? GNUNET_YES : GNUNET_NO;
+  prefix_levels = (GNUNET_YES == multi) ? num_levels - 1 : num_levels;
+  /* "+/#" matches exactly what "#" matches at that position */
+  if ((GNUNET_YES == multi) && (0 < prefix_levels)
+      && (1 == lengths[prefix_levels - 1])
+      && (TOPIC_FILTER_SINGLE[0] == levels[prefix_levels - 1][0]))
+  {
+    prefix_levels--;
+  }
+
+  single_loop = topic_filter_loop (GNUNET_NO);
+  multi_loop = topic_filter_loop (GNUNET_YES);
+  regex = GNUNET_strdup ("");
+  for (i = 0; i < prefix_levels; i++)
+  {
+    if ((1 == lengths[i]) && (TOPIC_FILTER_SINGLE[0] == levels[i][0]))
+    {
+      GNUNET_asprintf (&tmp, "%s%s%s",
+                       regex, (0 == i) ? "" : "/", single_loop);
+    }
+    else
+    {
+      GNUNET_asprintf (&tmp, "%s%s%.*s",
+                       regex, (0 == i) ? "" : "/", (int) lengths[i], levels[i]);
+    }
+    GNUNET_free (regex);
+    regex = tmp;
+  }
+  if (GNUNET_YES == multi)
+  {
+    if (0 == prefix_levels)
+    {
+      GNUNET_asprintf (&tmp, "%s", multi_loop);
+    }
+    else if (prefix_levels + 1 < num_levels)
+    {
+      /* A folded "+" level before the "#" can not be empty */
+      GNUNET_asprintf (&tmp, "%s/%s", regex, multi_loop);
+    }
+    else
+    {
+      /* "#" also matches the parent level */
+      GNUNET_asprintf (&tmp, "%s(/%s)?", regex, multi_loop);
+    }
+    GNUNET_free (regex);
+    regex = tmp;
+  }
+  GNUNET_free (single_loop);
+  GNUNET_free (multi_loop);
+  return regex;
+}
+
+
+int
+topic_filter_match (const char *filter, const char *topic)
+{
+  const char *f_end;
+  const char *t_end;
+
+  for (;;)
+  {
+    f_end = strchr (filter, TOPIC_FILTER_SEPARATOR);
+    if (NULL == f_end)
+    {
+      f_end = filter + strlen (filter);
+    }
+    t_end = strchr (topic, TOPIC_FILTER_SEPARATOR);
+    if (NULL == t_end)
+    {
+      t_end = topic + strlen (topic);
+    }
+    if (0 == strcmp (filter, TOPIC_FILTER_MULTI))
+    {
+      return GNUNET_YES;
+    }
+    if (((1 != f_end - filter) || (TOPIC_FILTER_SINGLE[0] != filter[0]))
+        && ((f_end - filter != t_end - topic)
+            || (0 != memcmp (filter, topic, f_end - filter))))
+    {
+      return GNUNET_NO;
+    }
+    if ('\0' == *f_end)
+    {
+      return ('\0' == *t_end) ? GNUNET_YES : GNUNET_NO;
+    }
+    if ('\0' == *t_end)
+    {
+      /* "#" also matches the parent level */
+      return (0 == strcmp (f_end + 1, TOPIC_FILTER_MULTI)) ? GNUNET_YES : GNUNET_NO;
+    }
+    filter = f_end + 1;
+    topic = t_end + 1;
+  }
+}
+
+struct Topic_Filter_Set *
+topic_filter_set_create (void)
+{
+  struct Topic_Filter_Set *set;
+
+  set = GNUNET_new (struct Topic_Filter_Set);
+  set->entries = GNUNET_CONTAINER_multihashmap_create (16, GNUNET_NO);
+  return set;
+}
+
+
+struct Topic_Filter_Entry *
+topic_filter_set_add (struct Topic_Filter_Set *set,
+                      const char *filter,
+                      int *created)
+{
+  struct Topic_Filter_Entry *entry;
+  struct GNUNET_HashCode key;
+  char *regex;
+
+  *created = GNUNET_NO;
+  regex = topic_filter_to_regex (filter);
+  if (NULL == regex)
+  {
+    return NULL;
+  }
+  GNUNET_CRYPTO_hash (regex, strlen (regex), &key);
+  entry = GNUNET_CONTAINER_multihashmap_get (set->entries, &key);
+  if (NULL != entry)
+  {
+    GNUNET_free (regex);
+    entry->subscriptions++;
+    return entry;
+  }
+
+  entry = GNUNET_new (struct Topic_Filter_Entry);
+  entry->regex = regex;
+  entry->key = key;
+  entry->subscriptions = 1;
+  GNUNET_CONTAINER_multihashmap_put (set->entries,
+                                     &key,
+                                     entry,
+                                     GNUNET_CONTAINER_MULTIHASHMAPOPTION_UNIQUE_FAST);
+  *created = GNUNET_YES;
+  return entry;
+}
+
+
+unsigned int
+topic_filter_set_remove (struct Topic_Filter_Set *set,
+                         struct Topic_Filter_Entry *entry)
+{
+  if (0 < --entry->subscriptions)
+  {
+    return entry->subscriptions;
+  }
+  GNUNET_CONTAINER_multihashmap_remove (set->entries, &entry->key, entry);
+  GNUNET_free (entry->regex);
+  GNUNET_free (entry);
+  return 0;
+}
+
+
+const char *
+topic_filter_entry_regex (const struct Topic_Filter_Entry *entry)
+{
+  return entry->regex;
+}
+
+
+unsigned int
+topic_filter_set_size (const struct Topic_Filter_Set *set)
+{
+  return GNUNET_CONTAINER_multihashmap_size (set->entries);
+}
+
+
+/**
+ * Free one entry of a set
+ *
+ * @param cls ignored
+ * @param key hash of the regex
+ * @param value The Topic_Filter_Entry
+ * @return #GNUNET_YES to continue iterating
+ */
+static int
+topic_filter_free_entry (void *cls,
+                         const struct GNUNET_HashCode *key,
+                         void *value)
+{
+  struct Topic_Filter_Entry *entry = (struct Topic_Filter_Entry *) value;
+
+  GNUNET_free (entry->regex);
+  GNUNET_free (entry);
+  return GNUNET_YES;
+}
+
+
+void
+topic_filter_set_destroy (struct Topic_Filter_Set *set)
+{
+  if (NULL == set)
+  {
+    return;
+  }
+  GNUNET_CONTAINER_multihashmap_iterate (set->entries,
+                                         &topic_filter_free_entry,
+                                         NULL);
+  GNUNET_CONTAINER_multihashmap_destroy (set->entries);
+  GNUNET_free (set);
+}
@@ -0,0 +1,134 @@
+#ifndef TOPIC_FILTER_H
+#define TOPIC_FILTER_H
+
+#include <gnunet/platform.h>
+#include <gnunet/gnunet_util_lib.h>
+
+
+/**
+ * Characters a topic level may consist of. Everything else is either a REGEX
+ * operator or not part of the REGEX alphabet.
+ */
+#define TOPIC_FILTER_ALPHABET \
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_"
+/**
+ * Maximum number of levels of a filter
+ */
+#define TOPIC_FILTER_MAX_LEVELS 16
+/**
+ * Maximum number of `+` and `#` wildcards in a filter. Every wildcard adds a
+ * looping state with an edge per alphabet character to the announcement.
+ */
+#define TOPIC_FILTER_MAX_WILDCARDS 4
+
+
+/**
+ * The MQTT filters subscribed to on a node, merged by equivalence so each
+ * distinct filter is announced once no matter how many clients subscribe to
+ * it.
+ */
+struct Topic_Filter_Set;
+
+
+/**
+ * One distinct filter in a set
+ */
+struct Topic_Filter_Entry;
+
+
+/**
+ * Translate an MQTT topic filter into a REGEX announcement regex.
+ *
+ * Literal levels stay literal, `+` becomes a loop over the level alphabet and
+ * a trailing `#` a loop over the alphabet and `/`, optional together with the
+ * separator before it as `#` also matches the parent level. A `+` directly
+ * before the final `#` is folded into it. Equivalent filters, e.g. `+/#` and
+ * `#`, translate to the same regex.
+ *
+ * @param filter The filter, e.g. `sensors/+/temp` or `news/#`
+ * @return The regex, free with GNUNET_free; NULL if @a filter is not a valid
+ *         MQTT filter, uses characters outside #TOPIC_FILTER_ALPHABET or
+ *         exceeds #TOPIC_FILTER_MAX_LEVELS or #TOPIC_FILTER_MAX_WILDCARDS
+ */
+char *
+topic_filter_to_regex (const char *filter);
+
+
+/**
+ * Check whether a topic matches an MQTT filter, the same way the regex of
+ * #topic_filter_to_regex does but without building it
+ *
+ * @param filter The filter, e.g. `cmd/#`
+ * @param topic The topic, e.g. `cmd/reboot`
+ * @return #GNUNET_YES if @a topic matches @a filter
+ */
+int
+topic_filter_match (const char *filter, const char *topic);
+
+
+/**
+ * Create an empty set
+ *
+ * @return The new set
+ */
+struct Topic_Filter_Set *
+topic_filter_set_create (void);
+
+
+/**
+ * Subscribe to a filter. Filters translating to the same regex share one
+ * entry, which counts its subscriptions.
+ *
+ * @param set The set
+ * @param filter The MQTT filter
+ * @param created Set to #GNUNET_YES if the entry is new and needs announcing,
+ *        #GNUNET_NO if an equivalent filter is already announced
+ * @return The entry, NULL if @a filter is rejected by #topic_filter_to_regex
+ */
+struct Topic_Filter_Entry *
+topic_filter_set_add (struct Topic_Filter_Set *set,
+                      const char *filter,
+                      int *created);
+
+
+/**
+ * Drop one subscription of an entry, freeing it with the last one
+ *
+ * @param set The set
+ * @param entry The entry
+ * @return Number of subscriptions left, 0 if @a entry was freed
+ */
+unsigned int
+topic_filter_set_remove (struct Topic_Filter_Set *set,
+                         struct Topic_Filter_Entry *entry);
+
+
+/**
+ * Get the regex of an entry
+ *
+ * @param entry The entry
+ * @return The regex to announce
+ */
+const char *
+topic_filter_entry_regex (const struct Topic_Filter_Entry *entry);
+
+
+/**
+ * Get the number of distinct filters in a set
+ *
+ * @param set The set
+ * @return Number of entries
+ */
+unsigned int
+topic_filter_set_size (const struct Topic_Filter_Set *set);
+
+
+/**
+ * Free a set and all its entries
+ *
+ * @param set The set, may be NULL
+ */
+void
+topic_filter_set_destroy (struct Topic_Filter_Set *set);
+
+#endif
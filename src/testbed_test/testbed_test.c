@@ -8,6 +8,14 @@
  * Number of peers we want to start
  */
 #define NUM_PEERS 5
+/**
+ * How long a single PUT may take before the DHT reports a timeout
+ */
+#define PUT_TIMEOUT GNUNET_TIME_relative_multiply(GNUNET_TIME_UNIT_MINUTES, 1)
+/**
+ * How long a case may run before its outstanding operations count as failed
+ */
+#define CASE_TIMEOUT GNUNET_TIME_relative_multiply(GNUNET_TIME_UNIT_MINUTES, 2)
 /*----------------------------------------------------------------------------*/
 /**
  * Closure to 'dht_ca' and 'dht_da' DHT adapters.
@@ -19,17 +27,194 @@ struct MyContext {
 	int ht_len;
 } ctxt;
 /*----------------------------------------------------------------------------*/
-static struct GNUNET_TESTBED_Operation *dht_op;
-static struct GNUNET_DHT_Handle *dht_handle;
-static struct GNUNET_DHT_GetHandle *dht_get_handle;
-static struct GNUNET_HashCode dht_put_key;
+/**
+ * One point of the sweep.
+ */
+struct BenchCase {
+	/**
+	 * Size of every PUT payload in bytes.
+	 */
+	size_t payload_size;
+	/**
+	 * Number of distinct keys PUT and then fetched.
+	 */
+	unsigned int key_count;
+	/**
+	 * Desired replication level of the PUTs and GETs.
+	 */
+	uint32_t replication;
+	/**
+	 * Passed as ht_len to GNUNET_DHT_connect; also the number of PUTs each
+	 * peer keeps in flight on its handle.
+	 */
+	int ht_len;
+};
+/**
+ * Connection to the DHT of one peer.
+ */
+struct PeerContext {
+	/**
+	 * The service connect operation.
+	 */
+	struct GNUNET_TESTBED_Operation *op;
+	/**
+	 * The DHT handle, NULL while not connected.
+	 */
+	struct GNUNET_DHT_Handle *dht_handle;
+	/**
+	 * Number of PUTs currently in flight on 'dht_handle'.
+	 */
+	unsigned int puts_in_flight;
+	/**
+	 * Next key this peer PUTs.
+	 */
+	unsigned int next_key;
+};
+/**
+ * State of one key of the running case.
+ */
+struct KeyContext {
+	/**
+	 * The key.
+	 */
+	struct GNUNET_HashCode key;
+	/**
+	 * Peer PUTting the key.
+	 */
+	unsigned int put_peer;
+	/**
+	 * Peer GETting the key.
+	 */
+	unsigned int get_peer;
+	/**
+	 * The PUT, NULL once acknowledged.
+	 */
+	struct GNUNET_DHT_PutHandle *put_handle;
+	/**
+	 * The GET, NULL before the PUT is acknowledged and after the first result.
+	 */
+	struct GNUNET_DHT_GetHandle *get_handle;
+	/**
+	 * When the PUT was issued.
+	 */
+	struct GNUNET_TIME_Absolute put_start;
+	/**
+	 * Time until the PUT was acknowledged.
+	 */
+	struct GNUNET_TIME_Relative put_latency;
+	/**
+	 * Time from issuing the PUT until the GET returned the value.
+	 */
+	struct GNUNET_TIME_Relative visibility_latency;
+	/**
+	 * GNUNET_YES if the PUT was acknowledged.
+	 */
+	int put_ok;
+	/**
+	 * GNUNET_YES if the GET returned the value.
+	 */
+	int get_ok;
+};
+/*----------------------------------------------------------------------------*/
+/**
+ * The sweep. Every parameter is varied on its own around the first case
+ * (256 bytes, 16 keys, replication 2, ht_len 10). Cases sharing an ht_len
+ * are kept together so the peers only reconnect when it changes.
+ */
+static const struct BenchCase cases[] = {
+	{   256, 16, 2, 10 },
+	{    16, 16, 2, 10 },
+	{  1024, 16, 2, 10 },
+	{  4096, 16, 2, 10 },
+	{ 32768, 16, 2, 10 },
+	{   256,  1, 2, 10 },
+	{   256, 64, 2, 10 },
+	{   256, 256, 2, 10 },
+	{   256, 16, 1, 10 },
+	{   256, 16, 3, 10 },
+	{   256, 16, 5, 10 },
+	{   256, 16, 2,  1 },
+	{   256, 16, 2, 64 },
+};
+#define NUM_CASES (sizeof(cases) / sizeof(cases[0]))
+
+static struct PeerContext peer_ctx[NUM_PEERS];
+static struct GNUNET_TESTBED_Peer **testbed_peers;
+static unsigned int peers_connected;
+
+static unsigned int current_case;
+static struct KeyContext *keys;
+static unsigned int keys_done;
+static void *payload;
+static struct GNUNET_TIME_Absolute case_start;
+static GNUNET_SCHEDULER_TaskIdentifier case_timeout_tid;
 
 static GNUNET_SCHEDULER_TaskIdentifier shutdown_tid;
 /**
  * Global result for testcase.
- */	
+ */
 static int result;
 /*----------------------------------------------------------------------------*/
+static void
+start_case(void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc);
+
+static void
+connect_peers(void);
+/*----------------------------------------------------------------------------*/
+/**
+ * Cancel all PUTs and GETs of the running case and free its state.
+ */
+static void
+cleanup_case(void)
+{
+	unsigned int i;
+
+	if(GNUNET_SCHEDULER_NO_TASK != case_timeout_tid) {
+		GNUNET_SCHEDULER_cancel(case_timeout_tid);
+		case_timeout_tid = GNUNET_SCHEDULER_NO_TASK;
+	}
+	if(NULL == keys) {
+		return;
+	}
+	for(i = 0; i < cases[current_case].key_count; i++) {
+		if(NULL != keys[i].put_handle) {
+			GNUNET_DHT_put_cancel(keys[i].put_handle);
+			keys[i].put_handle = NULL;
+		}
+		if(NULL != keys[i].get_handle) {
+			GNUNET_DHT_get_stop(keys[i].get_handle);
+			keys[i].get_handle = NULL;
+		}
+	}
+	GNUNET_free(keys);
+	keys = NULL;
+	GNUNET_free(payload);
+	payload = NULL;
+}
+
+
+/**
+ * Disconnect from the DHTs of all peers.
+ */
+static void
+disconnect_peers(void)
+{
+	unsigned int i;
+
+	for(i = 0; i < NUM_PEERS; i++) {
+		if(NULL != peer_ctx[i].op) {
+			/*
+			 * indirectly calls the dht_da() for closing down the connection to
+			 * the DHT
+			 */
+			GNUNET_TESTBED_operation_done(peer_ctx[i].op);
+			peer_ctx[i].op = NULL;
+		}
+	}
+	peers_connected = 0;
+}
+
+
 /**
  * Function run on CTRL-C or shutdown (i.e. success/timeout/etc.).
  * Cleans up.
@@ -38,119 +223,335 @@ static void
 shutdown_task(void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
 {
 	shutdown_tid = GNUNET_SCHEDULER_NO_TASK;
-	if(NULL != dht_op) {
-		/*
-		 * indirectly calls the dht_da() for closing down the connection to the
-		 * DHT
-		 */
-		GNUNET_TESTBED_operation_done(dht_op);
-		dht_op = NULL;
-		dht_handle = NULL;
-	}
-	result = GNUNET_OK;
+	/* GETs and PUTs have to go before the handles they run on */
+	cleanup_case();
+	disconnect_peers();
 	/* Also kills the testbed */
 	GNUNET_SCHEDULER_shutdown();
 }
 /*----------------------------------------------------------------------------*/
+/**
+ * Compare two relative times for qsort.
+ */
+static int
+compare_relative(const void *a, const void *b)
+{
+	const struct GNUNET_TIME_Relative *ra = a;
+	const struct GNUNET_TIME_Relative *rb = b;
+
+	if(ra->rel_value_us < rb->rel_value_us) {
+		return -1;
+	}
+	return (ra->rel_value_us > rb->rel_value_us) ? 1 : 0;
+}
+
 
 /**
- * DHT put start iteration continuation.
- * GNUNET DHT get will continue running even if some results are found. 
- * The continuation is called whenever a result is returned.
+ * Sort latencies and print their median and 95th percentile in ms.
+ *
+ * @param latencies the latencies, reordered
+ * @param count number of latencies
+ */
+static void
+print_percentiles(struct GNUNET_TIME_Relative *latencies, unsigned int count)
+{
+	if(0 == count) {
+		printf(" %9s %9s", "-", "-");
+		return;
+	}
+	qsort(latencies, count, sizeof(latencies[0]), &compare_relative);
+	printf(" %9.2f %9.2f",
+			latencies[count / 2].rel_value_us / 1000.0,
+			latencies[(count * 95) / 100].rel_value_us / 1000.0);
+}
+
+
+/**
+ * Print the results of the running case as one row of the report.
+ */
+static void
+report_case(void)
+{
+	const struct BenchCase *bc = &cases[current_case];
+	struct GNUNET_TIME_Relative *latencies;
+	struct GNUNET_TIME_Relative duration;
+	unsigned int puts_ok = 0;
+	unsigned int gets_ok = 0;
+	unsigned int i;
+
+	duration = GNUNET_TIME_absolute_get_duration(case_start);
+	latencies = GNUNET_malloc(bc->key_count * sizeof(latencies[0]));
+
+	if(0 == current_case) {
+		printf("%7s %5s %4s %6s %9s %9s %9s %9s %10s %6s\n",
+				"payload", "keys", "repl", "ht_len",
+				"put_p50", "put_p95", "vis_p50", "vis_p95",
+				"ops/s", "failed");
+	}
+	printf("%7u %5u %4u %6d",
+			(unsigned int) bc->payload_size, bc->key_count,
+			(unsigned int) bc->replication, bc->ht_len);
+
+	for(i = 0; i < bc->key_count; i++) {
+		if(GNUNET_YES == keys[i].put_ok) {
+			latencies[puts_ok++] = keys[i].put_latency;
+		}
+	}
+	print_percentiles(latencies, puts_ok);
+	for(i = 0; i < bc->key_count; i++) {
+		if(GNUNET_YES == keys[i].get_ok) {
+			latencies[gets_ok++] = keys[i].visibility_latency;
+		}
+	}
+	print_percentiles(latencies, gets_ok);
+
+	/* every acknowledged PUT and every answered GET is one operation */
+	printf(" %10.1f %6u\n",
+			(puts_ok + gets_ok) * 1000000.0 / GNUNET_MAX(1, duration.rel_value_us),
+			bc->key_count - gets_ok);
+	GNUNET_free(latencies);
+}
+
+
+/**
+ * Move on to the next case, reconnecting first if it uses another ht_len.
+ * Runs as its own task so the handles are not disconnected from within one
+ * of their callbacks.
+ */
+static void
+next_case(void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+	if(cases[current_case].ht_len != ctxt.ht_len) {
+		disconnect_peers();
+		connect_peers();
+		return;
+	}
+	start_case(NULL, tc);
+}
+
+
+/**
+ * Finish the running case and move on to the next one, or shut down after
+ * the last.
+ */
+static void
+finish_case(void)
+{
+	report_case();
+	cleanup_case();
+	current_case++;
+	if(NUM_CASES == current_case) {
+		result = GNUNET_OK;
+		GNUNET_SCHEDULER_cancel(shutdown_tid);
+		shutdown_tid = GNUNET_SCHEDULER_add_now(&shutdown_task, NULL);
+		return;
+	}
+	GNUNET_SCHEDULER_add_now(&next_case, NULL);
+}
+
+
+/**
+ * Mark a key as finished, finish the case once all keys are.
+ *
+ * @param kc the key
+ */
+static void
+key_done(struct KeyContext *kc)
+{
+	if(++keys_done == cases[current_case].key_count) {
+		finish_case();
+	}
+}
+
+
+/**
+ * The running case took too long, give up on what is still outstanding.
+ */
+static void
+case_timeout(void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+	case_timeout_tid = GNUNET_SCHEDULER_NO_TASK;
+	printf("case %u timed out with %u of %u keys done\n",
+			current_case, keys_done, cases[current_case].key_count);
+	finish_case();
+}
+/*----------------------------------------------------------------------------*/
+
+/**
+ * DHT get iteration continuation.
+ * GNUNET DHT get will continue running even if some results are found, so
+ * the GET is stopped after the first one.
  * Params should be clear from naming ad type, for reference check
  * https://gnunet.org/doxygen/d6/d5a/group__dht.html#ga03ebf65273abcd0046b7c917614c4be7
  */
 static void
-dht_get_cont (	void *cls, 
-				struct GNUNET_TIME_Absolute exp, 
-				const struct GNUNET_HashCode *key, 
-				const struct GNUNET_PeerIdentity *get_path, 
-				unsigned int get_path_length, 
-				const struct GNUNET_PeerIdentity *put_path, 
-				unsigned int put_path_length, 
-				enum GNUNET_BLOCK_Type type, 
-				size_t size, 
+dht_get_cont (	void *cls,
+				struct GNUNET_TIME_Absolute exp,
+				const struct GNUNET_HashCode *key,
+				const struct GNUNET_PeerIdentity *get_path,
+				unsigned int get_path_length,
+				const struct GNUNET_PeerIdentity *put_path,
+				unsigned int put_path_length,
+				enum GNUNET_BLOCK_Type type,
+				size_t size,
 				const void *data)
 {
-  	printf("data found = %s\n", (char *) data);
-  	printf("%s\n", "Found what we were looking for, cancelling dht get operation...");
-  	GNUNET_DHT_get_stop(dht_get_handle);
+	struct KeyContext *kc = cls;
+
+	GNUNET_DHT_get_stop(kc->get_handle);
+	kc->get_handle = NULL;
+	if(size != cases[current_case].payload_size) {
+		printf("GET for %s returned %u bytes instead of %u\n",
+				GNUNET_h2s(&kc->key), (unsigned int) size,
+				(unsigned int) cases[current_case].payload_size);
+	} else {
+		kc->visibility_latency = GNUNET_TIME_absolute_get_duration(kc->put_start);
+		kc->get_ok = GNUNET_YES;
+	}
+	key_done(kc);
 }
 
 
+static void
+issue_put(unsigned int peer);
+
+
 /**
  * DHT put continuation, called after the put has successfully sent out.
- * @param cls some closure (whatever that means..)
+ * Starts the GET for the key on its GET peer and the next PUT of the peer.
+ * @param cls the KeyContext
  * @param success GNUNET_OK if the PUT was transmitted, GNUNET_NO on timeout, GNUNET_SYSERR on disconnect from service after the PUT message was transmitted (so we don't know if it was received or not)
  */
 static void
 dht_put_cont (void *cls,
               int success)
 {
+	struct KeyContext *kc = cls;
+	const struct BenchCase *bc = &cases[current_case];
+
+	kc->put_handle = NULL;
+	peer_ctx[kc->put_peer].puts_in_flight--;
 	if(success == GNUNET_OK) {
-  		printf("put some secret into the dht =D, the key is %s\n", GNUNET_h2s(&dht_put_key));
-
-
-	  dht_get_handle = GNUNET_DHT_get_start( dht_handle,
-	  						GNUNET_BLOCK_TYPE_TEST,
-	  						&dht_put_key,
-	  						2,
-	  						GNUNET_DHT_RO_NONE,
-	  						NULL,
-	  						0,
-	  						&dht_get_cont,
-	  						NULL);
+		kc->put_latency = GNUNET_TIME_absolute_get_duration(kc->put_start);
+		kc->put_ok = GNUNET_YES;
+		kc->get_handle = GNUNET_DHT_get_start(peer_ctx[kc->get_peer].dht_handle,
+								GNUNET_BLOCK_TYPE_TEST,
+								&kc->key,
+								bc->replication,
+								GNUNET_DHT_RO_NONE,
+								NULL,
+								0,
+								&dht_get_cont,
+								kc);
 	} else if (success == GNUNET_NO) {
 		printf("%s\n", "DHT put timed out =(");
 	} else if (success == GNUNET_SYSERR) {
 		printf("%s\n", "Some crazy stuff happend =((((");
 	}
+	issue_put(kc->put_peer);
+	if(NULL == kc->get_handle) {
+		key_done(kc);
+	}
 }
 
+
 /**
- * This is where the test logic should be, at least that part of it that uses
- * the DHT of peer "0".
+ * Issue PUTs of a peer until it has ht_len of them in flight or has no keys
+ * left.
  *
- * @param cls closure, for the example: NULL
- * @param op should be equal to "dht_op"
- * @param ca_result result of the connect operation, the connection to the DHT
- *		service
- * @param emsg error message, if testbed somehow failed to connect to the DHT.
+ * @param peer index of the peer
  */
 static void
-service_connect_comp(void *cls, struct GNUNET_TESTBED_Operation *op,
-										 void *ca_result, const char *emsg)
+issue_put(unsigned int peer)
 {
-	char * data = "Some crazy data i put in the GNUNUT DHT! Hell Yeah!";
-	size_t data_size = strlen(data);
-	
-
-	GNUNET_assert(op == dht_op);
-	dht_handle = ca_result;
-	/*
-	 * Service to DHT successful; here we'd usually do something with the DHT
-	 * (ok, if successful)
-	 *
-	 * for now, just indiscriminately terminate after 10s
-	 */
+	const struct BenchCase *bc = &cases[current_case];
+	struct PeerContext *pc = &peer_ctx[peer];
+	struct KeyContext *kc;
 
-	GNUNET_DHT_put(dht_handle,
-	 				&dht_put_key, // key
-	 				2, // repl_lvl
+	while((pc->puts_in_flight < (unsigned int) bc->ht_len)
+			&& (pc->next_key < bc->key_count)) {
+		kc = &keys[pc->next_key];
+		pc->next_key += NUM_PEERS;
+		pc->puts_in_flight++;
+		kc->put_start = GNUNET_TIME_absolute_get();
+		kc->put_handle = GNUNET_DHT_put(pc->dht_handle,
+	 				&kc->key, // key
+	 				bc->replication, // repl_lvl
 	 				GNUNET_DHT_RO_NONE, // options
 	 				GNUNET_BLOCK_TYPE_TEST , // type
-	 				data_size, // size
-	 				data, // data
+	 				bc->payload_size, // size
+	 				payload, // data
 	 				GNUNET_TIME_UNIT_FOREVER_ABS, // expiry
-	 				GNUNET_TIME_relative_multiply(GNUNET_TIME_UNIT_MINUTES, 1), //timeout
+	 				PUT_TIMEOUT, //timeout
 	 				&dht_put_cont, // continuation
-	 				NULL); // closure
+	 				kc); // closure
+	}
+}
 
-	GNUNET_SCHEDULER_cancel(shutdown_tid);
-	shutdown_tid = GNUNET_SCHEDULER_add_delayed(
-			GNUNET_TIME_relative_multiply(GNUNET_TIME_UNIT_SECONDS, 10),
-			&shutdown_task,
+
+/**
+ * Set up the keys of the current case and start PUTting them from all peers.
+ * Key k is PUT by peer k mod NUM_PEERS and fetched by a different peer, so
+ * every ordered pair of peers is exercised once there are enough keys.
+ */
+static void
+start_case(void *cls, const struct GNUNET_SCHEDULER_TaskContext *tc)
+{
+	const struct BenchCase *bc = &cases[current_case];
+	char *name;
+	unsigned int i;
+
+	keys = GNUNET_malloc(bc->key_count * sizeof(struct KeyContext));
+	keys_done = 0;
+	payload = GNUNET_malloc(bc->payload_size);
+	memset(payload, 'x', bc->payload_size);
+	for(i = 0; i < bc->key_count; i++) {
+		/* keys are unique per case so no case reads data of an earlier one */
+		GNUNET_asprintf(&name, "testbed-test-%u-%u", current_case, i);
+		GNUNET_CRYPTO_hash(name, strlen(name), &keys[i].key);
+		GNUNET_free(name);
+		keys[i].put_peer = i % NUM_PEERS;
+		keys[i].get_peer = (keys[i].put_peer + 1 + (i / NUM_PEERS) % (NUM_PEERS - 1))
+				% NUM_PEERS;
+	}
+	case_timeout_tid = GNUNET_SCHEDULER_add_delayed(CASE_TIMEOUT,
+			&case_timeout,
 			NULL);
+	case_start = GNUNET_TIME_absolute_get();
+	for(i = 0; i < NUM_PEERS; i++) {
+		peer_ctx[i].puts_in_flight = 0;
+		peer_ctx[i].next_key = i;
+		issue_put(i);
+	}
+}
+
+/**
+ * Called once the DHT of one peer is connected. Starts the next case once all
+ * peers are.
+ *
+ * @param cls the PeerContext
+ * @param op the connect operation
+ * @param ca_result result of the connect operation, the connection to the DHT
+ *		service
+ * @param emsg error message, if testbed somehow failed to connect to the DHT.
+ */
+static void
+service_connect_comp(void *cls, struct GNUNET_TESTBED_Operation *op,
+										 void *ca_result, const char *emsg)
+{
+	struct PeerContext *pc = cls;
+
+	GNUNET_assert(op == pc->op);
+	if((NULL != emsg) || (NULL == ca_result)) {
+		printf("connecting to a DHT failed: %s\n", (NULL != emsg) ? emsg : "?");
+		GNUNET_SCHEDULER_cancel(shutdown_tid);
+		shutdown_tid = GNUNET_SCHEDULER_add_now(&shutdown_task, NULL);
+		return;
+	}
+	pc->dht_handle = ca_result;
+	if(NUM_PEERS == ++peers_connected) {
+		GNUNET_SCHEDULER_add_now(&start_case, NULL);
+	}
 }
 
 
@@ -164,7 +565,7 @@ service_connect_comp(void *cls, struct GNUNET_TESTBED_Operation *op,
  * such as the "ht_len" argument for the DHT).
  *
  * @param cls closure
- * @param cfg peer configuration (here: peer[0])
+ * @param cfg peer configuration
  *
  * @return NULL on error, otherwise some handle to access the subsystem
  */
@@ -173,8 +574,7 @@ dht_ca(void *cls, const struct GNUNET_CONFIGURATION_Handle *cfg)
 {
 	struct MyContext *ctxt = cls;
 	/* Use the provided configuration to connect to service */
-	dht_handle = GNUNET_DHT_connect(cfg, ctxt->ht_len);
-	return dht_handle;
+	return GNUNET_DHT_connect(cfg, ctxt->ht_len);
 }
 /*----------------------------------------------------------------------------*/
 /**
@@ -187,15 +587,42 @@ dht_ca(void *cls, const struct GNUNET_CONFIGURATION_Handle *cfg)
 static void
 dht_da(void *cls, void *op_result)
 {
-	// struct MyContext *ctxt = cls;
+	unsigned int i;
+
 	/* Disconnect from DHT service */
 	GNUNET_DHT_disconnect((struct GNUNET_DHT_Handle *)op_result);
-	dht_handle = NULL;
+	for(i = 0; i < NUM_PEERS; i++) {
+		if(peer_ctx[i].dht_handle == op_result) {
+			peer_ctx[i].dht_handle = NULL;
+		}
+	}
+}
+/*----------------------------------------------------------------------------*/
+/**
+ * Connect to the DHTs of all peers with the ht_len of the current case.
+ */
+static void
+connect_peers(void)
+{
+	unsigned int i;
+
+	ctxt.ht_len = cases[current_case].ht_len;
+	for(i = 0; i < NUM_PEERS; i++) {
+		/* connect to a peers service */
+		peer_ctx[i].op = GNUNET_TESTBED_service_connect(NULL, /* Closure for operation */
+				testbed_peers[i], /* The peer whose service to connect to */
+				"dht", /* The name of the service */
+				service_connect_comp, /* callback to call after a handle to service is opened */
+				&peer_ctx[i], /* closure for the above callback */
+				dht_ca, /* callback to call with peer's configuration; this should open the needed service connection */
+				dht_da, /* callback to be called when closing the opened service connection */
+				&ctxt); /* closure for the above two callbacks */
+	}
 }
 /*----------------------------------------------------------------------------*/
 /**
  * Main function inovked from TESTBED once all of the peers are up and running.
- * This one then connects just to the DHT service of peer 0.
+ * This one connects to the DHT services of all peers and runs the sweep.
  *
  * @param cls closure
  * @param h the run handle
@@ -216,18 +643,11 @@ test_master(void *cls,
 	 * Testbed is ready with peers running and connected in a pre-defined
 	 * overlay topology
 	 */
-	/* do something */
-	ctxt.ht_len = 10;
-	/* connect to a peers service */
-	dht_op = GNUNET_TESTBED_service_connect(NULL, /* Closure for operation */
-			peers[0], /* The peer whose service to connect to */
-			"dht", /* The name of the service */
-			service_connect_comp, /* callback to call after a handle to service is opened */
-			NULL, /* closure for the above callback */
-			dht_ca, /* callback to call with peer's configuration; this should open the needed service connection */
-			dht_da, /* callback to be called when closing the opened service connection */
-			&ctxt); /* closure for the above two callbacks */
-	shutdown_tid = GNUNET_SCHEDULER_add_delayed(GNUNET_TIME_UNIT_MINUTES,
+	GNUNET_assert(NUM_PEERS == num_peers);
+	testbed_peers = peers;
+	connect_peers();
+	/* Runs at shutdown, e.g. on CTRL-C, so the operations are cleaned up */
+	shutdown_tid = GNUNET_SCHEDULER_add_delayed(GNUNET_TIME_UNIT_FOREVER_REL,
 			&shutdown_task,
 			NULL);
 }